@@ -0,0 +1,355 @@
+/*
+ *--------------------------------------
+ * Program Name: HLBENCH
+ * Author:
+ * License:
+ * Description: Times the library's primitives and reports what each uses
+ *--------------------------------------
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/timers.h>
+#define HASHLIB_ENABLE_ADVANCED_MODE
+#include <hashlib.h>
+
+#define CEMU_CONSOLE ((char*)0xFB0000)
+#define MSGSIZE 1024
+#define MODSIZE 256
+#define ARENASIZE 3072
+
+// LMS_SHA256_M32_H5 with LMOTS_SHA256_N32_W4
+#define LMS_TYPE 5
+#define LMS_HEIGHT 5
+#define LMOTS_TYPE 3
+#define LMOTS_P 67
+#define LMS_SIGSIZE (4 + 4 + 32 + 32 * LMOTS_P + 4 + 32 * LMS_HEIGHT)
+
+// the 1024-bit group from RFC 5054 appendix A
+static const uint8_t srp_modulus[128] = {
+    0xEE,0xAF,0x0A,0xB9,0xAD,0xB3,0x8D,0xD6,0x9C,0x33,0xF8,0x0A,0xFA,0x8F,0xC5,0xE8,
+    0x60,0x72,0x61,0x87,0x75,0xFF,0x3C,0x0B,0x9E,0xA2,0x31,0x4C,0x9C,0x25,0x65,0x76,
+    0xD6,0x74,0xDF,0x74,0x96,0xEA,0x81,0xD3,0x38,0x3B,0x48,0x13,0xD6,0x92,0xC6,0xE0,
+    0xE0,0xD5,0xD8,0xE2,0x50,0xB9,0x8B,0xE4,0x8E,0x49,0x5C,0x1D,0x60,0x89,0xDA,0xD1,
+    0x5D,0xC7,0xD7,0xB4,0x61,0x54,0xD6,0xB6,0xCE,0x8E,0xF4,0xAD,0x69,0xB1,0x5D,0x49,
+    0x82,0x55,0x9B,0x29,0x7B,0xCF,0x18,0x85,0xC5,0x29,0xF5,0x66,0x66,0x0E,0x57,0xEC,
+    0x68,0xED,0xBC,0x3C,0x05,0x72,0x6C,0xC0,0x2F,0xD4,0xCB,0xF4,0x97,0x6E,0xAA,0x9A,
+    0xFD,0x51,0x38,0xFE,0x83,0x76,0x43,0x5B,0x9F,0xC6,0x1D,0x2F,0xC0,0xEB,0x06,0xE3
+};
+
+static uint8_t msg[MSGSIZE];
+static uint8_t out[MSGSIZE + 64];
+static uint8_t buf[MSGSIZE + 64];
+static uint8_t key[64];
+static uint8_t iv[AES_IVSIZE];
+static uint8_t pubkey[MODSIZE];
+static uint8_t arena[ARENASIZE];
+static uint8_t lms_pub[LMS_PUB_LEN];
+static uint8_t lms_sig[LMS_SIGSIZE];
+static uint8_t nodes[31 * 32];
+static uint8_t hmap_arena[64 * HMAP_SLOT_SIZE + 64];
+static size_t buflen;
+static hash_ctx hash;
+static hmac_ctx hmac;
+static aes_ctx aes;
+static otp_ctx otp;
+static srp_ctx srp;
+static record_ctx record_send, record_recv;
+static container_ctx container;
+static merkle_ctx merkle;
+static cdc_ctx cdc;
+static hmap_ctx hmap;
+
+static void fill(uint8_t *dst, size_t len, uint8_t seed){
+    for(size_t i = 0; i < len; i++)
+        dst[i] = (uint8_t)(i * 73 + seed * 151);
+}
+
+static void put32(uint8_t *dst, uint32_t v){
+    dst[0] = (uint8_t)(v >> 24);
+    dst[1] = (uint8_t)(v >> 16);
+    dst[2] = (uint8_t)(v >> 8);
+    dst[3] = (uint8_t)v;
+}
+
+// hashing
+static void bench_sha256(void){
+    hash_init(&hash, SHA256);
+    hash_update(&hash, msg, MSGSIZE);
+    hash_final(&hash, out);
+}
+static void bench_sha1(void){
+    hash_init(&hash, SHA1);
+    hash_update(&hash, msg, MSGSIZE);
+    hash_final(&hash, out);
+}
+static void bench_ascon_hash(void){
+    hash_init(&hash, ASCON_HASH256);
+    hash_update(&hash, msg, MSGSIZE);
+    hash_final(&hash, out);
+}
+static void bench_mgf1(void){
+    hash_mgf1(msg, 32, out, MODSIZE, SHA256);
+}
+
+// message authentication
+static void bench_hmac_sha256(void){
+    hmac_init(&hmac, key, 32, SHA256);
+    hmac_update(&hmac, msg, MSGSIZE);
+    hmac_final(&hmac, out);
+}
+static void bench_hmac_sha1(void){
+    hmac_init(&hmac, key, 20, SHA1);
+    hmac_update(&hmac, msg, MSGSIZE);
+    hmac_final(&hmac, out);
+}
+static void bench_poly1305(void){
+    hmac_init(&hmac, key, POLY1305_KEY_LEN, POLY1305);
+    hmac_update(&hmac, msg, MSGSIZE);
+    hmac_final(&hmac, out);
+}
+static void bench_siphash24(void){
+    hmac_init(&hmac, key, SIPHASH24_KEY_LEN, SIPHASH24);
+    hmac_update(&hmac, msg, 64);
+    hmac_final(&hmac, out);
+}
+static void bench_pbkdf2(void){
+    hmac_pbkdf2((char*)key, 32, out, 32, msg, 16, 100, SHA256);
+}
+static void bench_hotp(void){
+    otp_init(&otp, key, 20, 6);
+    hotp_generate(&otp, 1);
+}
+
+// ciphers
+static void bench_aes_init(void){
+    aes_init(key, &aes, 32);
+}
+static void bench_aes_ctr(void){
+    aes_encrypt(msg, MSGSIZE, out, &aes, iv, AES_MODE_CTR, SCHM_DEFAULT);
+}
+static void bench_aes_cbc_encrypt(void){
+    aes_encrypt(msg, MSGSIZE, out, &aes, iv, AES_MODE_CBC, SCHM_DEFAULT);
+}
+static void setup_aes_cbc_decrypt(void){
+    aes_encrypt(msg, MSGSIZE, buf, &aes, iv, AES_MODE_CBC, SCHM_DEFAULT);
+}
+static void bench_aes_cbc_decrypt(void){
+    aes_decrypt(buf, MSGSIZE, out, &aes, iv, AES_MODE_CBC, SCHM_DEFAULT);
+}
+static void bench_aes_siv_encrypt(void){
+    aes_siv_encrypt(key, 64, iv, AES_IVSIZE, msg, MSGSIZE, out);
+}
+static void setup_aes_siv_decrypt(void){
+    aes_siv_encrypt(key, 64, iv, AES_IVSIZE, msg, MSGSIZE, buf);
+}
+static void bench_aes_siv_decrypt(void){
+    aes_siv_decrypt(key, 64, iv, AES_IVSIZE, buf, MSGSIZE + AES_SIV_TAG_LEN, out);
+}
+static void bench_ascon_encrypt(void){
+    ascon_aead_encrypt(key, iv, NULL, 0, msg, MSGSIZE, out);
+}
+static void setup_ascon_decrypt(void){
+    ascon_aead_encrypt(key, iv, NULL, 0, msg, MSGSIZE, buf);
+}
+static void bench_ascon_decrypt(void){
+    ascon_aead_decrypt(key, iv, NULL, 0, buf, MSGSIZE + ASCON_TAG_LEN, out);
+}
+
+// public key
+static void bench_rsa_encrypt(void){
+    rsa_encrypt(msg, 32, out, pubkey, MODSIZE, SHA256);
+}
+static void bench_lms_verify(void){
+    // a well-formed signature that does not verify costs the same to check as one that does
+    lms_verify(msg, MSGSIZE, lms_pub, LMS_PUB_LEN, lms_sig, LMS_SIGSIZE);
+}
+// the top half of the SRP modulus, which is odd, and the first 8 bytes of the key as the exponent
+static void setup_modexp(void){
+    fill(buf, 64, 8);
+}
+static void setup_modexp_g2(void){
+    memset(buf, 0, 64);
+    buf[63] = 2;
+}
+static void bench_modexp(void){
+    powmod_bigexp(64, buf, key, srp_modulus, 8);
+}
+static void setup_srp(void){
+    srp_init(&srp, srp_modulus, sizeof srp_modulus, 2, "alice", 5);
+}
+static void bench_srp_client_start(void){
+    srp_client_start(&srp, out);
+}
+static void setup_srp_client_process(void){
+    setup_srp();
+    srp_client_start(&srp, out);
+    // the server's public value, B, below the modulus
+    fill(buf, sizeof srp_modulus, 7);
+    buf[0] = 0x12;
+}
+static void bench_srp_client_process(void){
+    srp_client_process(&srp, buf, msg, 16, "password", 8, out);
+}
+
+// record layer, compression and containers
+static void setup_record(void){
+    record_init(&record_send, key, 16, key + 16, 32, iv);
+    record_init(&record_recv, key, 16, key + 16, 32, iv);
+}
+static void bench_record_seal(void){
+    record_seal(&record_send, msg, MSGSIZE, out);
+}
+static void setup_record_open(void){
+    setup_record();
+    record_seal(&record_send, msg, MSGSIZE, buf);
+}
+static void bench_record_open(void){
+    record_open(&record_recv, buf, record_outsize(MSGSIZE), out);
+}
+static void bench_lz_compress(void){
+    lz_compress(msg, MSGSIZE, out);
+}
+static void setup_lz_decompress(void){
+    buflen = lz_compress(msg, MSGSIZE, buf);
+}
+static void bench_lz_decompress(void){
+    lz_decompress(buf, buflen, out, MSGSIZE);
+}
+static void setup_container(void){
+    container_create(&container, key, 32, MSGSIZE, 1, buf);
+}
+static void bench_container_seal(void){
+    container_seal(&container, 0, msg, MSGSIZE, true, out);
+}
+static void setup_container_open(void){
+    setup_container();
+    container_seal(&container, 0, msg, MSGSIZE, true, buf);
+}
+static void bench_container_open(void){
+    container_open(&container, 0, buf, MSGSIZE + CONTAINER_TAG_LEN, true, out);
+}
+
+// indexing and sync
+static void bench_merkle_build(void){
+    merkle_init(&merkle, nodes, 4, MSGSIZE / 16);
+    merkle_build(&merkle, msg, MSGSIZE);
+}
+static void bench_cdc_next(void){
+    cdc_init(&cdc, 64, 256, MSGSIZE);
+    cdc_next(&cdc, msg, MSGSIZE, out);
+}
+static void bench_rsync_signature(void){
+    rsync_signature(msg, MSGSIZE, 128, out);
+}
+static void setup_hmap(void){
+    hmap_init(&hmap, hmap_arena, sizeof hmap_arena, 64);
+    hmap_put(&hmap, msg, 16, 1);
+}
+static void bench_hmap_find(void){
+    size_t value;
+    hmap_find(&hmap, msg, 16, &value);
+}
+
+static const struct {
+    const char* name;
+    void (*setup)(void);        // run before each timed run, not timed
+    void (*run)(void);
+} benchmarks[] = {
+    {"sha256_1k", NULL, bench_sha256},
+    {"sha1_1k", NULL, bench_sha1},
+    {"ascon_hash256_1k", NULL, bench_ascon_hash},
+    {"mgf1_256", NULL, bench_mgf1},
+    {"hmac_sha256_1k", NULL, bench_hmac_sha256},
+    {"hmac_sha1_1k", NULL, bench_hmac_sha1},
+    {"poly1305_1k", NULL, bench_poly1305},
+    {"siphash24_64", NULL, bench_siphash24},
+    {"pbkdf2_100", NULL, bench_pbkdf2},
+    {"hotp", NULL, bench_hotp},
+    {"aes256_init", NULL, bench_aes_init},
+    {"aes256_ctr_1k", NULL, bench_aes_ctr},
+    {"aes256_cbc_encrypt_1k", NULL, bench_aes_cbc_encrypt},
+    {"aes256_cbc_decrypt_1k", setup_aes_cbc_decrypt, bench_aes_cbc_decrypt},
+    {"aes256_siv_encrypt_1k", NULL, bench_aes_siv_encrypt},
+    {"aes256_siv_decrypt_1k", setup_aes_siv_decrypt, bench_aes_siv_decrypt},
+    {"ascon_aead128_encrypt_1k", NULL, bench_ascon_encrypt},
+    {"ascon_aead128_decrypt_1k", setup_ascon_decrypt, bench_ascon_decrypt},
+    {"rsa2048_encrypt", NULL, bench_rsa_encrypt},
+    {"lms_h5_w4_verify_1k", NULL, bench_lms_verify},
+    {"powmod_bigexp_512_e64", setup_modexp, bench_modexp},
+    {"powmod_bigexp_512_g2_e64", setup_modexp_g2, bench_modexp},
+    {"srp1024_client_start", setup_srp, bench_srp_client_start},
+    {"srp1024_client_process", setup_srp_client_process, bench_srp_client_process},
+    {"record_seal_1k", setup_record, bench_record_seal},
+    {"record_open_1k", setup_record_open, bench_record_open},
+    {"lz_compress_1k", NULL, bench_lz_compress},
+    {"lz_decompress_1k", setup_lz_decompress, bench_lz_decompress},
+    {"container_seal_1k", setup_container, bench_container_seal},
+    {"container_open_1k", setup_container_open, bench_container_open},
+    {"merkle_build_1k", NULL, bench_merkle_build},
+    {"cdc_next_1k", NULL, bench_cdc_next},
+    {"rsync_signature_1k", NULL, bench_rsync_signature},
+    {"hmap_find", setup_hmap, bench_hmap_find},
+};
+#define BENCH_COUNT (sizeof benchmarks / sizeof benchmarks[0])
+
+int main(void)
+{
+    hashlib_profile stack, scratch;
+    bool profiled = false;
+
+    if(!csrand_init()) return 1;
+    // fixed inputs, so that runs can be compared with each other
+    fill(msg, sizeof msg, 1);
+    fill(key, sizeof key, 2);
+    fill(iv, sizeof iv, 3);
+    // not a real key, rsa_encrypt only needs an odd modulus of the right size
+    fill(pubkey, sizeof pubkey, 4);
+    pubkey[0] |= 0x80;
+    pubkey[MODSIZE-1] |= 1;
+    aes_init(key, &aes, 32);
+    // a public key and a signature of the right types and lengths
+    fill(lms_pub, sizeof lms_pub, 5);
+    put32(lms_pub, LMS_TYPE);
+    put32(lms_pub + 4, LMOTS_TYPE);
+    fill(lms_sig, sizeof lms_sig, 6);
+    put32(lms_sig, 0);
+    put32(lms_sig + 4, LMOTS_TYPE);
+    put32(lms_sig + 4 + 4 + 32 + 32 * LMOTS_P, LMS_TYPE);
+
+    timer_Enable(1, TIMER_CPU, TIMER_NOINT, TIMER_UP);
+
+    // one JSON object, one benchmark per line
+    sprintf(CEMU_CONSOLE, "{\"benchmarks\": [\n");
+    for(size_t i = 0; i < BENCH_COUNT; i++){
+        uint32_t cycles;
+
+        // on the stack, for the time and the stack use
+        if(benchmarks[i].setup) benchmarks[i].setup();
+        hashlib_profile_begin();
+        timer_Set(1, 0);
+        benchmarks[i].run();
+        cycles = timer_Get(1);
+        profiled = hashlib_profile_end(&stack);
+
+        // again with an arena set, for the scratch use
+        if(benchmarks[i].setup) benchmarks[i].setup();
+        hashlib_set_scratch(arena, sizeof arena);
+        hashlib_profile_begin();
+        benchmarks[i].run();
+        hashlib_profile_end(&scratch);
+        hashlib_set_scratch(NULL, 0);
+
+        sprintf(CEMU_CONSOLE, "  {\"name\": \"%s\", \"cycles\": %lu", benchmarks[i].name, (unsigned long)cycles);
+        if(profiled)
+            sprintf(CEMU_CONSOLE, ", \"stack\": %u, \"scratch\": %u", stack.stack, scratch.scratch);
+        sprintf(CEMU_CONSOLE, "}%s\n", (i + 1 < BENCH_COUNT) ? "," : "");
+    }
+    sprintf(CEMU_CONSOLE, "]}\n");
+
+    timer_Disable(1);
+    return 0;
+}
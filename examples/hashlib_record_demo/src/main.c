@@ -0,0 +1,63 @@
+/*
+ *--------------------------------------
+ * Program Name:
+ * Author:
+ * License:
+ * Description:
+ *--------------------------------------
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <hashlib.h>
+
+#define CEMU_CONSOLE ((char*)0xFB0000)
+
+void hexdump(uint8_t *addr, size_t len, uint8_t *label){
+    if(label) sprintf(CEMU_CONSOLE, "\n%s\n", label);
+    else sprintf(CEMU_CONSOLE, "\n");
+    for(size_t rem_len = len, ct=1; rem_len>0; rem_len--, addr++, ct++){
+        sprintf(CEMU_CONSOLE, "%02X ", *addr);
+        if(!(ct%AES_BLOCKSIZE)) sprintf(CEMU_CONSOLE, "\n");
+    }
+    sprintf(CEMU_CONSOLE, "\n");
+}
+
+int main(void)
+{
+    char msg[] = "The fox jumped over the dog!";
+    uint8_t key[32], mac_key[32], nonce[4];
+    uint8_t records[2][record_outsize(sizeof msg)];
+    char opened[sizeof msg];
+    record_ctx tx, rx;
+    
+    if(!csrand_init()) return 1;
+    csrand_fill(key, sizeof key);
+    csrand_fill(mac_key, sizeof mac_key);
+    csrand_fill(nonce, sizeof nonce);
+    
+    // both ends of one direction share keys and nonce
+    if(!record_init(&tx, key, sizeof key, mac_key, sizeof mac_key, nonce)) return 1;
+    if(!record_init(&rx, key, sizeof key, mac_key, sizeof mac_key, nonce)) return 1;
+    
+    sprintf(CEMU_CONSOLE, "\n\n----------------------------------\nHashlib Record Layer Demo\n");
+    
+    record_seal(&tx, msg, sizeof msg, records[0]);
+    record_seal(&tx, msg, sizeof msg, records[1]);
+    hexdump(records[0], sizeof records[0], "---Record 0---");
+    hexdump(records[1], sizeof records[1], "---Record 1---");
+    
+    // out of order is fine, a second copy is not
+    sprintf(CEMU_CONSOLE, "\nopen 1: %u", record_open(&rx, records[1], sizeof records[1], opened));
+    sprintf(CEMU_CONSOLE, "\nopen 0: %u", record_open(&rx, records[0], sizeof records[0], opened));
+    sprintf(CEMU_CONSOLE, "\nreplay 0: %u", record_open(&rx, records[0], sizeof records[0], opened));
+    
+    // flip one bit of the ciphertext
+    records[1][RECORD_HEADER_LEN] ^= 1;
+    sprintf(CEMU_CONSOLE, "\ntampered 1: %u", record_open(&rx, records[1], sizeof records[1], opened));
+    sprintf(CEMU_CONSOLE, "\n%s\n", opened);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ *--------------------------------------
+ * Program Name:
+ * Author:
+ * License:
+ * Description:
+ *--------------------------------------
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <hashlib.h>
+
+#define CEMU_CONSOLE ((char*)0xFB0000)
+#define MODSIZE 128
+
+// RFC 5054 appendix A, 1024-bit group, g = 2
+const uint8_t srp_N[MODSIZE] = {
+    0xEE,0xAF,0x0A,0xB9,0xAD,0xB3,0x8D,0xD6,0x9C,0x33,0xF8,0x0A,0xFA,0x8F,0xC5,0xE8,
+    0x60,0x72,0x61,0x87,0x75,0xFF,0x3C,0x0B,0x9E,0xA2,0x31,0x4C,0x9C,0x25,0x65,0x76,
+    0xD6,0x74,0xDF,0x74,0x96,0xEA,0x81,0xD3,0x38,0x3B,0x48,0x13,0xD6,0x92,0xC6,0xE0,
+    0xE0,0xD5,0xD8,0xE2,0x50,0xB9,0x8B,0xE4,0x8E,0x49,0x5C,0x1D,0x60,0x89,0xDA,0xD1,
+    0x5D,0xC7,0xD7,0xB4,0x61,0x54,0xD6,0xB6,0xCE,0x8E,0xF4,0xAD,0x69,0xB1,0x5D,0x49,
+    0x82,0x55,0x9B,0x29,0x7B,0xCF,0x18,0x85,0xC5,0x29,0xF5,0x66,0x66,0x0E,0x57,0xEC,
+    0x68,0xED,0xBC,0x3C,0x05,0x72,0x6C,0xC0,0x2F,0xD4,0xCB,0xF4,0x97,0x6E,0xAA,0x9A,
+    0xFD,0x51,0x38,0xFE,0x83,0x76,0x43,0x5B,0x9F,0xC6,0x1D,0x2F,0xC0,0xEB,0x06,0xE3
+};
+#define srp_g 2
+
+void hexdump(uint8_t *addr, size_t len, uint8_t *label){
+    if(label) sprintf(CEMU_CONSOLE, "\n%s\n", label);
+    else sprintf(CEMU_CONSOLE, "\n");
+    for(size_t rem_len = len, ct=1; rem_len>0; rem_len--, addr++, ct++){
+        sprintf(CEMU_CONSOLE, "%02X ", *addr);
+        if(!(ct%AES_BLOCKSIZE)) sprintf(CEMU_CONSOLE, "\n");
+    }
+    sprintf(CEMU_CONSOLE, "\n");
+}
+
+int main(void)
+{
+    char user[] = "alice";
+    char pass[] = "password123";
+    uint8_t salt[16];
+    uint8_t verifier[MODSIZE];
+    uint8_t pubkey[MODSIZE];
+    srp_ctx srp;
+    
+    if(!csrand_init()) return 1;
+    if(!srp_init(&srp, srp_N, MODSIZE, srp_g, user, strlen(user))) return 1;
+    
+    sprintf(CEMU_CONSOLE, "\n\n----------------------------------\nHashlib SRP Demo\n");
+    
+    // registration: the server keeps the salt and the verifier
+    csrand_fill(salt, sizeof salt);
+    srp_verifier(&srp, salt, sizeof salt, pass, strlen(pass), verifier);
+    hexdump(salt, sizeof salt, "---Salt---");
+    hexdump(verifier, MODSIZE, "---Verifier---");
+    
+    // login: send the username and A, then pass the server's salt and B to srp_client_process()
+    srp_client_start(&srp, pubkey);
+    hexdump(pubkey, MODSIZE, "---Client Public Value (A)---");
+    return 0;
+}
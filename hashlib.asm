@@ -3,7 +3,7 @@ include '../include/library.inc'
 ;include_library 'bigintce.asm'
 
 ;------------------------------------------
-library "HASHLIB", 9
+library "HASHLIB", 10
 
 ;------------------------------------------
 
@@ -37,7 +37,76 @@ library "HASHLIB", 9
     export pss_encode
     export powmod
     
+    ; v10 functions
+    export srp_init
+    export srp_verifier
+    export srp_client_start
+    export srp_client_process
+    export srp_client_verify
+    export powmod_bigexp
+    export record_init
+    export record_seal
+    export record_open
+    export record_seal_bulk
+    export record_open_bulk
+    export aes_cache_init
+    export aes_cache_get
+    export aes_cache_evict
+    export aes_cache_clear
+    export hashlib_set_scratch
+    export hash_updatev
+    export hmac_updatev
+    export csrand_init_adaptive
+    export merkle_init
+    export merkle_build
+    export merkle_update
+    export merkle_path
+    export merkle_verify
+    export cdc_init
+    export cdc_next
+    export cdc_index_init
+    export cdc_index_find
+    export cdc_index_add
+    export rsync_weak
+    export rsync_roll
+    export rsync_signature
+    export rsync_delta_init
+    export rsync_delta
+    export rsync_patch
+    export hash_pow_search
+    export otp_init
+    export hotp_generate
+    export hotp_generate_range
+    export totp_generate
+    export ascon_aead_encrypt
+    export ascon_aead_decrypt
+    export lms_verify
+    export hss_verify
+    export container_create
+    export container_load
+    export container_seal
+    export container_open
+    export record_seal_compressed
+    export record_open_compressed
+    export lz_compress
+    export lz_decompress
+    export aes_siv_encrypt
+    export aes_siv_decrypt
+    export hmap_init
+    export hmap_find
+    export hmap_put
+    export hmap_remove
+    export hashlib_profile_begin
+    export hashlib_profile_end
+    export lz_stream_init
+    export lz_stream_compress
+    export lz_stream_finish
+    export lz_stream_decompress
+    
 powmod = _powmod
+powmod_bigexp = _powmod_bigexp
+hash_updatev = _updatev
+hmac_updatev = _updatev
     
     
 
@@ -89,7 +158,7 @@ end macro
 
 ;------------------------------------------
 ; helper macro for restoring the interrupt state without prematurely returning, preserving a
-macro restore_interrupts_preserve_a? parent
+macro restore_interrupts_noret_preserve_a? parent
 	ld bc,0
 parent.__interrupt_state = $-3
 	push bc
@@ -118,6 +187,9 @@ _indcall:
 ;number of times to test each bit
 _num_tests := 1024
 _max_deviation := _num_tests/4
+
+;number of reads a byte must change within to get fully tested, in adaptive mode
+_screen_tests := 32
 ;------------------------------------------
 ; structures
 virtual at 0
@@ -127,6 +199,8 @@ virtual at 0
 	offset_state    rb 4*8
 	_sha256ctx_size:
 end virtual
+_sha1ctx_size := offset_state + 5*4
+_hmac_sha1ctx_size := 128 + _sha1ctx_size
 _sha256_m_buffer_length := 64*4
 
 ;-------------------------------------------
@@ -135,11 +209,29 @@ hash_func_lookup:
     dl hash_sha256_init
     dl hash_sha256_update
     dl hash_sha256_final
+    dl hash_sha1_init
+    dl hash_sha1_update
+    dl hash_sha1_final
+    dl hash_ascon_init
+    dl hash_ascon_update
+    dl hash_ascon_final
     
 hmac_func_lookup:
     dl hmac_sha256_init
     dl hmac_sha256_update
     dl hmac_sha256_final
+    dl hmac_sha1_init
+    dl hmac_sha1_update
+    dl hmac_sha1_final
+    dl _mac_unkeyed         ; ascon-hash has no keyed mode
+    dl _mac_unkeyed
+    dl _mac_unkeyed
+    dl mac_poly1305_init
+    dl mac_poly1305_update
+    dl mac_poly1305_final
+    dl mac_siphash_init
+    dl mac_siphash_update
+    dl mac_siphash_final
     
 
 
@@ -177,6 +269,17 @@ stack_clear:
     ld a, e
     ld (.smc_e), a
     
+    ; the scratch arena is wiped once, when the outermost routine returns
+    ld a, (_scratch_state)
+    cp a, _scratch_in_use
+    jq z, .restore
+    
+if defined HASHLIB_PROFILE
+    ; note how deep the stack went before the evidence is erased
+    ld hl, stackBot
+    call _profile_lower
+end if
+
     ; set from stackBot + 4 to ix - 1 to 0
     lea de, ix - 2
     ld hl, -(stackBot + 3)
@@ -184,10 +287,16 @@ stack_clear:
     push hl
     pop bc
     lea hl, ix - 1
+if defined HASHLIB_PROFILE
+    ; profiling builds erase with the paint, so the next measurement still sees it
+    ld (hl), _profile_paint
+else
     ld (hl), 0
+end if
     lddr
     
     ; restore a, hl, e
+.restore:
     ld e, 0
 .smc_e:=$-1
     ld a, 0
@@ -199,14 +308,229 @@ stack_clear:
     ret
  
 ;------------------------------------------
+; scratch arena
+_scratch_off    := 0
+_scratch_ready  := 1
+_scratch_in_use := 2
+_scratch_min    := 1024
+
+_scratch_state: db _scratch_off
+_scratch_arena: dl 0
+_scratch_size:  dl 0
+_scratch_sp:    dl 0
+
+; hashlib_set_scratch(arena, size);
+hashlib_set_scratch:
+    pop bc, hl, de
+    push de, hl, bc
+    ; the arena can't change under a running routine
+    ld a, (_scratch_state)
+    cp a, _scratch_in_use
+    ld a, 0
+    ret z
+    ; NULL turns the arena off
+    add hl, bc
+    or a, a
+    sbc hl, bc
+    jq z, .set_state
+    ex de, hl
+    ld bc, _scratch_min
+    or a, a
+    sbc hl, bc
+    ret c
+    add hl, bc
+    ld (_scratch_arena), de
+    ld (_scratch_size), hl
+    inc a
+.set_state:
+    ld (_scratch_state), a
+    ld a, 1
+    ret
+
+; call first thing in a routine with a large frame
+; moves the routine, its arguments, and everything it calls onto the arena
+_scratch_enter:
+    ld a, (_scratch_state)
+    cp a, _scratch_ready
+    ret nz
+    ld a, _scratch_in_use
+    ld (_scratch_state), a
+    pop iy
+    ; copy up to 8 arguments to the top of the arena
+    ld hl, 0
+    add hl, sp
+    ld (_scratch_sp), hl
+    ld bc, 3 + 8 * 3 - 1
+    add hl, bc
+    push hl
+    ld hl, (_scratch_arena)
+    ld de, (_scratch_size)
+    add hl, de
+    dec hl
+    ex de, hl
+    pop hl
+    ld bc, 8 * 3
+    lddr
+    ex de, hl
+    inc hl
+    ld sp, hl
+    ld hl, _scratch_leave
+    push hl
+    jp (iy)
+
+; the routine returns here, still on the arena
+_scratch_leave:
+    ld iy, (_scratch_sp)
+    ld sp, iy
+    push af, hl, de
+if defined HASHLIB_PROFILE
+    ld hl, (_scratch_arena)
+    call _profile_scan
+    ld (_profile_scratch_low), hl
+end if
+    ld hl, (_scratch_arena)
+    ld bc, (_scratch_size)
+    push hl
+    pop de
+    inc de
+    ld (hl), 0
+    dec bc
+    ldir
+    ld a, _scratch_ready
+    ld (_scratch_state), a
+    pop de, hl, af
+    ret
+
+;------------------------------------------
+; stack and scratch profiling
+; build with -i 'HASHLIB_PROFILE := 1' to measure what each call uses.
+; hashlib_profile_begin paints the free stack and the arena, and
+; hashlib_profile_end finds the lowest byte that no longer holds the paint.
+; stack_clear and _scratch_leave look before they erase anything
+_profile_paint  := $A5
+
+_profile_top:           dl 0
+_profile_low:           dl 0
+_profile_scratch_top:   dl 0
+_profile_scratch_low:   dl 0
+
+; hashlib_profile_begin();
+hashlib_profile_begin:
+if defined HASHLIB_PROFILE
+    ld hl, 3
+    add hl, sp
+    ld (_profile_top), hl
+    ld (_profile_low), hl
+    ; paint from stackBot up to just below the return address of _profile_fill
+    ld de, stackBot + 6
+    or a, a
+    sbc hl, de
+    push hl
+    pop bc
+    ld hl, stackBot
+    call _profile_fill
+    ; and all of the arena, if there is one
+    or a, a
+    sbc hl, hl
+    ld a, (_scratch_state)
+    cp a, _scratch_ready
+    jq nz, .no_arena
+    ld hl, (_scratch_arena)
+    ld bc, (_scratch_size)
+    call _profile_fill
+.no_arena:
+    ld (_profile_scratch_top), hl
+    ld (_profile_scratch_low), hl
+end if
+    ret
+
+; hashlib_profile_end(report);
+hashlib_profile_end:
+if defined HASHLIB_PROFILE
+    ld hl, stackBot
+    call _profile_lower
+    pop de, iy
+    push iy, de
+    ld hl, (_profile_top)
+    ld de, (_profile_low)
+    or a, a
+    sbc hl, de
+    ld (iy + 0), hl
+    ld hl, (_profile_scratch_top)
+    ld de, (_profile_scratch_low)
+    or a, a
+    sbc hl, de
+    ld (iy + 3), hl
+    ld a, 1
+else
+    xor a, a
+end if
+    ret
+
+if defined HASHLIB_PROFILE
+; fills bc bytes from hl with the paint, bc > 1
+; returns hl past the end
+; destroys: bc, de
+_profile_fill:
+    push hl
+    pop de
+    inc de
+    ld (hl), _profile_paint
+    dec bc
+    ldir
+    ex de, hl
+    ret
+
+; hl = start
+; returns hl = the first byte from start up that does not hold the paint
+; destroys: af
+_profile_scan:
+    ld a, _profile_paint
+.loop:
+    cp a, (hl)
+    ret nz
+    inc hl
+    jq .loop
+
+; lowers _profile_low to the first unpainted byte from hl up
+; destroys: af, de, hl
+_profile_lower:
+    call _profile_scan
+    ld de, (_profile_low)
+    or a, a
+    sbc hl, de
+    ret nc
+    add hl, de
+    ld (_profile_low), hl
+    ret
+end if
+ 
+;------------------------------------------
     
 
 csrand_init:
+; tests every byte, stopping early only on a perfect bit
+    or a, a
+    sbc hl, hl
+    xor a, a
+    jq _csrand_calibrate
+
+; csrand_init_adaptive(target);
+csrand_init_adaptive:
+    pop bc, hl
+    push hl, bc
+    ld a, _screen_tests
+
+_csrand_calibrate:
+; inputs: hl = deviation at which to stop early
+; inputs: a = reads per byte for the screening pass, 0 for none
 ; ix = selected byte
 ; de = current deviation
 ; hl = starting address
 ; bc = bytes to check
 ; outputs: hl = address
+    ld (.target), hl
+    ld (.screen_reads), a
     push ix
         ld ix, 0
         ld de, _max_deviation
@@ -215,14 +539,26 @@ csrand_init:
 .test_range_loop:
         push bc
             push hl
-                call _test_byte
+                ld b, 0
+.screen_reads := $-1
+                call _screen_byte
+                call nz, _test_byte
             pop hl
         pop bc
+        ; stop once the best byte is within the target
+        push hl
+            ld hl, 0
+.target := $-3
+            or a, a
+            sbc hl, de
+        pop hl
+        jq nc, .done
         inc hl
         dec bc
         ld a,c
         or a,b
         jq nz,.test_range_loop
+.done:
         lea hl, ix+0
         ld (_sprng_read_addr), hl
         add hl, de
@@ -233,6 +569,25 @@ csrand_init:
     inc a
     ret
 
+_screen_byte:
+; inputs: hl = byte
+; inputs: b = reads, 0 to skip screening
+; outputs: z if no bit of the byte changed over b reads, nz if it is worth testing
+; destroys: af, bc
+    inc b
+    dec b
+    jr z, .keep
+    ld c, (hl)
+.loop:
+    ld a, (hl)
+    xor a, c
+    ret nz
+    djnz .loop
+    ret
+.keep:
+    inc b
+    ret
+
 _test_byte:
 ; inputs: hl = byte
 ; outputs: none, but de should be edited if address contains less deviant bit
@@ -240,76 +595,144 @@ _test_byte:
 ; destroys: bc, af, hl
 ; modifies: de, ix
     push iy
+    push ix
+    push de
+    ld (.address), hl
     push hl
-    ld b, 8
-    ld c, 0
+    pop ix
+    ; bit-sliced hit counters, one per bit of the byte
+    ; bit n of level k is bit k of the count for bit n
+    ; levels 0-3 live in d, e, h, l and levels 4-10 at iy+4 to iy+10
+    ld bc, 0
+    push bc, bc, bc, bc
+    ld iy, 0
+    add iy, sp
+    ld d, b
+    ld e, b
+    ld h, b
+    ld l, b
+    ld (iy + 11), _num_tests / 256
+    ; read the byte once per test and add all eight bits to their counters
+.test_loop:
+    ld a, (ix + 0)
+    ld c, a
+    xor a, d
+    ld d, a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, e
+    ld e, a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, h
+    ld h, a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, l
+    ld l, a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 4)
+    ld (iy + 4), a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 5)
+    ld (iy + 5), a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 6)
+    ld (iy + 6), a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 7)
+    ld (iy + 7), a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 8)
+    ld (iy + 8), a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 9)
+    ld (iy + 9), a
+    xor a, c
+    and a, c
+    jq z, .counted
+    ld c, a
+    xor a, (iy + 10)
+    ld (iy + 10), a
+.counted:
+    djnz .test_loop
+    dec (iy + 11)
+    jq nz, .test_loop
+    ld (iy + 0), d
+    ld (iy + 1), e
+    ld (iy + 2), h
+    ld (iy + 3), l
+    ld de, (iy + 12)
+    ld ix, (iy + 15)
+
+    ld c, 1
 .test_byte_bitloop:
-    push bc
+    ; hl = hit count for the bit in c
     push de
-    ld a,c
-    call _test_bit  ; HL = bits set
+    or a,a
+    sbc hl, hl
+    lea de, iy + 10
+    ld b, 11
+.count_loop:
+    add hl, hl
+    ld a, (de)
+    and a, c
+    jr z, .count_next
+    inc hl
+.count_next:
+    dec de
+    djnz .count_loop
+    ; hl = deviation of the count from half
+    ex hl, de
+    ld hl, _num_tests/2
+    or a,a
+    sbc hl, de
+    jq nc, .deviation
+    ex hl,de
+    or a,a
+    sbc hl,hl
+    sbc hl,de
+.deviation:
     pop de
-    pop bc
     or a,a
     sbc hl, de
     jq nc, .skip_next_bit    ; IF HL < DE
     add hl,de
     ex hl, de
-    pop ix
-    push ix
+    ld ix, 0
+.address := $-3
 .skip_next_bit:
-    inc c
-    djnz .test_byte_bitloop
-    pop iy
+    sla c
+    jq nz, .test_byte_bitloop
+    ld hl, 12 + 3 + 3
+    add hl, sp
+    ld sp, hl
     pop iy
     ret
-
-_test_bit:
-; inputs: a = bit
-; inputs: hl = byte
-; outputs: hl = hit count
-; destroys: af, bc, de, hl
-    add a,a
-    add a,a
-    add a,a
-    add a,$46 ;bit 0,(hl)
-    ld (.smc1),a
-    ld (.smc2),a
-    ld (.smc3),a
-    ld (.smc4),a
-    ld bc,$ff
-    ld de,0
-.loop:
-    bit 0,(hl)
-.smc1:=$-1
-    jq z,.next1
-    inc de
-.next1:
-    bit 0,(hl)
-.smc2:=$-1
-    jq z,.next2
-    inc de
-.next2:
-    bit 0,(hl)
-.smc3:=$-1
-    jq z, .next3
-    inc de
-.next3:
-    bit 0,(hl)
-.smc4:=$-1
-    jq z, .next4
-    inc de
-.next4:
-    djnz .loop
-    ld hl,_num_tests/2
-    or a,a
-    sbc hl,de
-    ret nc
-    ex hl,de
-    or a,a
-    sbc hl,hl
-    sbc hl,de
-    ret
     
 	
 hashlib_SPRNGAddEntropy:
@@ -450,7 +873,9 @@ csrand_fill:
 	ret
 	
  
-hash_algs_impl  =   1
+hash_algs_impl  =   3
+hmac_algs_impl  =   2
+mac_algs_impl   =   5
  
 ; hash_init(context, alg);
 hash_init:
@@ -548,10 +973,10 @@ hmac_init:
     ; (ix+12) keylen
     ; (ix+15) alg
     
-    ; check if value of alg < hash_algs_impl, return 0 if not
+    ; check if value of alg < mac_algs_impl, return 0 if not
     ld a, (ix + 15)
     ld l, a
-    cp a, hash_algs_impl
+    cp a, mac_algs_impl
     sbc a,a
     jr z, .exit
     
@@ -575,9 +1000,8 @@ hmac_init:
     ld hl, (iy)
     call _indcallhl
     
-    ; pop arguments from stack
+    ; pop arguments from stack, returning what the method returned
     pop hl,hl,hl
-    ld a, 1     ; return true
 .exit:
     ld sp, ix
     pop ix
@@ -625,6 +1049,73 @@ hmac_final:
     
     
  
+; hash_updatev(context, iov, count);
+; hmac_updatev(context, iov, count);
+; both context types start with the same method pointers
+_updatev:
+    call	ti._frameset0
+    ; (ix+0) return vector
+    ; (ix+3) old ix
+    ; (ix+6) context
+    ; (ix+9) iov
+    ; (ix+12) count
+    
+    ; sha256 and hmac-sha256 take every segment in one pass
+    ld iy, (ix + 6)
+    ld hl, (iy + 3)
+    lea iy, iy + 9
+    ld de, hash_sha256_update
+    or a, a
+    sbc hl, de
+    jr z, .sha256
+    add hl, de
+    ld de, hmac_sha256_update
+    or a, a
+    sbc hl, de
+    jr nz, .each
+    ld de, 128
+    add iy, de
+.sha256:
+    ld hl, (ix + 12)
+    push hl
+    ld hl, (ix + 9)
+    push hl
+    push iy
+    call _sha256_updatev
+    jr .exit
+    
+    ; otherwise, one update per segment
+.each:
+    ld hl, (ix + 12)
+    ld de, 1
+    or a, a
+    sbc hl, de
+    jr c, .exit
+    ld (ix + 12), hl
+    ld iy, (ix + 9)
+    ld hl, (iy + 3)
+    lea iy, iy + 6
+    ld (ix + 9), iy
+    add hl, de
+    or a, a
+    sbc hl, de
+    jr z, .each
+    push hl
+    ld hl, (iy - 6)
+    push hl
+    ld iy, (ix + 6)
+    pea iy + 9
+    ld hl, (iy + 3)
+    call _indcallhl
+    pop hl,hl,hl
+    jr .each
+.exit:
+    ld sp, ix
+    pop ix
+    ret
+    
+    
+ 
 ; void hash_sha256_init(SHA256_CTX *ctx);
 hash_sha256_init:
     pop iy,de
@@ -639,8 +1130,30 @@ hash_sha256_init:
     jp (iy)
     
 
+; void hash_sha1_update(SHA1_CTX *ctx, const BYTE data[], size_t len);
+hash_sha1_update:
+	ld hl, _sha1_transform
+	jq _sha_update
+
+; void hash_sha1_init(SHA1_CTX *ctx);
+hash_sha1_init:
+    pop iy,de
+    push de
+    ld hl,$FF0000
+    ld bc,offset_state
+    ldir
+    ld c,5*4
+    ld hl,_sha1_state_init
+    ldir
+    ld a, 1
+    jp (iy)
+
 ; void hashlib_Sha256Update(SHA256_CTX *ctx, const BYTE data[], size_t len);
 hash_sha256_update:
+	ld hl, _sha256_transform
+; shared by sha1 and sha256, hl = block transform
+_sha_update:
+	ld (_sha256_update_apply_transform.transform), hl
 	save_interrupts
 
 	call ti._frameset0
@@ -677,7 +1190,7 @@ hash_sha256_update:
 	ld (iy + offset_datalen), a		   ;save current datalen
 	pop ix
 
-	restore_interrupts hash_sha256_update
+	restore_interrupts _sha_update
 	ret
 
 _sha256_update_loop:
@@ -692,6 +1205,7 @@ _sha256_update_apply_transform:
 	ld bc, (ix + 6)
 	push bc
 	call _sha256_transform	  ; if we have one block (64-bytes), transform block
+_sha256_update_apply_transform.transform := $-3
 	pop iy
 	ld bc, 512				  ; add 1 blocksize of bitlen to the bitlen field
 	push bc
@@ -702,8 +1216,75 @@ _sha256_update_apply_transform:
 	ld de, (ix + 6)
 	ret
 
+; _sha256_updatev(context, iov, count);
+; hash_sha256_update over a list of segments, under one frame and interrupt save
+_sha256_updatev:
+	ld hl, _sha256_transform
+	ld (_sha256_update_apply_transform.transform), hl
+	save_interrupts
+
+	call ti._frameset0
+	; (ix + 6) arg1: ctx
+	; (ix + 9) arg2: iov
+	; (ix + 12) arg3: count
+
+	ld iy, (ix + 6)
+	ld a, (iy + offset_datalen)
+	ld de, 0
+	ld e, a
+	ld hl, (ix + 6)
+	add hl, de
+	ex de, hl				; de = context / data ptr
+.segment:
+	push de
+	ld hl, (ix + 12)
+	ld de, 1
+	or a, a
+	sbc hl, de
+	pop de
+	jq c, .done
+	ld (ix + 12), hl
+	ld iy, (ix + 9)
+	ld hl, (iy + 0)			; hl = source data
+	ld bc, (iy + 3)			; bc = len
+	lea iy, iy + 6
+	ld (ix + 9), iy
+
+	; skip empty segments, the update loop can't take them
+	push hl
+	or a, a
+	sbc hl, hl
+	adc hl, bc
+	pop hl
+	jq z, .segment
+
+	call _sha256_update_loop
+	cp a,64
+	call z,_sha256_update_apply_transform
+	jq .segment
+.done:
+	ld iy, (ix + 6)
+	ld (iy + offset_datalen), a		   ;save current datalen
+	pop ix
+
+	restore_interrupts _sha256_updatev
+	ret
+
+; void hash_sha1_final(SHA1_CTX *ctx, BYTE hash[]);
+hash_sha1_final:
+	ld hl, _sha1_transform
+	ld a, 5
+	jq _sha_final
+
 ; void hashlib_Sha256Final(SHA256_CTX *ctx, BYTE hash[]);
 hash_sha256_final:
+	ld hl, _sha256_transform
+	ld a, 8
+; shared by sha1 and sha256, hl = block transform, a = digest length in words
+_sha_final:
+	ld (_sha_final.transform1), hl
+	ld (_sha_final.transform2), hl
+	ld (_sha_final.words), a
 	save_interrupts
 
 	ld hl,-_sha256ctx_size
@@ -719,9 +1300,17 @@ hash_sha256_final:
 	; ld (hl),2
 
 	ld iy, (ix + 6)					; iy =  context block
+	ld bc, 0
+	ld a, (_sha_final.words)
+	ld c, a
+	ld b, 4
+	mlt bc
+	ld hl, offset_state
+	add hl, bc
+	push hl
+	pop bc							; only copy as much state as the hash has
 	lea hl, iy
 	lea de, ix-_sha256ctx_size
-	ld bc, _sha256ctx_size
 	ldir
 
 	ld bc, 0
@@ -751,8 +1340,9 @@ _sha256_final_pad_loop1:
 	inc hl
 	ld (hl), a
 	djnz _sha256_final_pad_loop1
-	push iy
+	pea ix-_sha256ctx_size
 	call _sha256_transform
+_sha_final.transform1 := $-3
 	pop de
 	ld hl,$FF0000
 	ld bc,56
@@ -781,93 +1371,317 @@ _sha256_final_pad_message_len_loop:
 
 	push iy ;ctx
 	call _sha256_transform
+_sha_final.transform2 := $-3
 	pop iy
 
 	ld hl, (ix + 9)
 	lea iy, iy + offset_state
 	ld b, 8
+_sha_final.words := $-1
 	call _sha256_reverse_endianness
 
 	ld sp,ix
 	pop ix
 
-	restore_interrupts hash_sha256_final
+	restore_interrupts _sha_final
 	ret
 
-; reverse b longs endianness from iy to hl
-_sha256_reverse_endianness:
-	ld a, (iy + 0)
-	ld c, (iy + 1)
-	ld d, (iy + 2)
-	ld e, (iy + 3)
-	ld (hl), e
-	inc hl
-	ld (hl), d
-	inc hl
-	ld (hl), c
-	inc hl
-	ld (hl), a
-	inc hl
-	lea iy, iy + 4
-	djnz _sha256_reverse_endianness
+; hash_sha256_update wrapper that skips empty input
+; de = sha256 state, hl = data, bc = len
+; preserves bc, de, hl
+_sha256_update_nz:
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	pop	hl
+	ret	z
+	push	bc, hl, de
+	call	hash_sha256_update
+	pop	de, hl, bc
 	ret
 
-; helper macro to xor [B,C] with [R1,R2] storing into [R1,R2]
-; destroys: af
-macro _xorbc? R1,R2
-	ld a,b
-	xor a,R1
-	ld R1,a
-	ld a,c
-	xor a,R2
-	ld R2,a
-end macro
-
-; helper macro to add [B,C] with [R1,R2] storing into [R1,R2]
-; destroys: af
-; note: this will add including the carry flag, so be sure of what the carry flag is before this
-; note: if you're chaining this into a number longer than 16 bits, the order must be low->high
-macro _addbclow? R1,R2
-	ld a,c
-	add a,R2
-	ld R2,a
-	ld a,b
-	adc a,R1
-	ld R1,a
-end macro
-macro _addbchigh? R1,R2
-	ld a,c
-	adc a,R2
-	ld R2,a
-	ld a,b
-	adc a,R1
-	ld R1,a
-end macro
-
-; helper macro to move [d,e,h,l] <- [l,e,d,h] therefore shifting 8 bits right.
-; destroys: af
-macro _rotright8?
-	ld a,l
-	ld l,h
-	ld h,e
-	ld e,d
-	ld d,a
-end macro
+; hash_pow_search(prefix, len, difficulty, nonce);
+; finds a nonce such that H(prefix | nonce) starts with difficulty zero bits
+hash_pow_search:
+	save_interrupts
 
-; helper macro to move [d,e,h,l] <- [e,h,l,d] therefore shifting 8 bits left.
-; destroys: af
-macro _rotleft8?
-	ld a,d
-	ld d,e
-	ld e,h
-	ld h,l
-	ld l,a
-end macro
+	ld	hl, -(50 + 2 * _sha256ctx_size)
+	call	ti._frameset
+	; (ix+6) prefix
+	; (ix+9) len
+	; (ix+12) difficulty
+	; (ix+15) nonce
+	; (ix-12) pointers to the nonce bytes in the final blocks, low byte at (ix-3)
+	; (ix-15) context holding the first final block
+	; (ix-18) context holding the last final block
+	; (ix-50) midstate after the whole blocks of the prefix
+	; (ix-155) first context
+	; (ix-260) second context
 
+	lea	hl, ix - 50
+	ld	de, -_sha256ctx_size
+	add	hl, de
+	ld	(ix - 15), hl
+	add	hl, de
+	ld	(ix - 18), hl
 
-; #define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
-;input: [d,e,h,l], b
-;output: [d,e,h,l]
+	; compress the whole blocks of the prefix once
+	ld	hl, (ix - 15)
+	push	hl
+	call	hash_sha256_init
+	pop	de
+	ld	hl, (ix + 6)
+	ld	bc, (ix + 9)
+	call	_sha256_update_nz
+	ld	hl, offset_state
+	add	hl, de
+	lea	de, ix - 50
+	ld	bc, 32
+	ldir
+
+	; the message length includes the 4 nonce bytes
+	ld	iy, (ix - 15)
+	ld	c, (iy + offset_datalen)
+	ld	b, 8
+	mlt	bc
+	ld	hl, 4 * 8
+	add	hl, bc
+	push	hl
+	pea	iy + offset_bitlen
+	call	u64_addi
+	pop	bc, bc
+
+	; lay out the rest of the prefix, the nonce and the padding
+	; over one or two final blocks
+	ld	iy, (ix - 15)
+	ld	a, (iy + offset_datalen)
+.clear:
+	push	af
+	call	_pow_tail
+	ld	(hl), 0
+	pop	af
+	inc	a
+	cp	a, 128
+	jq	nz, .clear
+	ld	c, (iy + offset_datalen)
+	lea	iy, ix - 3
+	ld	hl, (ix + 15)
+	ld	b, 4
+.nonce:
+	push	bc, hl
+	ld	a, c
+	call	_pow_tail
+	ld	(iy + 0), hl
+	ex	de, hl
+	pop	hl
+	ldi
+	pop	bc
+	inc	c
+	lea	iy, iy - 3
+	djnz	.nonce
+	ld	a, c
+	call	_pow_tail
+	ld	(hl), $80
+	ld	a, c
+	cp	a, 56
+	jq	nc, .length
+	ld	hl, (ix - 15)
+	ld	(ix - 18), hl
+.length:
+	ld	iy, (ix - 15)
+	lea	hl, iy + offset_bitlen
+	ld	iy, (ix - 18)
+	lea	de, iy + offset_data + 63
+	ld	b, 8
+.length_loop:
+	ld	a, (hl)
+	ld	(de), a
+	inc	hl
+	dec	de
+	djnz	.length_loop
+
+	; each try only compresses the final blocks, from the midstate
+.try:
+	lea	hl, ix - 50
+	ld	iy, (ix - 15)
+	lea	de, iy + offset_state
+	ld	bc, 32
+	ldir
+	push	iy
+	call	_sha256_transform
+	pop	iy
+	ld	de, (ix - 18)
+	lea	hl, iy + 0
+	or	a, a
+	sbc	hl, de
+	jq	z, .check
+	lea	hl, iy + offset_state
+	ld	iy, (ix - 18)
+	lea	de, iy + offset_state
+	ld	bc, 32
+	ldir
+	push	iy
+	call	_sha256_transform
+	pop	iy
+.check:
+	ld	c, (ix + 12)
+	call	_pow_check
+	jq	z, .found
+
+	; next nonce, incremented in place in the block
+	lea	iy, ix - 3
+	ld	b, 4
+.carry:
+	ld	hl, (iy + 0)
+	inc	(hl)
+	jq	nz, .try
+	lea	iy, iy - 3
+	djnz	.carry
+	xor	a, a
+	jq	.exit
+
+.found:
+	lea	iy, ix - 3
+	ld	de, (ix + 15)
+	ld	b, 4
+.copy_nonce:
+	ld	hl, (iy + 0)
+	ld	a, (hl)
+	ld	(de), a
+	inc	de
+	lea	iy, iy - 3
+	djnz	.copy_nonce
+	ld	a, 1
+.exit:
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a hash_pow_search
+	ret
+
+; a = offset into the final blocks, in hash_pow_search's frame
+; returns hl = its address
+; destroys af, de
+_pow_tail:
+	ld	hl, (ix - 15)
+	cp	a, 64
+	jq	c, .first
+	ld	hl, (ix - 18)
+	sub	a, 64
+.first:
+	ld	de, 0
+	ld	e, a
+	add	hl, de
+	ret
+
+; iy = context, c = difficulty
+; returns z if the digest of its state starts with c zero bits
+; the state words are little endian, so the first digest byte is the top byte of the first word
+_pow_check:
+	lea	hl, iy + offset_state + 3
+.word:
+	ld	b, 4
+.byte:
+	ld	a, c
+	sub	a, 8
+	jq	c, .partial
+	ld	c, a
+	ld	a, (hl)
+	or	a, a
+	ret	nz
+	dec	hl
+	djnz	.byte
+	ld	de, 8
+	add	hl, de
+	jq	.word
+.partial:
+	ld	a, c
+	or	a, a
+	ret	z
+	ld	b, a
+	xor	a, a
+.mask:
+	scf
+	rra
+	djnz	.mask
+	and	a, (hl)
+	ret
+
+; reverse b longs endianness from iy to hl
+_sha256_reverse_endianness:
+	ld a, (iy + 0)
+	ld c, (iy + 1)
+	ld d, (iy + 2)
+	ld e, (iy + 3)
+	ld (hl), e
+	inc hl
+	ld (hl), d
+	inc hl
+	ld (hl), c
+	inc hl
+	ld (hl), a
+	inc hl
+	lea iy, iy + 4
+	djnz _sha256_reverse_endianness
+	ret
+
+; helper macro to xor [B,C] with [R1,R2] storing into [R1,R2]
+; destroys: af
+macro _xorbc? R1,R2
+	ld a,b
+	xor a,R1
+	ld R1,a
+	ld a,c
+	xor a,R2
+	ld R2,a
+end macro
+
+; helper macro to add [B,C] with [R1,R2] storing into [R1,R2]
+; destroys: af
+; note: this will add including the carry flag, so be sure of what the carry flag is before this
+; note: if you're chaining this into a number longer than 16 bits, the order must be low->high
+macro _addbclow? R1,R2
+	ld a,c
+	add a,R2
+	ld R2,a
+	ld a,b
+	adc a,R1
+	ld R1,a
+end macro
+macro _addbchigh? R1,R2
+	ld a,c
+	adc a,R2
+	ld R2,a
+	ld a,b
+	adc a,R1
+	ld R1,a
+end macro
+
+; helper macro to move [d,e,h,l] <- [l,e,d,h] therefore shifting 8 bits right.
+; destroys: af
+macro _rotright8?
+	ld a,l
+	ld l,h
+	ld h,e
+	ld e,d
+	ld d,a
+end macro
+
+; helper macro to move [d,e,h,l] <- [e,h,l,d] therefore shifting 8 bits left.
+; destroys: af
+macro _rotleft8?
+	ld a,d
+	ld d,e
+	ld e,h
+	ld h,l
+	ld l,a
+end macro
+
+
+; #define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
+;input: [d,e,h,l], b
+;output: [d,e,h,l]
 ;destroys: af, b
 _ROTLEFT:
 	xor a,a
@@ -1263,6 +2077,212 @@ _sha256_transform:
 	pop ix
 	ret
 
+
+; sha1 round functions, one byte of f(b,c,d) into reg
+; iy points to the working variables a,b,c,d,e
+; destroys: af
+macro _sha1_ch? reg,n
+	ld a,(iy + 8 + n)		; (b & c) | (~b & d) = d ^ (b & (c ^ d))
+	xor a,(iy + 12 + n)
+	and a,(iy + 4 + n)
+	xor a,(iy + 12 + n)
+	ld reg,a
+end macro
+macro _sha1_parity? reg,n
+	ld a,(iy + 4 + n)		; b ^ c ^ d
+	xor a,(iy + 8 + n)
+	xor a,(iy + 12 + n)
+	ld reg,a
+end macro
+macro _sha1_maj? reg,n
+	ld a,(iy + 4 + n)		; (b & c) | (d & (b | c))
+	or a,(iy + 8 + n)
+	and a,(iy + 12 + n)
+	ld c,a
+	ld a,(iy + 4 + n)
+	and a,(iy + 8 + n)
+	or a,c
+	ld reg,a
+end macro
+
+; rest of a sha1 round, with f(b,c,d) in [d,e,h,l]
+; tmp = ROTL5(a) + f + e + k + w[t], written as the next a one word below this one
+; so b,c,d,e never have to move, then c = ROTL30(b) in place
+; iy = working variables, ix = w[t]
+; destroys: af, bc, de, hl
+macro _sha1_round? k
+	ld bc, (ix + 0)
+	_addbclow h,l
+	ld bc, (ix + 2)
+	_addbchigh d,e
+	ld bc, (iy + 16)
+	_addbclow h,l
+	ld bc, (iy + 18)
+	_addbchigh d,e
+	ld bc, k and $FFFF
+	_addbclow h,l
+	ld bc, k shr 16
+	_addbchigh d,e
+	push de,hl
+	ld hl, (iy + 0)
+	ld de, (iy + 2)
+	_rotleft8
+	ld b,3
+	call _ROTRIGHT		; ROTL5(a)
+	pop bc
+	_addbclow h,l
+	pop bc
+	_addbchigh d,e
+	ld (iy - 4), hl
+	ld (iy - 2), e
+	ld (iy - 1), d
+	ld hl, (iy + 4)
+	ld de, (iy + 6)
+	ld b,2
+	call _ROTRIGHT		; ROTL30(b)
+	ld (iy + 4), hl
+	ld (iy + 6), e
+	ld (iy + 7), d
+	lea iy, iy - 4
+	lea ix, ix + 4
+end macro
+
+; void _sha1_transform(SHA1_CTX *ctx);
+; the whole schedule w[0..79] is expanded up front, and the working variables
+; slide down the frame one word per round instead of being shuffled
+_sha1_transform:
+._w := -80*4
+._vars := ._w - 85*4
+	ld hl,._vars
+	call ti._frameset
+	ld iy,(ix + 6)
+
+	; a..e = ctx state, at the top of the variable area
+	ld bc,._w - 5*4
+	lea hl,ix + 0
+	add hl,bc
+	ex de,hl
+	lea hl,iy + offset_state
+	ld bc,5*4
+	ldir
+
+	; w[0..15] = the block as big endian words
+	ex de,hl
+	ld b,16
+	call _sha256_reverse_endianness
+
+	; w[t] = ROTL1(w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16])
+	push ix
+	push hl
+	pop ix
+	ld a,80-16
+._expand:
+	push af
+	ld hl, (ix - 3*4)
+	ld de, (ix - 3*4 + 2)
+	ld bc, (ix - 8*4)
+	_xorbc h,l
+	ld bc, (ix - 8*4 + 2)
+	_xorbc d,e
+	ld bc, (ix - 14*4)
+	_xorbc h,l
+	ld bc, (ix - 14*4 + 2)
+	_xorbc d,e
+	ld bc, (ix - 16*4)
+	_xorbc h,l
+	ld bc, (ix - 16*4 + 2)
+	_xorbc d,e
+	ld a,d
+	rla
+	rl l
+	rl h
+	rl e
+	rl d
+	ld (ix + 0), l
+	ld (ix + 1), h
+	ld (ix + 2), e
+	ld (ix + 3), d
+	lea ix, ix + 4
+	pop af
+	dec a
+	jq nz,._expand
+
+	ld bc,._w
+	add ix,bc
+	lea iy,ix - 5*4
+
+	ld a,20
+._rounds1:
+	push af
+	_sha1_ch l,0
+	_sha1_ch h,1
+	_sha1_ch e,2
+	_sha1_ch d,3
+	_sha1_round $5A827999
+	pop af
+	dec a
+	jq nz,._rounds1
+
+	ld a,20
+._rounds2:
+	push af
+	_sha1_parity l,0
+	_sha1_parity h,1
+	_sha1_parity e,2
+	_sha1_parity d,3
+	_sha1_round $6ED9EBA1
+	pop af
+	dec a
+	jq nz,._rounds2
+
+	ld a,20
+._rounds3:
+	push af
+	_sha1_maj l,0
+	_sha1_maj h,1
+	_sha1_maj e,2
+	_sha1_maj d,3
+	_sha1_round $8F1BBCDC
+	pop af
+	dec a
+	jq nz,._rounds3
+
+	ld a,20
+._rounds4:
+	push af
+	_sha1_parity l,0
+	_sha1_parity h,1
+	_sha1_parity e,2
+	_sha1_parity d,3
+	_sha1_round $CA62C1D6
+	pop af
+	dec a
+	jq nz,._rounds4
+
+	; state += a..e
+	pop ix
+	push ix
+	ld ix, (ix + 6)
+	lea ix, ix + offset_state
+	ld b,5
+._add:
+	ld hl, (ix + 0)
+	ld de, (iy + 0)
+	ld a, (ix + 3)
+	or a,a
+	adc hl,de
+	adc a,(iy + 3)
+	ld (ix + 0), hl
+	ld (ix + 3), a
+	lea ix, ix + 4
+	lea iy, iy + 4
+	djnz ._add
+
+	pop ix
+	ld sp,ix
+	pop ix
+	ret
+
     
     
 _xor_buf:
@@ -1295,6 +2315,74 @@ _xor_buf:
 	pop	ix
 	ret
 	
+if defined HASHLIB_AES_TABLES
+; fills in _aes_sbox and _aes_invsbox the first time AES is used
+; destroys: af, bc, de, hl
+_aes_tables_build:
+	ld	hl, _aes_tables_ready
+	ld	a, (hl)
+	or	a, a
+	ret	nz
+	ld	(hl), 1
+	; p steps through the powers of 3 and q through the powers of 1/3, so q = 1/p
+	; sbox[p] = affine(q)
+	ld	bc, $0101
+.sbox:
+	ld	a, b
+	add	a, a
+	jr	nc, .p3
+	xor	a, $1B
+.p3:
+	xor	a, b
+	ld	b, a
+	ld	a, c
+	add	a, a
+	xor	a, c
+	ld	c, a
+	add	a, a
+	add	a, a
+	xor	a, c
+	ld	c, a
+	add	a, a
+	add	a, a
+	add	a, a
+	add	a, a
+	xor	a, c
+	bit	7, a
+	jr	z, .q3
+	xor	a, $09
+.q3:
+	ld	c, a
+	ld	d, a
+	rlc	d
+	xor	a, d
+	rlc	d
+	xor	a, d
+	rlc	d
+	xor	a, d
+	rlc	d
+	xor	a, d
+	xor	a, $63
+	ld	hl, _aes_sbox
+	ld	de, 0
+	ld	e, b
+	add	hl, de
+	ld	(hl), a
+	ld	hl, _aes_invsbox
+	ld	e, a
+	add	hl, de
+	ld	(hl), b
+	ld	a, b
+	dec	a
+	jr	nz, .sbox
+	; 0 has no inverse
+	ld	a, $63
+	ld	(_aes_sbox), a
+	xor	a, a
+	ld	(_aes_invsbox + $63), a
+	ret
+end if
+
 _aes_SubWord:
 	ld	hl, -9
 	call	ti._frameset
@@ -1463,6 +2551,9 @@ _aes_SubWord:
 	ret
 	
 aes_init:
+if defined HASHLIB_AES_TABLES
+	call	_aes_tables_build
+end if
 	save_interrupts
 
 	ld	hl, -25
@@ -1692,6342 +2783,14302 @@ aes_init:
 	ld	sp, ix
 	pop	ix
 	
-	restore_interrupts aes_init
+	restore_interrupts_preserve_a aes_init
 	ret
 	
-_aes_AddRoundKey:
-	ld	hl, -3
-	call	ti._frameset
-	ld	iy, (ix + 9)
-	ld	de, (iy)
-	ld	h, (iy + 3)
-	ld	l, 24
-	push	de
-	pop	bc
-	ld	a, h
-	call	ti._lshru
-	ld	(ix + -3), bc
-	ld	l, 16
-	push	de
-	pop	bc
-	ld	a, h
-	call	ti._lshru
-	ld	iy, (ix + 6)
-	ld	a, (iy)
-	ld	hl, (ix + -3)
-	xor	a, l
-	ld	(iy), a
-	ld	a, (iy + 4)
-	xor	a, c
-	ld	(iy + 4), a
-	ld	a, (iy + 8)
-	xor	a, d
-	ld	(iy + 8), a
-	ld	a, (iy + 12)
-	xor	a, e
-	ld	(iy + 12), a
-	ld	hl, (ix + 9)
-	push	hl
-	pop	iy
-	ld	de, (iy + 4)
-	ld	h, (iy + 7)
-	push	de
-	pop	bc
-	ld	a, h
-	ld	l, 24
-	call	ti._lshru
-	ld	(ix + -3), bc
-	push	de
-	pop	bc
-	ld	a, h
-	ld	l, 16
-	call	ti._lshru
-	ld	iy, (ix + 6)
-	ld	a, (iy + 1)
-	ld	hl, (ix + -3)
-	xor	a, l
-	ld	(iy + 1), a
-	ld	a, (iy + 5)
-	xor	a, c
-	ld	(iy + 5), a
-	ld	a, (iy + 9)
-	xor	a, d
-	ld	(iy + 9), a
-	ld	a, (iy + 13)
-	xor	a, e
-	ld	(iy + 13), a
-	ld	hl, (ix + 9)
-	push	hl
-	pop	iy
-	ld	de, (iy + 8)
-	ld	h, (iy + 11)
-	push	de
-	pop	bc
-	ld	a, h
-	ld	l, 24
-	call	ti._lshru
-	ld	(ix + -3), bc
-	push	de
-	pop	bc
-	ld	a, h
-	ld	l, 16
-	call	ti._lshru
-	ld	iy, (ix + 6)
-	ld	a, (iy + 2)
-	ld	hl, (ix + -3)
-	xor	a, l
-	ld	(iy + 2), a
-	ld	a, (iy + 6)
-	xor	a, c
-	ld	(iy + 6), a
-	ld	a, (iy + 10)
-	xor	a, d
-	ld	(iy + 10), a
-	ld	a, (iy + 14)
-	xor	a, e
-	ld	(iy + 14), a
-	ld	hl, (ix + 9)
-	push	hl
-	pop	iy
-	ld	de, (iy + 12)
-	ld	h, (iy + 15)
-	push	de
-	pop	bc
-	ld	a, h
-	ld	l, 24
-	call	ti._lshru
-	ld	(ix + -3), bc
-	push	de
-	pop	bc
-	ld	a, h
-	ld	l, 16
-	call	ti._lshru
-	ld	iy, (ix + 6)
-	ld	a, (iy + 3)
-	ld	hl, (ix + -3)
-	xor	a, l
-	ld	(iy + 3), a
-	ld	a, (iy + 7)
-	xor	a, c
-	ld	(iy + 7), a
-	ld	a, (iy + 11)
-	xor	a, d
-	ld	(iy + 11), a
-	ld	a, (iy + 15)
-	xor	a, e
-	ld	(iy + 15), a
-	pop	hl
-	pop	ix
-	ret
-	
-_aes_SubBytes:
-	call	ti._frameset0
-	ld	hl, (ix + 6)
-	ld	iy, _aes_sbox
+_aes_SubShiftRows:
+; SubBytes and ShiftRows in one pass, from the state at ix-16 to ix-32
+; t[4c + r] = sbox[s[4((c + r) & 3) + r]]
+	ld	bc, 0
+	ld	c, (ix + -16)
+	ld	hl, _aes_sbox
+	add	hl, bc
 	ld	a, (hl)
-	ld	de, 0
-	ld	e, a
-	ld	b, 4
-	push	de
-	pop	hl
-	ld	c, b
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	lea	hl, iy + 0
+	ld	(ix + -32), a
+	ld	c, (ix + -11)
+	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy), a
-	ld	a, (iy + 1)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -31), a
+	ld	c, (ix + -6)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 1), a
-	ld	a, (iy + 2)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -30), a
+	ld	c, (ix + -1)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 2), a
-	ld	a, (iy + 3)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -29), a
+	ld	c, (ix + -12)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 3), a
-	ld	a, (iy + 4)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	ld	iy, _aes_sbox
-	lea	hl, iy + 0
+	ld	(ix + -28), a
+	ld	c, (ix + -7)
+	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 4), a
-	ld	a, (iy + 5)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -27), a
+	ld	c, (ix + -2)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 5), a
-	ld	a, (iy + 6)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -26), a
+	ld	c, (ix + -13)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 6), a
-	ld	a, (iy + 7)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	ld	iy, _aes_sbox
-	lea	hl, iy + 0
+	ld	(ix + -25), a
+	ld	c, (ix + -8)
+	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 7), a
-	ld	a, (iy + 8)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -24), a
+	ld	c, (ix + -3)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 8), a
-	ld	a, (iy + 9)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -23), a
+	ld	c, (ix + -14)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 9), a
-	ld	a, (iy + 10)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	ld	hl, _aes_sbox
-	add	hl, bc
-	add	hl, de
-	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 10), a
-	ld	a, (iy + 11)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -22), a
+	ld	c, (ix + -9)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 11), a
-	ld	a, (iy + 12)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -21), a
+	ld	c, (ix + -4)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 12), a
-	ld	a, (iy + 13)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -20), a
+	ld	c, (ix + -15)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 13), a
-	ld	a, (iy + 14)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	ld	b, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	ld	c, b
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -19), a
+	ld	c, (ix + -10)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 14), a
-	ld	a, (iy + 15)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -18), a
+	ld	c, (ix + -5)
 	ld	hl, _aes_sbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 15), a
-	pop	ix
+	ld	(ix + -17), a
 	ret
-	
-_aes_InvSubBytes:
-	call	ti._frameset0
-	ld	hl, (ix + 6)
-	ld	iy, _aes_invsbox
-	ld	a, (hl)
-	ld	de, 0
-	ld	e, a
-	ld	b, 4
-	push	de
-	pop	hl
-	ld	c, b
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	lea	hl, iy + 0
+
+_aes_InvSubShiftRows:
+; InvSubBytes and InvShiftRows in one pass, from the state at ix-16 to ix-32
+; t[4c + r] = invsbox[s[4((c - r) & 3) + r]]
+	ld	bc, 0
+	ld	c, (ix + -16)
+	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy), a
-	ld	a, (iy + 1)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -32), a
+	ld	c, (ix + -3)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 1), a
-	ld	a, (iy + 2)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -31), a
+	ld	c, (ix + -6)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 2), a
-	ld	a, (iy + 3)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -30), a
+	ld	c, (ix + -9)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 3), a
-	ld	a, (iy + 4)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	ld	iy, _aes_invsbox
-	lea	hl, iy + 0
+	ld	(ix + -29), a
+	ld	c, (ix + -12)
+	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 4), a
-	ld	a, (iy + 5)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -28), a
+	ld	c, (ix + -15)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 5), a
-	ld	a, (iy + 6)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -27), a
+	ld	c, (ix + -2)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 6), a
-	ld	a, (iy + 7)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
-	ld	iy, _aes_invsbox
-	lea	hl, iy + 0
+	ld	(ix + -26), a
+	ld	c, (ix + -5)
+	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 7), a
-	ld	a, (iy + 8)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -25), a
+	ld	c, (ix + -8)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 8), a
-	ld	a, (iy + 9)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -24), a
+	ld	c, (ix + -11)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 9), a
-	ld	a, (iy + 10)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -23), a
+	ld	c, (ix + -14)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 10), a
-	ld	a, (iy + 11)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -22), a
+	ld	c, (ix + -1)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 11), a
-	ld	a, (iy + 12)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -21), a
+	ld	c, (ix + -4)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 12), a
-	ld	a, (iy + 13)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -20), a
+	ld	c, (ix + -7)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 13), a
-	ld	a, (iy + 14)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	ld	b, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	ld	c, b
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -19), a
+	ld	c, (ix + -10)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 14), a
-	ld	a, (iy + 15)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	c, 4
-	call	ti._ishru
-	and	a, 15
-	ld	e, a
-	call	ti._ishl
-	push	hl
-	pop	bc
+	ld	(ix + -18), a
+	ld	c, (ix + -13)
 	ld	hl, _aes_invsbox
 	add	hl, bc
-	add	hl, de
 	ld	a, (hl)
-	ld	(iy + 15), a
-	pop	ix
-	ret
-	
-_aes_ShiftRows:
-	call	ti._frameset0
-	ld	iy, (ix + 6)
-	ld	a, (iy + 4)
-	ld	l, (iy + 5)
-	ld	(iy + 4), l
-	ld	l, (iy + 6)
-	ld	(iy + 5), l
-	ld	l, (iy + 7)
-	ld	(iy + 6), l
-	ld	(iy + 7), a
-	ld	a, (iy + 8)
-	ld	l, (iy + 10)
-	ld	(iy + 8), l
-	ld	(iy + 10), a
-	ld	a, (iy + 9)
-	ld	l, (iy + 11)
-	ld	(iy + 9), l
-	ld	(iy + 11), a
-	ld	a, (iy + 12)
-	ld	l, (iy + 15)
-	ld	(iy + 12), l
-	ld	l, (iy + 14)
-	ld	(iy + 15), l
-	ld	l, (iy + 13)
-	ld	(iy + 14), l
-	ld	(iy + 13), a
-	pop	ix
-	ret
-	
-_aes_InvShiftRows:
-	call	ti._frameset0
-	ld	iy, (ix + 6)
-	ld	a, (iy + 7)
-	ld	l, (iy + 6)
-	ld	(iy + 7), l
-	ld	l, (iy + 5)
-	ld	(iy + 6), l
-	ld	l, (iy + 4)
-	ld	(iy + 5), l
-	ld	(iy + 4), a
-	ld	a, (iy + 11)
-	ld	l, (iy + 9)
-	ld	(iy + 11), l
-	ld	(iy + 9), a
-	ld	a, (iy + 10)
-	ld	l, (iy + 8)
-	ld	(iy + 10), l
-	ld	(iy + 8), a
-	ld	a, (iy + 15)
-	ld	l, (iy + 12)
-	ld	(iy + 15), l
-	ld	l, (iy + 13)
-	ld	(iy + 12), l
-	ld	l, (iy + 14)
-	ld	(iy + 13), l
-	ld	(iy + 14), a
-	pop	ix
+	ld	(ix + -17), a
 	ret
-
-_aes_MixColumns:
-	ld	hl, -13
+_increment_iv:
+	ld	hl, -9
 	call	ti._frameset
-	ld	iy, (ix + 6)
-	ld	e, (iy)
-	ld	(ix + -2), e
-	ld	a, (iy + 4)
-	ld	(ix + -1), a
-	ld	l, (iy + 8)
-	ld	(ix + -3), l
-	ld	l, (iy + 12)
-	ld	(ix + -6), l
+	ld	de, (ix + 9)
+	ld	hl, 16
+	ld	iy, 1
+	ld	bc, 0
 	or	a, a
-	sbc	hl, hl
-	ld	l, e
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	iy, _gf_mul
+	sbc	hl, de
+	ld	(ix + -3), hl
 	lea	hl, iy + 0
-	add	hl, de
-	ld	(ix + -9), hl
-	ld	l, (hl)
-	ld	(ix + -13), l
 	or	a, a
-	sbc	hl, hl
-	ld	l, a
-	call	ti._imulu
-	push	hl
-	pop	de
-	add	iy, de
-	ld	bc, 0
-	push	bc
-	pop	hl
-	ld	e, (ix + -3)
-	ld	l, e
-	ld	a, (ix + -6)
-	ld	c, a
-	ld	(ix + -12), bc
-	xor	a, e
-	xor	a, (ix + -13)
-	xor	a, (iy + 1)
-	lea	de, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy), a
-	push	de
-	pop	iy
-	ld	a, (iy)
-	xor	a, (ix + -2)
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	xor	a, (ix + -6)
-	xor	a, (iy + 1)
-	lea	hl, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 4), a
-	ld	a, (ix + -1)
-	xor	a, (ix + -2)
-	ld	e, a
-	ld	a, (hl)
-	xor	a, e
-	ld	(ix + -2), a
-	ld	hl, (ix + -12)
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	ld	a, (iy + 1)
-	lea	hl, iy + 0
-	xor	a, (ix + -2)
-	ld	iy, (ix + 6)
-	ld	(iy + 8), a
-	ld	a, (ix + -3)
-	xor	a, (ix + -1)
-	ld	iy, (ix + -9)
-	xor	a, (iy + 1)
-	xor	a, (hl)
+	sbc	hl, de
+	ld	(ix + -6), hl
 	ld	iy, (ix + 6)
-	ld	(iy + 12), a
-	ld	e, (iy + 1)
-	ld	(ix + -2), e
-	ld	a, (iy + 5)
-	ld	(ix + -1), a
-	ld	l, (iy + 9)
-	ld	(ix + -3), l
-	ld	l, (iy + 13)
-	ld	(ix + -6), l
-	ld	iy, 0
-	lea	hl, iy + 0
-	ld	l, e
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	add	hl, de
+	lea	hl, iy + 15
 	ld	(ix + -9), hl
-	ld	l, (hl)
-	ld	(ix + -13), l
-	lea	hl, iy + 0
-	ld	l, a
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	add	hl, de
-	push	hl
-	pop	iy
-	ld	bc, 0
+.loop:
 	push	bc
 	pop	hl
-	ld	e, (ix + -3)
-	ld	l, e
-	ld	a, (ix + -6)
-	ld	c, a
-	ld	(ix + -12), bc
-	xor	a, e
-	xor	a, (ix + -13)
-	xor	a, (iy + 1)
-	lea	de, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 1), a
-	push	de
-	pop	iy
+	ld	de, 15
+	add	hl, de
+	ld	de, (ix + -3)
+	or	a, a
+	sbc	hl, de
+	jq	c, .exit_loop
+	ld	iy, (ix + -9)
+	add	iy, bc
+	inc	(iy)
+	ld	hl, (ix + -6)
+	or	a, a
+	sbc	hl, bc
+	jq	z, .exit_loop
 	ld	a, (iy)
-	xor	a, (ix + -2)
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	xor	a, (ix + -6)
+	dec	bc
+	or	a, a
+	jq	z, .loop
+.exit_loop:
+	ld	sp, ix
+	pop	ix
+	ret
+	
+	
+aes_ecb_unsafe_encrypt:
+	save_interrupts
+
+	ld	hl, -32
+	call	ti._frameset
+	ld	iy, (ix + 12)
+	lea	iy, iy + 3
+	ld	hl, (ix + 6)
+	ld	a, (hl)
+	xor	a, (iy + 3)
+	ld	(ix + -16), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 2)
+	ld	(ix + -15), a
+	inc	hl
+	ld	a, (hl)
 	xor	a, (iy + 1)
-	lea	hl, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 5), a
-	ld	a, (ix + -1)
-	xor	a, (ix + -2)
-	ld	e, a
+	ld	(ix + -14), a
+	inc	hl
 	ld	a, (hl)
-	xor	a, e
+	xor	a, (iy + 0)
+	ld	(ix + -13), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 7)
+	ld	(ix + -12), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 6)
+	ld	(ix + -11), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 5)
+	ld	(ix + -10), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 4)
+	ld	(ix + -9), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 11)
+	ld	(ix + -8), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 10)
+	ld	(ix + -7), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 9)
+	ld	(ix + -6), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 8)
+	ld	(ix + -5), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 15)
+	ld	(ix + -4), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 14)
+	ld	(ix + -3), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 13)
 	ld	(ix + -2), a
-	ld	hl, (ix + -12)
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	ld	a, (iy + 1)
-	lea	hl, iy + 0
-	xor	a, (ix + -2)
-	ld	iy, (ix + 6)
-	ld	(iy + 9), a
-	ld	a, (ix + -3)
-	xor	a, (ix + -1)
-	ld	iy, (ix + -9)
-	xor	a, (iy + 1)
-	xor	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 13), a
-	ld	e, (iy + 2)
-	ld	(ix + -2), e
-	ld	a, (iy + 6)
-	ld	(ix + -1), a
-	ld	l, (iy + 10)
-	ld	(ix + -3), l
-	ld	l, (iy + 14)
-	ld	(ix + -6), l
-	ld	iy, 0
-	lea	hl, iy + 0
-	ld	l, e
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	add	hl, de
-	ld	(ix + -9), hl
-	ld	l, (hl)
-	ld	(ix + -13), l
-	lea	hl, iy + 0
-	ld	l, a
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	add	hl, de
-	push	hl
-	pop	iy
-	ld	bc, 0
-	push	bc
-	pop	hl
-	ld	e, (ix + -3)
-	ld	l, e
-	ld	a, (ix + -6)
-	ld	c, a
-	ld	(ix + -12), bc
-	xor	a, e
-	xor	a, (ix + -13)
-	xor	a, (iy + 1)
-	lea	de, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 2), a
-	push	de
-	pop	iy
-	ld	a, (iy)
-	xor	a, (ix + -2)
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	xor	a, (ix + -6)
-	xor	a, (iy + 1)
-	lea	hl, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 6), a
-	ld	a, (ix + -1)
-	xor	a, (ix + -2)
-	ld	e, a
-	ld	a, (hl)
-	xor	a, e
-	ld	(ix + -2), a
-	ld	hl, (ix + -12)
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	ld	a, (iy + 1)
-	lea	hl, iy + 0
-	xor	a, (ix + -2)
-	ld	iy, (ix + 6)
-	ld	(iy + 10), a
-	ld	a, (ix + -3)
-	xor	a, (ix + -1)
-	ld	iy, (ix + -9)
-	xor	a, (iy + 1)
-	xor	a, (hl)
-	ld	iy, (ix + 6)
-	ld	(iy + 14), a
-	ld	e, (iy + 3)
-	ld	(ix + -1), e
-	ld	a, (iy + 7)
-	ld	(ix + -9), a
-	ld	l, (iy + 11)
-	ld	(ix + -2), l
-	ld	l, (iy + 15)
-	ld	(ix + -3), l
-	ld	iy, 0
-	lea	hl, iy + 0
-	ld	l, e
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	add	hl, de
-	ld	(ix + -6), hl
-	ld	l, (hl)
-	ld	(ix + -13), l
-	lea	hl, iy + 0
-	ld	l, a
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	add	hl, de
-	push	hl
-	pop	iy
-	ld	de, 0
-	push	de
-	pop	bc
-	ld	l, (ix + -2)
-	ld	c, l
-	ld	a, (ix + -3)
-	ld	e, a
-	ld	(ix + -12), de
-	xor	a, l
-	xor	a, (ix + -13)
-	xor	a, (iy + 1)
-	lea	hl, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 3), a
-	ld	a, (hl)
-	xor	a, (ix + -1)
-	push	bc
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, de
-	xor	a, (ix + -3)
-	xor	a, (iy + 1)
-	lea	bc, iy + 0
-	ld	iy, (ix + 6)
-	ld	(iy + 7), a
-	ld	d, (ix + -9)
-	ld	a, d
-	xor	a, (ix + -1)
-	ld	e, a
-	push	bc
-	pop	hl
+	inc	hl
 	ld	a, (hl)
-	xor	a, e
-	ld	e, a
-	ld	hl, (ix + -12)
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	a, (iy + 1)
-	lea	hl, iy + 0
-	xor	a, e
-	ld	iy, (ix + 6)
-	ld	(iy + 11), a
-	lea	bc, iy + 0
-	ld	a, (ix + -2)
-	xor	a, d
-	ld	iy, (ix + -6)
+	xor	a, (iy + 12)
+	ld	(ix + -1), a
+; every round but the last, run by the kernel for this key size
+	ld	hl, (ix + 12)
+	ld	hl, (hl)
+	ld	de, _aes_encrypt_kernels
+	call	_aes_kernel
+	call	_aes_SubShiftRows
+	lea	iy, iy + 16
+	ld	hl, (ix + 9)
+	ld	a, (ix + -32)
+	xor	a, (iy + 3)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -31)
+	xor	a, (iy + 2)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -30)
 	xor	a, (iy + 1)
-	xor	a, (hl)
-	push	bc
-	pop	iy
-	ld	(iy + 15), a
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -29)
+	xor	a, (iy + 0)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -28)
+	xor	a, (iy + 7)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -27)
+	xor	a, (iy + 6)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -26)
+	xor	a, (iy + 5)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -25)
+	xor	a, (iy + 4)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -24)
+	xor	a, (iy + 11)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -23)
+	xor	a, (iy + 10)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -22)
+	xor	a, (iy + 9)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -21)
+	xor	a, (iy + 8)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -20)
+	xor	a, (iy + 15)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -19)
+	xor	a, (iy + 14)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -18)
+	xor	a, (iy + 13)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -17)
+	xor	a, (iy + 12)
+	ld	(hl), a
 	ld	sp, ix
 	pop	ix
+
+	restore_interrupts aes_ecb_unsafe_encrypt
 	ret
 	
-_aes_InvMixColumns:
-	ld	hl, -11
+aes_ecb_unsafe_decrypt:
+	save_interrupts
+
+	ld	hl, -32
 	call	ti._frameset
-	ld	iy, (ix + 6)
-	ld	l, (iy)
-	ld	a, (iy + 4)
-	ld	e, (iy + 8)
-	ld	(ix + -9), e
-	ld	e, (iy + 12)
-	ld	(ix + -10), e
-	ld	de, 0
-	ld	e, l
-	ld	bc, 6
-	push	de
-	pop	hl
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -3), iy
-	ld	l, (iy + 5)
-	ld	(ix + -11), l
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -6), iy
-	ld	a, (iy + 3)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -9)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -9), iy
-	ld	a, (iy + 4)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -10)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, bc
-	ld	a, (iy + 2)
-	lea	bc, iy + 0
-	xor	a, (ix + -11)
+	ld	iy, (ix + 12)
+	ld	hl, (iy)
+; start from the last round key and walk back down the schedule, (keysize / 32) + 6 rounds on
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	ld	bc, 0
+	ld	b, h
+	ld	c, 16
+	mlt	bc
+	ld	hl, 6 * 16 + 3
+	add	hl, bc
+	ex	de, hl
+	add	iy, de
 	ld	hl, (ix + 6)
-	ld	(hl), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 5)
-	ld	iy, (ix + -3)
+	ld	a, (hl)
+	xor	a, (iy + 3)
+	ld	(ix + -16), a
+	inc	hl
+	ld	a, (hl)
 	xor	a, (iy + 2)
-	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 3)
-	xor	a, l
-	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 4)
-	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 4), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 2)
-	ld	iy, (ix + -3)
+	ld	(ix + -15), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 1)
+	ld	(ix + -14), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 0)
+	ld	(ix + -13), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 7)
+	ld	(ix + -12), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 6)
+	ld	(ix + -11), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 5)
+	ld	(ix + -10), a
+	inc	hl
+	ld	a, (hl)
 	xor	a, (iy + 4)
-	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 5)
-	xor	a, l
-	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 3)
-	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 8), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 4)
-	ld	iy, (ix + -3)
+	ld	(ix + -9), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 11)
+	ld	(ix + -8), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 10)
+	ld	(ix + -7), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 9)
+	ld	(ix + -6), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 8)
+	ld	(ix + -5), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 15)
+	ld	(ix + -4), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 14)
+	ld	(ix + -3), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 13)
+	ld	(ix + -2), a
+	inc	hl
+	ld	a, (hl)
+	xor	a, (iy + 12)
+	ld	(ix + -1), a
+	ld	hl, (ix + 12)
+	ld	hl, (hl)
+	ld	de, _aes_decrypt_kernels
+	call	_aes_kernel
+	call	_aes_InvSubShiftRows
+	lea	iy, iy + -16
+	ld	hl, (ix + 9)
+	ld	a, (ix + -32)
 	xor	a, (iy + 3)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -31)
+	xor	a, (iy + 2)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -30)
+	xor	a, (iy + 1)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -29)
+	xor	a, (iy + 0)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -28)
+	xor	a, (iy + 7)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -27)
+	xor	a, (iy + 6)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -26)
+	xor	a, (iy + 5)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -25)
+	xor	a, (iy + 4)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -24)
+	xor	a, (iy + 11)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -23)
+	xor	a, (iy + 10)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -22)
+	xor	a, (iy + 9)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -21)
+	xor	a, (iy + 8)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -20)
+	xor	a, (iy + 15)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -19)
+	xor	a, (iy + 14)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -18)
+	xor	a, (iy + 13)
+	ld	(hl), a
+	inc	hl
+	ld	a, (ix + -17)
+	xor	a, (iy + 12)
+	ld	(hl), a
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts aes_ecb_unsafe_decrypt
+	ret
+	
+; aes_init only accepts 128, 192 and 256 bit keys, so keysize / 64 - 2 picks one of three kernels
+; hl = keysize, de = kernel table
+_aes_kernel:
+	add	hl, hl
+	add	hl, hl
+	ld	a, h
+	sub	a, 2
+	ld	bc, 0
+	ld	c, a
+	ex	de, hl
+	add	hl, bc
+	add	hl, bc
+	add	hl, bc
+	ld	hl, (hl)
+	jp	(hl)
+
+_aes_encrypt_kernels:
+	dl	_aes_encrypt_128
+	dl	_aes_encrypt_192
+	dl	_aes_encrypt_256
+
+_aes_decrypt_kernels:
+	dl	_aes_decrypt_128
+	dl	_aes_decrypt_192
+	dl	_aes_decrypt_256
+
+; one round with MixColumns, from the state at ix-16 back to it, iy = the last round key used
+macro _aes_encrypt_round?
+	ld	bc, 0
+	ld	c, (ix + -16)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -32), a
+	ld	c, (ix + -11)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -31), a
+	ld	c, (ix + -6)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -30), a
+	ld	c, (ix + -1)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -29), a
+	ld	c, (ix + -12)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -28), a
+	ld	c, (ix + -7)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -27), a
+	ld	c, (ix + -2)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -26), a
+	ld	c, (ix + -13)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -25), a
+	ld	c, (ix + -8)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -24), a
+	ld	c, (ix + -3)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -23), a
+	ld	c, (ix + -14)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -22), a
+	ld	c, (ix + -9)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -21), a
+	ld	c, (ix + -4)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -20), a
+	ld	c, (ix + -15)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -19), a
+	ld	c, (ix + -10)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -18), a
+	ld	c, (ix + -5)
+	ld	hl, _aes_sbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -17), a
+	lea	iy, iy + 16
+	ld	b, (ix + -32)
+	ld	c, (ix + -31)
+	ld	d, (ix + -30)
+	ld	e, (ix + -29)
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 2)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, b
+	xor	a, (iy + 3)
+	ld	(ix + -16), a
+	ld	a, c
+	xor	a, d
+	add	a, a
 	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 5)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 12), a
-	ld	l, (iy + 1)
-	ld	a, (iy + 5)
-	ld	c, (iy + 9)
-	ld	(ix + -9), c
-	ld	c, (iy + 13)
-	ld	(ix + -10), c
-	ld	e, l
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -3), iy
-	ld	l, (iy + 5)
-	ld	(ix + -11), l
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -6), iy
-	ld	a, (iy + 3)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -9)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -9), iy
-	ld	a, (iy + 4)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -10)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, bc
-	ld	a, (iy + 2)
-	lea	bc, iy + 0
-	xor	a, (ix + -11)
-	ld	iy, (ix + 6)
-	ld	(iy + 1), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 5)
-	ld	iy, (ix + -3)
+	xor	a, h
+	xor	a, c
 	xor	a, (iy + 2)
+	ld	(ix + -15), a
+	ld	a, d
+	xor	a, e
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 3)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, d
+	xor	a, (iy + 1)
+	ld	(ix + -14), a
+	ld	a, e
+	xor	a, b
+	add	a, a
 	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 4)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 5), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 2)
-	ld	iy, (ix + -3)
-	xor	a, (iy + 4)
-	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 5)
-	xor	a, l
-	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 3)
-	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 9), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 4)
-	ld	iy, (ix + -3)
-	xor	a, (iy + 3)
+	xor	a, h
+	xor	a, e
+	xor	a, (iy + 0)
+	ld	(ix + -13), a
+	ld	b, (ix + -28)
+	ld	c, (ix + -27)
+	ld	d, (ix + -26)
+	ld	e, (ix + -25)
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 2)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, b
+	xor	a, (iy + 7)
+	ld	(ix + -12), a
+	ld	a, c
+	xor	a, d
+	add	a, a
 	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 5)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 13), a
-	ld	l, (iy + 2)
-	ld	a, (iy + 6)
-	ld	c, (iy + 10)
-	ld	(ix + -9), c
-	ld	c, (iy + 14)
-	ld	(ix + -10), c
-	ld	e, l
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -3), iy
-	ld	l, (iy + 5)
-	ld	(ix + -11), l
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -6), iy
-	ld	a, (iy + 3)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -9)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -9), iy
-	ld	a, (iy + 4)
-	xor	a, (ix + -11)
+	xor	a, h
+	xor	a, c
+	xor	a, (iy + 6)
 	ld	(ix + -11), a
-	ld	a, (ix + -10)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	hl, _gf_mul
-	push	hl
-	pop	iy
-	add	iy, bc
-	ld	a, (iy + 2)
-	lea	bc, iy + 0
-	xor	a, (ix + -11)
-	ld	iy, (ix + 6)
-	ld	(iy + 2), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 5)
-	ld	iy, (ix + -3)
-	xor	a, (iy + 2)
+	ld	a, d
+	xor	a, e
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 3)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, d
+	xor	a, (iy + 5)
+	ld	(ix + -10), a
+	ld	a, e
+	xor	a, b
+	add	a, a
 	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 4)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 6), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 2)
-	ld	iy, (ix + -3)
+	xor	a, h
+	xor	a, e
 	xor	a, (iy + 4)
+	ld	(ix + -9), a
+	ld	b, (ix + -24)
+	ld	c, (ix + -23)
+	ld	d, (ix + -22)
+	ld	e, (ix + -21)
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 5)
-	xor	a, l
-	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 3)
-	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 10), a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 4)
-	ld	iy, (ix + -3)
-	xor	a, (iy + 3)
-	ld	l, a
-	ld	iy, (ix + -9)
-	ld	a, (iy + 2)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, b
+	xor	a, (iy + 11)
+	ld	(ix + -8), a
+	ld	a, c
+	xor	a, d
+	add	a, a
 	ld	l, a
-	push	bc
-	pop	iy
-	ld	a, (iy + 5)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 14), a
-	ld	l, (iy + 3)
-	ld	a, (iy + 7)
-	ld	c, (iy + 11)
-	ld	(ix + -6), c
-	ld	c, (iy + 15)
-	ld	(ix + -10), c
-	ld	e, l
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -9), iy
-	ld	l, (iy + 5)
-	ld	(ix + -11), l
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -3), iy
-	ld	a, (iy + 3)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -6)
-	ld	e, a
-	push	de
-	pop	hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	bc
-	ld	iy, _gf_mul
-	add	iy, bc
-	ld	(ix + -6), iy
-	ld	a, (iy + 4)
-	xor	a, (ix + -11)
-	ld	(ix + -11), a
-	ld	a, (ix + -10)
-	ld	e, a
-	ex	de, hl
-	ld	bc, 6
-	call	ti._imulu
-	push	hl
-	pop	de
-	ld	iy, _gf_mul
-	add	iy, de
-	ld	a, (iy + 2)
-	lea	de, iy + 0
-	xor	a, (ix + -11)
-	ld	iy, (ix + 6)
-	ld	(iy + 3), a
-	ld	iy, (ix + -3)
-	ld	a, (iy + 5)
-	ld	iy, (ix + -9)
-	xor	a, (iy + 2)
-	lea	bc, iy + 0
+	xor	a, h
+	xor	a, c
+	xor	a, (iy + 10)
+	ld	(ix + -7), a
+	ld	a, d
+	xor	a, e
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 3)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, d
+	xor	a, (iy + 9)
+	ld	(ix + -6), a
+	ld	a, e
+	xor	a, b
+	add	a, a
 	ld	l, a
-	push	de
-	pop	iy
-	ld	a, (iy + 4)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	hl, (ix + 6)
-	push	hl
-	pop	iy
-	ld	(iy + 7), a
-	ld	iy, (ix + -3)
-	ld	a, (iy + 2)
-	push	bc
-	pop	iy
-	xor	a, (iy + 4)
+	xor	a, h
+	xor	a, e
+	xor	a, (iy + 8)
+	ld	(ix + -5), a
+	ld	b, (ix + -20)
+	ld	c, (ix + -19)
+	ld	d, (ix + -18)
+	ld	e, (ix + -17)
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 5)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, b
+	xor	a, (iy + 15)
+	ld	(ix + -4), a
+	ld	a, c
+	xor	a, d
+	add	a, a
 	ld	l, a
-	push	de
-	pop	iy
-	ld	a, (iy + 3)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 11), a
-	ld	iy, (ix + -3)
-	ld	a, (iy + 4)
-	push	bc
-	pop	iy
-	xor	a, (iy + 3)
+	xor	a, h
+	xor	a, c
+	xor	a, (iy + 14)
+	ld	(ix + -3), a
+	ld	a, d
+	xor	a, e
+	add	a, a
 	ld	l, a
-	ld	iy, (ix + -6)
-	ld	a, (iy + 2)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
+	xor	a, h
+	xor	a, d
+	xor	a, (iy + 13)
+	ld	(ix + -2), a
+	ld	a, e
+	xor	a, b
+	add	a, a
 	ld	l, a
-	push	de
-	pop	iy
-	ld	a, (iy + 5)
+	sbc	a, a
+	and	a, $1B
 	xor	a, l
-	ld	iy, (ix + 6)
-	ld	(iy + 15), a
-	ld	sp, ix
-	pop	ix
-	ret
-	
-_increment_iv:
-	ld	hl, -9
-	call	ti._frameset
-	ld	de, (ix + 9)
-	ld	hl, 16
-	ld	iy, 1
-	ld	bc, 0
-	or	a, a
-	sbc	hl, de
-	ld	(ix + -3), hl
-	lea	hl, iy + 0
-	or	a, a
-	sbc	hl, de
-	ld	(ix + -6), hl
-	ld	iy, (ix + 6)
-	lea	hl, iy + 15
-	ld	(ix + -9), hl
-.loop:
-	push	bc
-	pop	hl
-	ld	de, 15
-	add	hl, de
-	ld	de, (ix + -3)
-	or	a, a
-	sbc	hl, de
-	jq	c, .exit_loop
-	ld	iy, (ix + -9)
-	add	iy, bc
-	inc	(iy)
-	ld	hl, (ix + -6)
-	or	a, a
-	sbc	hl, bc
-	jq	z, .exit_loop
-	ld	a, (iy)
-	dec	bc
-	or	a, a
-	jq	z, .loop
-.exit_loop:
-	ld	sp, ix
-	pop	ix
-	ret
-	
-	
-aes_ecb_unsafe_encrypt:
-	save_interrupts
+	xor	a, h
+	xor	a, e
+	xor	a, (iy + 12)
+	ld	(ix + -1), a
+end macro
 
-	ld	hl, -22
-	call	ti._frameset
-	ld	iy, (ix + 6)
-	lea	de, ix + -16
-	ld	(ix + -19), de
-	ld	hl, (ix + 12)
-	ld	hl, (hl)
-	ld	(ix + -22), hl
-	ld	a, (iy)
+macro _aes_decrypt_round?
+	ld	bc, 0
+	ld	c, (ix + -16)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -32), a
+	ld	c, (ix + -3)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -31), a
+	ld	c, (ix + -6)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -30), a
+	ld	c, (ix + -9)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -29), a
+	ld	c, (ix + -12)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -28), a
+	ld	c, (ix + -15)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -27), a
+	ld	c, (ix + -2)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -26), a
+	ld	c, (ix + -5)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -25), a
+	ld	c, (ix + -8)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -24), a
+	ld	c, (ix + -11)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -23), a
+	ld	c, (ix + -14)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -22), a
+	ld	c, (ix + -1)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -21), a
+	ld	c, (ix + -4)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -20), a
+	ld	c, (ix + -7)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -19), a
+	ld	c, (ix + -10)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -18), a
+	ld	c, (ix + -13)
+	ld	hl, _aes_invsbox
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + -17), a
+	lea	iy, iy + -16
+	ld	a, (ix + -32)
+	xor	a, (iy + 3)
+	ld	b, a
+	ld	a, (ix + -31)
+	xor	a, (iy + 2)
+	ld	c, a
+	ld	a, (ix + -30)
+	xor	a, (iy + 1)
+	ld	d, a
+	ld	a, (ix + -29)
+	xor	a, (iy + 0)
+	ld	e, a
+	ld	a, b
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, b
+	ld	b, a
+	ld	a, h
+	xor	a, d
+	ld	d, a
+	ld	a, c
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, c
+	ld	c, a
+	ld	a, h
+	xor	a, e
+	ld	e, a
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, b
 	ld	(ix + -16), a
-	ld	a, (iy + 1)
-	ld	(ix + -12), a
-	ld	a, (iy + 2)
-	ld	(ix + -8), a
-	ld	a, (iy + 3)
-	ld	(ix + -4), a
-	ld	a, (iy + 4)
+	ld	a, c
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, c
 	ld	(ix + -15), a
-	ld	a, (iy + 5)
-	ld	(ix + -11), a
-	ld	a, (iy + 6)
-	ld	(ix + -7), a
-	ld	a, (iy + 7)
-	ld	(ix + -3), a
-	ld	a, (iy + 8)
+	ld	a, d
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, d
 	ld	(ix + -14), a
-	ld	a, (iy + 9)
-	ld	(ix + -10), a
-	ld	a, (iy + 10)
-	ld	(ix + -6), a
-	ld	a, (iy + 11)
-	ld	(ix + -2), a
-	ld	a, (iy + 12)
+	ld	a, e
+	xor	a, b
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, e
 	ld	(ix + -13), a
-	ld	a, (iy + 13)
-	ld	(ix + -9), a
-	ld	a, (iy + 14)
-	ld	(ix + -5), a
-	ld	a, (iy + 15)
-	ld	(ix + -1), a
-	ld	iy, (ix + 12)
-	pea	iy + 3
-	push	de
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
-	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
+	ld	a, (ix + -28)
+	xor	a, (iy + 7)
+	ld	b, a
+	ld	a, (ix + -27)
+	xor	a, (iy + 6)
+	ld	c, a
+	ld	a, (ix + -26)
+	xor	a, (iy + 5)
+	ld	d, a
+	ld	a, (ix + -25)
+	xor	a, (iy + 4)
+	ld	e, a
+	ld	a, b
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, b
+	ld	b, a
+	ld	a, h
+	xor	a, d
+	ld	d, a
+	ld	a, c
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, c
+	ld	c, a
+	ld	a, h
+	xor	a, e
+	ld	e, a
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, b
+	ld	(ix + -12), a
+	ld	a, c
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, c
+	ld	(ix + -11), a
+	ld	a, d
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, d
+	ld	(ix + -10), a
+	ld	a, e
+	xor	a, b
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, e
 	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_MixColumns
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 19
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
-	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
+	ld	a, (ix + -24)
+	xor	a, (iy + 11)
+	ld	b, a
+	ld	a, (ix + -23)
+	xor	a, (iy + 10)
+	ld	c, a
+	ld	a, (ix + -22)
+	xor	a, (iy + 9)
+	ld	d, a
+	ld	a, (ix + -21)
+	xor	a, (iy + 8)
+	ld	e, a
+	ld	a, b
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, b
+	ld	b, a
+	ld	a, h
+	xor	a, d
+	ld	d, a
+	ld	a, c
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, c
+	ld	c, a
+	ld	a, h
+	xor	a, e
+	ld	e, a
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, b
+	ld	(ix + -8), a
+	ld	a, c
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, c
+	ld	(ix + -7), a
+	ld	a, d
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, d
 	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
+	ld	a, e
+	xor	a, b
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, e
 	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
+	ld	a, (ix + -20)
+	xor	a, (iy + 15)
+	ld	b, a
+	ld	a, (ix + -19)
+	xor	a, (iy + 14)
+	ld	c, a
+	ld	a, (ix + -18)
+	xor	a, (iy + 13)
+	ld	d, a
+	ld	a, (ix + -17)
+	xor	a, (iy + 12)
+	ld	e, a
+	ld	a, b
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, b
+	ld	b, a
+	ld	a, h
+	xor	a, d
+	ld	d, a
+	ld	a, c
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	ld	h, a
+	xor	a, c
+	ld	c, a
+	ld	a, h
+	xor	a, e
+	ld	e, a
+	ld	a, b
+	xor	a, c
+	xor	a, d
+	xor	a, e
+	ld	h, a
+	ld	a, b
+	xor	a, c
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, b
+	ld	(ix + -4), a
+	ld	a, c
+	xor	a, d
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, c
 	ld	(ix + -3), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_MixColumns
+	ld	a, d
+	xor	a, e
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, d
+	ld	(ix + -2), a
+	ld	a, e
+	xor	a, b
+	add	a, a
+	ld	l, a
+	sbc	a, a
+	and	a, $1B
+	xor	a, l
+	xor	a, h
+	xor	a, e
+	ld	(ix + -1), a
+end macro
+
+; all rounds but the last, two to a call and no round counter
+; each key size enters the chain far enough up to run its own number of rounds
+_aes_encrypt_256:
+	call	_aes_encrypt_round2
+_aes_encrypt_192:
+	call	_aes_encrypt_round2
+_aes_encrypt_128:
+	call	_aes_encrypt_round1
+	call	_aes_encrypt_round2
+	call	_aes_encrypt_round2
+	call	_aes_encrypt_round2
+_aes_encrypt_round2:
+	_aes_encrypt_round
+_aes_encrypt_round1:
+	_aes_encrypt_round
+	ret
+
+_aes_decrypt_256:
+	call	_aes_decrypt_round2
+_aes_decrypt_192:
+	call	_aes_decrypt_round2
+_aes_decrypt_128:
+	call	_aes_decrypt_round1
+	call	_aes_decrypt_round2
+	call	_aes_decrypt_round2
+	call	_aes_decrypt_round2
+_aes_decrypt_round2:
+	_aes_decrypt_round
+_aes_decrypt_round1:
+	_aes_decrypt_round
+	ret
+
+aes_encrypt:
+	call	_scratch_enter
+	save_interrupts
+
+	ld	hl, -95
+	call	ti._frameset
+	ld	de, (ix + 6)
+	ld	bc, 1
+	push	de
 	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_1
+	jq	.lbl_21
+.lbl_1:
 	ld	iy, (ix + 12)
-	pea	iy + 35
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
+	lea	hl, iy + 0
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_2
+	jq	.lbl_21
+.lbl_2:
+	ld	hl, (ix + 15)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_3
+	jq	.lbl_21
+.lbl_3:
+	ld	hl, (ix + 18)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_21
+	ld	bc, (ix + 9)
+	push	bc
 	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_6
+	ld	bc, 2
+.lbl_21:
+	push	bc
+	restore_interrupts_noret aes_encrypt
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
+	jp stack_clear
+.lbl_6:
+	ld	l, (ix + 21)
+	ld	a, l
+	or	a, a
+	jq	nz, .lbl_7
+	ld	a, (ix + 24)
+	cp	a, 2
+	jq	c, .lbl_11
+	ld	bc, 4
+	jq	.lbl_21
+.lbl_7:
+	ld	a, l
+	cp	a, 1
+	jq	nz, .lbl_8
+	lea	hl, ix + -64
+	ld	(ix + -86), hl
+	push	de
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	lea	bc, iy + 0
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_16
+	ld	hl, (ix + 9)
 	push	hl
-	call	_aes_MixColumns
+	push	de
+	push	iy
+	call	ti._memcpy
 	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 51
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
+.lbl_16:
+	lea	hl, ix + -80
+	ld	(ix + -83), hl
+	ld	hl, 16
 	push	hl
-	call	_aes_SubBytes
-	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 18)
 	push	hl
-	call	_aes_MixColumns
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 67
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -86)
 	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
+	call	ti._memcpy
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_MixColumns
 	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 83
-	ld	hl, (ix + -19)
+if defined HASHLIB_AES_BITSLICE
+	ld	hl, (ix + 9)
 	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 12)
 	push	hl
-	call	_aes_SubBytes
-	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -86)
 	push	hl
-	call	_aes_MixColumns
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 99
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 15)
 	push	hl
-	call	_aes_AddRoundKey
+	call	_aes_ctr_bs
+	pop	hl, hl, hl, hl
+	ld	bc, 0
+	jq	.lbl_21
+end if
+	ld	hl, (ix + 9)
+	push	hl
+	pop	iy
+	ld	de, -16
+	add	iy, de
+	ld	de, 17
+	or	a, a
+	sbc	hl, de
+	ld	hl, 0
+	push	hl
+	pop	bc
+	ld	de, (ix + 15)
+	jq	c, .lbl_20
+	lea	bc, iy + 0
+	push	hl
+	pop	iy
+.lbl_18:
+	lea	hl, iy + 0
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .lbl_22
+	push	de
+	ld	hl, (ix + -83)
+	push	hl
+	ld	hl, (ix + -86)
+	push	hl
+	ld	(ix + -89), iy
+	ld	(ix + -92), bc
+	call	aes_ecb_unsafe_encrypt
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	ld	de, (ix + -89)
+	ld	hl, (ix + 12)
+	add	hl, de
+	ld	de, 16
+	push	de
 	push	hl
-	call	_aes_MixColumns
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 115
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -83)
 	push	hl
-	call	_aes_AddRoundKey
+	call	_xor_buf
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	ld	hl, 16
+	push	hl
+	ld	hl, (ix + -86)
 	push	hl
-	call	_aes_MixColumns
+	call	_increment_iv
+	ld	bc, (ix + -92)
+	ld	iy, (ix + -89)
 	pop	hl
-	ld	de, 131
-	ld	iy, (ix + 12)
+	pop	hl
+	ld	de, 16
 	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	de, (ix + 15)
+	jq	.lbl_18
+.lbl_11:
+	lea	hl, ix + -16
+	ld	(ix + -83), hl
+	lea	hl, ix + -32
+	ld	(ix + -86), hl
+	lea	hl, ix + -48
+	ld	(ix + -89), hl
+	ld	l, a
 	push	hl
-	call	_aes_AddRoundKey
+	push	iy
+	push	bc
+	push	de
+	call	hashlib_AESPadMessage
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_MixColumns
 	pop	hl
-	ld	de, 147
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	c, 4
+	ld	hl, (ix + 9)
+	call	ti._ishru
+	ld	(ix + -92), hl
+	ld	hl, 16
+	push	hl
+	ld	hl, (ix + 18)
 	push	hl
-	call	_aes_AddRoundKey
+	ld	hl, (ix + -89)
+	push	hl
+	call	ti._memcpy
+	ld	de, (ix + -92)
+	ld	iy, (ix + 12)
+	ld	bc, 0
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	de, 128
-	ld	hl, (ix + -22)
-	or	a, a
-	sbc	hl, de
-	jq	nz, .lbl2
-	ld	de, 163
-	jq	.lbl4
-.lbl2:
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_MixColumns
+	inc	de
+.lbl_12:
+	push	de
 	pop	hl
-	ld	de, 163
-	ld	hl, (ix + 12)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_26
+	ld	hl, 16
 	push	hl
-	pop	iy
-	add	iy, de
 	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -83)
 	push	hl
-	call	_aes_AddRoundKey
+	ld	(ix + -95), iy
+	ld	(ix + -92), de
+	call	ti._memcpy
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	ld	hl, 16
 	push	hl
-	call	_aes_MixColumns
-	pop	hl
-	ld	de, 179
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -83)
+	push	hl
+	ld	hl, (ix + -89)
 	push	hl
-	call	_aes_AddRoundKey
+	call	_xor_buf
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	de, 192
-	ld	hl, (ix + -22)
-	or	a, a
-	sbc	hl, de
-	jq	nz, .lbl5
-	ld	de, 195
-.lbl4:
-	ld	iy, (ix + 12)
-	jq	.lbl6
-.lbl5:
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 15)
 	push	hl
-	call	_aes_MixColumns
-	pop	hl
-	ld	de, 195
-	ld	hl, (ix + 12)
+	ld	hl, (ix + -86)
 	push	hl
-	pop	iy
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -83)
 	push	hl
-	call	_aes_AddRoundKey
+	call	aes_ecb_unsafe_encrypt
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_SubBytes
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	hl, (ix + -19)
+	ld	hl, 16
+	push	hl
+	ld	hl, (ix + -86)
+	push	hl
+	ld	hl, (ix + -95)
 	push	hl
-	call	_aes_MixColumns
+	call	ti._memcpy
 	pop	hl
-	ld	de, 211
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	pop	hl
+	pop	hl
+	ld	hl, 16
+	push	hl
+	ld	hl, (ix + -86)
 	push	hl
-	call	_aes_AddRoundKey
+	ld	hl, (ix + -89)
+	push	hl
+	call	ti._memcpy
+	ld	de, (ix + -92)
+	ld	iy, (ix + -95)
+	ld	bc, 0
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
+	pop	hl
+	dec	de
+	lea	iy, iy + 16
+	jq	.lbl_12
+.lbl_8:
+	ld	bc, 3
+	jq	.lbl_21
+.lbl_26:
+	jq	.lbl_21
+.lbl_22:
+	lea	bc, iy + 0
+.lbl_20:
+	ld	(ix + -89), bc
+	push	de
+	ld	hl, (ix + -83)
 	push	hl
-	call	_aes_SubBytes
-	ld	iy, (ix + 12)
+	ld	hl, (ix + -86)
+	push	hl
+	call	aes_ecb_unsafe_encrypt
 	pop	hl
-	ld	a, (ix + -12)
-	ld	l, (ix + -11)
-	ld	(ix + -12), l
-	ld	l, (ix + -10)
-	ld	(ix + -11), l
-	ld	l, (ix + -9)
-	ld	(ix + -10), l
-	ld	(ix + -9), a
-	ld	a, (ix + -8)
-	ld	l, (ix + -6)
-	ld	(ix + -8), l
-	ld	(ix + -6), a
-	ld	a, (ix + -7)
-	ld	l, (ix + -5)
-	ld	(ix + -7), l
-	ld	(ix + -5), a
-	ld	a, (ix + -4)
-	ld	l, (ix + -1)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -2), l
-	ld	(ix + -3), a
-	ld	de, 227
-.lbl6:
+	pop	hl
+	pop	hl
+	ld	hl, (ix + 12)
+	push	hl
+	pop	iy
+	ld	de, (ix + -89)
 	add	iy, de
+	ld	hl, (ix + 9)
+	or	a, a
+	sbc	hl, de
+	push	hl
 	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -83)
 	push	hl
-	call	_aes_AddRoundKey
+	call	_xor_buf
 	pop	hl
 	pop	hl
-	ld	a, (ix + -16)
-	ld	iy, (ix + 9)
-	ld	(iy), a
-	ld	a, (ix + -12)
-	ld	(iy + 1), a
-	ld	a, (ix + -8)
-	ld	(iy + 2), a
-	ld	a, (ix + -4)
-	ld	(iy + 3), a
-	ld	a, (ix + -15)
-	ld	(iy + 4), a
-	ld	a, (ix + -11)
-	ld	(iy + 5), a
-	ld	a, (ix + -7)
-	ld	(iy + 6), a
-	ld	a, (ix + -3)
-	ld	(iy + 7), a
-	ld	a, (ix + -14)
-	ld	(iy + 8), a
-	ld	a, (ix + -10)
-	ld	(iy + 9), a
-	ld	a, (ix + -6)
-	ld	(iy + 10), a
-	ld	a, (ix + -2)
-	ld	(iy + 11), a
-	ld	a, (ix + -13)
-	ld	(iy + 12), a
-	ld	a, (ix + -9)
-	ld	(iy + 13), a
-	ld	a, (ix + -5)
-	ld	(iy + 14), a
-	ld	a, (ix + -1)
-	ld	(iy + 15), a
-	ld	sp, ix
-	pop	ix
-
-	restore_interrupts aes_ecb_unsafe_encrypt
-	ret
+	pop	hl
+	ld	bc, 0
+	jq	.lbl_21
 	
-aes_ecb_unsafe_decrypt:
+aes_decrypt:
+	call	_scratch_enter
 	save_interrupts
 
-	ld	hl, -19
+	ld	hl, -66
 	call	ti._frameset
-	ld	iy, (ix + 6)
+	ld	hl, (ix + 6)
+	ld	de, 1
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_9
 	ld	hl, (ix + 12)
-	lea	de, ix + -16
-	ld	(ix + -19), de
-	ld	de, (hl)
-	ld	a, (iy)
-	ld	(ix + -16), a
-	ld	a, (iy + 1)
-	ld	(ix + -12), a
-	ld	a, (iy + 2)
-	ld	(ix + -8), a
-	ld	a, (iy + 3)
-	ld	(ix + -4), a
-	ld	a, (iy + 4)
-	ld	(ix + -15), a
-	ld	a, (iy + 5)
-	ld	(ix + -11), a
-	ld	a, (iy + 6)
-	ld	(ix + -7), a
-	ld	a, (iy + 7)
-	ld	(ix + -3), a
-	ld	a, (iy + 8)
-	ld	(ix + -14), a
-	ld	a, (iy + 9)
-	ld	(ix + -10), a
-	ld	a, (iy + 10)
-	ld	(ix + -6), a
-	ld	a, (iy + 11)
-	ld	(ix + -2), a
-	ld	a, (iy + 12)
-	ld	(ix + -13), a
-	ld	a, (iy + 13)
-	ld	(ix + -9), a
-	ld	a, (iy + 14)
-	ld	(ix + -5), a
-	ld	a, (iy + 15)
-	ld	(ix + -1), a
-	ld	bc, 129
-	push	de
-	pop	hl
+	add	hl, bc
 	or	a, a
 	sbc	hl, bc
-	call	ti._setflag
-	jq	m, .lbl3
-	ld	bc, (ix + -19)
-	ld	iy, 193
-	ex	de, hl
-	lea	de, iy + 0
+	jq	z, .lbl_9
+	ld	hl, (ix + 15)
+	add	hl, bc
 	or	a, a
-	sbc	hl, de
-	call	ti._setflag
-	ld	hl, (ix + 12)
-	jq	m, .lbl4
-	ld	de, 227
+	sbc	hl, bc
+	jq	z, .lbl_9
+	ld	iy, (ix + 18)
+	lea	hl, iy + 0
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_9
+	ld	hl, (ix + 9)
+	ld	de, 5
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_9
+	ld	l, (ix + 21)
+	ld	a, l
+	or	a, a
+	jq	nz, .lbl_13
+	ld	a, (ix + 24)
+	cp	a, 2
+	jq	c, .lbl_15
+	ld	de, 4
+	jq	.lbl_9
+.lbl_13:
+	ld	a, l
+	cp	a, 1
+	jq	nz, .lbl_19
+	or	a, a
+	sbc	hl, hl
 	push	hl
-	pop	iy
-	add	iy, de
-	push	iy
-	push	bc
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	inc	hl
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	de, 211
-	ld	iy, (ix + 12)
-	add	iy, de
 	push	iy
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 15)
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	de, 195
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 12)
 	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 9)
 	push	hl
-	call	_aes_InvMixColumns
-	jq	.lbl5
-.lbl3:
-	ld	de, 163
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 6)
 	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	jq	.lbl7
-.lbl4:
-	ld	de, 195
+	call	aes_encrypt
+	ld	hl, 21
+	add	hl, sp
+	ld	sp, hl
+	jq	.lbl_21
+.lbl_15:
+	ld	hl, (ix + 9)
+	ld	a, l
+	and	a, 15
+	or	a, a
+	jq	nz, .lbl_9
+	lea	de, ix + -16
+	ld	(ix + -51), de
+	lea	de, ix + -32
+	ld	(ix + -54), de
+	lea	de, ix + -48
+	ld	c, 4
+	call	ti._ishru
+	ld	(ix + -57), hl
+	ld	hl, 16
 	push	hl
-	pop	iy
-	add	iy, de
 	push	iy
-	push	bc
-	call	_aes_AddRoundKey
+	ld	(ix + -60), de
+	push	de
+	call	ti._memcpy
+	ld	de, (ix + -57)
 	pop	hl
-.lbl5:
 	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvSubBytes
 	pop	hl
-	ld	de, 179
+if defined HASHLIB_AES_BITSLICE
 	ld	hl, (ix + 12)
 	push	hl
-	pop	iy
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 9)
 	push	hl
-	call	_aes_InvMixColumns
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 6)
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	de, 163
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -60)
 	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 15)
 	push	hl
-	call	_aes_InvMixColumns
-.lbl7:
-	pop	hl
-	ld	de, (ix + -19)
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
+	call	_aes_cbc_decrypt_bs
+	ld	hl, 15
+	add	hl, sp
+	ld	sp, hl
+	jq	.lbl_20
+end if
+	ld	iy, 0
+.lbl_17:
 	push	de
-	call	_aes_InvSubBytes
 	pop	hl
-	ld	de, 147
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	ld	hl, (ix + 6)
+	jq	z, .lbl_20
+	lea	bc, iy + 0
+	ld	(ix + -66), bc
+	add	hl, bc
+	ld	(ix + -57), de
+	ld	de, 16
+	push	de
+	push	hl
+	ld	hl, (ix + -51)
 	push	hl
-	call	_aes_AddRoundKey
+	ld	(ix + -63), iy
+	call	ti._memcpy
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
 	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 15)
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	de, 131
-	ld	iy, (ix + 12)
-	add	iy, de
-	push	iy
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -54)
 	push	hl
-	call	_aes_AddRoundKey
+	ld	hl, (ix + -51)
+	push	hl
+	call	aes_ecb_unsafe_decrypt
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
 	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	ld	hl, 16
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 115
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -54)
 	push	hl
-	call	_aes_AddRoundKey
+	ld	hl, (ix + -60)
+	push	hl
+	call	_xor_buf
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
 	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 12)
+	ld	de, (ix + -66)
+	add	hl, de
+	ld	de, 16
+	push	de
+	ld	de, (ix + -54)
+	push	de
 	push	hl
-	call	_aes_InvSubBytes
+	call	ti._memcpy
 	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 99
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
+	ld	hl, 16
 	push	hl
-	call	_aes_InvMixColumns
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -51)
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 83
-	ld	hl, (ix + -19)
+	ld	hl, (ix + -60)
 	push	hl
-	call	_aes_AddRoundKey
+	call	ti._memcpy
+	ld	iy, (ix + -63)
+	ld	de, (ix + -57)
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
 	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 67
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 51
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvMixColumns
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
+	dec	de
+	ld	bc, 16
+	add	iy, bc
+	jq	.lbl_17
+.lbl_19:
+	ld	de, 3
+	jq	.lbl_9
+.lbl_20:
+	ld	a, (ix + 24)
+	ld	l, a
 	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 35
-	ld	hl, (ix + -19)
+	ld	hl, (ix + 12)
 	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -19)
+	ld	de, (ix + 9)
+	push	de
 	push	hl
-	call	_aes_InvMixColumns
+	call	hashlib_AESStripPadding
 	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
-	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
-	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvSubBytes
 	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 19
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
 	pop	hl
 	pop	hl
-	ld	hl, (ix + -19)
+.lbl_21:
+	ld	de, 0
+.lbl_9:
+	ex	de, hl
+	restore_interrupts_noret aes_decrypt
+	jp stack_clear
+	
+	
+if defined HASHLIB_AES_BITSLICE
+;------------------------------------------
+; bitsliced aes, eight blocks at a time
+; build with -i 'HASHLIB_AES_BITSLICE := 1' to use it for CTR mode and CBC decryption
+;
+; bit k of byte p of all eight blocks sits in one byte, bit j belonging to block j, so every
+; step is plain boolean logic on whole bytes: there are no table lookups and nothing
+; branches on the data or the key
+;
+; frame of _aes_bs_crypt:
+;   ix-3 blocks, ix-6 round key, ix-7 direction, ix-8 rounds left, ix-9 pass counter
+;   ix-10 and ix-11 spare planes while transposing
+;   ix-12 .. ix-40 spill slots for the s-box and mixcolumns circuits
+;   two 128-byte buffers around iy: A at iy-128, B at iy+0, plane k of byte p at 16k + p
+
+; hl = 128 bytes of blocks, processed in place, de = aes_ctx, a = 0 to encrypt, 1 to decrypt
+; destroys: af, bc, de, hl, iy
+_aes_bs_crypt:
+	push	ix
+	ld	ix, 0
+	add	ix, sp
 	push	hl
-	call	_aes_InvMixColumns
-	pop	hl
-	ld	a, (ix + -9)
-	ld	l, (ix + -10)
-	ld	(ix + -9), l
-	ld	l, (ix + -11)
-	ld	(ix + -10), l
-	ld	l, (ix + -12)
-	ld	(ix + -11), l
-	ld	(ix + -12), a
-	ld	a, (ix + -5)
-	ld	l, (ix + -7)
-	ld	(ix + -5), l
+	push	de
 	ld	(ix + -7), a
-	ld	a, (ix + -6)
-	ld	l, (ix + -8)
-	ld	(ix + -6), l
+	ld	hl, -290
+	add	hl, sp
+	ld	sp, hl
+	call	.base
+	ld	hl, (ix + -3)
+	lea	de, iy + 0
+	ld	bc, 128
+	ldir
+	call	_aes_bs_pack
+; (keysize / 32) + 6 rounds
+	ld	hl, (ix + -6)
+	ld	de, (hl)
+	inc	hl
+	inc	hl
+	inc	hl
+	ex	de, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	ld	a, h
+	add	a, 5
 	ld	(ix + -8), a
-	ld	a, (ix + -1)
-	ld	l, (ix + -4)
-	ld	(ix + -1), l
-	ld	l, (ix + -3)
-	ld	(ix + -4), l
-	ld	l, (ix + -2)
-	ld	(ix + -3), l
-	ld	(ix + -2), a
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_InvSubBytes
-	pop	hl
-	ld	iy, (ix + 12)
-	pea	iy + 3
-	ld	hl, (ix + -19)
-	push	hl
-	call	_aes_AddRoundKey
-	pop	hl
-	pop	hl
-	ld	a, (ix + -16)
-	ld	iy, (ix + 9)
-	ld	(iy), a
-	ld	a, (ix + -12)
+	ex	de, hl
+	ld	(ix + -6), hl
+	bit	0, (ix + -7)
+	jq	nz, .decrypt
+	call	.ark_a
+.encrypt:
+	call	_aes_bs_sub
+	call	_aes_bs_shift
+	call	_aes_bs_mix
+	call	.ark_a
+	dec	(ix + -8)
+	jq	nz, .encrypt
+	call	_aes_bs_sub
+	call	_aes_bs_shift
+	call	.ark_b
+	jq	.done
+.decrypt:
+; start from the last round key and walk back down the schedule
+	ld	bc, 0
+	ld	b, a
+	inc	b
+	ld	c, 16
+	mlt	bc
+	add	hl, bc
+	ld	(ix + -6), hl
+	call	.ark_a
+.decrypt_round:
+	call	_aes_bs_invshift
+	call	_aes_bs_invsub
+	call	.ark_b
+	call	_aes_bs_invmix
+	dec	(ix + -8)
+	jq	nz, .decrypt_round
+	call	_aes_bs_invshift
+	call	_aes_bs_invsub
+	call	.ark_b
+.done:
+	call	_aes_bs_unpack
+	lea	hl, iy + -128
+	ld	de, (ix + -3)
+	ld	bc, 128
+	ldir
+	ld	sp, ix
+	pop	ix
+	ret
+
+; iy = the middle of the two buffers
+.base:
+	lea	iy, ix + -128
+	lea	iy, iy + -40
+	ret
+
+; AddRoundKey on A or B with the key at (ix - 6), which then moves on to the next one
+.ark_a:
+	lea	iy, iy + -128
+	call	_aes_bs_ark
+	call	.base
+	ld	hl, (ix + -6)
+	ld	de, 16
+	bit	0, (ix + -7)
+	jq	z, .next_a
+	ld	de, -16
+.next_a:
+	add	hl, de
+	ld	(ix + -6), hl
+	ret
+
+.ark_b:
+	call	_aes_bs_ark
+	ld	hl, (ix + -6)
+	ld	de, 16
+	bit	0, (ix + -7)
+	jq	z, .next_b
+	ld	de, -16
+.next_b:
+	add	hl, de
+	ld	(ix + -6), hl
+	ret
+
+; xors the round key at (ix - 6) into the planes at iy, each key bit widened to 0 or $FF
+_aes_bs_ark:
+	ld	hl, (ix + -6)
+	ld	(ix + -9), 4
+.column:
+	ld	c, (hl)
+	inc	hl
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 3)
+	ld	(iy + 3), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 19)
+	ld	(iy + 19), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 35)
+	ld	(iy + 35), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 51)
+	ld	(iy + 51), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 67)
+	ld	(iy + 67), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 83)
+	ld	(iy + 83), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 99)
+	ld	(iy + 99), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 115)
+	ld	(iy + 115), a
+	ld	c, (hl)
+	inc	hl
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 2)
+	ld	(iy + 2), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 18)
+	ld	(iy + 18), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 34)
+	ld	(iy + 34), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 50)
+	ld	(iy + 50), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 66)
+	ld	(iy + 66), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 82)
+	ld	(iy + 82), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 98)
+	ld	(iy + 98), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 114)
+	ld	(iy + 114), a
+	ld	c, (hl)
+	inc	hl
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 1)
+	ld	(iy + 1), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 17)
+	ld	(iy + 17), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 33)
+	ld	(iy + 33), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 49)
+	ld	(iy + 49), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 65)
+	ld	(iy + 65), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 81)
+	ld	(iy + 81), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 97)
+	ld	(iy + 97), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 113)
+	ld	(iy + 113), a
+	ld	c, (hl)
+	inc	hl
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 0)
+	ld	(iy + 0), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 16)
+	ld	(iy + 16), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 32)
+	ld	(iy + 32), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 48)
+	ld	(iy + 48), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 64)
+	ld	(iy + 64), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 80)
+	ld	(iy + 80), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 96)
+	ld	(iy + 96), a
+	rr	c
+	sbc	a, a
+	xor	a, (iy + 112)
+	ld	(iy + 112), a
+	lea	iy, iy + 4
+	dec	(ix + -9)
+	jq	nz, .column
+	lea	iy, iy + -16
+	ret
+
+; B, eight blocks one after the other, to A in planes
+_aes_bs_pack:
+	ld	(ix + -9), 16
+.byte:
+	ld	a, (iy + 0)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 16)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 32)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 48)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 64)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 80)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 96)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	a, (iy + 112)
+	rra
+	rr	b
+	rra
+	rr	c
+	rra
+	rr	d
+	rra
+	rr	e
+	rra
+	rr	h
+	rra
+	rr	l
+	rra
+	rr	(ix + -10)
+	rra
+	rr	(ix + -11)
+	ld	(iy + -128), b
+	ld	(iy + -112), c
+	ld	(iy + -96), d
+	ld	(iy + -80), e
+	ld	(iy + -64), h
+	ld	(iy + -48), l
+	ld	a, (ix + -10)
+	ld	(iy + -32), a
+	ld	a, (ix + -11)
+	ld	(iy + -16), a
+	inc	iy
+	dec	(ix + -9)
+	jq	nz, .byte
+	lea	iy, iy + -16
+	ret
+
+; B in planes to A, eight blocks one after the other
+_aes_bs_unpack:
+	ld	(ix + -9), 16
+.byte:
+	ld	b, (iy + 0)
+	ld	c, (iy + 16)
+	ld	d, (iy + 32)
+	ld	e, (iy + 48)
+	ld	h, (iy + 64)
+	ld	l, (iy + 80)
+	ld	a, (iy + 96)
+	ld	(ix + -10), a
+	ld	a, (iy + 112)
+	ld	(ix + -11), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -128), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -112), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -96), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -80), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -64), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -48), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -32), a
+	rr	(ix + -11)
+	rla
+	rr	(ix + -10)
+	rla
+	rr	l
+	rla
+	rr	h
+	rla
+	rr	e
+	rla
+	rr	d
+	rla
+	rr	c
+	rla
+	rr	b
+	rla
+	ld	(iy + -16), a
+	inc	iy
+	dec	(ix + -9)
+	jq	nz, .byte
+	lea	iy, iy + -16
+	ret
+
+; ShiftRows, A to B
+_aes_bs_shift:
+	ld	(ix + -9), 8
+.plane:
+	ld	a, (iy + -128)
+	ld	(iy + 0), a
+	ld	a, (iy + -123)
 	ld	(iy + 1), a
-	ld	a, (ix + -8)
+	ld	a, (iy + -118)
 	ld	(iy + 2), a
-	ld	a, (ix + -4)
+	ld	a, (iy + -113)
 	ld	(iy + 3), a
-	ld	a, (ix + -15)
+	ld	a, (iy + -124)
 	ld	(iy + 4), a
-	ld	a, (ix + -11)
+	ld	a, (iy + -119)
 	ld	(iy + 5), a
-	ld	a, (ix + -7)
+	ld	a, (iy + -114)
 	ld	(iy + 6), a
-	ld	a, (ix + -3)
+	ld	a, (iy + -125)
 	ld	(iy + 7), a
-	ld	a, (ix + -14)
+	ld	a, (iy + -120)
 	ld	(iy + 8), a
-	ld	a, (ix + -10)
+	ld	a, (iy + -115)
 	ld	(iy + 9), a
-	ld	a, (ix + -6)
+	ld	a, (iy + -126)
 	ld	(iy + 10), a
-	ld	a, (ix + -2)
+	ld	a, (iy + -121)
 	ld	(iy + 11), a
-	ld	a, (ix + -13)
+	ld	a, (iy + -116)
 	ld	(iy + 12), a
-	ld	a, (ix + -9)
+	ld	a, (iy + -127)
 	ld	(iy + 13), a
-	ld	a, (ix + -5)
+	ld	a, (iy + -122)
 	ld	(iy + 14), a
-	ld	a, (ix + -1)
+	ld	a, (iy + -117)
 	ld	(iy + 15), a
-	ld	sp, ix
-	pop	ix
-	
-	restore_interrupts aes_ecb_unsafe_decrypt
+	lea	iy, iy + 16
+	dec	(ix + -9)
+	jq	nz, .plane
+	lea	iy, iy + -128
 	ret
-	
-aes_encrypt:
-	save_interrupts
 
-	ld	hl, -95
-	call	ti._frameset
-	ld	de, (ix + 6)
-	ld	bc, 1
-	push	de
-	pop	hl
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_1
-	jq	.lbl_21
-.lbl_1:
-	ld	iy, (ix + 12)
-	lea	hl, iy + 0
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_2
-	jq	.lbl_21
-.lbl_2:
-	ld	hl, (ix + 15)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_3
-	jq	.lbl_21
-.lbl_3:
-	ld	hl, (ix + 18)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_21
-	ld	bc, (ix + 9)
-	push	bc
-	pop	hl
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_6
-	ld	bc, 2
-.lbl_21:
-	push	bc
-	restore_interrupts_noret aes_encrypt
-	pop	hl
-	jp stack_clear
-.lbl_6:
-	ld	l, (ix + 21)
+; InvShiftRows, A to B
+_aes_bs_invshift:
+	ld	(ix + -9), 8
+.plane:
+	ld	a, (iy + -128)
+	ld	(iy + 0), a
+	ld	a, (iy + -115)
+	ld	(iy + 1), a
+	ld	a, (iy + -118)
+	ld	(iy + 2), a
+	ld	a, (iy + -121)
+	ld	(iy + 3), a
+	ld	a, (iy + -124)
+	ld	(iy + 4), a
+	ld	a, (iy + -127)
+	ld	(iy + 5), a
+	ld	a, (iy + -114)
+	ld	(iy + 6), a
+	ld	a, (iy + -117)
+	ld	(iy + 7), a
+	ld	a, (iy + -120)
+	ld	(iy + 8), a
+	ld	a, (iy + -123)
+	ld	(iy + 9), a
+	ld	a, (iy + -126)
+	ld	(iy + 10), a
+	ld	a, (iy + -113)
+	ld	(iy + 11), a
+	ld	a, (iy + -116)
+	ld	(iy + 12), a
+	ld	a, (iy + -119)
+	ld	(iy + 13), a
+	ld	a, (iy + -122)
+	ld	(iy + 14), a
+	ld	a, (iy + -125)
+	ld	(iy + 15), a
+	lea	iy, iy + 16
+	dec	(ix + -9)
+	jq	nz, .plane
+	lea	iy, iy + -128
+	ret
+
+; SubBytes on A, as the Boyar-Peralta circuit: 32 ands and 83 xors per byte
+_aes_bs_sub:
+	ld	(ix + -9), 16
+.byte:
+	ld	a, (iy + -64)
+	xor	a, (iy + -96)
+	ld	b, a
+	ld	a, (iy + -16)
+	xor	a, (iy + -112)
+	ld	c, a
+	ld	a, (iy + -16)
+	xor	a, (iy + -64)
+	ld	d, a
+	ld	a, (iy + -16)
+	xor	a, (iy + -96)
+	ld	e, a
+	ld	a, (iy + -32)
+	xor	a, (iy + -48)
+	ld	h, a
+	xor	a, (iy + -128)
+	ld	l, a
+	xor	a, (iy + -64)
+	ld	(ix + -12), a
+	ld	a, c
+	xor	a, b
+	ld	(ix + -13), b
+	ld	b, a
 	ld	a, l
-	or	a, a
-	jq	nz, .lbl_7
-	ld	a, (ix + 24)
-	cp	a, 2
-	jq	c, .lbl_11
-	ld	bc, 4
-	jq	.lbl_21
-.lbl_7:
+	xor	a, (iy + -16)
+	ld	(ix + -14), a
 	ld	a, l
-	cp	a, 1
-	jq	nz, .lbl_8
-	lea	hl, ix + -64
-	ld	(ix + -86), hl
+	xor	a, (iy + -112)
+	ld	(ix + -15), l
+	ld	l, a
+	xor	a, e
+	ld	(ix + -16), l
+	ld	l, a
+	ld	a, b
+	xor	a, (iy + -80)
+	ld	(ix + -17), l
+	ld	l, a
+	xor	a, (iy + -96)
+	ld	(ix + -18), b
+	ld	b, a
+	ld	a, l
+	xor	a, (iy + -32)
+	ld	l, a
+	ld	a, b
+	xor	a, (iy + -128)
+	ld	(ix + -19), a
+	ld	a, b
+	xor	a, h
+	ld	(ix + -20), b
+	ld	b, a
+	ld	a, l
+	xor	a, d
+	ld	(ix + -21), l
+	ld	l, a
+	xor	a, (iy + -128)
+	ld	(ix + -22), d
+	ld	d, a
+	ld	a, b
+	xor	a, l
+	ld	(ix + -23), a
+	ld	a, b
+	xor	a, e
+	ld	(ix + -24), a
+	ld	a, h
+	xor	a, l
+	ld	h, a
+	xor	a, c
+	ld	(ix + -25), a
+	ld	a, h
+	xor	a, (iy + -16)
+	ld	(ix + -26), a
+	ld	a, (ix + -18)
+	and	a, (ix + -20)
+	ld	(ix + -27), e
+	ld	e, a
+	ld	a, (ix + -17)
+	and	a, (ix + -19)
+	xor	a, e
+	ld	(ix + -28), a
+	ld	a, (ix + -12)
+	and	a, (iy + -128)
+	xor	a, e
+	ld	e, a
+	ld	a, c
+	and	a, h
+	ld	(ix + -29), c
+	ld	c, a
+	ld	a, (ix + -16)
+	and	a, (ix + -15)
+	xor	a, c
+	ld	(ix + -30), h
+	ld	h, a
+	ld	a, d
+	and	a, (ix + -14)
+	xor	a, c
+	ld	c, a
+	ld	a, l
+	and	a, (ix + -22)
+	ld	(ix + -31), l
+	ld	l, a
+	ld	a, (ix + -13)
+	and	a, (ix + -23)
+	xor	a, l
+	ld	(ix + -32), d
+	ld	d, a
+	ld	a, b
+	and	a, (ix + -27)
+	xor	a, l
+	ld	l, a
+	ld	a, d
+	xor	a, (ix + -28)
+	ld	(ix + -28), b
+	ld	b, a
+	ld	a, e
+	xor	a, l
+	ld	e, a
+	ld	a, h
+	xor	a, d
+	ld	h, a
+	ld	a, c
+	xor	a, l
+	ld	d, a
+	ld	a, b
+	xor	a, (ix + -21)
+	ld	c, a
+	ld	a, e
+	xor	a, (ix + -24)
+	ld	l, a
+	ld	a, h
+	xor	a, (ix + -25)
+	ld	b, a
+	ld	a, d
+	xor	a, (ix + -26)
+	ld	e, a
+	ld	a, c
+	xor	a, l
+	ld	h, a
+	ld	a, c
+	and	a, b
+	ld	d, a
+	xor	a, e
+	ld	c, a
+	and	a, h
+	xor	a, l
+	ld	(ix + -26), h
+	ld	h, a
+	ld	a, b
+	xor	a, e
+	ld	(ix + -25), h
+	ld	h, a
+	ld	a, l
+	xor	a, d
+	and	a, h
+	xor	a, e
+	ld	l, a
+	xor	a, b
+	ld	d, a
+	ld	a, c
+	xor	a, l
+	and	a, e
+	ld	h, a
+	xor	a, d
+	ld	b, a
+	ld	a, c
+	xor	a, h
+	and	a, (ix + -25)
+	xor	a, (ix + -26)
+	ld	e, a
+	xor	a, b
+	ld	d, a
+	ld	a, l
+	xor	a, (ix + -25)
+	ld	c, a
+	ld	a, e
+	xor	a, (ix + -25)
+	ld	h, a
+	ld	a, l
+	xor	a, b
+	ld	(ix + -26), e
+	ld	e, a
+	ld	a, c
+	xor	a, d
+	ld	(ix + -24), d
+	ld	d, a
+	ld	a, e
+	and	a, (ix + -20)
+	ld	(ix + -20), a
+	ld	a, b
+	and	a, (ix + -19)
+	ld	(ix + -19), a
+	ld	a, l
+	and	a, (iy + -128)
+	ld	(ix + -21), a
+	ld	a, h
+	and	a, (ix + -30)
+	ld	(ix + -30), a
+	ld	a, (ix + -26)
+	and	a, (ix + -15)
+	ld	(ix + -15), a
+	ld	a, (ix + -25)
+	and	a, (ix + -32)
+	ld	(ix + -32), a
+	ld	a, c
+	and	a, (ix + -31)
+	ld	(ix + -31), a
+	ld	a, d
+	and	a, (ix + -23)
+	ld	(ix + -23), a
+	ld	a, (ix + -24)
+	and	a, (ix + -28)
+	ld	(ix + -28), a
+	ld	a, e
+	and	a, (ix + -18)
+	ld	e, a
+	ld	a, b
+	and	a, (ix + -17)
+	ld	b, a
+	ld	a, l
+	and	a, (ix + -12)
+	ld	l, a
+	ld	a, h
+	and	a, (ix + -29)
+	ld	h, a
+	ld	a, (ix + -26)
+	and	a, (ix + -16)
+	ld	(ix + -16), h
+	ld	h, a
+	ld	a, (ix + -25)
+	and	a, (ix + -14)
+	ld	(ix + -14), a
+	ld	a, c
+	and	a, (ix + -22)
+	ld	c, a
+	ld	a, d
+	and	a, (ix + -13)
+	ld	d, a
+	ld	a, (ix + -24)
+	and	a, (ix + -27)
+	ld	(ix + -27), a
+	ld	a, c
+	xor	a, d
+	ld	c, a
+	ld	a, b
+	xor	a, l
+	ld	l, a
+	ld	a, h
+	xor	a, (ix + -32)
+	ld	h, a
+	ld	a, e
+	xor	a, b
+	ld	e, a
+	ld	a, (ix + -21)
+	xor	a, (ix + -16)
+	ld	b, a
+	ld	a, (ix + -21)
+	xor	a, (ix + -32)
+	ld	(ix + -32), l
+	ld	l, a
+	ld	a, (ix + -23)
+	xor	a, (ix + -28)
+	ld	(ix + -28), l
+	ld	l, a
+	ld	a, (ix + -20)
+	xor	a, (ix + -30)
+	ld	(ix + -20), e
+	ld	e, a
+	ld	a, (ix + -31)
+	xor	a, (ix + -23)
+	ld	(ix + -23), l
+	ld	l, a
+	ld	a, d
+	xor	a, (ix + -27)
+	ld	d, a
+	ld	a, h
+	xor	a, (ix + -16)
+	ld	(ix + -16), d
+	ld	d, a
+	ld	a, b
+	xor	a, e
+	ld	b, a
+	ld	a, c
+	xor	a, (ix + -15)
+	ld	(ix + -27), e
+	ld	e, a
+	ld	a, l
+	xor	a, (ix + -30)
+	ld	l, a
+	ld	a, c
+	xor	a, b
+	ld	c, a
+	ld	a, b
+	xor	a, (ix + -14)
+	ld	b, a
+	ld	a, e
+	xor	a, (ix + -23)
+	ld	(ix + -23), h
+	ld	h, a
+	ld	a, e
+	xor	a, (ix + -20)
+	ld	e, a
+	ld	a, l
+	xor	a, (ix + -15)
+	ld	(ix + -15), a
+	ld	a, b
+	xor	a, h
+	ld	b, a
+	ld	a, e
+	xor	a, (ix + -19)
+	ld	(ix + -19), a
+	ld	a, l
+	xor	a, e
+	ld	(iy + -16), a
+	ld	a, d
+	xor	a, h
+	cpl
+	ld	(iy + -112), a
+	ld	a, c
+	xor	a, (ix + -23)
+	cpl
+	ld	(iy + -128), a
+	ld	a, b
+	xor	a, (ix + -15)
+	ld	l, a
+	ld	a, (ix + -27)
+	xor	a, (ix + -19)
+	ld	(iy + -64), a
+	ld	e, a
+	ld	a, (ix + -28)
+	xor	a, (ix + -19)
+	ld	(iy + -80), a
+	ld	a, b
+	xor	a, (ix + -32)
+	ld	(iy + -96), a
+	ld	a, e
+	xor	a, (ix + -15)
+	cpl
+	ld	(iy + -32), a
+	ld	a, l
+	xor	a, (ix + -16)
+	cpl
+	ld	(iy + -48), a
+	inc	iy
+	dec	(ix + -9)
+	jq	nz, .byte
+	lea	iy, iy + -16
+	ret
+
+; InvSubBytes on B, as the forward circuit between two inverse affine maps
+_aes_bs_invsub:
+	ld	(ix + -9), 16
+.byte:
+	ld	a, (iy + 32)
+	xor	a, (iy + 80)
+	xor	a, (iy + 112)
+	cpl
+	ld	b, a
+	ld	a, (iy + 48)
+	xor	a, (iy + 96)
+	xor	a, (iy + 0)
+	ld	c, a
+	ld	a, (iy + 64)
+	xor	a, (iy + 112)
+	xor	a, (iy + 16)
+	cpl
+	ld	d, a
+	ld	a, (iy + 80)
+	xor	a, (iy + 0)
+	xor	a, (iy + 32)
+	ld	e, a
+	ld	a, (iy + 96)
+	xor	a, (iy + 16)
+	xor	a, (iy + 48)
+	ld	h, a
+	ld	a, (iy + 112)
+	xor	a, (iy + 32)
+	xor	a, (iy + 64)
+	ld	l, a
+	ld	a, (iy + 0)
+	xor	a, (iy + 48)
+	xor	a, (iy + 80)
+	ld	(ix + -12), e
+	ld	e, a
+	ld	a, (iy + 16)
+	xor	a, (iy + 64)
+	xor	a, (iy + 96)
+	ld	(ix + -13), b
+	ld	b, a
+	ld	a, h
+	xor	a, d
+	ld	(ix + -14), a
+	ld	a, b
+	xor	a, c
+	ld	(ix + -15), c
+	ld	c, a
+	ld	a, b
+	xor	a, h
+	ld	(ix + -16), a
+	ld	a, b
+	xor	a, d
+	ld	(ix + -17), d
+	ld	d, a
+	ld	a, e
+	xor	a, l
+	ld	l, a
+	xor	a, (ix + -13)
+	ld	(ix + -18), l
+	ld	l, a
+	xor	a, h
+	ld	h, a
+	ld	a, c
+	xor	a, (ix + -14)
+	ld	(ix + -19), h
+	ld	h, a
+	ld	a, l
+	xor	a, b
+	ld	(ix + -20), a
+	ld	a, l
+	xor	a, (ix + -15)
+	ld	(ix + -15), l
+	ld	l, a
+	xor	a, d
+	ld	(ix + -21), l
+	ld	l, a
+	ld	a, h
+	xor	a, (ix + -12)
+	ld	(ix + -12), l
+	ld	l, a
+	xor	a, (ix + -17)
+	ld	(ix + -17), h
+	ld	h, a
+	ld	a, l
+	xor	a, e
+	ld	l, a
+	ld	a, h
+	xor	a, (ix + -13)
+	ld	e, a
+	ld	a, h
+	xor	a, (ix + -18)
+	ld	(ix + -22), e
+	ld	e, a
+	ld	a, l
+	xor	a, (ix + -16)
+	ld	(ix + -23), l
+	ld	l, a
+	xor	a, (ix + -13)
+	ld	(ix + -24), a
+	ld	a, e
+	xor	a, l
+	ld	(ix + -25), a
+	ld	a, e
+	xor	a, d
+	ld	(ix + -26), a
+	ld	a, l
+	xor	a, (ix + -18)
+	ld	(ix + -18), d
+	ld	d, a
+	xor	a, c
+	ld	(ix + -27), a
+	ld	a, b
+	xor	a, d
+	ld	b, a
+	ld	a, h
+	and	a, (ix + -17)
+	ld	(ix + -28), h
+	ld	h, a
+	ld	a, (ix + -12)
+	and	a, (ix + -22)
+	xor	a, h
+	ld	(ix + -29), b
+	ld	b, a
+	ld	a, (ix + -19)
+	and	a, (ix + -13)
+	xor	a, h
+	ld	h, a
+	ld	a, c
+	and	a, d
+	ld	(ix + -30), c
+	ld	c, a
+	ld	a, (ix + -21)
+	and	a, (ix + -15)
+	xor	a, c
+	ld	(ix + -31), d
+	ld	d, a
+	ld	a, (ix + -20)
+	and	a, (ix + -24)
+	xor	a, c
+	ld	c, a
+	ld	a, l
+	and	a, (ix + -16)
+	ld	(ix + -32), l
+	ld	l, a
+	ld	a, (ix + -14)
+	and	a, (ix + -25)
+	xor	a, l
+	ld	(ix + -33), c
+	ld	c, a
+	ld	a, e
+	and	a, (ix + -18)
+	xor	a, l
+	ld	l, a
+	ld	a, b
+	xor	a, c
+	ld	b, a
+	ld	a, h
+	xor	a, l
+	ld	h, a
+	ld	a, d
+	xor	a, c
+	ld	d, a
+	ld	a, l
+	xor	a, (ix + -33)
+	ld	c, a
+	ld	a, b
+	xor	a, (ix + -23)
+	ld	l, a
+	ld	a, h
+	xor	a, (ix + -26)
+	ld	b, a
+	ld	a, d
+	xor	a, (ix + -27)
+	ld	h, a
+	ld	a, c
+	xor	a, (ix + -29)
+	ld	d, a
+	ld	a, l
+	xor	a, b
+	ld	c, a
+	ld	a, l
+	and	a, h
+	ld	l, a
+	xor	a, d
+	ld	(ix + -29), e
+	ld	e, a
+	and	a, c
+	xor	a, b
+	ld	(ix + -27), c
+	ld	c, a
+	ld	a, h
+	xor	a, d
+	ld	(ix + -26), c
+	ld	c, a
+	ld	a, b
+	xor	a, l
+	and	a, c
+	xor	a, d
+	ld	b, a
+	xor	a, h
+	ld	l, a
+	ld	a, e
+	xor	a, b
+	and	a, d
+	ld	c, a
+	xor	a, l
+	ld	h, a
+	ld	a, e
+	xor	a, c
+	and	a, (ix + -26)
+	xor	a, (ix + -27)
+	ld	d, a
+	xor	a, h
+	ld	l, a
+	ld	a, b
+	xor	a, (ix + -26)
+	ld	e, a
+	ld	a, d
+	xor	a, (ix + -26)
+	ld	c, a
+	ld	a, b
+	xor	a, h
+	ld	(ix + -27), d
+	ld	d, a
+	ld	a, e
+	xor	a, l
+	ld	(ix + -23), l
+	ld	l, a
+	ld	a, d
+	and	a, (ix + -28)
+	ld	(ix + -28), a
+	ld	a, h
+	and	a, (ix + -22)
+	ld	(ix + -22), a
+	ld	a, b
+	and	a, (ix + -13)
+	ld	(ix + -13), a
+	ld	a, c
+	and	a, (ix + -31)
+	ld	(ix + -31), a
+	ld	a, (ix + -27)
+	and	a, (ix + -15)
+	ld	(ix + -15), a
+	ld	a, (ix + -26)
+	and	a, (ix + -24)
+	ld	(ix + -24), a
+	ld	a, e
+	and	a, (ix + -32)
+	ld	(ix + -32), a
+	ld	a, l
+	and	a, (ix + -25)
+	ld	(ix + -25), a
+	ld	a, (ix + -23)
+	and	a, (ix + -29)
+	ld	(ix + -29), a
+	ld	a, d
+	and	a, (ix + -17)
+	ld	d, a
+	ld	a, h
+	and	a, (ix + -12)
+	ld	h, a
+	ld	a, b
+	and	a, (ix + -19)
+	ld	b, a
+	ld	a, c
+	and	a, (ix + -30)
+	ld	c, a
+	ld	a, (ix + -27)
+	and	a, (ix + -21)
+	ld	(ix + -21), c
+	ld	c, a
+	ld	a, (ix + -26)
+	and	a, (ix + -20)
+	ld	(ix + -20), a
+	ld	a, e
+	and	a, (ix + -16)
+	ld	e, a
+	ld	a, l
+	and	a, (ix + -14)
+	ld	l, a
+	ld	a, (ix + -23)
+	and	a, (ix + -18)
+	ld	(ix + -18), a
+	ld	a, e
+	xor	a, l
+	ld	e, a
+	ld	a, h
+	xor	a, b
+	ld	b, a
+	ld	a, c
+	xor	a, (ix + -24)
+	ld	c, a
+	ld	a, d
+	xor	a, h
+	ld	d, a
+	ld	a, (ix + -13)
+	xor	a, (ix + -21)
+	ld	h, a
+	ld	a, (ix + -13)
+	xor	a, (ix + -24)
+	ld	(ix + -24), b
+	ld	b, a
+	ld	a, (ix + -25)
+	xor	a, (ix + -29)
+	ld	(ix + -29), b
+	ld	b, a
+	ld	a, (ix + -28)
+	xor	a, (ix + -31)
+	ld	(ix + -28), d
+	ld	d, a
+	ld	a, (ix + -32)
+	xor	a, (ix + -25)
+	ld	(ix + -25), b
+	ld	b, a
+	ld	a, l
+	xor	a, (ix + -18)
+	ld	l, a
+	ld	a, c
+	xor	a, (ix + -21)
+	ld	(ix + -21), l
+	ld	l, a
+	ld	a, h
+	xor	a, d
+	ld	h, a
+	ld	a, e
+	xor	a, (ix + -15)
+	ld	(ix + -18), d
+	ld	d, a
+	ld	a, b
+	xor	a, (ix + -31)
+	ld	b, a
+	ld	a, e
+	xor	a, h
+	ld	e, a
+	ld	a, h
+	xor	a, (ix + -20)
+	ld	h, a
+	ld	a, d
+	xor	a, (ix + -25)
+	ld	(ix + -25), c
+	ld	c, a
+	ld	a, d
+	xor	a, (ix + -28)
+	ld	d, a
+	ld	a, b
+	xor	a, (ix + -15)
+	ld	(ix + -15), a
+	ld	a, h
+	xor	a, c
+	ld	h, a
+	ld	a, d
+	xor	a, (ix + -22)
+	ld	(ix + -22), a
+	ld	a, b
+	xor	a, d
+	ld	b, a
+	ld	a, l
+	xor	a, c
+	cpl
+	ld	d, a
+	ld	a, e
+	xor	a, (ix + -25)
+	cpl
+	ld	l, a
+	ld	a, h
+	xor	a, (ix + -15)
+	ld	c, a
+	ld	a, (ix + -18)
+	xor	a, (ix + -22)
+	ld	e, a
+	ld	a, (ix + -29)
+	xor	a, (ix + -22)
+	ld	(ix + -22), d
+	ld	d, a
+	ld	a, h
+	xor	a, (ix + -24)
+	ld	h, a
+	ld	a, e
+	xor	a, (ix + -15)
+	cpl
+	ld	(ix + -15), e
+	ld	e, a
+	ld	a, c
+	xor	a, (ix + -21)
+	cpl
+	ld	c, a
+	xor	a, h
+	xor	a, b
+	cpl
+	ld	(iy + 0), a
+	ld	a, d
+	xor	a, e
+	xor	a, l
+	ld	(iy + 16), a
+	ld	a, b
+	xor	a, (ix + -15)
+	xor	a, (ix + -22)
+	cpl
+	ld	(iy + 32), a
+	ld	a, c
+	xor	a, l
+	xor	a, h
+	ld	(iy + 48), a
+	ld	a, e
+	xor	a, (ix + -22)
+	xor	a, d
+	ld	(iy + 64), a
+	ld	a, b
+	xor	a, h
+	xor	a, (ix + -15)
+	ld	(iy + 80), a
+	ld	a, l
+	xor	a, d
+	xor	a, c
+	ld	(iy + 96), a
+	ld	a, (ix + -22)
+	xor	a, (ix + -15)
+	xor	a, e
+	ld	(iy + 112), a
+	inc	iy
+	dec	(ix + -9)
+	jq	nz, .byte
+	lea	iy, iy + -16
+	ret
+
+; MixColumns, B to A
+_aes_bs_mix:
+	ld	(ix + -9), 4
+.column:
+	ld	a, (iy + 0)
+	xor	a, (iy + 1)
+	ld	b, a
+	ld	a, (iy + 2)
+	xor	a, (iy + 3)
+	ld	c, a
+	xor	a, b
+	ld	d, a
+	ld	a, (iy + 112)
+	xor	a, (iy + 113)
+	ld	e, a
+	ld	a, d
+	xor	a, (iy + 0)
+	xor	a, e
+	ld	(iy + -128), a
+	ld	a, (iy + 113)
+	xor	a, (iy + 114)
+	ld	h, a
+	ld	a, d
+	xor	a, (iy + 1)
+	xor	a, h
+	ld	(iy + -127), a
+	ld	a, (iy + 114)
+	xor	a, (iy + 115)
+	ld	l, a
+	xor	a, (iy + 2)
+	xor	a, d
+	ld	(iy + -126), a
+	ld	a, (iy + 112)
+	xor	a, (iy + 115)
+	ld	(ix + -12), c
+	ld	c, a
+	xor	a, (iy + 3)
+	xor	a, d
+	ld	(iy + -125), a
+	ld	a, (iy + 16)
+	xor	a, (iy + 17)
+	ld	d, a
+	ld	a, (iy + 18)
+	xor	a, (iy + 19)
+	ld	(ix + -13), c
+	ld	c, a
+	xor	a, d
+	ld	(ix + -14), c
+	ld	c, a
+	ld	a, b
+	xor	a, (iy + 16)
+	xor	a, c
+	xor	a, e
+	ld	(iy + -112), a
+	ld	a, (iy + 1)
+	xor	a, (iy + 2)
+	ld	b, a
+	ld	a, c
+	xor	a, (iy + 17)
+	xor	a, b
+	xor	a, h
+	ld	(iy + -111), a
+	ld	a, l
+	xor	a, (iy + 18)
+	xor	a, c
+	xor	a, (ix + -12)
+	ld	(iy + -110), a
+	ld	a, (iy + 0)
+	xor	a, (iy + 3)
+	ld	b, a
+	ld	a, (iy + 19)
+	xor	a, (ix + -13)
+	xor	a, c
+	xor	a, b
+	ld	(iy + -109), a
+	ld	a, (iy + 32)
+	xor	a, (iy + 33)
+	ld	c, a
+	ld	a, (iy + 34)
+	xor	a, (iy + 35)
+	ld	b, a
+	xor	a, c
+	ld	(ix + -12), b
+	ld	b, a
+	ld	a, d
+	xor	a, (iy + 32)
+	xor	a, b
+	ld	(iy + -96), a
+	ld	a, (iy + 17)
+	xor	a, (iy + 18)
+	ld	d, a
+	ld	a, b
+	xor	a, (iy + 33)
+	xor	a, d
+	ld	(iy + -95), a
+	ld	a, (iy + 34)
+	xor	a, (ix + -14)
+	xor	a, b
+	ld	(iy + -94), a
+	ld	a, (iy + 16)
+	xor	a, (iy + 19)
+	ld	d, a
+	ld	a, b
+	xor	a, (iy + 35)
+	xor	a, d
+	ld	(iy + -93), a
+	ld	a, (iy + 48)
+	xor	a, (iy + 49)
+	ld	b, a
+	ld	a, (iy + 50)
+	xor	a, (iy + 51)
+	ld	d, a
+	xor	a, b
+	ld	(ix + -14), d
+	ld	d, a
+	ld	a, c
+	xor	a, (iy + 48)
+	xor	a, e
+	xor	a, d
+	ld	(iy + -80), a
+	ld	a, (iy + 33)
+	xor	a, (iy + 34)
+	ld	c, a
+	ld	a, d
+	xor	a, (iy + 49)
+	xor	a, c
+	xor	a, h
+	ld	(iy + -79), a
+	ld	a, l
+	xor	a, (iy + 50)
+	xor	a, (ix + -12)
+	xor	a, d
+	ld	(iy + -78), a
+	ld	a, (iy + 32)
+	xor	a, (iy + 35)
+	ld	c, a
+	ld	a, (iy + 51)
+	xor	a, (ix + -13)
+	xor	a, d
+	xor	a, c
+	ld	(iy + -77), a
+	ld	a, (iy + 64)
+	xor	a, (iy + 65)
+	ld	d, a
+	ld	a, (iy + 66)
+	xor	a, (iy + 67)
+	ld	c, a
+	xor	a, d
+	ld	(ix + -12), c
+	ld	c, a
+	ld	a, e
+	xor	a, (iy + 64)
+	xor	a, b
+	xor	a, c
+	ld	(iy + -64), a
+	ld	a, (iy + 49)
+	xor	a, (iy + 50)
+	ld	b, a
+	ld	a, c
+	xor	a, (iy + 65)
+	xor	a, b
+	xor	a, h
+	ld	(iy + -63), a
+	ld	a, l
+	xor	a, (iy + 66)
+	xor	a, (ix + -14)
+	xor	a, c
+	ld	(iy + -62), a
+	ld	a, (iy + 48)
+	xor	a, (iy + 51)
+	ld	b, a
+	ld	a, (iy + 67)
+	xor	a, (ix + -13)
+	xor	a, c
+	xor	a, b
+	ld	(iy + -61), a
+	ld	a, (iy + 80)
+	xor	a, (iy + 81)
+	ld	h, a
+	ld	a, (iy + 82)
+	xor	a, (iy + 83)
+	ld	c, a
+	xor	a, h
+	ld	b, a
+	ld	a, d
+	xor	a, (iy + 80)
+	xor	a, b
+	ld	(iy + -48), a
+	ld	a, (iy + 65)
+	xor	a, (iy + 66)
+	ld	d, a
+	ld	a, b
+	xor	a, (iy + 81)
+	xor	a, d
+	ld	(iy + -47), a
+	ld	a, (iy + 82)
+	xor	a, (ix + -12)
+	xor	a, b
+	ld	(iy + -46), a
+	ld	a, (iy + 64)
+	xor	a, (iy + 67)
+	ld	d, a
+	ld	a, b
+	xor	a, (iy + 83)
+	xor	a, d
+	ld	(iy + -45), a
+	ld	a, (iy + 96)
+	xor	a, (iy + 97)
+	ld	b, a
+	ld	a, (iy + 98)
+	xor	a, (iy + 99)
+	ld	d, a
+	xor	a, b
+	ld	(ix + -12), d
+	ld	d, a
+	ld	a, h
+	xor	a, (iy + 96)
+	xor	a, d
+	ld	(iy + -32), a
+	ld	a, (iy + 81)
+	xor	a, (iy + 82)
+	ld	h, a
+	ld	a, d
+	xor	a, (iy + 97)
+	xor	a, h
+	ld	(iy + -31), a
+	ld	a, c
+	xor	a, (iy + 98)
+	xor	a, d
+	ld	(iy + -30), a
+	ld	a, (iy + 80)
+	xor	a, (iy + 83)
+	xor	a, (iy + 99)
+	xor	a, d
+	ld	(iy + -29), a
+	ld	a, l
+	xor	a, e
+	ld	h, a
+	xor	a, (iy + 112)
+	xor	a, b
+	ld	(iy + -16), a
+	ld	a, (iy + 97)
+	xor	a, (iy + 98)
+	ld	c, a
+	ld	a, h
+	xor	a, (iy + 113)
+	xor	a, c
+	ld	(iy + -15), a
+	ld	a, h
+	xor	a, (iy + 114)
+	xor	a, (ix + -12)
+	ld	(iy + -14), a
+	ld	a, (iy + 96)
+	xor	a, (iy + 99)
+	ld	d, a
+	ld	a, h
+	xor	a, (iy + 115)
+	xor	a, d
+	ld	(iy + -13), a
+	lea	iy, iy + 4
+	dec	(ix + -9)
+	jq	nz, .column
+	lea	iy, iy + -16
+	ret
+
+; InvMixColumns, B to A
+_aes_bs_invmix:
+	ld	(ix + -9), 4
+.column:
+	ld	a, (iy + 0)
+	xor	a, (iy + 2)
+	ld	b, a
+	ld	a, (iy + 16)
+	xor	a, (iy + 18)
+	ld	c, a
+	ld	a, (iy + 32)
+	xor	a, (iy + 34)
+	ld	d, a
+	ld	a, (iy + 48)
+	xor	a, (iy + 50)
+	ld	e, a
+	ld	a, (iy + 64)
+	xor	a, (iy + 66)
+	ld	h, a
+	ld	a, (iy + 80)
+	xor	a, (iy + 82)
+	ld	l, a
+	ld	a, (iy + 96)
+	xor	a, (iy + 98)
+	ld	(ix + -12), h
+	ld	h, a
+	ld	a, (iy + 112)
+	xor	a, (iy + 114)
+	ld	(ix + -13), e
+	ld	e, a
+	ld	a, h
+	xor	a, (iy + 0)
+	ld	(ix + -14), d
+	ld	d, a
+	ld	a, (iy + 1)
+	xor	a, (iy + 3)
+	ld	(ix + -15), c
+	ld	c, a
+	ld	a, (iy + 17)
+	xor	a, (iy + 19)
+	ld	(ix + -16), a
+	ld	a, (iy + 33)
+	xor	a, (iy + 35)
+	ld	(ix + -17), a
+	ld	a, (iy + 49)
+	xor	a, (iy + 51)
+	ld	(ix + -18), a
+	ld	a, (iy + 65)
+	xor	a, (iy + 67)
+	ld	(ix + -19), a
+	ld	a, (iy + 81)
+	xor	a, (iy + 83)
+	ld	(ix + -20), c
+	ld	c, a
+	ld	a, (iy + 97)
+	xor	a, (iy + 99)
+	ld	(ix + -21), b
+	ld	b, a
+	ld	a, (iy + 113)
+	xor	a, (iy + 115)
+	ld	(ix + -22), a
+	ld	a, b
+	xor	a, (iy + 1)
+	ld	(ix + -23), e
+	ld	e, a
+	xor	a, d
+	ld	(ix + -24), e
+	ld	e, a
+	ld	a, h
+	xor	a, (iy + 2)
+	ld	(ix + -25), h
+	ld	h, a
+	ld	a, b
+	xor	a, (iy + 3)
+	ld	(ix + -26), b
+	ld	b, a
+	xor	a, h
+	ld	(ix + -27), b
+	ld	b, a
+	xor	a, e
+	ld	(ix + -28), b
+	ld	b, a
+	ld	a, l
+	xor	a, (iy + 112)
+	ld	(ix + -29), e
+	ld	e, a
+	ld	a, c
+	xor	a, (iy + 113)
+	ld	(ix + -30), h
+	ld	h, a
+	xor	a, e
+	ld	(ix + -31), e
+	ld	e, a
+	xor	a, b
+	xor	a, d
+	ld	(iy + -128), a
+	ld	a, l
+	xor	a, (iy + 114)
+	ld	l, a
+	xor	a, h
+	ld	(ix + -32), h
+	ld	h, a
+	ld	a, b
+	xor	a, (ix + -24)
+	xor	a, h
+	ld	(iy + -127), a
+	ld	a, c
+	xor	a, (iy + 115)
+	ld	c, a
+	xor	a, l
+	ld	(ix + -33), l
+	ld	l, a
+	ld	a, b
+	xor	a, (ix + -30)
+	xor	a, l
+	ld	(iy + -126), a
+	ld	a, c
+	xor	a, (ix + -31)
+	ld	(ix + -34), c
+	ld	c, a
+	ld	a, b
+	xor	a, (ix + -27)
+	xor	a, c
+	ld	(iy + -125), a
+	ld	a, (iy + 16)
+	xor	a, (ix + -25)
+	xor	a, (ix + -23)
+	ld	b, a
+	ld	a, (iy + 17)
+	xor	a, (ix + -26)
+	xor	a, (ix + -22)
+	ld	(ix + -35), c
+	ld	c, a
+	xor	a, b
+	ld	(ix + -36), d
+	ld	d, a
+	ld	a, (iy + 18)
+	xor	a, (ix + -25)
+	xor	a, (ix + -23)
+	ld	(ix + -37), l
+	ld	l, a
+	ld	a, (iy + 19)
+	xor	a, (ix + -26)
+	xor	a, (ix + -22)
+	ld	(ix + -38), h
+	ld	h, a
+	xor	a, l
+	ld	(ix + -39), h
+	ld	h, a
+	xor	a, d
+	ld	(ix + -40), h
+	ld	h, a
+	ld	a, e
+	xor	a, (ix + -29)
+	xor	a, b
+	xor	a, h
+	ld	(iy + -112), a
+	ld	a, (ix + -24)
+	xor	a, (ix + -30)
+	ld	(ix + -30), e
+	ld	e, a
+	ld	a, c
+	xor	a, (ix + -38)
+	xor	a, h
+	xor	a, e
+	ld	(iy + -111), a
+	ld	a, (ix + -28)
+	xor	a, (ix + -37)
+	xor	a, l
+	xor	a, h
+	ld	(iy + -110), a
+	ld	a, (ix + -27)
+	xor	a, (ix + -36)
+	ld	e, a
+	ld	a, (ix + -35)
+	xor	a, (ix + -39)
+	xor	a, h
+	xor	a, e
+	ld	(iy + -109), a
+	ld	a, (iy + 32)
+	xor	a, (ix + -21)
+	xor	a, (ix + -23)
+	ld	h, a
+	ld	a, (iy + 33)
+	xor	a, (ix + -20)
+	xor	a, (ix + -22)
+	ld	e, a
+	xor	a, h
+	ld	(ix + -36), b
+	ld	b, a
+	ld	a, (iy + 34)
+	xor	a, (ix + -21)
+	xor	a, (ix + -23)
+	ld	(ix + -21), e
+	ld	e, a
+	ld	a, (iy + 35)
+	xor	a, (ix + -20)
+	xor	a, (ix + -22)
+	ld	(ix + -20), c
+	ld	c, a
+	xor	a, e
+	ld	(ix + -27), c
+	ld	c, a
+	xor	a, b
+	ld	(ix + -28), c
+	ld	c, a
+	ld	a, d
+	xor	a, h
+	xor	a, c
+	ld	(iy + -96), a
+	ld	a, l
+	xor	a, (ix + -20)
+	ld	d, a
+	ld	a, c
+	xor	a, (ix + -21)
+	xor	a, d
+	ld	(iy + -95), a
+	ld	a, e
+	xor	a, (ix + -40)
+	xor	a, c
+	ld	(iy + -94), a
+	ld	a, (ix + -36)
+	xor	a, (ix + -39)
+	ld	l, a
+	ld	a, c
+	xor	a, (ix + -27)
+	xor	a, l
+	ld	(iy + -93), a
+	ld	a, (iy + 48)
+	xor	a, (ix + -15)
+	xor	a, (ix + -25)
+	ld	d, a
+	ld	a, (iy + 49)
+	xor	a, (ix + -16)
+	xor	a, (ix + -26)
+	ld	c, a
+	xor	a, d
+	ld	l, a
+	ld	a, (iy + 50)
+	xor	a, (ix + -15)
+	xor	a, (ix + -25)
+	ld	(ix + -15), h
+	ld	h, a
+	ld	a, (iy + 51)
+	xor	a, (ix + -16)
+	xor	a, (ix + -26)
+	ld	(ix + -16), c
+	ld	c, a
+	xor	a, h
+	ld	(ix + -39), c
+	ld	c, a
+	xor	a, l
+	ld	(ix + -36), c
+	ld	c, a
+	ld	a, b
+	xor	a, (ix + -30)
+	xor	a, d
+	xor	a, c
+	ld	(iy + -80), a
+	ld	a, e
+	xor	a, (ix + -21)
+	xor	a, (ix + -38)
+	xor	a, (ix + -16)
+	xor	a, c
+	ld	(iy + -79), a
+	ld	a, (ix + -37)
+	xor	a, (ix + -28)
+	xor	a, h
+	xor	a, c
+	ld	(iy + -78), a
+	ld	a, (ix + -15)
+	xor	a, (ix + -27)
+	xor	a, (ix + -35)
+	xor	a, (ix + -39)
+	xor	a, c
+	ld	(iy + -77), a
+	ld	a, (iy + 64)
+	xor	a, (ix + -14)
+	xor	a, (ix + -25)
+	xor	a, (ix + -23)
+	ld	b, a
+	ld	a, (iy + 65)
+	xor	a, (ix + -17)
+	xor	a, (ix + -26)
+	xor	a, (ix + -22)
+	ld	e, a
+	xor	a, b
+	ld	c, a
+	ld	a, (iy + 66)
+	xor	a, (ix + -14)
+	xor	a, (ix + -25)
+	xor	a, (ix + -23)
+	ld	(ix + -25), d
+	ld	d, a
+	ld	a, (iy + 67)
+	xor	a, (ix + -17)
+	xor	a, (ix + -26)
+	xor	a, (ix + -22)
+	ld	(ix + -26), e
+	ld	e, a
+	xor	a, d
+	ld	(ix + -17), e
+	ld	e, a
+	xor	a, c
+	ld	(ix + -14), e
+	ld	e, a
+	xor	a, b
+	xor	a, (ix + -30)
+	xor	a, l
+	ld	(iy + -64), a
+	ld	a, h
+	xor	a, (ix + -16)
+	ld	l, a
+	ld	a, e
+	xor	a, (ix + -26)
+	xor	a, l
+	xor	a, (ix + -38)
+	ld	(iy + -63), a
+	ld	a, d
+	xor	a, e
+	xor	a, (ix + -37)
+	xor	a, (ix + -36)
+	ld	(iy + -62), a
+	ld	a, (ix + -25)
+	xor	a, (ix + -39)
+	ld	h, a
+	ld	a, e
+	xor	a, (ix + -17)
+	xor	a, h
+	xor	a, (ix + -35)
+	ld	(iy + -61), a
+	ld	a, (iy + 80)
+	xor	a, (ix + -13)
+	xor	a, (ix + -23)
+	ld	l, a
+	ld	a, (iy + 81)
+	xor	a, (ix + -18)
+	xor	a, (ix + -22)
+	ld	e, a
+	xor	a, l
+	ld	h, a
+	ld	a, (iy + 82)
+	xor	a, (ix + -13)
+	xor	a, (ix + -23)
+	ld	(ix + -23), b
+	ld	b, a
+	ld	a, (iy + 83)
+	xor	a, (ix + -18)
+	xor	a, (ix + -22)
+	ld	(ix + -22), e
+	ld	e, a
+	xor	a, b
+	ld	(ix + -18), e
+	ld	e, a
+	xor	a, h
+	ld	(ix + -13), e
+	ld	e, a
+	ld	a, c
+	xor	a, l
+	xor	a, e
+	ld	(iy + -48), a
+	ld	a, d
+	xor	a, (ix + -26)
+	ld	c, a
+	ld	a, e
+	xor	a, (ix + -22)
+	xor	a, c
+	ld	(iy + -47), a
+	ld	a, b
+	xor	a, (ix + -14)
+	xor	a, e
+	ld	(iy + -46), a
+	ld	a, (ix + -23)
+	xor	a, (ix + -17)
+	ld	d, a
+	ld	a, e
+	xor	a, (ix + -18)
+	xor	a, d
+	ld	(iy + -45), a
+	ld	a, (iy + 96)
+	xor	a, (ix + -12)
+	ld	c, a
+	ld	a, (iy + 97)
+	xor	a, (ix + -19)
+	ld	e, a
+	xor	a, c
+	ld	d, a
+	ld	a, (iy + 98)
+	xor	a, (ix + -12)
+	ld	(ix + -12), l
+	ld	l, a
+	ld	a, (iy + 99)
+	xor	a, (ix + -19)
+	ld	(ix + -19), e
+	ld	e, a
+	xor	a, l
+	ld	(ix + -17), e
+	ld	e, a
+	xor	a, d
+	ld	(ix + -23), e
+	ld	e, a
+	ld	a, h
+	xor	a, c
+	xor	a, e
+	ld	(iy + -32), a
+	ld	a, b
+	xor	a, (ix + -22)
+	ld	h, a
+	ld	a, e
+	xor	a, (ix + -19)
+	xor	a, h
+	ld	(iy + -31), a
+	ld	a, l
+	xor	a, (ix + -13)
+	xor	a, e
+	ld	(iy + -30), a
+	ld	a, (ix + -12)
+	xor	a, (ix + -18)
+	ld	b, a
+	ld	a, e
+	xor	a, (ix + -17)
+	xor	a, b
+	ld	(iy + -29), a
+	ld	a, (ix + -30)
+	xor	a, (ix + -37)
+	ld	h, a
+	xor	a, d
+	xor	a, (ix + -31)
+	ld	(iy + -16), a
+	ld	a, l
+	xor	a, (ix + -19)
+	xor	a, h
+	xor	a, (ix + -32)
+	ld	(iy + -15), a
+	ld	a, h
+	xor	a, (ix + -23)
+	xor	a, (ix + -33)
+	ld	(iy + -14), a
+	ld	a, c
+	xor	a, (ix + -17)
+	xor	a, h
+	xor	a, (ix + -34)
+	ld	(iy + -13), a
+	lea	iy, iy + 4
+	dec	(ix + -9)
+	jq	nz, .column
+	lea	iy, iy + -16
+	ret
+
+; _aes_ctr_bs(ks, ctr, out, len);
+; xors the CTR keystream into out, eight counter blocks per batch
+_aes_ctr_bs:
+	ld	hl, -128
+	call	ti._frameset
+.batch:
+	ld	bc, (ix + 15)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .done
+	lea	de, ix - 128
+	ld	a, 8
+.fill:
+	ld	hl, (ix + 9)
+	ld	bc, 16
+	ldir
+	push	af
+	push	de
+	ld	hl, 16
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	call	_increment_iv
+	pop	hl, hl
+	pop	de
+	pop	af
+	dec	a
+	jq	nz, .fill
+	lea	hl, ix - 128
+	ld	de, (ix + 6)
+	xor	a, a
+	call	_aes_bs_crypt
+	; bc = min(128, len)
+	ld	hl, (ix + 15)
+	ld	bc, 128
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .full
+	add	hl, bc
+	push	hl
+	pop	bc
+	or	a, a
+	sbc	hl, hl
+.full:
+	ld	(ix + 15), hl
+	ld	hl, (ix + 12)
+	lea	de, ix - 128
+	call	_aes_bs_xor
+	ld	(ix + 12), hl
+	jq	.batch
+.done:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; _aes_cbc_decrypt_bs(ks, iv, in, len, out);
+; len is a multiple of 16, iv is left holding the last ciphertext block
+_aes_cbc_decrypt_bs:
+	ld	hl, -128
+	call	ti._frameset
+.batch:
+	ld	bc, (ix + 15)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .done
+	; bc = min(128, len)
+	ld	bc, 128
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .full
+	add	hl, bc
+	push	hl
+	pop	bc
+	or	a, a
+	sbc	hl, hl
+.full:
+	ld	(ix + 15), hl
+	push	bc
+	ld	hl, (ix + 12)
+	lea	de, ix - 128
+	ldir
+	lea	hl, ix - 128
+	ld	de, (ix + 6)
+	ld	a, 1
+	call	_aes_bs_crypt
+	; every block is xored with the ciphertext block before it, the first with the iv,
+	; all read before anything is written in case in and out overlap
+	lea	hl, ix - 128
+	ld	de, (ix + 9)
+	ld	bc, 16
+	call	_aes_bs_xor
+	pop	hl
+	push	hl
+	ld	de, -16
+	add	hl, de
+	push	hl
+	pop	bc
+	ld	a, b
+	or	a, c
+	jq	z, .chained
+	lea	hl, ix - 112
+	ld	de, (ix + 12)
+	call	_aes_bs_xor
+.chained:
+	pop	bc
+	ld	hl, (ix + 12)
+	add	hl, bc
+	ld	(ix + 12), hl
+	ld	de, -16
+	add	hl, de
+	ld	de, (ix + 9)
+	push	bc
+	ld	bc, 16
+	ldir
+	pop	bc
+	lea	hl, ix - 128
+	ld	de, (ix + 18)
+	ldir
+	ld	(ix + 18), de
+	jq	.batch
+.done:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; hl ^= de for bc bytes, bc nonzero
+; returns hl and de just past the end
+_aes_bs_xor:
+	ld	a, (de)
+	xor	a, (hl)
+	ld	(hl), a
+	inc	de
+	inc	hl
+	dec	bc
+	ld	a, c
+	or	a, b
+	jq	nz, _aes_bs_xor
+	ret
+end if
+
+;------------------------------------------
+; aes key schedule cache
+virtual at 0
+	aesc_offset_entries     rb 3
+	aesc_offset_capacity    rb 3
+	aesc_offset_clock       rb 3
+	_aes_cache_size:
+end virtual
+virtual at 0
+	aesc_entry_fingerprint  rb 3
+	aesc_entry_stamp        rb 3
+	aesc_entry_ks           rb 3 + 240
+	_aes_cache_entry_size:
+end virtual
+
+; aes_cache_init(cache, arena, size);
+aes_cache_init:
+	call	ti._frameset0
+	ld	hl, (ix + 12)
+	ld	bc, _aes_cache_entry_size
+	call	ti._idivu
+	ld	iy, (ix + 6)
+	ld	(iy + aesc_offset_capacity), hl
+	ld	de, (ix + 9)
+	ld	(iy + aesc_offset_entries), de
+	push	hl
+	call	_aes_cache_wipe
+	pop	hl
+	ld	sp, ix
+	pop	ix
+	ret
+
+; aes_cache_clear(cache);
+aes_cache_clear:
+	pop	de, iy
+	push	iy, de
+	; fall through
+
+; iy = cache
+; zeroes every entry and restarts the clock
+_aes_cache_wipe:
+	or	a, a
+	sbc	hl, hl
+	ld	(iy + aesc_offset_clock), hl
+	ld	hl, (iy + aesc_offset_capacity)
+	ld	bc, _aes_cache_entry_size
+	call	ti._imulu
+	push	hl
+	ld	hl, 0
+	push	hl
+	ld	hl, (iy + aesc_offset_entries)
+	push	hl
+	call	ti._memset
+	pop	hl, hl, hl
+	ret
+
+; iy = entry
+_aes_cache_wipe_entry:
+	lea	hl, iy + 0
+	lea	de, iy + 1
+	ld	(hl), 0
+	ld	bc, _aes_cache_entry_size - 1
+	ldir
+	ret
+
+; de = key, bc = keylen
+; returns hl = 24-bit fingerprint of the key
+_aes_cache_fingerprint:
+	or	a, a
+	sbc	hl, hl
+	add	hl, bc
+.loop:
+	push	de
+	push	hl
+	pop	de
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, de
+	pop	de
+	ld	a, (de)
+	xor	a, l
+	ld	l, a
+	inc	de
+	dec	bc
+	ld	a, b
+	or	a, c
+	jq	nz, .loop
+	ret
+
+; looks a key up, using the frame of aes_cache_get or aes_cache_evict
+; returns carry set if keylen is not 16, 24, or 32
+_aes_cache_find:
+	ld	hl, (ix + 12)
+	ld	de, 33
+	or	a, a
+	sbc	hl, de
+	ccf
+	ret	c
+	ld	a, (ix + 12)
+	cp	a, 16
+	ret	c
+	and	a, 7
+	add	a, 255
+	ret	c
+
+	ld	de, (ix + 9)
+	ld	bc, (ix + 12)
+	call	_aes_cache_fingerprint
+	ld	(ix - 3), hl
+	or	a, a
+	sbc	hl, hl
+	ld	(ix - 9), hl
+	ld	(ix - 12), hl
+	dec	hl
+	ld	(ix - 15), hl
+	ld	iy, (ix + 6)
+	ld	hl, (iy + aesc_offset_entries)
+	ld	(ix - 6), hl
+	ld	bc, (iy + aesc_offset_capacity)
+.loop:
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	ret	z
+	dec	bc
+	push	bc
+	ld	iy, (ix - 6)
+
+	; track the least recently used entry, empty entries have stamp 0
+	ld	hl, (iy + aesc_entry_stamp)
+	ld	de, (ix - 15)
+	or	a, a
+	sbc	hl, de
+	jq	nc, .lru
+	add	hl, de
+	ld	(ix - 15), hl
+	ld	(ix - 9), iy
+.lru:
+	; empty entries never match, their key size is 0
+	ld	hl, (iy + aesc_entry_fingerprint)
+	ld	de, (ix - 3)
+	or	a, a
+	sbc	hl, de
+	jq	nz, .next
+	ld	hl, (ix + 12)
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	ld	de, (iy + aesc_entry_ks)
+	or	a, a
+	sbc	hl, de
+	jq	nz, .next
+
+	; confirm, the round keys start with the key itself, one little endian word at a time
+	ld	de, (ix + 9)
+	lea	iy, iy + aesc_entry_ks + 3
+	ld	a, (ix + 12)
+	rrca
+	rrca
+	ld	b, a
+	ld	c, 0
+.compare:
+	ld	a, (de)
+	xor	a, (iy + 3)
+	or	a, c
+	ld	c, a
+	inc	de
+	ld	a, (de)
+	xor	a, (iy + 2)
+	or	a, c
+	ld	c, a
+	inc	de
+	ld	a, (de)
+	xor	a, (iy + 1)
+	or	a, c
+	ld	c, a
+	inc	de
+	ld	a, (de)
+	xor	a, (iy + 0)
+	or	a, c
+	ld	c, a
+	inc	de
+	lea	iy, iy + 4
+	djnz	.compare
+	or	a, a
+	jq	nz, .next
+	ld	hl, (ix - 6)
+	ld	(ix - 12), hl
+.next:
+	ld	hl, (ix - 6)
+	ld	de, _aes_cache_entry_size
+	add	hl, de
+	ld	(ix - 6), hl
+	pop	bc
+	jq	.loop
+
+; aes_cache_get(cache, key, keylen);
+aes_cache_get:
+	ld	hl, -15
+	call	ti._frameset
+	; (ix+6) cache
+	; (ix+9) key
+	; (ix+12) keylen
+	; (ix-3) key fingerprint
+	; (ix-6) current entry
+	; (ix-9) least recently used entry
+	; (ix-12) matching entry
+	; (ix-15) oldest stamp
+
+	; stamps are 24 bits, start over rather than wrap
+	ld	iy, (ix + 6)
+	ld	hl, (iy + aesc_offset_clock)
+	ld	de, 1
+	add	hl, de
+	call	c, _aes_cache_wipe
+	call	_aes_cache_find
+	jq	c, .null
+	ld	bc, (ix - 12)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	nz, .hit
+
+	; miss, expand the key into the least recently used entry
+	ld	bc, (ix - 9)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .null
+	push	bc
+	pop	iy
+	call	_aes_cache_wipe_entry
+	ld	hl, (ix + 12)
+	push	hl
+	pea	iy + aesc_entry_ks
+	ld	hl, (ix + 9)
+	push	hl
+	call	aes_init
+	pop	hl, hl, hl
+	ld	iy, (ix - 9)
+	ld	hl, (ix - 3)
+	ld	(iy + aesc_entry_fingerprint), hl
+	ld	(ix - 12), iy
+.hit:
+	ld	iy, (ix + 6)
+	ld	hl, (iy + aesc_offset_clock)
+	inc	hl
+	ld	(iy + aesc_offset_clock), hl
+	ld	iy, (ix - 12)
+	ld	(iy + aesc_entry_stamp), hl
+	lea	hl, iy + aesc_entry_ks
+	jp	stack_clear
+.null:
+	or	a, a
+	sbc	hl, hl
+	jp	stack_clear
+
+; aes_cache_evict(cache, key, keylen);
+aes_cache_evict:
+	ld	hl, -15
+	call	ti._frameset
+	; same frame as aes_cache_get
+	call	_aes_cache_find
+	ld	a, 0
+	jq	c, .exit
+	ld	bc, (ix - 12)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .exit
+	push	bc
+	pop	iy
+	call	_aes_cache_wipe_entry
+	ld	a, 1
+.exit:
+	jp	stack_clear
+
+
+;------------------------------------------
+; aes-siv (RFC 5297), one associated data string
+virtual at 0
+	siv_offset_x            rb 16   ; cmac chaining value, then V
+	siv_offset_buf          rb 16   ; cmac block not yet absorbed
+	siv_offset_fill         rb 1
+	siv_offset_k1           rb 16   ; cmac subkeys
+	siv_offset_k2           rb 16
+	siv_offset_d            rb 16   ; s2v accumulator, then the last block
+	siv_offset_v            rb 16   ; received V when decrypting
+	siv_offset_mac          rb 3 + 240
+	siv_offset_ctr          rb 3 + 240
+	_siv_size:
+end virtual
+
+; aes_siv_encrypt(key, keylen, ad, adlen, in, len, out);
+aes_siv_encrypt:
+	call	_scratch_enter
+	ld	a, 1
+	jq	_aes_siv
+
+; aes_siv_decrypt(key, keylen, ad, adlen, in, len, out);
+aes_siv_decrypt:
+	call	_scratch_enter
+	ld	a, 2
+_aes_siv:
+	ld	hl, -(_siv_size + 5)
+	call	ti._frameset
+	; (ix+6) key
+	; (ix+9) keylen
+	; (ix+12) ad, NULL for no associated data string
+	; (ix+15) adlen
+	; (ix+18) in
+	; (ix+21) len
+	; (ix+24) out
+	; (ix-3) state
+	; (ix-4) mode
+	; (ix-5) half the key length
+	ld	(ix - 4), a
+	ld	iy, 0
+	add	iy, sp
+	ld	(ix - 3), iy
+
+	; K1 for cmac is the first half of the key, K2 for ctr the second
+	ld	hl, (ix + 9)
+	ld	de, 65
+	or	a, a
+	sbc	hl, de
+	jq	nc, .fail
+	ld	a, (ix + 9)
+	srl	a
+	jq	c, .fail
+	ld	(ix - 5), a
+	or	a, a
+	sbc	hl, hl
+	ld	l, a
+	push	hl
+	pea	iy + siv_offset_mac
+	ld	hl, (ix + 6)
+	push	hl
+	call	aes_init
+	pop	hl, hl, hl
+	or	a, a
+	jq	z, .fail
+	ld	iy, (ix - 3)
+	ld	de, siv_offset_ctr
+	add	iy, de
+	or	a, a
+	sbc	hl, hl
+	ld	l, (ix - 5)
+	push	hl
+	push	iy
+	ld	de, (ix + 6)
+	add	hl, de
+	push	hl
+	call	aes_init
+	pop	hl, hl, hl
+	or	a, a
+	jq	z, .fail
+	ld	iy, (ix - 3)
+
+	bit	1, (ix - 4)
+	jq	z, .encrypt
+	; V is the first 16 bytes of the input, the ciphertext follows it
+	ld	hl, (ix + 21)
+	ld	de, 16
+	or	a, a
+	sbc	hl, de
+	jq	c, .fail
+	ld	(ix + 21), hl
+	ld	hl, (ix + 18)
+	lea	de, iy + siv_offset_v
+	ld	bc, 16
+	ldir
+	ld	(ix + 18), hl
+	lea	hl, iy + siv_offset_v
+	lea	de, iy + siv_offset_x
+	ld	c, 16
+	ldir
+	ld	hl, (ix + 18)
+	ld	de, (ix + 24)
+	call	.ctr
+	; authenticate what came out
+	ld	hl, (ix + 24)
+	call	.s2v
+	ld	bc, 16
+	push	bc
+	pea	iy + siv_offset_v
+	pea	iy + siv_offset_x
+	call	digest_compare
+	pop	hl, hl, hl
+	or	a, a
+	jq	nz, .exit
+	; a forged message leaves nothing behind
+	ld	bc, (ix + 21)
+	push	bc
+	ld	bc, 0
+	push	bc
+	ld	hl, (ix + 24)
+	push	hl
+	call	ti._memset
+	pop	hl, hl, hl
+.fail:
+	xor	a, a
+.exit:
+	jp	stack_clear
+
+.encrypt:
+	ld	hl, (ix + 18)
+	call	.s2v
+	lea	hl, iy + siv_offset_x
+	ld	de, (ix + 24)
+	ld	bc, 16
+	ldir
+	ld	hl, (ix + 18)
+	call	.ctr
+	ld	a, 1
+	jq	.exit
+
+; V = S2V(K1, ad, hl), in the state's x, with len at (ix + 21)
+.s2v:
+	push	hl
+	; L = E(0), K1' = dbl(L), K2' = dbl(K1')
+	call	.cmac_init
+	call	.encrypt_x
+	lea	hl, iy + siv_offset_x
+	lea	de, iy + siv_offset_k1
+	ld	bc, 16
+	ldir
+	lea	hl, iy + siv_offset_k1
+	call	_siv_dbl
+	lea	de, iy + siv_offset_k2
+	ld	bc, 16
+	ldir
+	lea	hl, iy + siv_offset_k2
+	call	_siv_dbl
+	; D = CMAC(0)
+	call	.cmac_init
+	ld	(iy + siv_offset_fill), 16
+	call	.cmac_final
+	lea	hl, iy + siv_offset_x
+	lea	de, iy + siv_offset_d
+	ld	bc, 16
+	ldir
+	; D = dbl(D) xor CMAC(ad)
+	ld	bc, (ix + 12)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .no_ad
+	call	.cmac_init
+	ld	de, (ix + 12)
+	ld	bc, (ix + 15)
+	call	.cmac_update
+	call	.cmac_final
+	lea	hl, iy + siv_offset_d
+	call	_siv_dbl
+	ex	de, hl
+	lea	hl, iy + siv_offset_x
+	call	.xor16
+.no_ad:
+	call	.cmac_init
+	pop	de
+	ld	hl, (ix + 21)
+	ld	bc, 16
+	or	a, a
+	sbc	hl, bc
+	jq	c, .short
+	; at least a block: CMAC(in xorend D), D xored into the last 16 bytes
+	push	hl
+	pop	bc
+	call	.cmac_update
+	ex	de, hl
+	lea	de, iy + siv_offset_d
+	call	.xor16
+	jq	.last
+.short:
+	; CMAC(dbl(D) xor pad(in))
+	lea	hl, iy + siv_offset_d
+	call	_siv_dbl
+	ld	a, (ix + 21)
+	or	a, a
+	jq	z, .pad
+	ld	b, a
+.short_xor:
+	ld	a, (de)
+	xor	a, (hl)
+	ld	(hl), a
+	inc	de
+	inc	hl
+	djnz	.short_xor
+.pad:
+	ld	a, (hl)
+	xor	a, $80
+	ld	(hl), a
+.last:
+	lea	de, iy + siv_offset_d
+	ld	bc, 16
+	call	.cmac_update
+	; fall through
+
+; x = CMAC(everything passed to .cmac_update)
+.cmac_final:
+	ld	a, (iy + siv_offset_fill)
+	cp	a, 16
+	lea	hl, iy + siv_offset_k1
+	jq	z, .complete
+	; 10* padding and the second subkey
+	ld	bc, 0
+	ld	c, a
+	lea	hl, iy + siv_offset_buf
+	add	hl, bc
+	ld	(hl), $80
+	ld	a, 15
+	sub	a, c
+	jq	z, .padded
+	ld	b, a
+.zero:
+	inc	hl
+	ld	(hl), 0
+	djnz	.zero
+.padded:
+	lea	hl, iy + siv_offset_k2
+.complete:
+	lea	de, iy + siv_offset_buf
+	call	.xor16
+	; fall through
+
+; x = E(x xor buf)
+.block:
+	push	de
+	lea	hl, iy + siv_offset_buf
+	lea	de, iy + siv_offset_x
+	call	.xor16
+	call	.encrypt_x
+	ld	(iy + siv_offset_fill), 0
+	pop	de
+	ret
+
+; zeroes x and the block buffer
+.cmac_init:
+	lea	hl, iy + siv_offset_x
+	lea	de, iy + siv_offset_x + 1
+	ld	(hl), 0
+	ld	bc, siv_offset_fill
+	ldir
+	ret
+
+; de = data, bc = len
+; the last block is always held back for .cmac_final
+; returns de past the data
+.cmac_update:
+	push	bc
+	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	ret	z
+	ld	a, (iy + siv_offset_fill)
+	cp	a, 16
+	jq	nz, .room
+	push	bc
+	call	.block
+	pop	bc
+	xor	a, a
+.room:
+	push	bc
+	ld	bc, 0
+	ld	c, a
+	lea	hl, iy + siv_offset_buf
+	add	hl, bc
+	ld	a, (de)
+	ld	(hl), a
+	inc	de
+	inc	(iy + siv_offset_fill)
+	pop	bc
+	dec	bc
+	jq	.cmac_update
+
+; (de) ^= (hl), 16 bytes
+.xor16:
+	ld	b, 16
+.xor:
+	ld	a, (de)
+	xor	a, (hl)
+	ld	(de), a
+	inc	de
+	inc	hl
+	djnz	.xor
+	ret
+
+; x = E(K1, x)
+.encrypt_x:
+	pea	iy + siv_offset_mac
+	pea	iy + siv_offset_x
+	pea	iy + siv_offset_x
+	call	aes_ecb_unsafe_encrypt
+	pop	hl, hl, hl
+	ld	iy, (ix - 3)
+	ret
+
+; len bytes from hl to de under CTR(K2, Q), Q = x with bits 63 and 31 cleared
+.ctr:
+	res	7, (iy + siv_offset_x + 8)
+	res	7, (iy + siv_offset_x + 12)
+	ld	bc, (ix + 21)
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	pop	hl
+	ret	z
+	ld	bc, 0
+	push	bc
+	inc	c
+	push	bc
+	pea	iy + siv_offset_x
+	ld	bc, siv_offset_ctr
+	add	iy, bc
+	push	iy, de
+	ld	bc, (ix + 21)
+	push	bc, hl
+	call	aes_encrypt
+	ld	hl, 21
+	add	hl, sp
+	ld	sp, hl
+	ld	iy, (ix - 3)
+	ret
+
+; hl = 16-byte block, doubled in GF(2^128) in place
+; returns hl unchanged
+_siv_dbl:
+	push	hl
+	ld	bc, 15
+	add	hl, bc
+	ld	b, 16
+	or	a, a
+.shift:
+	rl	(hl)
+	dec	hl
+	djnz	.shift
+	sbc	a, a
+	and	a, $87
+	pop	hl
+	push	hl
+	ld	bc, 15
+	add	hl, bc
+	xor	a, (hl)
+	ld	(hl), a
+	pop	hl
+	ret
+
+
+hashlib_AESPadMessage:
+	save_interrupts
+  	ld	hl, -6
+	call	ti._frameset
+	ld	bc, (ix + 9)
+	ld	de, 0
+	push	bc
+	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_1
+	jq	.lbl_10
+.lbl_1:
+	ld	hl, (ix + 6)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_2
+	jq	.lbl_10
+.lbl_2:
+	ld	hl, (ix + 12)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_3
+	jq	.lbl_10
+.lbl_3:
+	push	bc
+	pop	hl
+	ld	bc, 16
+	ld	iy, -16
+	ld	a, l
+	and	a, 15
+	add	hl, bc
+	ld	(ix + -3), hl
+	lea	bc, iy + 0
+	call	ti._iand
+	or	a, a
+	jq	z, .lbl_5
+	ld	(ix + -3), hl
+.lbl_5:
+	ld	l, (ix + 15)
+	ld	a, l
+	or	a, a
+	ld	iy, (ix + 12)
+	jq	nz, .lbl_6
+	ld	hl, (ix + 9)
+	ex	de, hl
+	add	iy, de
+	ld	hl, (ix + -3)
+	or	a, a
+	sbc	hl, de
+	push	hl
+	push	hl
+	push	iy
+	call	ti._memset
+	pop	hl
+	pop	hl
+	pop	hl
+	jq	.lbl_9
+.lbl_6:
+	ld	a, l
+	cp	a, 1
+	ld	bc, (ix + 9)
+	jq	nz, .lbl_10
+	add	iy, bc
+	ld	(ix + -6), iy
+	ld	hl, (ix + -3)
+	or	a, a
+	sbc	hl, bc
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	push	hl
+	push	iy
+	call	ti._memset
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	hl, (ix + -6)
+	set	7, (hl)
+.lbl_9:
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	de, (ix + -3)
+.lbl_10:
+	ex	de, hl
+	ld	sp, ix
+	pop	ix
+	restore_interrupts hashlib_AESPadMessage
+	ret
+ 
+oaep_encode:
+	call	_scratch_enter
+	save_interrupts
+
+	ld	hl, -403
+	call	ti._frameset
+	ld	a, (ix + 21)
+	ld	hl, _hash_out_lens
+	ld	iy, 0
+	lea	de, iy + 0
+	ld	e, a
+	add	hl, de
+	ld	a, (hl)
+	lea	de, iy + 0
+	ld	e, a
+	push	de
+	pop	iy
+	add	iy, iy
+	ld	bc, -379
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), iy
+	ld	bc, 2
+	add	iy, bc
+	ld	hl, (ix + 15)
+	ld	bc, (ix + 9)
+	or	a, a
+	sbc	hl, bc
+	push	ix
+	ld	bc, -382
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	hl, -2
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -379
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	or	a, a
+	sbc	hl, bc
+	push	ix
+	ld	de, -382
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	add	hl, bc
+	push	ix
+	ld	bc, -388
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	de, (ix + -3)
+	push	de
+	pop	hl
+	ld	bc, -1
+	call	ti._ixor
+	ld	bc, (ix + 15)
+	add	hl, bc
+	ld	(ix + -3), bc
+	push	ix
+	ld	bc, -382
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	push	de
+	pop	hl
+	inc	hl
+	push	ix
+	ld	bc, -385
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	push	ix
+	ld	bc, -379
+	add	ix, bc
+	ld	(ix + 0), de
+	pop	ix
+	add	hl, de
+	push	ix
+	ld	bc, -391
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	de, (ix + 9)
+	add	iy, de
+	ld	de, 257
+	ld	bc, (ix + -3)
+	push	bc
+	pop	hl
+	or	a, a
+	sbc	hl, de
+	jq	nc, .lbl_1
+	ld	hl, (ix + 9)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_1
+	ld	hl, (ix + 6)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_1
+	ld	hl, (ix + 12)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_1
+	lea	de, iy + 0
+	push	bc
+	pop	hl
+	or	a, a
+	sbc	hl, de
+	jq	nc, .lbl_10
+.lbl_1:
+	or	a, a
+	sbc	hl, hl
+.lbl_20:
+    restore_interrupts_noret oaep_encode
+    jp stack_clear
+.lbl_10:
+	lea	hl, ix + -120
+	ld	bc, -397
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), hl
+	ld	hl, (ix + 12)
+	ld	(hl), 0
+	ex	de, hl
+	inc	de
+	ld	bc, -379
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -400
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), de
+	push	de
+	call	csrand_fill
+	pop	hl
+	pop	hl
+	ld	a, (ix + 21)
+	ld	l, a
+	push	hl
+	ld	bc, -397
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_init
+	pop	hl
+	pop	hl
+	ld	l, 1
+	xor	a, l
+	bit	0, a
+	ld	hl, 0
+	jq	nz, .lbl_20
+	ld	de, (ix + 18)
+	ld	bc, -376
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	bc, -394
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), hl
+	push	de
+	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_13
+	push	de
+	call	ti._strlen
+	pop	de
+	push	hl
+	ld	hl, (ix + 18)
+	push	hl
+	ld	bc, -397
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_update
+	pop	hl
+	pop	hl
+	pop	hl
+.lbl_13:
+	ld	hl, (ix + 12)
+	ld	bc, -385
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	add	hl, de
+	push	ix
+	ld	bc, -403
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	push	hl
+	ld	bc, -397
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_final
+	pop	hl
+	pop	hl
+	ld	hl, (ix + 12)
+	push	ix
+	ld	bc, -391
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	add	hl, de
+	push	ix
+	ld	bc, -388
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	ld	de, 0
+	push	de
+	push	hl
+	call	ti._memset
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -391
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	de, (hl)
+	push	ix
+	ld	bc, -388
+	add	ix, bc
+	ld	hl, (ix + 0)
+	pop	ix
+	add	hl, de
+	ex	de, hl
+	ld	bc, (ix + 12)
+	push	bc
+	pop	hl
+	add	hl, de
+	ld	(hl), 1
+	inc	de
+	push	bc
+	pop	hl
+	add	hl, de
+	ld	de, (ix + 9)
+	push	de
+	ld	de, (ix + 6)
+	push	de
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	a, (ix + 21)
+	ld	l, a
+	push	hl
+	ld	bc, -382
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -394
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -379
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -400
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_mgf1
+	ld	de, -385
+	lea	hl, ix + 0
+	add	hl, de
+	ld	bc, (hl)
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	de, -394
+	lea	hl, ix + 0
+	add	hl, de
+	ld	iy, (hl)
+	ld	de, (ix + 15)
+.lbl_14:
+	push	de
+	pop	hl
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_16
+	ld	hl, (ix + 12)
+	add	hl, bc
+	ld	a, (hl)
+	xor	a, (iy)
+	ld	(hl), a
+	inc	bc
+	inc	iy
+	jq	.lbl_14
+.lbl_16:
+	ld	a, (ix + 21)
+	ld	l, a
+	push	hl
+	ld	bc, -379
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -394
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -382
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -403
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_mgf1
+	ld	de, (ix + 15)
+	pop	bc
+	pop	bc
+	pop	bc
+	pop	bc
+	pop	bc
+	ld	(ix + -3), de
+	ld	de, -379
+	lea	hl, ix + 0
+	add	hl, de
+	ld	bc, (hl)
+	ld	de, (ix + -3)
+.lbl_17:
+	push	bc
+	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_19
+	ld	(ix + -3), de
+	ld	de, -400
+	lea	hl, ix + 0
+	add	hl, de
+	ld	iy, (hl)
+	ld	a, (iy)
+	push	ix
+	ld	de, -394
+	add	ix, de
+	ld	hl, (ix + 0)
+	pop	ix
+	xor	a, (hl)
+	ld	(iy), a
+	dec	bc
+	inc	hl
+	push	ix
+	add	ix, de
+	ld	(ix + 0), hl
+	pop	ix
+	inc	iy
+	ld	de, -400
+	lea	hl, ix + 0
+	add	hl, de
+	ld	(hl), iy
+	ld	de, (ix + -3)
+	jq	.lbl_17
+.lbl_19:
+	ex	de, hl
+	jq	.lbl_20
+	
+ 
+hashlib_AESStripPadding:
+	save_interrupts
+
+ 	ld	hl, -3
+	call	ti._frameset
+	ld	bc, (ix + 9)
+	ld	de, 0
+	push	bc
+	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_1
+	jq	.lbl_10
+.lbl_1:
+	ld	iy, (ix + 6)
+	lea	hl, iy + 0
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_2
+	jq	.lbl_10
+.lbl_2:
+	ld	hl, (ix + 12)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_3
+	jq	.lbl_10
+.lbl_3:
+	ld	l, (ix + 15)
+	ld	a, l
+	or	a, a
+	jq	nz, .lbl_4
+	push	bc
+	pop	de
+	dec	de
+	lea	hl, iy + 0
+	add	hl, de
+	ld	a, (hl)
+	ld	de, 0
+	ld	e, a
+	push	bc
+	pop	hl
+	or	a, a
+	sbc	hl, de
+	push	hl
+	pop	bc
+	jq	.lbl_9
+.lbl_4:
+	ld	a, l
+	cp	a, 1
+	jq	nz, .lbl_10
+	lea	hl, iy + 0
+	dec	hl
+	ld	(ix + -3), hl
+.lbl_7:
+	ld	hl, (ix + -3)
+	add	hl, bc
+	dec	bc
+	ld	a, (hl)
+	cp	a, -128
+	jq	nz,	.lbl_7
+	inc	bc
+.lbl_9:
+	ld	(ix + -3), bc
+	push	bc
+	push	iy
+	ld	hl, (ix + 12)
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	de, (ix + -3)
+	ld	iy, (ix + 12)
+	add	iy, de
+	ld	hl, (ix + 9)
+	ld	de, (ix + -3)
+	or	a, a
+	sbc	hl, de
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	push	hl
+	push	iy
+	call	ti._memset
+	ld	de, (ix + -3)
+	pop	hl
+	pop	hl
+	pop	hl
+.lbl_10:
+	ex	de, hl
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts hashlib_AESStripPadding
+	ret
+ 
+oaep_decode:
+	call	_scratch_enter
+	save_interrupts
+
+	ld	hl, -729
+	call	ti._frameset
+	ld	de, (ix + 9)
+	ld	bc, 0
+	dec	de
+	ld	iy, 256
+	ex	de, hl
+	lea	de, iy + 0
+	or	a, a
+	sbc	hl, de
+	jq	nc, .lbl_29
+	ld	hl, (ix + 6)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_29
+	ld	hl, (ix + 12)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_29
+	ld	de, -440
+	lea	iy, ix + 0
+	add	iy, de
+	ld	a, (ix + 18)
+	ld	bc, -1
+	ld	hl, _hash_out_lens
+	push	ix
+	ld	de, -714
+	add	ix, de
+	ld	(ix + 0), iy
+	pop	ix
+	lea	de, iy + 114
+	ld	(ix + -3), bc
+	ld	bc, -702
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), de
+	push	ix
+	ld	bc, -696
+	add	ix, bc
+	lea	de, ix + 0
+	pop	ix
+	push	ix
+	ld	bc, -699
+	add	ix, bc
+	ld	(ix + 0), de
+	pop	ix
+	ld	de, 0
+	ld	e, a
+	add	hl, de
+	ld	e, (hl)
+	push	de
+	pop	hl
+	ld	bc, (ix + -3)
+	call	ti._ixor
+	ld	bc, (ix + 9)
+	add	hl, bc
+	ld	(ix + -3), bc
+	push	ix
+	ld	bc, -711
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	bc, -705
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), de
+	push	de
+	pop	hl
+	inc	hl
+	push	ix
+	ld	bc, -708
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	add	hl, de
+	push	ix
+	ld	de, -729
+	add	ix, de
+	ld	(ix + 0), hl
+	pop	ix
+	ld	bc, (ix + -3)
+	push	bc
+	ld	hl, (ix + 6)
+	push	hl
+	ld	bc, -699
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -699
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	ix
+	ld	bc, -708
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	add	hl, de
+	ld	a, (ix + 18)
+	ld	e, a
+	push	de
+	push	ix
+	ld	bc, -705
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	ix
+	ld	bc, -702
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	ix
+	ld	bc, -711
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	hl
+	call	hash_mgf1
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	l, 1
+	xor	a, l
+	bit	0, a
+	jq	nz, .lbl_10
+	lea	hl, ix + -70
+	ld	de, -720
+	lea	iy, ix + 0
+	add	iy, de
+	ld	(iy + 0), hl
+	ld	de, -714
+	lea	hl, ix + 0
+	add	hl, de
+	ld	iy, (hl)
+	lea	hl, iy + 0
+	ld	de, -717
+	lea	iy, ix + 0
+	add	iy, de
+	ld	(iy + 0), hl
+	ld	de, -699
+	lea	hl, ix + 0
+	add	hl, de
+	ld	iy, (hl)
+	inc	iy
+	push	ix
+	ld	de, -702
+	add	ix, de
+	ld	hl, (ix + 0)
+	pop	ix
+	push	ix
+	ld	de, -723
+	add	ix, de
+	ld	(ix + 0), hl
+	pop	ix
+	ld	de, -705
+	lea	hl, ix + 0
+	add	hl, de
+	ld	bc, (hl)
+	push	ix
+	ld	de, -714
+	add	ix, de
+	ld	(ix + 0), bc
+	pop	ix
+.lbl_8:
+	ld	de, -714
+	lea	hl, ix + 0
+	add	hl, de
+	ld	hl, (hl)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_11
+	ld	a, (iy)
+	ld	de, -726
+	lea	hl, ix + 0
+	add	hl, de
+	ld	(hl), iy
+	ld	de, -723
+	lea	iy, ix + 0
+	add	iy, de
+	ld	hl, (iy + 0)
+	xor	a, (hl)
+	push	ix
+	ld	de, -726
+	add	ix, de
+	ld	iy, (ix + 0)
+	pop	ix
+	ld	(iy), a
+	ld	(ix + -3), bc
+	ld	bc, -714
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	dec	de
+	push	ix
+	add	ix, bc
+	ld	(ix + 0), de
+	pop	ix
+	inc	hl
+	push	ix
+	ld	de, -723
+	add	ix, de
+	ld	(ix + 0), hl
+	pop	ix
+	ld	de, -726
+	lea	hl, ix + 0
+	add	hl, de
+	ld	iy, (hl)
+	inc	iy
+	ld	bc, (ix + -3)
+	jq	.lbl_8
+.lbl_11:
+	ld	de, -699
+	lea	hl, ix + 0
+	add	hl, de
+	ld	hl, (hl)
+	inc	hl
+	ld	a, (ix + 18)
+	ld	e, a
+	push	de
+	ld	(ix + -3), bc
+	ld	bc, -711
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	push	de
+	push	ix
+	ld	bc, -702
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	ld	bc, (ix + -3)
+	push	bc
+	push	hl
+	call	hash_mgf1
+	ld	bc, -702
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	de, (ix + 9)
+	ld	(ix + -3), de
+	ld	de, -708
+	lea	hl, ix + 0
+	add	hl, de
+	ld	bc, (hl)
+	ld	de, (ix + -3)
+.lbl_12:
+	push	de
+	pop	hl
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_14
+	ld	(ix + -3), de
+	ld	de, -699
+	lea	hl, ix + 0
+	add	hl, de
+	ld	hl, (hl)
+	add	hl, bc
+	ld	a, (hl)
+	xor	a, (iy)
+	ld	(hl), a
+	inc	bc
+	inc	iy
+	ld	de, (ix + -3)
+	jq	.lbl_12
+.lbl_14:
+	ld	a, (ix + 18)
+	ld	l, a
+	push	hl
+	ld	bc, -717
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_init
+	pop	hl
+	pop	hl
+	ld	hl, (ix + 15)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_16
+	push	hl
+	call	ti._strlen
+	pop	de
+	push	hl
+	ld	hl, (ix + 15)
+	push	hl
+	ld	bc, -717
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_update
+	pop	hl
+	pop	hl
+	pop	hl
+.lbl_16:
+	ld	bc, -720
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -717
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_final
+	pop	hl
+	pop	hl
+	ld	bc, -705
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	ld	bc, -720
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	digest_compare
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	l, 1
+	xor	a, l
+	bit	0, a
+	jq	nz, .lbl_10
+	ld	de, -729
+	lea	hl, ix + 0
+	add	hl, de
+	ld	bc, (hl)
+	push	bc
+	pop	hl
+	ld	de, (ix + 9)
+	or	a, a
+	sbc	hl, de
+	jq	c, .lbl_19
+	push	bc
+	pop	de
+.lbl_19:
+	ld	(ix + -3), bc
+	ld	bc, -702
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), de
+	ld	iy, 0
+	ld	bc, (ix + -3)
+.lbl_20:
+	push	bc
+	pop	hl
+	ld	de, (ix + 9)
+	or	a, a
+	sbc	hl, de
+	jq	nc, .lbl_24
+	ld	de, -699
+	lea	hl, ix + 0
+	add	hl, de
+	ld	hl, (hl)
+	add	hl, bc
+	ld	a, (hl)
+	cp	a, 1
+	jq	z, .lbl_25
+	inc	bc
+	jq	.lbl_20
+.lbl_10:
+	ld	iy, 0
+.lbl_28:
+	lea	bc, iy + 0
+.lbl_29:
+	push	bc
+	pop	hl
+    restore_interrupts_noret oaep_decode
+    jp stack_clear
+.lbl_24:
+	ld	bc, -702
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	de, (hl)
+	jq	.lbl_26
+.lbl_25:
+	push	bc
+	pop	de
+.lbl_26:
+	push	de
+	pop	hl
+	ld	bc, (ix + 9)
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_28
+	inc	de
+	ld	(ix + -3), bc
+	ld	bc, -699
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	add	iy, de
+	ld	bc, (ix + -3)
+	push	bc
+	pop	hl
+	or	a, a
+	sbc	hl, de
+	push	ix
+	ld	bc, -699
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	push	hl
+	push	iy
+	ld	hl, (ix + 12)
+	push	hl
+	call	ti._memcpy
+	ld	bc, -699
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	pop	hl
+	pop	hl
+	pop	hl
+	jq	.lbl_28
+    
+    
+pss_encode:
+	call	_scratch_enter
+	save_interrupts
+
+    ld	hl, -606
+	call	ti._frameset
+	ld	a, (ix + 21)
+	ld	hl, _hash_out_lens
+	ld	iy, -1
+	ld	bc, 0
+	push	bc
+	pop	de
+	ld	e, a
+	add	hl, de
+	ld	a, (hl)
+	push	bc
+	pop	de
+	ld	e, a
+	push	de
+	pop	hl
+	lea	bc, iy + 0
+	call	ti._ixor
+	ld	bc, (ix + 15)
+	ld	(ix + -3), de
+	ld	de, -579
+	lea	iy, ix + 0
+	add	iy, de
+	ld	(iy + 0), hl
+	push	hl
+	pop	iy
+	add	iy, bc
+	ld	bc, -585
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), iy
+	ld	de, (ix + -3)
+	push	de
+	pop	hl
+	push	hl
+	pop	iy
+	add	iy, iy
+	ld	bc, 8
+	add	iy, bc
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -582
+	add	ix, de
+	ld	(ix + 0), iy
+	pop	ix
+	add	hl, bc
+	ld	bc, -588
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), hl
+	ld	bc, -579
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	ld	de, (ix + -3)
+	or	a, a
+	sbc	hl, de
+	push	ix
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	iy, (ix + 15)
+	ld	bc, -128
+	add	iy, bc
+	ld	hl, (ix + 9)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_1
+	ld	hl, (ix + 6)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_1
+	ld	hl, (ix + 12)
+	push	ix
+	ld	bc, -591
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_1
+	ld	bc, -594
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), de
+	ld	de, 129
+	lea	hl, iy + 0
+	or	a, a
+	sbc	hl, de
+	jq	c, .lbl_8
+.lbl_1:
+	or	a, a
+	sbc	hl, hl
+.lbl_17:
+    restore_interrupts_noret pss_encode
+	jp stack_clear
+.lbl_8:
+	ld	bc, -320
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	bc, -142
+	lea	hl, ix + 0
+	add	hl, bc
+	push	ix
+	ld	bc, -600
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	bc, -603
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), iy
+	lea	hl, iy + 64
+	ld	bc, -597
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), hl
+	ld	hl, (ix + 15)
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	call	ti._memset
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	hl, 136
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	push	hl
+	ld	bc, -600
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	ti._memset
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	a, (ix + 21)
+	ld	l, a
+	push	hl
+	ld	bc, -597
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_init
+	pop	hl
+	pop	hl
+	ld	l, 1
+	xor	a, l
+	bit	0, a
+	ld	hl, 0
+	jq	nz, .lbl_17
+	ld	bc, -603
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	lea	hl, iy + 0
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), hl
+	ld	bc, -576
+	lea	hl, ix + 0
+	add	hl, bc
+	push	ix
+	ld	bc, -606
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	ld	bc, -597
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_update
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -600
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	pea	iy + 8
+	ld	bc, -597
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	hl, (iy + 0)
+	push	hl
+	call	hash_final
+	ld	de, (ix + 18)
+	pop	hl
+	pop	hl
+	ld	bc, -600
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -588
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	add	iy, bc
+	ld	de, (ix + -3)
+	push	de
+	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	push	ix
+	ld	bc, -588
+	push	af
+	add	ix, bc
+	pop	af
+	ld	(ix + 0), iy
+	pop	ix
+	jq	nz, .lbl_11
+	ld	bc, -594
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	push	iy
+	call	csrand_fill
+	jq	.lbl_12
+.lbl_11:
+	ld	bc, -594
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	push	de
+	push	iy
+	call	ti._memcpy
+	pop	hl
+.lbl_12:
+	pop	hl
+	pop	hl
+	ld	bc, -579
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	ld	de, (ix + 15)
+	add	hl, de
+	ex	de, hl
+	ld	hl, (ix + 12)
+	add	hl, de
+	ld	bc, -594
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	push	de
+	push	ix
+	ld	bc, -588
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	de, (ix + 15)
+	dec	de
+	push	de
+	pop	hl
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -579
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	add	hl, bc
+	push	hl
+	pop	bc
+	ld	iy, (ix + 12)
+	lea	hl, iy + 0
+	add	hl, bc
+	ld	(hl), 1
+	lea	hl, iy + 0
+	ld	de, (ix + -3)
+	add	hl, de
+	ld	(hl), -68
+	ld	a, (ix + 21)
+	ld	l, a
+	ld	bc, -579
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), hl
+	push	hl
+	ld	bc, -597
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_init
+	pop	hl
+	pop	hl
+	ld	bc, -582
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -600
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -597
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_update
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -603
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -597
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_final
+	pop	hl
+	pop	hl
+	ld	hl, (ix + 12)
+	push	ix
+	ld	bc, -585
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	add	hl, de
+	push	ix
+	ld	bc, -594
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	ix
+	ld	bc, -603
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -579
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -585
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -606
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -594
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -603
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_mgf1
+	ld	de, -594
+	lea	hl, ix + 0
+	add	hl, de
+	ld	bc, (hl)
+	ld	de, (ix + 15)
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	inc	bc
+.lbl_14:
+	push	de
+	pop	hl
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_16
+	ld	(ix + -3), de
+	ld	de, -591
+	lea	hl, ix + 0
+	add	hl, de
+	ld	hl, (hl)
+	ld	a, (hl)
+	ld	de, -606
+	lea	iy, ix + 0
+	add	iy, de
+	ld	iy, (iy + 0)
+	xor	a, (iy)
+	ld	(hl), a
+	inc	bc
+	inc	iy
+	push	ix
+	add	ix, de
+	ld	(ix + 0), iy
+	pop	ix
+	inc	hl
+	ld	de, -591
+	lea	iy, ix + 0
+	add	iy, de
+	ld	(iy + 0), hl
+	ld	de, (ix + -3)
+	jq	.lbl_14
+.lbl_16:
+	ex	de, hl
+	jq	.lbl_17
+    
+
+ digest_compare:
+    pop	iy, de, hl, bc
+	push	bc, hl, de, iy
+	xor	a, a
+.loop:
+	ld	iyl, a
+	ld	a, (de)
+	inc	de
+	xor	a, (hl)
+	or	a, iyl
+	cpi
+	jq	pe, .loop
+	add	a, -1
+	sbc	a, a
+	inc	a
+	ret
+    
+	
+hash_mgf1:
+	call	_scratch_enter
+	save_interrupts
+
+   	ld	hl, -328
+	call	ti._frameset
+	ld	bc, -302
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	a, (ix + 18)
+	ld	hl, _hash_out_lens
+	ld	de, 0
+	push	ix
+	ld	bc, -308
+	add	ix, bc
+	ld	(ix + 0), de
+	pop	ix
+	push	ix
+	ld	de, -311
+	add	ix, de
+	ld	(ix + 0), iy
+	pop	ix
+	lea	bc, iy + 114
+	ld	de, 0
+	ld	(ix + -3), bc
+	ld	bc, -305
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), de
+	ld	e, a
+	add	hl, de
+	ld	l, (hl)
+	push	ix
+	ld	de, -320
+	add	ix, de
+	ld	(ix + 0), l
+	pop	ix
+	ld	l, a
+	push	hl
+	ld	bc, (ix + -3)
+	ld	de, -314
+	lea	hl, ix + 0
+	add	hl, de
+	ld	(hl), bc
+	push	bc
+	call	hash_init
+	ld	e, a
+	pop	hl
+	pop	hl
+	ld	l, 1
+	xor	a, l
+	bit	0, a
+	jq	nz, .lbl_6
+	ld	hl, (ix + 6)
+	ld	bc, -321
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), e
+	ld	de, (ix + 9)
+	lea	bc, ix + -70
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -324
+	add	ix, de
+	ld	(ix + 0), bc
+	pop	ix
+	push	ix
+	ld	de, -311
+	add	ix, de
+	ld	iy, (ix + 0)
+	pop	ix
+	lea	bc, iy + 0
+	ld	de, -317
+	lea	iy, ix + 0
+	add	iy, de
+	ld	(iy + 0), bc
+	push	ix
+	ld	de, -305
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	push	ix
+	ld	de, -320
+	add	ix, de
+	ld	a, (ix + 0)
+	pop	ix
+	ld	c, a
+	push	ix
+	ld	de, -305
+	add	ix, de
+	ld	(ix + 0), bc
+	pop	ix
+	ld	de, (ix + -3)
+	push	de
+	push	hl
+	ld	bc, -314
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_update
+	ld	bc, (ix + 15)
+	ld	(ix + -3), bc
+	ld	bc, -321
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	e, (hl)
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, (ix + -3)
+	ld	(ix + -3), de
+	ld	de, -311
+	lea	hl, ix + 0
+	add	hl, de
+	ld	(hl), bc
+	xor	a, a
+	ld	iy, 0
+	ld	de, (ix + -3)
+.lbl_2:
+	lea	hl, iy + 0
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .lbl_6
+	ld	bc, -320
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), iy
+	ld	bc, -305
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	push	de
+	pop	hl
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -311
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	or	a, a
+	sbc	hl, bc
+	ld	de, (ix + -3)
+	jq	c, .lbl_5
+	push	bc
+	pop	de
+.lbl_5:
+	ld	(ix + -3), bc
+	ld	bc, -328
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	(hl), de
+	ld	bc, -308
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	ld	bc, (ix + -3)
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -311
+	add	ix, de
+	ld	(ix + 0), bc
+	pop	ix
+	ld	de, (ix + -3)
+	push	de
+	pop	bc
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -325
+	add	ix, de
+	ld	(ix + 0), a
+	pop	ix
+	ld	l, 24
+	call	ti._lshru
+	ld	a, c
+	ld	(ix + -74), a
+	ld	de, (ix + -3)
+	push	de
+	pop	bc
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -325
+	add	ix, de
+	ld	a, (ix + 0)
+	pop	ix
+	ld	l, 16
+	call	ti._lshru
+	ld	a, c
+	ld	(ix + -73), a
+	ld	de, (ix + -3)
+	push	ix
+	ld	bc, -308
+	add	ix, bc
+	ld	(ix + 0), de
+	pop	ix
+	ld	a, d
+	ld	(ix + -72), a
+	ld	a, e
+	ld	(ix + -71), a
+	ld	hl, 114
+	push	hl
+	ld	bc, -314
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -317
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	hl, 4
+	push	hl
+	pea	ix + -74
+	ld	bc, -317
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_update
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -324
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -317
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hash_final
+	pop	hl
+	pop	hl
+	ld	bc, -320
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	de, (hl)
+	ld	hl, (ix + 12)
+	add	hl, de
+	push	ix
+	ld	bc, -328
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	ix
+	ld	bc, -324
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	push	de
+	push	hl
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -320
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	iy, (hl)
+	push	ix
+	ld	bc, -305
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	add	iy, de
+	push	ix
+	ld	bc, -308
+	add	ix, bc
+	ld	hl, (ix + 0)
+	pop	ix
+	push	ix
+	ld	bc, -325
+	add	ix, bc
+	ld	e, (ix + 0)
+	pop	ix
+	ld	bc, 1
+	xor	a, a
+	call	ti._ladd
+	ld	(ix + -3), bc
+	push	ix
+	ld	bc, -308
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	a, e
+	push	ix
+	ld	bc, -311
+	add	ix, bc
+	ld	hl, (ix + 0)
+	pop	ix
+	push	ix
+	ld	bc, -305
+	add	ix, bc
+	ld	de, (ix + 0)
+	pop	ix
+	or	a, a
+	sbc	hl, de
+	push	ix
+	ld	bc, -311
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	push	ix
+	ld	bc, -321
+	add	ix, bc
+	ld	e, (ix + 0)
+	pop	ix
+	ld	bc, (ix + -3)
+	ld	bc, (ix + 15)
+	jq	.lbl_2
+.lbl_6:
+	ld	a, e
+    restore_interrupts_noret hash_mgf1
+	jp stack_clear
+ 
+	
+rsa_encrypt:
+	call	_scratch_enter
+	save_interrupts
+
+	ld	hl, -6
+	call	ti._frameset
+	ld	hl, (ix + 12)
+	ld	iyl, 0
+	ld	de, 1
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_1
+	jq	.lbl_12
+.lbl_1:
+	ld	hl, (ix + 6)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_2
+	jq	.lbl_12
+.lbl_2:
+	ld	hl, (ix + 15)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_12
+	ld	hl, (ix + 18)
+	ld	de, 3
+	ld	bc, -128
+	add	hl, bc
+	ld	bc, 129
+	or	a, a
+	sbc	hl, bc
+	jq	c, .lbl_4
+	jq	.lbl_12
+.lbl_4:
+	ld	bc, (ix + 18)
+	dec	bc
+	ld	hl, (ix + 15)
+	add	hl, bc
+	ld	a, (hl)
+	and	a, 1
+	ld	l, 1
+	xor	a, l
+	bit	0, a
+	jq	nz, .lbl_12
+	ld	de, 2
+.lbl_6:
+	ld	bc, 0
+	ld	c, iyl
+	ld	hl, (ix + 15)
+	add	hl, bc
+	ld	a, (hl)
+	or	a, a
+	jq	nz, .lbl_8
+	inc	iyl
+	ld	hl, (ix + 12)
+	add	hl, bc
+	ld	(hl), 0
+	jq	.lbl_6
+.lbl_8:
+	ld	iy, (ix + 9)
+	lea	hl, iy + 0
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_9
+	jq	.lbl_12
+.lbl_9:
+	push	bc
+	pop	iy
+	ld	bc, 66
+	add	hl, bc
+	lea	bc, iy + 0
+	push	hl
+	pop	iy
+	ld	hl, (ix + 18)
+	ld	(ix + -6), bc
+	or	a, a
+	sbc	hl, bc
+	ld	(ix + -3), hl
+	lea	bc, iy + 0
+	or	a, a
+	sbc	hl, bc
+	jq	c, .lbl_12
+	ld	hl, (ix + 12)
+	ld	de, (ix + -6)
+	add	hl, de
+	ld	a, (ix + 21)
+	ld	e, a
+	push	de
+	ld	de, 0
+	push	de
+	ld	de, (ix + -3)
+	push	de
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	oaep_encode
+	pop	de
+	pop	de
+	pop	de
+	pop	de
+	pop	de
+	pop	de
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	ld	de, 4
+	jq	z, .lbl_12
+	ld	hl, (ix + 18)
+	ld	bc, 255
+	call	ti._iand
+	ld	de, (ix + 15)
+	push	de
+	ld	de, 65537
+	push	de
+	ld	de, (ix + 12)
+	push	de
+	push	hl
+	call	_powmod
+	pop	hl
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	de, 0
+.lbl_12:
+	ex	de, hl
+	restore_interrupts_noret rsa_encrypt
+	jp stack_clear
+ 
+ 
+;void powmod(uint8_t size, uint8_t *restrict base, uint24_t exp, const uint8_t *restrict mod);
+_powmod:
+   call   _scratch_enter
+   push   ix
+   ld   ix, 0
+   lea   bc, ix
+   add   ix, sp
+.ret  := ix    + long
+.size := .ret  + long
+.base := .size + long
+.exp  := .base + long
+.mod  := .exp  + long
+.acc  := ix    - long
+.tmp  := .acc  - long
+.end  := .tmp  - byte
+   ld   c, (.size)
+   dec   c
+   ld   hl, .end - ix
+   add   hl, sp
+   push   hl
+;   scf
+   sbc   hl, bc
+   push   hl
+;   or   a, a
+   sbc   hl, bc
+   ld   sp, hl
+   call   .alloc
+   call   .enter
+   ld   c, (.size)
+   dec   c
+   inc   bc
+   ld   de, (.acc)
+   lddr ; leaks size
+   ld   hl, (.exp)
+   scf
+.normalize:
+   adc   hl, hl
+   jq   nc, .normalize ; leaks exp
+   xor   a, a
+.loop:
+   push   hl, af
+   ld   hl, (.acc)
+   call   nz, .mul ; leaks exp
+   pop   af
+   ld   hl, (.base)
+   call   c, .mul ; leaks exp
+   pop   hl
+;   or   a, a
+   adc   hl, hl
+   jq   nz, .loop ; leaks exp
+   ld   de, (.tmp)
+   add   hl, de
+   dec   de
+;   ld   bc, 0
+   ld   c, (.size)
+   dec   c
+   ld   (hl), b
+   push   hl
+   lddr ; leaks size
+   pop   hl
+   inc   (hl)
+   ld   iy, (.base)
+   call   .mul.alt
+   ld   sp, ix
+   pop   ix
+   ret
+   ; reserves the stack below hl for the modulus and a multiplicand, one byte of each in turn
+   ; assumes bc = size - 1, hl = sp = the lowest byte used so far
+   ; returns de = the end of the buffer, sp below it
+.alloc:
+   pop   iy
+   dec   hl
+   ex   de, hl
+   ld   hl, 0
+   add   hl, de
+   sbc   hl, bc
+   sbc   hl, bc
+   dec   hl
+   ld   sp, hl
+   jp   (iy)
+   ; vi(base) = vi(base) * R % vi(mod), also sets up nmi
+   ; moves mod into the buffer from .alloc, where mod[i] sits right after the multiplicand's byte i
+   ; assumes bc = size - 1, de = the end of that buffer, vi(base) < vi(mod)
+   ; returns hl = base, bc = 0, cf = 0
+.enter:
+   ld   hl, (.mod)
+   add   hl, bc
+   push   hl
+   dec   de
+   ld   (.mod), de
+   inc   de
+   ld   b, (.size)
+.spread:
+   ld   a, (hl)
+   ld   (de), a
+   dec   hl
+   dec   de
+   dec   de
+   djnz   .spread ; leaks size
+   pop   hl
+   ld   b, bsr 8
+   ld   e, b
+;   ld   e, 1
+.nmi.loop:
+   ld   a, e
+   ld   d, (hl)
+   mlt   de
+   inc   de
+   inc   de
+   ld   d, a
+   mlt   de
+   djnz   .nmi.loop ; leaks size
+   ld   a, e
+   ld   (.nmi), a
+   ld   hl, (.base)
+   add   hl, bc
+   ld   (.base), hl
+   ld   c, 8
+.mod.outer:
+   ld   b, (.size)
+.mod.inner:
+   push   bc, hl
+   ld   b, (.size)
+;   or   a, a
+.shift:
+   rl   (hl)
+   dec   hl
+   djnz   .shift ; leaks size
+   pop   hl
+   push   hl
+   call   .reduce
+   pop   hl, bc
+   djnz   .mod.inner ; leaks size
+   dec   c
+   jq   nz, .mod.outer ; leaks constant
+   ret
+   ; vi(acc) = vi(acc) * vi(hl) % vi(mod)
+   ; assumes bc = 0
+   ; destroys vi(tmp)
+   ; returns bc = 0, cf = 0
+.mul:
+   ld   iy, (.tmp)
+.mul.alt:
+   push   hl
+   lea   hl, iy - 0
+   lea   de, iy - 1
+   ld   c, (.size)
+   dec   c
+   ld   (hl), b
+   lddr ; leaks size
+   ld   de, (.acc)
+   ld   (.acc), iy
+   ld   (.tmp), de
+   pop   hl
+   push   de
+   ld   de, (.mod)
+   ld   b, (.size)
+.mul.spread:
+   ld   a, (hl)
+   ld   (de), a
+   dec   hl
+   dec   de
+   dec   de
+   djnz   .mul.spread ; leaks size
+   pop   de
+   ld   c, (.size)
+   or   a, a
+.mul.outer:
+   ld   a, (de)
+   ld   (.cur), a
+   dec   de
+   push   de, ix, iy, af
+   ld   b, (.size)
+   dec   b
+   ld   ix, (.mod)
+   ld   e, (ix)
+   ld   d, a
+   mlt   de
+   ld   l, (iy)
+   ld   h, 0
+   add   hl, de
+   ld   e, l
+   ld   d, 0
+.nmi := $ - byte
+   mlt   de
+   ld   a, e
+   ld   (.adj), a
+   ld   d, (ix + 1)
+   mlt   de
+   add.s   hl, de
+   ld   e, h
+   ld   d, l
+;   ld   d, 0
+   rl   d
+.mul.inner:
+   lea   ix, ix - 2
+   ld   l, (ix)
+   ld   h, 0
+.cur := $ - byte
+   mlt   hl
+   adc   hl, de
+   ld   e, (ix + 1)
+   ld   d, 0
+.adj := $ - byte
+   mlt   de
+   add.s   hl, de
+   ld   e, h
+   ld   d, 0
+   rl   d
+   ld   a, l
+   dec   iy
+   add   a, (iy)
+   ld   (iy + 1), a
+   djnz   .mul.inner ; leaks size
+   ld   l, b
+   rl   l
+   ld   h, b
+   pop   af
+   adc   hl, de
+   ld   (iy + 0), l
+   sra   h
+   pop   iy, ix, de
+   dec   c
+   jq   nz, .mul.outer ; leaks size
+   lea   hl, iy
+   ; if (cf:vi(hl) >= vi(mod)) cf:vi(hl) -= vi(mod)
+   ; assumes bcu = 0
+   ; destroys vi(tmp)
+   ; returns bc = 0, cf = 0
+.reduce:
+   ccf
+   sbc   a, a
+   ld   c, a
+   ld   b, (.size)
+   ld   de, (.tmp)
+   ld   iy, (.mod)
+   or   a, a
+   push   hl, de
+.reduce.sub:
+   ld   a, (hl)
+   dec   hl
+   sbc   a, (iy + 1)
+   lea   iy, iy - 2
+   ld   (de), a
+   dec   de
+   djnz   .reduce.sub ; leaks size
+   sbc   a, a
+   and   a, c
+   and   a, long
+   sbc   hl, hl
+   ld   l, a
+   add   hl, sp
+   ld   hl, (hl)
+   pop   de, de
+   ld   c, (.size)
+   dec   c
+   inc   bc
+   lddr ; leaks size, assuming that base and stack are in normal ram
+   ret
+ 
+;void powmod_bigexp(uint8_t size, uint8_t *restrict base, const uint8_t *restrict exp, const uint8_t *restrict mod, size_t exp_len);
+; left-to-right sliding window over a big endian exponent of any length
+; reuses the montgomery core of _powmod, so the frame layout must match
+_powmod_bigexp:
+   call   _scratch_enter
+   push   ix
+   ld   ix, 0
+   lea   bc, ix
+   add   ix, sp
+.ret  := ix    + long
+.size := .ret  + long
+.base := .size + long
+.exp  := .base + long
+.mod  := .exp  + long
+.len  := .mod  + long
+.acc  := ix    - long
+.tmp  := .acc  - long
+.sq   := .tmp  - long
+.tbl  := .sq   - long * 8
+.win  := .tbl  - byte
+.wlen := .win  - byte
+.wmax := .wlen - byte
+.run  := .wmax - byte
+.bits := .run  - byte
+.cur  := .bits - byte
+.tcnt := .cur  - byte
+.gen  := .tcnt - byte
+.end  := .gen  - byte
+   ; a base below 256, like a group generator, is multiplied in by doubling and adding
+   ; instead of through the table, so .gen holds it, or 0 for any other base
+   ld   hl, (.base)
+   ld   b, (.size)
+   xor   a, a
+   jq   .small.test
+.small.or:
+   or   a, (hl)
+   inc   hl
+.small.test:
+   djnz   .small.or ; leaks size
+   jq   nz, .small.none ; leaks base
+   ld   a, (hl)
+   cp   a, 2
+   jq   nc, .small.set ; leaks base
+.small.none:
+   xor   a, a
+.small.set:
+   ld   (.gen), a
+   ld   c, (.size)
+   dec   c
+   ld   hl, .end - ix
+   add   hl, sp
+   ld   (.acc), hl
+;   scf
+   sbc   hl, bc
+   ld   (.tmp), hl
+   scf
+   sbc   hl, bc
+   ld   (.sq), hl
+   ; table of base^1, base^3, ... base^(2^w - 1)
+   ; w = 4 up to 128 bytes, w = 3 above that to bound the stack use
+   ld   de, 3 * 256 + 3
+   ld   a, c
+   cp   a, 128
+   jq   nc, .window
+   ld   de, 4 * 256 + 7
+.window:
+   ld   (.wmax), d
+   ld   (.tcnt), e
+   ld   a, e
+   lea   iy, .tbl + long
+.alloc:
+   scf
+   sbc   hl, bc
+   ld   (iy), hl
+   lea   iy, iy + long
+   dec   a
+   jq   nz, .alloc
+   or   a, a
+   sbc   hl, bc
+   ld   sp, hl
+   call   _powmod.alloc
+   call   _powmod.enter
+   ld   (.tbl), hl
+   ld   a, (.gen)
+   or   a, a
+   jq   nz, .start ; leaks base
+   ld   de, (.acc)
+   call   .copy
+   call   .square
+   ld   hl, (.acc)
+   ld   de, (.sq)
+   call   .copy
+   ld   a, (.tcnt)
+   lea   iy, .tbl
+.table:
+   push   af
+   ld   hl, (iy)
+   lea   iy, iy + long
+   push   iy
+   ld   de, (.acc)
+   call   .copy
+   ld   hl, (.sq)
+   call   _powmod.mul
+   pop   iy
+   ld   hl, (.acc)
+   ld   de, (iy)
+   call   .copy
+   pop   af
+   dec   a
+   jq   nz, .table
+.start:
+   xor   a, a
+   ld   (.win), a
+   ld   (.wlen), a
+   ld   (.run), a
+.next_byte:
+   ld   hl, (.len)
+   add   hl, bc
+   or   a, a
+   sbc   hl, bc
+   jq   z, .done
+   dec   hl
+   ld   (.len), hl
+   ld   hl, (.exp)
+   ld   a, (hl)
+   inc   hl
+   ld   (.exp), hl
+   ld   (.cur), a
+   ld   (.bits), 8
+.next_bit:
+   ld   a, (.gen)
+   or   a, a
+   jq   nz, .small.bit ; leaks base
+   ld   a, (.cur)
+   add   a, a
+   ld   (.cur), a
+   ld   a, (.win)
+   adc   a, a
+   jq   z, .zero ; leaks exp
+   ld   (.win), a
+   inc   (.wlen)
+   ld   a, (.wlen)
+   cp   a, (.wmax)
+   call   z, .flush ; leaks exp
+   jq   .next
+.zero:
+   or   a, (.run)
+   call   nz, .square ; leaks exp
+   jq   .next
+.small.bit:
+   ld   a, (.run)
+   or   a, a
+   call   nz, .square ; leaks exp
+   ld   a, (.cur)
+   add   a, a
+   ld   (.cur), a
+   call   c, .small.mul ; leaks exp
+.next:
+   dec   (.bits)
+   jq   nz, .next_bit
+   jq   .next_byte
+.done:
+   ld   a, (.wlen)
+   or   a, a
+   call   nz, .flush ; leaks exp
+   ld   bc, 0
+   ld   hl, (.tmp)
+   push   hl
+   ld   (hl), b
+   ld   c, (.size)
+   dec   c
+   ld   de, (.tmp)
+   dec   de
+   lddr ; leaks size
+   pop   hl
+   inc   (hl)
+   ld   a, (.run)
+   or   a, a
+   jq   nz, .convert
+   ld   de, (.base)
+   call   .copy ; exp == 0
+   jq   .exit
+.convert:
+   ld   iy, (.base)
+   call   _powmod.mul.alt
+.exit:
+   ld   sp, ix
+   pop   ix
+   ret
+   ; vi(acc) = vi(acc) ^ 2 ^ (wlen - t) * tbl[win >> t >> 1] ^ 2 ^ t
+   ; where t is the number of trailing zeros of win
+.flush:
+   ld   a, (.win)
+   ld   bc, 0
+.flush.strip:
+   rrca
+   jq   c, .flush.odd ; leaks exp
+   inc   c
+   jq   .flush.strip
+.flush.odd:
+   and   a, 127
+   push   bc
+   ld   e, a
+   ld   d, long
+   mlt   de
+   lea   hl, .tbl
+   add   hl, de
+   ld   hl, (hl)
+   ld   a, (.run)
+   or   a, a
+   jq   z, .flush.first
+   push   hl
+   ld   a, (.wlen)
+   sub   a, c
+.flush.head:
+   push   af
+   call   .square
+   pop   af
+   dec   a
+   jq   nz, .flush.head ; leaks exp
+   pop   hl
+   call   _powmod.mul
+   jq   .flush.tail
+.flush.first:
+   ld   de, (.acc)
+   call   .copy
+   inc   (.run)
+.flush.tail:
+   pop   bc
+   ld   a, c
+   or   a, a
+   jq   z, .flush.done
+.flush.trail:
+   push   af
+   call   .square
+   pop   af
+   dec   a
+   jq   nz, .flush.trail ; leaks exp
+.flush.done:
+   ld   (.win), a
+   ld   (.wlen), a
+   ret
+   ; vi(acc) = vi(acc) * gen % vi(mod), or vi(acc) = base for the first one bit
+   ; walks the bits of gen below its top one, with a one bit shifted in after them to stop on
+.small.mul:
+   ld   a, (.run)
+   or   a, a
+   jq   nz, .small.step ; leaks exp
+   inc   (.run)
+   ld   hl, (.tbl)
+   ld   de, (.acc)
+   jq   .copy
+.small.step:
+   ld   hl, (.acc)
+   ld   de, (.sq)
+   call   .copy
+   ld   a, (.gen)
+   scf
+.small.top:
+   adc   a, a
+   jq   nc, .small.top ; leaks base
+.small.loop:
+   add   a, a
+   ret   z
+   push   af
+   call   .double
+   pop   af
+   push   af
+   call   c, .add ; leaks base
+   pop   af
+   jq   .small.loop
+   ; vi(acc) = vi(acc) * 2 % vi(mod)
+.double:
+   ld   hl, (.acc)
+   ld   b, (.size)
+   or   a, a
+.double.shift:
+   rl   (hl)
+   dec   hl
+   djnz   .double.shift ; leaks size
+   ld   hl, (.acc)
+   jq   _powmod.reduce
+   ; vi(acc) = vi(acc) + vi(sq) % vi(mod)
+.add:
+   ld   hl, (.acc)
+   ld   de, (.sq)
+   ld   b, (.size)
+   or   a, a
+.add.loop:
+   ld   a, (de)
+   adc   a, (hl)
+   ld   (hl), a
+   dec   hl
+   dec   de
+   djnz   .add.loop ; leaks size
+   ld   hl, (.acc)
+   jq   _powmod.reduce
+   ; vi(acc) = vi(acc) ^ 2 % vi(mod)
+.square:
+   ld   bc, 0
+   ld   hl, (.acc)
+   jq   _powmod.mul
+   ; vi(de) = vi(hl)
+   ; returns bc = 0
+.copy:
+   ld   bc, 0
+   ld   c, (.size)
+   dec   c
+   inc   bc
+   lddr ; leaks size
+   ret
+ 
+ 
+;void _mulmod(uint8_t size, uint8_t *restrict a, const uint8_t *restrict b, const uint8_t *restrict mod);
+; vi(a) = vi(a) * vi(b) % vi(mod), assumes vi(a), vi(b) < vi(mod)
+_mulmod:
+   push   ix
+   ld   ix, 0
+   lea   bc, ix
+   add   ix, sp
+.ret  := ix    + long
+.size := .ret  + long
+.base := .size + long
+.fac  := .base + long
+.mod  := .fac  + long
+.acc  := ix    - long
+.tmp  := .acc  - long
+.end  := .tmp  - byte
+   ld   c, (.size)
+   dec   c
+   ld   hl, .end - ix
+   add   hl, sp
+   push   hl
+;   scf
+   sbc   hl, bc
+   push   hl
+;   or   a, a
+   sbc   hl, bc
+   ld   sp, hl
+   call   _powmod.alloc
+   call   _powmod.enter
+   ld   hl, (.fac)
+   ld   c, (.size)
+   dec   c
+   add   hl, bc
+   inc   bc
+   ld   de, (.acc)
+   lddr ; leaks size
+   ld   hl, (.base)
+   call   _powmod.mul
+   ld   hl, (.acc)
+   ld   de, (.base)
+   ld   c, (.size)
+   dec   c
+   inc   bc
+   lddr ; leaks size
+   ld   sp, ix
+   pop   ix
+   ret
+ 
+ 
+;void _modsub(uint8_t size, uint8_t *restrict a, const uint8_t *restrict b, const uint8_t *restrict mod);
+; vi(a) = (vi(a) - vi(b)) % vi(mod), assumes vi(a), vi(b) < vi(mod)
+_modsub:
+   call   ti._frameset0
+   ld   bc, 0
+   ld   c, (ix + 6)
+   dec   c
+   ld   hl, (ix + 9)
+   add   hl, bc
+   push   hl
+   ld   iy, (ix + 12)
+   add   iy, bc
+   ld   b, (ix + 6)
+;   or   a, a
+.sub:
+   ld   a, (hl)
+   sbc   a, (iy)
+   ld   (hl), a
+   dec   hl
+   dec   iy
+   djnz   .sub ; leaks size
+   ; add the modulus back in if the subtraction borrowed
+   sbc   a, a
+   ld   c, a
+   ld   iy, (ix + 15)
+   ld   de, 0
+   ld   e, (ix + 6)
+   dec   e
+   add   iy, de
+   pop   hl
+   ld   b, (ix + 6)
+.add:
+   ld   a, (iy)
+   and   a, c
+   ld   e, a
+   rr   d
+   ld   a, (hl)
+   adc   a, e
+   ld   (hl), a
+   rl   d
+   dec   hl
+   dec   iy
+   djnz   .add ; leaks size
+   pop   ix
+   ret
+ 
+ 
+;void _mpi_muladd(uint8_t *r, const uint8_t *x, const uint8_t *y, uint8_t len);
+; vi(r) += vi(x) * vi(y), where r is 2 * len bytes and its upper len bytes are zero
+_mpi_muladd:
+   call   ti._frameset0
+   ld   bc, 0
+   ld   c, (ix + 15)
+   dec   c
+   ld   hl, (ix + 9)
+   add   hl, bc
+   ld   (ix + 9), hl
+   ld   hl, (ix + 12)
+   add   hl, bc
+   ld   (ix + 12), hl
+   ld   hl, (ix + 6)
+   add   hl, bc
+   inc   bc
+   add   hl, bc
+   ld   (ix + 6), hl
+   ld   b, c
+.outer:
+   push   bc
+   ld   hl, (ix + 9)
+   ld   a, (hl)
+   ld   (.xi), a
+   dec   hl
+   ld   (ix + 9), hl
+   ld   iy, (ix + 6)
+   lea   de, iy - 1
+   ld   (ix + 6), de
+   ld   hl, (ix + 12)
+   ld   b, (ix + 15)
+   ld   c, 0
+.inner:
+   ld   e, (hl)
+   ld   d, 0
+.xi := $ - byte
+   mlt   de
+   ld   a, e
+   add   a, c
+   ld   e, a
+   ld   a, d
+   adc   a, 0
+   ld   c, a
+   ld   a, e
+   add   a, (iy)
+   ld   (iy), a
+   ld   a, c
+   adc   a, 0
+   ld   c, a
+   dec   hl
+   dec   iy
+   djnz   .inner
+   ld   (iy), c
+   pop   bc
+   djnz   .outer
+   pop   ix
+   ret
+ 
+ 
+;------------------------------------------
+; SRP-6a (RFC 5054, SHA-256)
+virtual at 0
+	srp_offset_modulus      rb 3
+	srp_offset_size         rb 1
+	srp_offset_generator    rb 1
+	srp_offset_secret       rb 32
+	srp_offset_key          rb 32
+	srp_offset_proof        rb 32
+	srp_offset_idhash       rb 32
+	srp_offset_identity     rb _sha256ctx_size
+	srp_offset_pubkey       rb 256
+	_srp_ctx_size:
+end virtual
+
+SRP_OK                  := 0
+SRP_INVALID_SERVER_KEY  := 1
+
+; iy = srp context
+; returns bc = modulus length
+_srp_modlen:
+	ld	bc, 0
+	ld	c, (iy + srp_offset_size)
+	dec	c
+	inc	bc
+	ret
+
+; writes PAD(g) to de
+; iy = srp context
+_srp_pad_generator:
+	call	_srp_modlen
+	dec	bc
+	dec	bc
 	push	de
 	pop	hl
-	lea	bc, iy + 0
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_16
+	ld	(hl), b
+	inc	de
+	ldir
+	ld	a, (iy + srp_offset_generator)
+	ld	(de), a
+	ret
+
+; srp_init(context, modulus, modlen, generator, identity, idlen);
+srp_init:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) modulus
+	; (ix+12) modlen
+	; (ix+15) generator
+	; (ix+18) identity
+	; (ix+21) idlen
+
+	; modulus must be 33 to 256 bytes, odd, with a nonzero leading byte
+	xor	a, a
+	ld	hl, (ix + 12)
+	ld	de, -33
+	add	hl, de
+	jq	nc, .exit
+	ld	de, -(256 - 33 + 1)
+	add	hl, de
+	jq	c, .exit
 	ld	hl, (ix + 9)
-	push	hl
-	push	de
+	or	a, (hl)
+	jq	z, .exit
+	ld	bc, (ix + 12)
+	add	hl, bc
+	dec	hl
+	bit	0, (hl)
+	jq	z, .return_false
+	ld	a, (ix + 15)
+	cp	a, 2
+	jq	c, .return_false
+
+	ld	iy, (ix + 6)
+	ld	(iy + srp_offset_generator), a
+	ld	(iy + srp_offset_size), c
+	ld	hl, (ix + 9)
+	ld	(iy + srp_offset_modulus), hl
+
+	; identity state = I | ":", kept to compute x later
+	ld	de, srp_offset_identity
+	add	iy, de
 	push	iy
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-.lbl_16:
-	lea	hl, ix + -80
-	ld	(ix + -83), hl
-	ld	hl, 16
-	push	hl
+	call	hash_sha256_init
+	pop	de
 	ld	hl, (ix + 18)
-	push	hl
-	ld	hl, (ix + -86)
-	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
+	ld	bc, (ix + 21)
+	call	_sha256_update_nz
+	ld	hl, _srp_colon
+	ld	bc, 1
+	call	_sha256_update_nz
+
+	; idhash = H(I), using the public key field as scratch
+	ld	iy, (ix + 6)
+	ld	de, srp_offset_pubkey
+	add	iy, de
+	push	iy
+	call	hash_sha256_init
+	pop	de
+	ld	hl, (ix + 18)
+	ld	bc, (ix + 21)
+	call	_sha256_update_nz
+	ld	iy, (ix + 6)
+	pea	iy + srp_offset_idhash
+	push	de
+	call	hash_sha256_final
+	pop	de, hl
+	ld	a, 1
+	jq	.exit
+.return_false:
+	xor	a, a
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+_srp_colon:	db ":"
+
+; _srp_compute_x(context, salt, saltlen, password, passlen, x);
+; x = H(s | H(I | ":" | P))
+_srp_compute_x:
+	ld	hl, -_sha256ctx_size
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) salt
+	; (ix+12) saltlen
+	; (ix+15) password
+	; (ix+18) passlen
+	; (ix+21) x
+
+	ld	hl, (ix + 6)
+	ld	de, srp_offset_identity
+	add	hl, de
+	lea	de, ix - _sha256ctx_size
+	ld	bc, _sha256ctx_size
+	ldir
+	lea	de, ix - _sha256ctx_size
+	ld	hl, (ix + 15)
+	ld	bc, (ix + 18)
+	call	_sha256_update_nz
+	ld	hl, (ix + 21)
+	push	hl, de
+	call	hash_sha256_final
+	call	hash_sha256_init
+	pop	de, hl
 	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	call	_sha256_update_nz
+	ld	hl, (ix + 21)
+	ld	bc, 32
+	call	_sha256_update_nz
+	push	hl, de
+	call	hash_sha256_final
+	jp	stack_clear
+
+; srp_verifier(context, salt, saltlen, password, passlen, verifier);
+srp_verifier:
+	call	_scratch_enter
+	ld	hl, -32
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) salt
+	; (ix+12) saltlen
+	; (ix+15) password
+	; (ix+18) passlen
+	; (ix+21) verifier
+	; (ix-32) x
+
+	pea	ix - 32
+	ld	hl, (ix + 18)
 	push	hl
-	pop	iy
-	ld	de, -16
-	add	iy, de
-	ld	de, 17
-	or	a, a
-	sbc	hl, de
-	ld	hl, 0
+	ld	hl, (ix + 15)
 	push	hl
-	pop	bc
-	ld	de, (ix + 15)
-	jq	c, .lbl_20
-	lea	bc, iy + 0
+	ld	hl, (ix + 12)
 	push	hl
-	pop	iy
-.lbl_18:
-	lea	hl, iy + 0
-	or	a, a
-	sbc	hl, bc
-	jq	nc, .lbl_22
-	push	de
-	ld	hl, (ix + -83)
+	ld	hl, (ix + 9)
 	push	hl
-	ld	hl, (ix + -86)
+	ld	hl, (ix + 6)
 	push	hl
-	ld	(ix + -89), iy
-	ld	(ix + -92), bc
-	call	aes_ecb_unsafe_encrypt
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	de, (ix + -89)
-	ld	hl, (ix + 12)
-	add	hl, de
-	ld	de, 16
-	push	de
+	call	_srp_compute_x
+
+	; v = g^x % N
+	ld	iy, (ix + 6)
+	ld	de, (ix + 21)
+	call	_srp_pad_generator
+	ld	hl, 32
 	push	hl
-	ld	hl, (ix + -83)
+	ld	hl, (iy + srp_offset_modulus)
 	push	hl
-	call	_xor_buf
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, 16
+	pea	ix - 32
+	ld	hl, (ix + 21)
 	push	hl
-	ld	hl, (ix + -86)
+	ld	l, (iy + srp_offset_size)
 	push	hl
-	call	_increment_iv
-	ld	bc, (ix + -92)
-	ld	iy, (ix + -89)
-	pop	hl
-	pop	hl
-	ld	de, 16
-	add	iy, de
-	ld	de, (ix + 15)
-	jq	.lbl_18
-.lbl_11:
-	lea	hl, ix + -16
-	ld	(ix + -83), hl
-	lea	hl, ix + -32
-	ld	(ix + -86), hl
-	lea	hl, ix + -48
-	ld	(ix + -89), hl
-	ld	l, a
+	call	_powmod_bigexp
+	jp	stack_clear
+
+; srp_client_start(context, pubkey);
+srp_client_start:
+	call	_scratch_enter
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) pubkey
+
+	; a = 32 random bytes
+	ld	hl, 32
 	push	hl
+	ld	iy, (ix + 6)
+	pea	iy + srp_offset_secret
+	call	csrand_fill
+	pop	hl, hl
+
+	; A = g^a % N
+	ld	iy, (ix + 6)
+	ld	de, srp_offset_pubkey
+	add	iy, de
 	push	iy
-	push	bc
+	pop	de
+	ld	iy, (ix + 6)
 	push	de
-	call	hashlib_AESPadMessage
-	pop	hl
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	c, 4
-	ld	hl, (ix + 9)
-	call	ti._ishru
-	ld	(ix + -92), hl
-	ld	hl, 16
-	push	hl
-	ld	hl, (ix + 18)
+	call	_srp_pad_generator
+	pop	de
+	ld	hl, 32
 	push	hl
-	ld	hl, (ix + -89)
+	ld	hl, (iy + srp_offset_modulus)
 	push	hl
-	call	ti._memcpy
-	ld	de, (ix + -92)
-	ld	iy, (ix + 12)
-	ld	bc, 0
-	pop	hl
-	pop	hl
-	pop	hl
-	inc	de
-.lbl_12:
+	pea	iy + srp_offset_secret
 	push	de
-	pop	hl
+	ld	l, (iy + srp_offset_size)
+	push	hl
+	call	_powmod_bigexp
+	pop	hl, hl, hl, hl, hl
+
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, srp_offset_pubkey
+	ld	de, (ix + 6)
+	add	hl, de
+	ld	de, (ix + 9)
+	ldir
+	jp	stack_clear
+
+; srp_client_process(context, server_pubkey, salt, saltlen, password, passlen, proof);
+srp_client_process:
+	call	_scratch_enter
+	ld	hl, -763
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) server public key, B
+	; (ix+12) salt
+	; (ix+15) saltlen
+	; (ix+18) password
+	; (ix+21) passlen
+	; (ix+24) client proof, M1
+.psha := ix - long
+.pu   := .psha - long
+.px   := .pu - long
+.pe   := .px - long
+.pt   := .pe - long
+.pb   := .pt - long
+	lea	hl, ix - 18
+	ld	de, -32
+	add	hl, de
+	ld	(.pu), hl
+	add	hl, de
+	ld	(.px), hl
+	ld	de, -64
+	add	hl, de
+	ld	(.pe), hl
+	ld	de, -_sha256ctx_size
+	add	hl, de
+	ld	(.psha), hl
+	ld	de, -256
+	add	hl, de
+	ld	(.pt), hl
+	add	hl, de
+	ld	(.pb), hl
+
+	; abort if B % N == 0, B must be nonzero and less than N
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 9)
+	ld	b, (iy + srp_offset_size)
+	xor	a, a
+.b_nonzero:
+	or	a, (hl)
+	inc	hl
+	djnz	.b_nonzero
+	or	a, a
+	ld	a, SRP_INVALID_SERVER_KEY
+	jq	z, .exit
+	dec	hl
+	ex	de, hl
+	call	_srp_modlen
+	dec	bc
+	ld	hl, (iy + srp_offset_modulus)
 	add	hl, bc
+	ld	b, (iy + srp_offset_size)
 	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_26
-	ld	hl, 16
+.b_range:
+	ld	a, (de)
+	sbc	a, (hl)
+	dec	de
+	dec	hl
+	djnz	.b_range
+	ld	a, SRP_INVALID_SERVER_KEY
+	jq	nc, .exit
+
+	; u = H(PAD(A) | PAD(B)), abort if u == 0
+	ld	de, (.psha)
+	push	de
+	call	hash_sha256_init
+	pop	de
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, (ix + 6)
+	push	de
+	ld	de, srp_offset_pubkey
+	add	hl, de
+	pop	de
+	call	_sha256_update_nz
+	ld	hl, (ix + 9)
+	call	_sha256_update_nz
+	ld	hl, (.pu)
+	push	hl, de
+	call	hash_sha256_final
+	pop	de, hl
+	ld	b, 32
+	xor	a, a
+.u_nonzero:
+	or	a, (hl)
+	inc	hl
+	djnz	.u_nonzero
+	or	a, a
+	ld	a, SRP_INVALID_SERVER_KEY
+	jq	z, .exit
+
+	; k = H(N | PAD(g)), zero-extended to the modulus length in vi(b)
+	ld	iy, (ix + 6)
+	ld	de, (.pt)
+	call	_srp_pad_generator
+	ld	de, (.psha)
+	push	de
+	call	hash_sha256_init
+	pop	de
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, (iy + srp_offset_modulus)
+	call	_sha256_update_nz
+	ld	hl, (.pt)
+	call	_sha256_update_nz
+	push	bc
+	ld	hl, 0
 	push	hl
-	push	iy
-	ld	hl, (ix + -83)
+	ld	hl, (.pb)
 	push	hl
-	ld	(ix + -95), iy
-	ld	(ix + -92), de
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, 16
+	call	ti._memset
+	pop	hl, de, bc
+	add	hl, bc
+	ld	bc, -32
+	add	hl, bc
 	push	hl
-	ld	hl, (ix + -83)
+	ld	hl, (.psha)
 	push	hl
-	ld	hl, (ix + -89)
+	call	hash_sha256_final
+	pop	hl, hl
+
+	; x = H(s | H(I | ":" | P))
+	ld	hl, (.px)
+	push	hl
+	ld	hl, (ix + 21)
+	push	hl
+	ld	hl, (ix + 18)
 	push	hl
-	call	_xor_buf
-	pop	hl
-	pop	hl
-	pop	hl
 	ld	hl, (ix + 15)
 	push	hl
-	ld	hl, (ix + -86)
+	ld	hl, (ix + 12)
 	push	hl
-	ld	hl, (ix + -83)
+	ld	hl, (ix + 6)
 	push	hl
-	call	aes_ecb_unsafe_encrypt
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, 16
+	call	_srp_compute_x
+	pop	hl, hl, hl, hl, hl, hl
+
+	; vi(t) = k * g^x % N
+	ld	iy, (ix + 6)
+	ld	de, (.pt)
+	call	_srp_pad_generator
+	ld	hl, 32
 	push	hl
-	ld	hl, (ix + -86)
+	ld	hl, (iy + srp_offset_modulus)
 	push	hl
-	ld	hl, (ix + -95)
+	ld	hl, (.px)
 	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, 16
+	ld	hl, (.pt)
 	push	hl
-	ld	hl, (ix + -86)
+	ld	l, (iy + srp_offset_size)
 	push	hl
-	ld	hl, (ix + -89)
+	call	_powmod_bigexp
+	pop	hl, hl, hl, hl, hl
+	ld	iy, (ix + 6)
+	ld	hl, (iy + srp_offset_modulus)
 	push	hl
-	call	ti._memcpy
-	ld	de, (ix + -92)
-	ld	iy, (ix + -95)
-	ld	bc, 0
-	pop	hl
-	pop	hl
-	pop	hl
-	dec	de
-	lea	iy, iy + 16
-	jq	.lbl_12
-.lbl_8:
-	ld	bc, 3
-	jq	.lbl_21
-.lbl_26:
-	jq	.lbl_21
-.lbl_22:
-	lea	bc, iy + 0
-.lbl_20:
-	ld	(ix + -89), bc
-	push	de
-	ld	hl, (ix + -83)
+	ld	hl, (.pb)
 	push	hl
-	ld	hl, (ix + -86)
+	ld	hl, (.pt)
 	push	hl
-	call	aes_ecb_unsafe_encrypt
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, (ix + 12)
+	ld	l, (iy + srp_offset_size)
 	push	hl
-	pop	iy
-	ld	de, (ix + -89)
-	add	iy, de
+	call	_mulmod
+	pop	hl, hl, hl, hl
+
+	; vi(b) = B - vi(t) % N
+	ld	iy, (ix + 6)
+	call	_srp_modlen
 	ld	hl, (ix + 9)
-	or	a, a
-	sbc	hl, de
+	ld	de, (.pb)
+	ldir
+	ld	hl, (iy + srp_offset_modulus)
 	push	hl
-	push	iy
-	ld	hl, (ix + -83)
+	ld	hl, (.pt)
 	push	hl
-	call	_xor_buf
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, 0
-	jq	.lbl_21
-	
-aes_decrypt:
-	save_interrupts
+	ld	hl, (.pb)
+	push	hl
+	ld	l, (iy + srp_offset_size)
+	push	hl
+	call	_modsub
+	pop	hl, hl, hl, hl
 
-	ld	hl, -66
-	call	ti._frameset
+	; vi(e) = a + u * x
+	ld	hl, (.pe)
+	push	hl
+	pop	de
+	inc	de
+	ld	(hl), 0
+	ld	bc, 31
+	ldir
 	ld	hl, (ix + 6)
-	ld	de, 1
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_9
-	ld	hl, (ix + 12)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_9
-	ld	hl, (ix + 15)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_9
-	ld	iy, (ix + 18)
-	lea	hl, iy + 0
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_9
-	ld	hl, (ix + 9)
-	ld	de, 5
+	ld	bc, srp_offset_secret
 	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_9
-	ld	l, (ix + 21)
-	ld	a, l
-	or	a, a
-	jq	nz, .lbl_13
-	ld	a, (ix + 24)
-	cp	a, 2
-	jq	c, .lbl_15
-	ld	de, 4
-	jq	.lbl_9
-.lbl_13:
-	ld	a, l
-	cp	a, 1
-	jq	nz, .lbl_19
-	or	a, a
-	sbc	hl, hl
+	ld	c, 32
+	ldir
+	ld	hl, 32
 	push	hl
-	inc	hl
+	ld	hl, (.px)
 	push	hl
-	push	iy
-	ld	hl, (ix + 15)
+	ld	hl, (.pu)
 	push	hl
-	ld	hl, (ix + 12)
+	ld	hl, (.pe)
 	push	hl
-	ld	hl, (ix + 9)
+	call	_mpi_muladd
+	pop	hl, hl, hl, hl
+
+	; S = vi(b) ^ vi(e) % N
+	ld	iy, (ix + 6)
+	ld	hl, 64
 	push	hl
-	ld	hl, (ix + 6)
+	ld	hl, (iy + srp_offset_modulus)
 	push	hl
-	call	aes_encrypt
-	ld	hl, 21
-	add	hl, sp
-	ld	sp, hl
-	jq	.lbl_21
-.lbl_15:
-	ld	hl, (ix + 9)
-	ld	a, l
-	and	a, 15
-	or	a, a
-	jq	nz, .lbl_9
-	lea	de, ix + -16
-	ld	(ix + -51), de
-	lea	de, ix + -32
-	ld	(ix + -54), de
-	lea	de, ix + -48
-	ld	c, 4
-	call	ti._ishru
-	ld	(ix + -57), hl
-	ld	hl, 16
+	ld	hl, (.pe)
 	push	hl
-	push	iy
-	ld	(ix + -60), de
+	ld	hl, (.pb)
+	push	hl
+	ld	l, (iy + srp_offset_size)
+	push	hl
+	call	_powmod_bigexp
+	pop	hl, hl, hl, hl, hl
+
+	; K = H(S)
+	ld	de, (.psha)
 	push	de
-	call	ti._memcpy
-	ld	de, (ix + -57)
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	iy, 0
-.lbl_17:
+	call	hash_sha256_init
+	pop	de
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, (.pb)
+	call	_sha256_update_nz
+	ld	iy, (ix + 6)
+	pea	iy + srp_offset_key
 	push	de
-	pop	hl
+	call	hash_sha256_final
+	pop	de, hl
+
+	; vi(x) = H(N) ^ H(g)
+	push	de
+	call	hash_sha256_init
+	pop	de
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, (iy + srp_offset_modulus)
+	call	_sha256_update_nz
+	ld	hl, (.px)
+	push	hl, de
+	call	hash_sha256_final
+	pop	de, hl
+	push	de
+	call	hash_sha256_init
+	pop	de
+	ld	hl, (ix + 6)
+	ld	bc, srp_offset_generator
 	add	hl, bc
-	or	a, a
-	sbc	hl, bc
+	ld	c, 1
+	call	_sha256_update_nz
+	ld	hl, (.pu)
+	push	hl, de
+	call	hash_sha256_final
+	pop	de, hl
+	ld	de, (.px)
+	ld	b, 32
+.xor_hg:
+	ld	a, (de)
+	xor	a, (hl)
+	ld	(de), a
+	inc	de
+	inc	hl
+	djnz	.xor_hg
+
+	; M1 = H(H(N) ^ H(g) | H(I) | s | A | B | K)
+	ld	de, (.psha)
+	push	de
+	call	hash_sha256_init
+	pop	de
+	ld	hl, (.px)
+	ld	bc, 32
+	call	_sha256_update_nz
 	ld	hl, (ix + 6)
-	jq	z, .lbl_20
-	lea	bc, iy + 0
-	ld	(ix + -66), bc
+	ld	c, srp_offset_idhash
 	add	hl, bc
-	ld	(ix + -57), de
-	ld	de, 16
+	ld	c, 32
+	call	_sha256_update_nz
+	ld	hl, (ix + 12)
+	ld	bc, (ix + 15)
+	call	_sha256_update_nz
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, (ix + 6)
+	push	bc
+	ld	bc, srp_offset_pubkey
+	add	hl, bc
+	pop	bc
+	call	_sha256_update_nz
+	ld	hl, (ix + 9)
+	call	_sha256_update_nz
+	ld	hl, (ix + 6)
+	ld	bc, srp_offset_key
+	add	hl, bc
+	ld	c, 32
+	call	_sha256_update_nz
+	ld	hl, (ix + 24)
+	push	hl, de
+	call	hash_sha256_final
+	pop	de, hl
+
+	; M2 = H(A | M1 | K), kept to check the server's proof
 	push	de
+	call	hash_sha256_init
+	pop	de
+	ld	iy, (ix + 6)
+	call	_srp_modlen
+	ld	hl, (ix + 6)
+	push	bc
+	ld	bc, srp_offset_pubkey
+	add	hl, bc
+	pop	bc
+	call	_sha256_update_nz
+	ld	hl, (ix + 24)
+	ld	bc, 32
+	call	_sha256_update_nz
+	ld	hl, (ix + 6)
+	ld	c, srp_offset_key
+	add	hl, bc
+	ld	c, 32
+	call	_sha256_update_nz
+	ld	iy, (ix + 6)
+	pea	iy + srp_offset_proof
+	push	de
+	call	hash_sha256_final
+	ld	a, SRP_OK
+.exit:
+	jp	stack_clear
+
+; srp_client_verify(context, proof);
+srp_client_verify:
+	pop	bc, iy, hl
+	push	hl, iy, bc
+	ld	de, 32
+	push	de, hl
+	pea	iy + srp_offset_proof
+	call	digest_compare
+	pop	hl, hl, hl
+	ret
+ 
+ 
+hmac_sha256_init:
+	save_interrupts
+
+	ld	hl, -70
+	call	ti._frameset
+	ld	hl, 64
+	ld	de, 0
+	lea	bc, ix + -64
+	ld	(ix + -67), bc
 	push	hl
-	ld	hl, (ix + -51)
-	push	hl
-	ld	(ix + -63), iy
-	call	ti._memcpy
+	push	de
+	push	bc
+	call	ti._memset
 	pop	hl
 	pop	hl
 	pop	hl
-	ld	hl, (ix + 15)
-	push	hl
-	ld	hl, (ix + -54)
-	push	hl
-	ld	hl, (ix + -51)
+	ld	de, 65
+	ld	hl, (ix + 12)
+	or	a, a
+	sbc	hl, de
+	ld	de, 128
+	jq	c, .lbl_2
+	ld	hl, (ix + 6)
+	add	hl, de
+	ld	(ix + -70), hl
 	push	hl
-	call	aes_ecb_unsafe_decrypt
-	pop	hl
-	pop	hl
+	call	hash_sha256_init
 	pop	hl
-	ld	hl, 16
+	or	a, a
+	sbc	hl, hl
 	push	hl
-	ld	hl, (ix + -54)
+	ld	hl, (ix + 12)
 	push	hl
-	ld	hl, (ix + -60)
+	ld	hl, (ix + 9)
 	push	hl
-	call	_xor_buf
+	ld	hl, (ix + -70)
+	push	hl
+	call	hash_sha256_update
 	pop	hl
 	pop	hl
 	pop	hl
+	pop	hl
+	ld	hl, (ix + -67)
+	push	hl
+	ld	hl, (ix + -70)
+	push	hl
+	call	hash_sha256_final
+	jq	.lbl_3
+.lbl_2:
 	ld	hl, (ix + 12)
-	ld	de, (ix + -66)
-	add	hl, de
-	ld	de, 16
-	push	de
-	ld	de, (ix + -54)
-	push	de
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + -67)
 	push	hl
 	call	ti._memcpy
 	pop	hl
+.lbl_3:
 	pop	hl
 	pop	hl
-	ld	hl, 16
+	ld	hl, 64
 	push	hl
-	ld	hl, (ix + -51)
+	ld	hl, 54
 	push	hl
-	ld	hl, (ix + -60)
+	ld	hl, (ix + 6)
 	push	hl
-	call	ti._memcpy
-	ld	iy, (ix + -63)
-	ld	de, (ix + -57)
+	call	ti._memset
 	pop	hl
 	pop	hl
 	pop	hl
-	dec	de
-	ld	bc, 16
-	add	iy, bc
-	jq	.lbl_17
-.lbl_19:
-	ld	de, 3
-	jq	.lbl_9
-.lbl_20:
-	ld	a, (ix + 24)
-	ld	l, a
-	push	hl
-	ld	hl, (ix + 12)
+	ld	hl, 64
 	push	hl
-	ld	de, (ix + 9)
-	push	de
+	ld	hl, 92
 	push	hl
-	call	hashlib_AESStripPadding
-	pop	hl
-	pop	hl
+	ld	iy, (ix + 6)
+	pea	iy + 64
+	call	ti._memset
 	pop	hl
 	pop	hl
-.lbl_21:
-	ld	de, 0
-.lbl_9:
-	ex	de, hl
-	restore_interrupts_noret aes_decrypt
-	jp stack_clear
-	
-	
-hashlib_AESPadMessage:
-	save_interrupts
-  	ld	hl, -6
-	call	ti._frameset
-	ld	bc, (ix + 9)
-	ld	de, 0
-	push	bc
 	pop	hl
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_1
-	jq	.lbl_10
-.lbl_1:
-	ld	hl, (ix + 6)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_2
-	jq	.lbl_10
-.lbl_2:
-	ld	hl, (ix + 12)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_3
-	jq	.lbl_10
-.lbl_3:
+	ld	de, 64
+	ld	bc, 0
+.lbl_5:
 	push	bc
 	pop	hl
-	ld	bc, 16
-	ld	iy, -16
-	ld	a, l
-	and	a, 15
-	add	hl, bc
-	ld	(ix + -3), hl
-	lea	bc, iy + 0
-	call	ti._iand
-	or	a, a
-	jq	z, .lbl_5
-	ld	(ix + -3), hl
-.lbl_5:
-	ld	l, (ix + 15)
-	ld	a, l
-	or	a, a
-	ld	iy, (ix + 12)
-	jq	nz, .lbl_6
-	ld	hl, (ix + 9)
-	ex	de, hl
-	add	iy, de
-	ld	hl, (ix + -3)
 	or	a, a
 	sbc	hl, de
-	push	hl
-	push	hl
-	push	iy
-	call	ti._memset
-	pop	hl
-	pop	hl
-	pop	hl
-	jq	.lbl_9
-.lbl_6:
-	ld	a, l
-	cp	a, 1
-	ld	bc, (ix + 9)
-	jq	nz, .lbl_10
+	ld	hl, (ix + -67)
+	jq	z, .lbl_7
+	add	hl, bc
+	ld	l, (hl)
+	ld	iy, (ix + 6)
 	add	iy, bc
-	ld	(ix + -6), iy
-	ld	hl, (ix + -3)
-	or	a, a
-	sbc	hl, bc
+	ld	a, (iy)
+	xor	a, l
+	ld	(iy), a
+	ld	a, (iy + 64)
+	xor	a, l
+	ld	(iy + 64), a
+	inc	bc
+	jq	.lbl_5
+.lbl_7:
+	ld	hl, (ix + 6)
+	ld	de, 128
+	add	hl, de
+	ld	(ix + -67), hl
 	push	hl
+	call	hash_sha256_init
+	pop	hl
 	or	a, a
 	sbc	hl, hl
 	push	hl
-	push	iy
-	call	ti._memset
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, (ix + -6)
-	set	7, (hl)
-.lbl_9:
-	ld	hl, (ix + 9)
+	ld	hl, 64
 	push	hl
 	ld	hl, (ix + 6)
 	push	hl
-	ld	hl, (ix + 12)
+	ld	hl, (ix + -67)
 	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	de, (ix + -3)
-.lbl_10:
-	ex	de, hl
-	ld	sp, ix
-	pop	ix
-	restore_interrupts hashlib_AESPadMessage
-	ret
- 
-oaep_encode:
-	save_interrupts
+	call	hash_sha256_update
+	ld	a, 1
 
-	ld	hl, -403
-	call	ti._frameset
-	ld	a, (ix + 21)
-	ld	hl, _hash_out_lens
-	ld	iy, 0
-	lea	de, iy + 0
-	ld	e, a
+	restore_interrupts_noret_preserve_a hmac_sha256_init
+	jp stack_clear
+    
+ 
+hmac_sha256_update:
+	call	ti._frameset0
+	ld	hl, (ix + 6)
+	ld	iy, (ix + 9)
+	ld	bc, (ix + 12)
+	ld	de, 128
 	add	hl, de
-	ld	a, (hl)
-	lea	de, iy + 0
-	ld	e, a
+	ld	de, 0
 	push	de
-	pop	iy
-	add	iy, iy
-	ld	bc, -379
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), iy
-	ld	bc, 2
-	add	iy, bc
-	ld	hl, (ix + 15)
-	ld	bc, (ix + 9)
-	or	a, a
-	sbc	hl, bc
-	push	ix
-	ld	bc, -382
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	ld	hl, -2
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -379
-	add	ix, de
-	ld	bc, (ix + 0)
-	pop	ix
-	or	a, a
-	sbc	hl, bc
-	push	ix
-	ld	de, -382
-	add	ix, de
-	ld	bc, (ix + 0)
+	push	bc
+	push	iy
+	push	hl
+	call	hash_sha256_update
+	ld	sp, ix
 	pop	ix
-	add	hl, bc
+	ret
+	
+    
+hmac_sha256_final:
+	call	_scratch_enter
+	save_interrupts
+
+    ld	hl, -280
+	call	ti._frameset
+	ld	bc, (ix + 6)
+	ld	hl, 236
+	lea	de, ix + -38
+	ld	(ix + -3), bc
+	ld	bc, -280
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	(iy + 0), de
 	push	ix
-	ld	bc, -388
+	ld	bc, -274
 	add	ix, bc
-	ld	(ix + 0), hl
+	lea	de, ix + 0
 	pop	ix
-	ld	de, (ix + -3)
-	push	de
-	pop	hl
-	ld	bc, -1
-	call	ti._ixor
-	ld	bc, (ix + 15)
-	add	hl, bc
-	ld	(ix + -3), bc
 	push	ix
-	ld	bc, -382
+	ld	bc, -277
 	add	ix, bc
-	ld	(ix + 0), hl
+	ld	(ix + 0), de
 	pop	ix
+	push	hl
+	ld	bc, (ix + -3)
+	push	bc
 	push	de
+	call	ti._memcpy
 	pop	hl
-	inc	hl
+	pop	hl
+	pop	hl
+	ld	de, 128
+	ld	bc, -277
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	add	hl, de
 	push	ix
-	ld	bc, -385
 	add	ix, bc
 	ld	(ix + 0), hl
 	pop	ix
 	push	ix
-	ld	bc, -379
-	add	ix, bc
-	ld	(ix + 0), de
-	pop	ix
-	add	hl, de
-	push	ix
-	ld	bc, -391
+	ld	bc, -280
 	add	ix, bc
-	ld	(ix + 0), hl
+	ld	de, (ix + 0)
 	pop	ix
-	ld	de, (ix + 9)
-	add	iy, de
-	ld	de, 257
-	ld	bc, (ix + -3)
-	push	bc
+	push	de
+	push	hl
+	call	hash_sha256_final
 	pop	hl
-	or	a, a
-	sbc	hl, de
-	jq	nc, .lbl_1
-	ld	hl, (ix + 9)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_1
-	ld	hl, (ix + 6)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_1
-	ld	hl, (ix + 12)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_1
-	lea	de, iy + 0
-	push	bc
 	pop	hl
-	or	a, a
-	sbc	hl, de
-	jq	nc, .lbl_10
-.lbl_1:
-	or	a, a
-	sbc	hl, hl
-.lbl_20:
-    restore_interrupts_noret oaep_encode
-    jp stack_clear
-.lbl_10:
-	lea	hl, ix + -120
-	ld	bc, -397
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), hl
-	ld	hl, (ix + 12)
-	ld	(hl), 0
-	ex	de, hl
-	inc	de
-	ld	bc, -379
+	ld	bc, -277
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	ld	bc, -400
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), de
-	push	de
-	call	csrand_fill
-	pop	hl
+	call	hash_sha256_init
 	pop	hl
-	ld	a, (ix + 21)
-	ld	l, a
+	or	a, a
+	sbc	hl, hl
 	push	hl
-	ld	bc, -397
+	ld	hl, 64
+	push	hl
+	ld	iy, (ix + 6)
+	pea	iy + 64
+	ld	bc, -277
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	call	hash_init
+	call	hash_sha256_update
+	pop	hl
 	pop	hl
 	pop	hl
-	ld	l, 1
-	xor	a, l
-	bit	0, a
-	ld	hl, 0
-	jq	nz, .lbl_20
-	ld	de, (ix + 18)
-	ld	bc, -376
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	bc, -394
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), hl
-	push	de
 	pop	hl
-	add	hl, bc
 	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_13
-	push	de
-	call	ti._strlen
-	pop	de
+	sbc	hl, hl
 	push	hl
-	ld	hl, (ix + 18)
+	ld	hl, 32
 	push	hl
-	ld	bc, -397
+	ld	bc, -280
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	call	hash_update
-	pop	hl
-	pop	hl
-	pop	hl
-.lbl_13:
-	ld	hl, (ix + 12)
-	ld	bc, -385
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	add	hl, de
-	push	ix
-	ld	bc, -403
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	push	hl
-	ld	bc, -397
+	ld	bc, -277
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	call	hash_final
-	pop	hl
+	call	hash_sha256_update
 	pop	hl
-	ld	hl, (ix + 12)
-	push	ix
-	ld	bc, -391
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	add	hl, de
-	push	ix
-	ld	bc, -388
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
-	ld	de, 0
-	push	de
-	push	hl
-	call	ti._memset
 	pop	hl
 	pop	hl
 	pop	hl
-	ld	bc, -391
+	ld	hl, (ix + 9)
+	push	hl
+	ld	bc, -277
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	de, (hl)
-	push	ix
-	ld	bc, -388
-	add	ix, bc
-	ld	hl, (ix + 0)
-	pop	ix
-	add	hl, de
-	ex	de, hl
-	ld	bc, (ix + 12)
-	push	bc
-	pop	hl
+	ld	hl, (hl)
+	push	hl
+	call	hash_sha256_final
+
+	restore_interrupts_noret hmac_sha256_final
+	jp stack_clear
+	
+    
+hmac_sha256_reset:
+	save_interrupts
+
+    ld	hl, -3
+	call	ti._frameset
+	ld	hl, (ix + 6)
+	ld	de, 128
 	add	hl, de
-	ld	(hl), 1
-	inc	de
-	push	bc
+	ld	(ix + -3), hl
+	push	hl
+	call	hash_sha256_init
 	pop	hl
-	add	hl, de
-	ld	de, (ix + 9)
-	push	de
-	ld	de, (ix + 6)
-	push	de
+	or	a, a
+	sbc	hl, hl
+	push	hl
+	ld	hl, 64
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	ld	hl, (ix + -3)
+	push	hl
+	call	hash_sha256_update
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts hmac_sha256_reset
+	ret
+
+hmac_sha1_init:
+	save_interrupts
+
+	ld	hl, -64
+	call	ti._frameset
+	lea	de, ix - 64
+	ld	hl, $FF0000
+	ld	bc, 64
+	ldir
+	ld	hl, (ix + 12)
+	ld	bc, 65
+	or	a, a
+	sbc	hl, bc
+	jq	c, .short
+	; keys longer than a block are hashed first
+	ld	hl, (ix + 6)
+	ld	bc, 128
+	add	hl, bc
 	push	hl
-	call	ti._memcpy
-	pop	hl
+	call	hash_sha1_init
 	pop	hl
-	pop	hl
-	ld	a, (ix + 21)
-	ld	l, a
+	ld	bc, (ix + 12)
+	push	bc
+	ld	bc, (ix + 9)
+	push	bc
 	push	hl
-	ld	bc, -382
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	call	hash_sha1_update
+	pop	hl, bc, bc
+	pea	ix - 64
 	push	hl
-	ld	bc, -394
-	lea	hl, ix + 0
+	call	hash_sha1_final
+	pop	hl, hl
+	jq	.pads
+.short:
+	ld	bc, (ix + 12)
+	ld	a, c
+	or	a, a
+	jq	z, .pads
+	ld	hl, (ix + 9)
+	lea	de, ix - 64
+	ldir
+.pads:
+	ld	iy, (ix + 6)
+	lea	hl, ix - 64
+	ld	b, 64
+.xor:
+	ld	a, (hl)
+	xor	a, $36
+	ld	(iy + 0), a
+	xor	a, $36 xor $5C
+	ld	(iy + 64), a
+	inc	hl
+	inc	iy
+	djnz	.xor
+	; the inner hash starts with ipad
+	ld	hl, (ix + 6)
+	push	hl
+	ld	bc, 128
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	ld	bc, -379
-	lea	hl, ix + 0
+	call	_sha1_pad_block
+	pop	hl, hl
+	ld	a, 1
+
+	restore_interrupts_noret_preserve_a hmac_sha1_init
+	jp stack_clear
+
+
+hmac_sha1_update:
+	pop	de, hl
+	ld	bc, 128
+	add	hl, bc
+	push	hl, de
+	jp	hash_sha1_update
+
+
+hmac_sha1_final:
+	save_interrupts
+
+	ld	hl, -(_sha1ctx_size + 20)
+	call	ti._frameset
+._inner := -20
+._outer := ._inner - _sha1ctx_size
+	ld	iy, (ix + 6)
+	ld	bc, 128
+	add	iy, bc
+	pea	ix + ._inner
+	push	iy
+	call	hash_sha1_final
+	pop	hl, hl
+	; outer hash over opad and the inner digest
+	ld	hl, (ix + 6)
+	ld	bc, 64
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	ld	bc, -400
-	lea	hl, ix + 0
+	pea	ix + ._outer
+	call	_sha1_pad_block
+	pop	hl, hl
+	ld	bc, 20
+	push	bc
+	pea	ix + ._inner
+	pea	ix + ._outer
+	call	hash_sha1_update
+	pop	hl, hl, hl
+	ld	hl, (ix + 9)
+	push	hl
+	pea	ix + ._outer
+	call	hash_sha1_final
+
+	restore_interrupts_noret hmac_sha1_final
+	jp stack_clear
+
+
+; _sha1_pad_block(sha1ctx, pad);
+; starts a sha1 context with one 64-byte key pad
+_sha1_pad_block:
+	call	ti._frameset0
+	ld	hl, (ix + 6)
+	push	hl
+	call	hash_sha1_init
+	ld	bc, 64
+	push	bc
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	hash_sha1_update
+	ld	sp, ix
+	pop	ix
+	ret
+
+
+;------------------------------------------
+; fast keyed MACs, reached through the hmac_* dispatch
+; poly1305 (RFC 8439) is a one-time authenticator; siphash-2-4 is a keyed prf
+; for hash tables and short tags. neither is built on a hash, so they share
+; the hmac_ctx methods but not its layout
+
+; every method of a hash with no keyed mode
+_mac_unkeyed:
+	xor	a, a
+	ret
+
+; poly1305 state. r is kept with its bytes reversed, so both operands of each
+; product column are walked upwards
+virtual at 0
+	poly_offset_h       rb 17
+	poly_offset_r       rb 16
+	poly_offset_s       rb 16
+	poly_offset_data    rb 16
+	poly_offset_len     rb 1
+	_poly_ctx_size:
+end virtual
+
+POLY1305_KEY_LEN    := 32
+
+; scratch in the frame of the caller of _poly1305_block
+_poly_t     := -53          ; 17 bytes
+_poly_d     := -36          ; 33-byte product, plus 3 bytes that must stay zero
+_poly_frame := 53
+
+; bool mac_poly1305_init(poly1305_ctx *ctx, const BYTE key[], size_t keylen);
+mac_poly1305_init:
+	call	ti._frameset0
+	xor	a, a
+	ld	hl, (ix + 12)
+	ld	bc, POLY1305_KEY_LEN
+	sbc	hl, bc
+	jq	nz, .exit
+	ld	iy, (ix + 6)
+	lea	hl, iy + poly_offset_h
+	ld	b, 17
+.clear:
+	ld	(hl), a
+	inc	hl
+	djnz	.clear
+	ld	(iy + poly_offset_len), a
+	; r = key[0..15], clamped, stored reversed
+	ld	hl, (ix + 9)
+	ld	bc, 15
 	add	hl, bc
-	ld	hl, (hl)
+	lea	de, iy + poly_offset_r
+	ld	b, 16
+.reverse:
+	ld	a, (hl)
+	ld	(de), a
+	dec	hl
+	inc	de
+	djnz	.reverse
+	ld	a, $0F
+	and	a, (iy + poly_offset_r + 0)
+	ld	(iy + poly_offset_r + 0), a
+	ld	a, $0F
+	and	a, (iy + poly_offset_r + 4)
+	ld	(iy + poly_offset_r + 4), a
+	ld	a, $0F
+	and	a, (iy + poly_offset_r + 8)
+	ld	(iy + poly_offset_r + 8), a
+	ld	a, $0F
+	and	a, (iy + poly_offset_r + 12)
+	ld	(iy + poly_offset_r + 12), a
+	ld	a, $FC
+	and	a, (iy + poly_offset_r + 3)
+	ld	(iy + poly_offset_r + 3), a
+	ld	a, $FC
+	and	a, (iy + poly_offset_r + 7)
+	ld	(iy + poly_offset_r + 7), a
+	ld	a, $FC
+	and	a, (iy + poly_offset_r + 11)
+	ld	(iy + poly_offset_r + 11), a
+	; s = key[16..31]
+	ld	hl, (ix + 9)
+	ld	bc, 16
+	add	hl, bc
+	ldir
+	ld	a, 1
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; void mac_poly1305_update(poly1305_ctx *ctx, const BYTE data[], size_t len);
+mac_poly1305_update:
+	ld	hl, -_poly_frame
+	call	ti._frameset
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+.chunk:
 	push	hl
-	call	hash_mgf1
-	ld	de, -385
-	lea	hl, ix + 0
-	add	hl, de
-	ld	bc, (hl)
-	pop	hl
-	pop	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
 	pop	hl
+	jq	z, .done
+	; n = min(16 - len, remaining)
+	ld	a, 16
+	sub	a, (iy + poly_offset_len)
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	ld	l, a
+	or	a, a
+	sbc	hl, bc
 	pop	hl
+	jq	c, .room
+	ld	a, c
+.room:
+	push	hl
+	push	bc
 	pop	hl
-	ld	de, -394
-	lea	hl, ix + 0
+	ld	bc, 0
+	ld	c, a
+	or	a, a
+	sbc	hl, bc
+	ex	(sp), hl			; remaining length on the stack
+	ld	de, 0
+	ld	e, (iy + poly_offset_len)
+	add	a, e
+	ld	(iy + poly_offset_len), a
+	push	hl
+	lea	hl, iy + poly_offset_data
 	add	hl, de
-	ld	iy, (hl)
-	ld	de, (ix + 15)
-.lbl_14:
-	push	de
+	ex	de, hl
+	pop	hl
+	ldir
+	cp	a, 16
+	jq	nz, .next
+	ld	(iy + poly_offset_len), 0
+	push	hl
+	lea	hl, iy + poly_offset_data
+	ld	a, 1
+	call	_poly1305_block
 	pop	hl
+.next:
+	pop	bc
+	jq	.chunk
+.done:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; void mac_poly1305_final(poly1305_ctx *ctx, BYTE tag[]);
+mac_poly1305_final:
+	ld	hl, -(_poly_frame + _poly_ctx_size)
+	call	ti._frameset
+._copy := -(_poly_frame + _poly_ctx_size)
+	ld	hl, (ix + 6)
+	lea	de, ix + ._copy
+	ld	bc, _poly_ctx_size
+	ldir
+	lea	iy, ix + ._copy
+	; a partial block is padded with a single 1 and gets no 2^128 bit
+	ld	a, (iy + poly_offset_len)
 	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_16
-	ld	hl, (ix + 12)
+	jq	z, .reduce
+	lea	hl, iy + poly_offset_data
+	ld	bc, 0
+	ld	c, a
 	add	hl, bc
-	ld	a, (hl)
-	xor	a, (iy)
+	ld	(hl), 1
+	ld	a, 15
+	sub	a, c
+	jq	z, .padded
+	ld	b, a
+.pad:
+	inc	hl
+	ld	(hl), 0
+	djnz	.pad
+.padded:
+	lea	hl, iy + poly_offset_data
+	xor	a, a
+	call	_poly1305_block
+.reduce:
+	; fold the bits above 2^130 in once more, so that h < 2^130 + 5
+	ld	a, (iy + poly_offset_h + 16)
+	ld	c, a
+	and	a, 3
+	ld	(iy + poly_offset_h + 16), a
+	srl	c
+	srl	c
+	ld	a, c
+	add	a, a
+	add	a, a
+	add	a, c
+	lea	hl, iy + poly_offset_h
+	call	_poly1305_carry
+	; g = h + 5 reaches 2^130 exactly when h >= p, and then h mod p = g mod 2^130
+	lea	hl, iy + poly_offset_h
+	lea	de, ix + _poly_t
+	ld	bc, 17
+	ldir
+	lea	hl, ix + _poly_t
+	ld	a, 5
+	call	_poly1305_carry
+	ld	a, (ix + _poly_t + 16)
+	rra
+	rra
+	rra
+	sbc	a, a
+	cpl
+	ld	c, a
+	lea	de, iy + poly_offset_h
+	lea	hl, ix + _poly_t
+	ld	b, 16
+.select:
+	ld	a, (de)
+	xor	a, (hl)
+	and	a, c
+	xor	a, (hl)
 	ld	(hl), a
-	inc	bc
-	inc	iy
-	jq	.lbl_14
-.lbl_16:
-	ld	a, (ix + 21)
-	ld	l, a
+	inc	de
+	inc	hl
+	djnz	.select
+	; tag = (h + s) mod 2^128
+	ld	de, (ix + 9)
+	lea	hl, ix + _poly_t
+	ld	bc, 16
+	ldir
+	ld	de, (ix + 9)
+	lea	hl, iy + poly_offset_s
+	ld	b, 16
+	call	_poly1305_add
+	jp	stack_clear
+
+; h = (h + block + hibit * 2^128) * r, partially reduced mod 2^130 - 5
+; iy = state, hl = block, a = hibit
+; uses (ix + _poly_t) and (ix + _poly_d)
+; destroys: af, bc, de, hl
+_poly1305_block:
+	lea	de, ix + _poly_t
+	ld	bc, 16
+	ldir
+	ld	(de), a
+	lea	de, iy + poly_offset_h
+	lea	hl, ix + _poly_t
+	ld	b, 17
+	call	_poly1305_add
+	lea	hl, ix + _poly_d
 	push	hl
-	ld	bc, -379
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	(hl), 0
 	push	hl
-	ld	bc, -394
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	pop	de
+	inc	de
+	ld	bc, 35
+	ldir
+	pop	hl
+	call	_poly1305_mul
+	; 2^130 = 5 (mod p): with c the bits above 2^130, h = d mod 2^130 + 4c + c
+	lea	hl, ix + _poly_d + 16
+	lea	de, ix + _poly_t
+	ld	bc, 17
+	ldir
+	ld	a, (ix + _poly_t)
+	and	a, $FC
+	ld	(ix + _poly_t), a
+	ld	a, (ix + _poly_d + 16)
+	and	a, 3
+	ld	(ix + _poly_d + 16), a
+	lea	de, ix + _poly_d
+	lea	hl, ix + _poly_t
+	ld	b, 17
+	call	_poly1305_add
+	lea	hl, ix + _poly_t + 16
+	ld	b, 17
+	or	a, a
+.shr1:
+	rr	(hl)
+	dec	hl
+	djnz	.shr1
+	lea	hl, ix + _poly_t + 16
+	ld	b, 17
+	or	a, a
+.shr2:
+	rr	(hl)
+	dec	hl
+	djnz	.shr2
+	lea	de, ix + _poly_d
+	lea	hl, ix + _poly_t
+	ld	b, 17
+	call	_poly1305_add
+	lea	hl, ix + _poly_d
+	lea	de, iy + poly_offset_h
+	ld	bc, 17
+	ldir
+	ret
+
+; d = h * r, one 24-bit column sum at a time; a column never exceeds 17 * 255 * 255
+; iy = state, hl = d, zeroed
+; destroys: af, bc, de, hl
+_poly1305_mul:
+	push	ix
+	; columns 0 to 15 start at h[0] and r[k]
+	lea	de, iy + poly_offset_r + 15
+	ld	a, 1
+.low:
+	push	af, de, iy
+	lea	ix, iy + poly_offset_h
+	push	de
+	pop	iy
+	call	.column
+	pop	iy, de, af
+	dec	de
+	inc	a
+	cp	a, 17
+	jq	nz, .low
+	; columns 16 to 31 start at h[k - 15] and r[15]
+	lea	de, iy + poly_offset_h + 1
+	ld	a, 16
+.high:
+	push	af, de, iy
+	push	de
+	pop	ix
+	lea	iy, iy + poly_offset_r
+	call	.column
+	pop	iy, de, af
+	inc	de
+	dec	a
+	jq	nz, .high
+	pop	ix
+	ret
+; the carry of the previous column is already at (hl)
+.column:
 	push	hl
-	ld	bc, -382
-	lea	hl, ix + 0
-	add	hl, bc
 	ld	hl, (hl)
-	push	hl
-	ld	bc, -403
-	lea	hl, ix + 0
+.term:
+	ld	b, (ix)
+	ld	c, (iy)
+	mlt	bc
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hash_mgf1
-	ld	de, (ix + 15)
-	pop	bc
-	pop	bc
-	pop	bc
-	pop	bc
-	pop	bc
-	ld	(ix + -3), de
-	ld	de, -379
-	lea	hl, ix + 0
-	add	hl, de
-	ld	bc, (hl)
-	ld	de, (ix + -3)
-.lbl_17:
-	push	bc
+	inc	ix
+	inc	iy
+	dec	a
+	jq	nz, .term
+	ex	de, hl
 	pop	hl
-	add	hl, bc
+	ld	(hl), de
+	inc	hl
+	ret
+
+; (de) += (hl), b bytes
+; destroys: af, b, de, hl
+_poly1305_add:
 	or	a, a
+.loop:
+	ld	a, (de)
+	adc	a, (hl)
+	ld	(de), a
+	inc	hl
+	inc	de
+	djnz	.loop
+	ret
+
+; (hl) += a, 17 bytes
+; destroys: af, b, hl
+_poly1305_carry:
+	add	a, (hl)
+	ld	(hl), a
+	ld	b, 16
+.loop:
+	inc	hl
+	ld	a, (hl)
+	adc	a, 0
+	ld	(hl), a
+	djnz	.loop
+	ret
+
+
+; siphash-2-4 state: v0..v3, then the unfinished 8-byte word
+virtual at 0
+	sip_offset_v        rb 4*8
+	sip_offset_m        rb 8
+	sip_offset_pos      rb 1
+	sip_offset_len      rb 1
+	_sip_ctx_size:
+end virtual
+
+SIPHASH24_KEY_LEN     := 16
+
+_sip_t := -8
+
+; lane d += lane s. a lane rotated left by 32 is not moved; its bytes are
+; just addressed from o = 4 instead of 0, so byte j is at (j + o) and 7
+macro _sip_add? d, od, s, os
+	repeat 8, j:0
+		ld a,(iy + d + ((j + od) and 7))
+		if j = 0
+			add a,(iy + s + ((j + os) and 7))
+		else
+			adc a,(iy + s + ((j + os) and 7))
+		end if
+		ld (iy + d + ((j + od) and 7)),a
+	end repeat
+end macro
+
+; lane x = ROTL(x, 8 * q + n) ^ lane y, for n = -3 .. 1
+; destroys: af
+macro _sip_rotxor? x, q, n, y, oy
+	repeat 8, j:0
+		ld a,(iy + x + ((j - q) and 7))
+		ld (ix + _sip_t + j),a
+	end repeat
+	if n = 1
+		_ascon_rol1 _sip_t
+	else if n = -3
+		_ascon_ror1 _sip_t
+		_ascon_ror1 _sip_t
+		_ascon_ror1 _sip_t
+	end if
+	repeat 8, j:0
+		ld a,(ix + _sip_t + j)
+		xor a,(iy + y + ((j + oy) and 7))
+		ld (iy + x + j),a
+	end repeat
+end macro
+
+; one SipRound, with v0 and v2 addressed from o0 and o2
+macro _sip_round? o0, o2
+	_sip_add 0, o0, 8, 0			; v0 += v1
+	_sip_rotxor 8, 2, -3, 0, o0		; v1 = ROTL(v1,13) ^ v0, v0 = ROTL(v0,32)
+	_sip_add 16, o2, 24, 0			; v2 += v3
+	_sip_rotxor 24, 2, 0, 16, o2		; v3 = ROTL(v3,16) ^ v2
+	_sip_add 0, o0 + 4, 24, 0		; v0 += v3
+	_sip_rotxor 24, 3, -3, 0, o0 + 4	; v3 = ROTL(v3,21) ^ v0
+	_sip_add 16, o2, 8, 0			; v2 += v1
+	_sip_rotxor 8, 2, 1, 16, o2		; v1 = ROTL(v1,17) ^ v2, v2 = ROTL(v2,32)
+end macro
+
+; runs 2 * a SipRounds; after each pair v0 and v2 are back in place
+; iy = state
+; destroys: af, bc, de, hl
+_siphash_rounds:
+._n := _sip_t - 1
+	ld	hl, ._n
+	call	ti._frameset
+	ld	(ix + ._n), a
+._pair:
+	_sip_round 0, 0
+	_sip_round 4, 4
+	dec	(ix + ._n)
+	jq	nz, ._pair
+	ld	sp, ix
+	pop	ix
+	ret
+
+; absorbs the word at sip_offset_m
+; iy = state
+; destroys: af, bc, de, hl
+_siphash_compress:
+	lea	de, iy + 24
+	call	.xor
+	ld	a, 1
+	call	_siphash_rounds
+	lea	de, iy + 0
+.xor:
+	lea	hl, iy + sip_offset_m
+	ld	b, 8
+.loop:
+	ld	a, (de)
+	xor	a, (hl)
+	ld	(de), a
+	inc	hl
+	inc	de
+	djnz	.loop
+	ret
+
+; bool mac_siphash_init(siphash_ctx *ctx, const BYTE key[], size_t keylen);
+mac_siphash_init:
+	call	ti._frameset0
+	xor	a, a
+	ld	hl, (ix + 12)
+	ld	bc, SIPHASH24_KEY_LEN
 	sbc	hl, bc
-	jq	z, .lbl_19
-	ld	(ix + -3), de
-	ld	de, -400
-	lea	hl, ix + 0
-	add	hl, de
-	ld	iy, (hl)
+	jq	nz, .exit
+	; v0 = k0 ^ iv0, v1 = k1 ^ iv1, v2 = k0 ^ iv2, v3 = k1 ^ iv3
+	ld	de, (ix + 6)
+	ld	hl, _siphash_iv
+	ld	c, 4
+.lane:
+	ld	iy, (ix + 9)
+	bit	0, c
+	jq	z, .half
+	lea	iy, iy + 8
+.half:
+	ld	b, 8
+.byte:
 	ld	a, (iy)
-	push	ix
-	ld	de, -394
-	add	ix, de
-	ld	hl, (ix + 0)
-	pop	ix
 	xor	a, (hl)
-	ld	(iy), a
-	dec	bc
+	ld	(de), a
 	inc	hl
-	push	ix
-	add	ix, de
-	ld	(ix + 0), hl
-	pop	ix
+	inc	de
 	inc	iy
-	ld	de, -400
-	lea	hl, ix + 0
-	add	hl, de
-	ld	(hl), iy
-	ld	de, (ix + -3)
-	jq	.lbl_17
-.lbl_19:
+	djnz	.byte
+	dec	c
+	jq	nz, .lane
 	ex	de, hl
-	jq	.lbl_20
-	
- 
-hashlib_AESStripPadding:
-	save_interrupts
+	ld	b, 8 + 2
+.clear:
+	ld	(hl), 0
+	inc	hl
+	djnz	.clear
+	ld	a, 1
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
 
- 	ld	hl, -3
-	call	ti._frameset
-	ld	bc, (ix + 9)
-	ld	de, 0
-	push	bc
+; void mac_siphash_update(siphash_ctx *ctx, const BYTE data[], size_t len);
+mac_siphash_update:
+	call	ti._frameset0
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+.byte:
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
 	pop	hl
+	jq	z, .done
+	dec	bc
+	ld	a, (hl)
+	inc	hl
+	push	hl, bc
+	lea	hl, iy + sip_offset_m
+	ld	bc, 0
+	ld	c, (iy + sip_offset_pos)
+	add	hl, bc
+	ld	(hl), a
+	inc	(iy + sip_offset_len)
+	ld	a, c
+	inc	a
+	and	a, 7
+	ld	(iy + sip_offset_pos), a
+	call	z, _siphash_compress
+	pop	bc, hl
+	jq	.byte
+.done:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; void mac_siphash_final(siphash_ctx *ctx, BYTE out[]);
+mac_siphash_final:
+	ld	hl, -_sip_ctx_size
+	call	ti._frameset
+	ld	hl, (ix + 6)
+	lea	de, ix - _sip_ctx_size
+	ld	bc, _sip_ctx_size
+	ldir
+	lea	iy, ix - _sip_ctx_size
+	ld	de, (ix + 9)
+	call	_siphash_finish
+	jp	stack_clear
+
+; pads and absorbs the last word, then writes the 8-byte output
+; iy = state, de = out
+; destroys: af, bc, de, hl, iy
+_siphash_finish:
+	push	de
+	; the last word is zero padded and carries the length mod 256 in its top byte
+	lea	hl, iy + sip_offset_m
+	ld	bc, 0
+	ld	c, (iy + sip_offset_pos)
 	add	hl, bc
+	ld	a, 7
+	sub	a, c
+	jq	z, .length
+	ld	b, a
+.pad:
+	ld	(hl), 0
+	inc	hl
+	djnz	.pad
+.length:
+	ld	a, (iy + sip_offset_len)
+	ld	(hl), a
+	call	_siphash_compress
+	ld	a, (iy + 16)
+	cpl
+	ld	(iy + 16), a
+	ld	a, 2
+	call	_siphash_rounds
+	pop	de
+	ld	b, 8
+.out:
+	ld	a, (iy + 0)
+	xor	a, (iy + 8)
+	xor	a, (iy + 16)
+	xor	a, (iy + 24)
+	ld	(de), a
+	inc	iy
+	inc	de
+	djnz	.out
+	ret
+
+
+;------------------------------------------
+; hash map, open addressing with linear probing over a flat slot array.
+; keys are hashed with siphash-2-4 under a random per-map key, so colliding
+; keys cannot be chosen from outside, and are copied to the top of the arena
+virtual at 0
+	hmap_offset_key         rb SIPHASH24_KEY_LEN
+	hmap_offset_slots       rb 3
+	hmap_offset_mask        rb 3
+	hmap_offset_count       rb 3
+	hmap_offset_free        rb 3
+	hmap_offset_end         rb 3
+	_hmap_size:
+end virtual
+
+virtual at 0
+	hslot_offset_hash       rb 3
+	hslot_offset_key        rb 3
+	hslot_offset_len        rb 3
+	hslot_offset_value      rb 3
+	_hmap_slot_size:
+end virtual
+
+HMAP_MAX_SLOTS          := 32768
+
+HMAP_NEW                := 0
+HMAP_UPDATED            := 1
+HMAP_FULL               := 2
+
+; hmap_init(map, arena, size, slots);
+hmap_init:
+	call	ti._frameset0
+	; (ix+6) map
+	; (ix+9) arena
+	; (ix+12) size
+	; (ix+15) slots
+
+	; slots must be a power of 2, from 2 to HMAP_MAX_SLOTS
+	ld	hl, (ix + 15)
+	dec	hl
+	dec	hl
+	ld	de, HMAP_MAX_SLOTS - 1
+	xor	a, a
+	sbc	hl, de
+	jq	nc, .exit
+	ld	de, (ix + 15)
+	push	de
+	pop	hl
+	dec	hl
+	ld	a, l
+	and	a, e
+	ld	c, a
+	ld	a, h
+	and	a, d
+	or	a, c
+	ld	a, 0
+	jq	nz, .exit
+	ld	iy, (ix + 6)
+	ld	(iy + hmap_offset_mask), hl
+	; the slots come first, and must fit
+	push	de
+	pop	hl
+	add	hl, hl
+	add	hl, de
+	add	hl, hl
+	add	hl, hl
+	push	hl
+	pop	bc
+	ld	hl, (ix + 12)
 	or	a, a
 	sbc	hl, bc
-	jq	nz, .lbl_1
-	jq	.lbl_10
-.lbl_1:
-	ld	iy, (ix + 6)
-	lea	hl, iy + 0
+	jq	c, .exit
+	ld	hl, (ix + 9)
+	ld	(iy + hmap_offset_slots), hl
+	ld	(hl), 0
+	push	hl
+	pop	de
+	inc	de
+	dec	bc
+	ldir
+	ld	(iy + hmap_offset_free), de
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
 	add	hl, bc
+	ld	(iy + hmap_offset_end), hl
 	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_2
-	jq	.lbl_10
-.lbl_2:
-	ld	hl, (ix + 12)
+	sbc	hl, hl
+	ld	(iy + hmap_offset_count), hl
+	ld	hl, SIPHASH24_KEY_LEN
+	push	hl, iy
+	call	csrand_fill
+	pop	hl, hl
+	ld	a, 1
+.exit:
+	pop	ix
+	ret
+
+; hmap_find(map, key, keylen, value);
+hmap_find:
+	ld	hl, -6
+	call	ti._frameset
+	; (ix+15) value
+
+	call	_hmap_lookup
+	ld	a, 0
+	jq	c, .exit
+	ld	hl, (ix + 15)
 	add	hl, bc
 	or	a, a
 	sbc	hl, bc
-	jq	nz, .lbl_3
-	jq	.lbl_10
-.lbl_3:
-	ld	l, (ix + 15)
-	ld	a, l
-	or	a, a
-	jq	nz, .lbl_4
-	push	bc
-	pop	de
-	dec	de
-	lea	hl, iy + 0
-	add	hl, de
-	ld	a, (hl)
-	ld	de, 0
-	ld	e, a
-	push	bc
-	pop	hl
-	or	a, a
-	sbc	hl, de
+	jq	z, .found
+	ld	de, (iy + hslot_offset_value)
+	ld	(hl), de
+.found:
+	ld	a, 1
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; hmap_put(map, key, keylen, value);
+hmap_put:
+	ld	hl, -9
+	call	ti._frameset
+	; (ix+15) value
+
+	call	_hmap_lookup
+	ld	a, HMAP_UPDATED
+	jq	nc, .value
+	ld	(ix - 9), iy
+	ld	iy, (ix + 6)
+	ld	a, HMAP_FULL
+	; the load stays at 3/4 or below, so every probe ends at an empty slot
+	ld	hl, (iy + hmap_offset_count)
+	inc	hl
+	add	hl, hl
+	add	hl, hl
+	ex	de, hl
+	ld	hl, (iy + hmap_offset_mask)
+	inc	hl
 	push	hl
 	pop	bc
-	jq	.lbl_9
-.lbl_4:
-	ld	a, l
-	cp	a, 1
-	jq	nz, .lbl_10
-	lea	hl, iy + 0
-	dec	hl
-	ld	(ix + -3), hl
-.lbl_7:
-	ld	hl, (ix + -3)
-	add	hl, bc
-	dec	bc
-	ld	a, (hl)
-	cp	a, -128
-	jq	nz,	.lbl_7
-	inc	bc
-.lbl_9:
-	ld	(ix + -3), bc
-	push	bc
-	push	iy
-	ld	hl, (ix + 12)
-	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	de, (ix + -3)
-	ld	iy, (ix + 12)
-	add	iy, de
-	ld	hl, (ix + 9)
-	ld	de, (ix + -3)
+	add	hl, hl
+	add	hl, bc
 	or	a, a
 	sbc	hl, de
-	push	hl
+	jq	c, .exit
+	; the key has to fit in the arena
+	ld	hl, (iy + hmap_offset_free)
+	ld	bc, (ix + 12)
+	add	hl, bc
+	ex	de, hl
+	ld	hl, (iy + hmap_offset_end)
 	or	a, a
-	sbc	hl, hl
+	sbc	hl, de
+	jq	c, .exit
+	ld	hl, (iy + hmap_offset_free)
+	ld	(iy + hmap_offset_free), de
 	push	hl
-	push	iy
-	call	ti._memset
-	ld	de, (ix + -3)
-	pop	hl
-	pop	hl
-	pop	hl
-.lbl_10:
 	ex	de, hl
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	call	_hmap_copy
+	ld	hl, (iy + hmap_offset_count)
+	inc	hl
+	ld	(iy + hmap_offset_count), hl
+	pop	de
+	ld	iy, (ix - 9)
+	ld	(iy + hslot_offset_key), de
+	ld	hl, (ix - 3)
+	ld	(iy + hslot_offset_hash), hl
+	ld	hl, (ix + 12)
+	ld	(iy + hslot_offset_len), hl
+	ld	a, HMAP_NEW
+.value:
+	ld	hl, (ix + 15)
+	ld	(iy + hslot_offset_value), hl
+.exit:
 	ld	sp, ix
 	pop	ix
-
-	restore_interrupts hashlib_AESStripPadding
 	ret
- 
-oaep_decode:
-	save_interrupts
 
-	ld	hl, -729
+; hmap_remove(map, key, keylen);
+hmap_remove:
+	ld	hl, -15
 	call	ti._frameset
-	ld	de, (ix + 9)
-	ld	bc, 0
-	dec	de
-	ld	iy, 256
-	ex	de, hl
-	lea	de, iy + 0
+	; (ix-9) index of the hole
+	; (ix-12) mask
+	; (ix-15) slot that may move into the hole
+
+	call	_hmap_lookup
+	ld	a, 0
+	jq	c, .exit
+	ld	iy, (ix + 6)
+	ld	hl, (iy + hmap_offset_count)
+	dec	hl
+	ld	(iy + hmap_offset_count), hl
+	ld	hl, (iy + hmap_offset_mask)
+	ld	(ix - 12), hl
+	ld	hl, (ix - 6)
+	ld	(ix - 9), hl
+	; close the gap, so no probe stops short of an entry past it
+.shift:
+	ld	iy, (ix + 6)
+	ld	de, (ix - 6)
+	call	_hmap_next
+	ld	(ix - 6), de
+	call	_hmap_slot
+	ld	(ix - 15), hl
+	push	hl
+	pop	iy
+	ld	bc, (iy + hslot_offset_key)
 	or	a, a
-	sbc	hl, de
-	jq	nc, .lbl_29
-	ld	hl, (ix + 6)
-	add	hl, bc
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .done
+	; an entry stays put if its home slot lies after the hole
+	ld	hl, (ix - 6)
+	ld	bc, (iy + hslot_offset_hash)
 	or	a, a
 	sbc	hl, bc
-	jq	z, .lbl_29
-	ld	hl, (ix + 12)
-	add	hl, bc
+	ld	a, l
+	and	a, (ix - 12)
+	ld	c, a
+	ld	a, h
+	and	a, (ix - 11)
+	ld	b, a
+	ld	hl, (ix - 6)
+	ld	de, (ix - 9)
 	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_29
-	ld	de, -440
-	lea	iy, ix + 0
-	add	iy, de
-	ld	a, (ix + 18)
-	ld	bc, -1
-	ld	hl, _hash_out_lens
-	push	ix
-	ld	de, -714
-	add	ix, de
-	ld	(ix + 0), iy
-	pop	ix
-	lea	de, iy + 114
-	ld	(ix + -3), bc
-	ld	bc, -702
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), de
-	push	ix
-	ld	bc, -696
-	add	ix, bc
-	lea	de, ix + 0
-	pop	ix
-	push	ix
-	ld	bc, -699
-	add	ix, bc
-	ld	(ix + 0), de
-	pop	ix
-	ld	de, 0
-	ld	e, a
-	add	hl, de
-	ld	e, (hl)
-	push	de
-	pop	hl
-	ld	bc, (ix + -3)
-	call	ti._ixor
-	ld	bc, (ix + 9)
-	add	hl, bc
-	ld	(ix + -3), bc
-	push	ix
-	ld	bc, -711
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	ld	bc, -705
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), de
-	push	de
-	pop	hl
-	inc	hl
-	push	ix
-	ld	bc, -708
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	add	hl, de
-	push	ix
-	ld	de, -729
-	add	ix, de
-	ld	(ix + 0), hl
-	pop	ix
-	ld	bc, (ix + -3)
-	push	bc
-	ld	hl, (ix + 6)
-	push	hl
-	ld	bc, -699
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, -699
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	ix
-	ld	bc, -708
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	add	hl, de
-	ld	a, (ix + 18)
-	ld	e, a
-	push	de
-	push	ix
-	ld	bc, -705
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
-	push	ix
-	ld	bc, -702
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
-	push	ix
-	ld	bc, -711
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
+	sbc	hl, de
+	ld	a, l
+	and	a, (ix - 12)
+	ld	l, a
+	ld	a, h
+	and	a, (ix - 11)
+	ld	h, a
+	ld	a, c
+	sub	a, l
+	ld	a, b
+	sbc	a, h
+	jq	c, .shift
+	ld	iy, (ix + 6)
+	ld	de, (ix - 9)
+	call	_hmap_slot
+	ex	de, hl
+	ld	hl, (ix - 15)
+	ld	bc, _hmap_slot_size
+	ldir
+	ld	hl, (ix - 6)
+	ld	(ix - 9), hl
+	jq	.shift
+.done:
+	ld	iy, (ix + 6)
+	ld	de, (ix - 9)
+	call	_hmap_slot
 	push	hl
-	call	hash_mgf1
-	pop	hl
-	pop	hl
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	l, 1
-	xor	a, l
-	bit	0, a
-	jq	nz, .lbl_10
-	lea	hl, ix + -70
-	ld	de, -720
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), hl
-	ld	de, -714
-	lea	hl, ix + 0
-	add	hl, de
-	ld	iy, (hl)
-	lea	hl, iy + 0
-	ld	de, -717
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), hl
-	ld	de, -699
-	lea	hl, ix + 0
-	add	hl, de
-	ld	iy, (hl)
-	inc	iy
-	push	ix
-	ld	de, -702
-	add	ix, de
-	ld	hl, (ix + 0)
-	pop	ix
-	push	ix
-	ld	de, -723
-	add	ix, de
-	ld	(ix + 0), hl
-	pop	ix
-	ld	de, -705
-	lea	hl, ix + 0
-	add	hl, de
-	ld	bc, (hl)
-	push	ix
-	ld	de, -714
-	add	ix, de
-	ld	(ix + 0), bc
-	pop	ix
-.lbl_8:
-	ld	de, -714
-	lea	hl, ix + 0
-	add	hl, de
-	ld	hl, (hl)
-	add	hl, bc
+	pop	iy
 	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_11
-	ld	a, (iy)
-	ld	de, -726
-	lea	hl, ix + 0
-	add	hl, de
-	ld	(hl), iy
-	ld	de, -723
-	lea	iy, ix + 0
-	add	iy, de
-	ld	hl, (iy + 0)
-	xor	a, (hl)
-	push	ix
-	ld	de, -726
-	add	ix, de
-	ld	iy, (ix + 0)
-	pop	ix
-	ld	(iy), a
-	ld	(ix + -3), bc
-	ld	bc, -714
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	dec	de
-	push	ix
-	add	ix, bc
-	ld	(ix + 0), de
+	sbc	hl, hl
+	ld	(iy + hslot_offset_key), hl
+	ld	a, 1
+.exit:
+	ld	sp, ix
 	pop	ix
-	inc	hl
-	push	ix
-	ld	de, -723
-	add	ix, de
-	ld	(ix + 0), hl
+	ret
+
+; finds the slot of a key
+; (ix+6) map, (ix+9) key, (ix+12) keylen, from the caller's frame
+; returns iy = the slot holding the key (nc), or the empty slot where it would go (c),
+; (ix-3) = hash, (ix-6) = index of the slot
+; destroys: af, bc, de, hl
+_hmap_lookup:
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_hmap_hash
+	pop	bc, bc, bc
+	ld	(ix - 3), hl
+	ld	iy, (ix + 6)
+	ld	de, 0
+	ld	a, l
+	and	a, (iy + hmap_offset_mask)
+	ld	e, a
+	ld	a, h
+	and	a, (iy + hmap_offset_mask + 1)
+	ld	d, a
+.probe:
+	ld	(ix - 6), de
+	call	_hmap_slot
+	push	hl
+	pop	iy
+	ld	bc, (iy + hslot_offset_key)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	scf
+	ret	z
+	; check the stored hash and length before the key itself
+	ld	hl, (iy + hslot_offset_hash)
+	ld	de, (ix - 3)
+	or	a, a
+	sbc	hl, de
+	jq	nz, .next
+	ld	hl, (iy + hslot_offset_len)
+	ld	bc, (ix + 12)
+	sbc	hl, bc
+	jq	nz, .next
+	sbc	hl, bc			; an empty key matches at once
+	ret	z
+	ld	hl, (iy + hslot_offset_key)
+	ld	de, (ix + 9)
+.compare:
+	ld	a, (de)
+	inc	de
+	cpi
+	jq	nz, .next
+	jp	pe, .compare
+	or	a, a
+	ret
+.next:
+	ld	iy, (ix + 6)
+	ld	de, (ix - 6)
+	call	_hmap_next
+	jq	.probe
+
+; _hmap_hash(map, key, keylen);
+; returns hl = the low 24 bits of the siphash-2-4 of the key
+_hmap_hash:
+._ctx := -(_sip_ctx_size + 8)
+._out := -8
+	ld	hl, ._ctx
+	call	ti._frameset
+	ld	hl, SIPHASH24_KEY_LEN
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	pea	ix + ._ctx
+	call	mac_siphash_init
+	pop	hl, hl, hl
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	pea	ix + ._ctx
+	call	mac_siphash_update
+	pop	hl, hl, hl
+	lea	iy, ix + ._ctx
+	lea	de, ix + ._out
+	call	_siphash_finish
+	ld	hl, (ix + ._out)
+	ld	sp, ix
 	pop	ix
-	ld	de, -726
-	lea	hl, ix + 0
+	ret
+
+; iy = map, de = index
+; returns hl = slot
+; preserves de
+_hmap_slot:
+	push	de
+	pop	hl
+	add	hl, hl
 	add	hl, de
-	ld	iy, (hl)
-	inc	iy
-	ld	bc, (ix + -3)
-	jq	.lbl_8
-.lbl_11:
-	ld	de, -699
-	lea	hl, ix + 0
+	add	hl, hl
+	add	hl, hl
+	push	de
+	ld	de, (iy + hmap_offset_slots)
 	add	hl, de
-	ld	hl, (hl)
-	inc	hl
-	ld	a, (ix + 18)
+	pop	de
+	ret
+
+; iy = map, de = index
+; returns de = the next index, wrapping around
+; destroys: af
+_hmap_next:
+	inc	de
+	ld	a, e
+	and	a, (iy + hmap_offset_mask)
 	ld	e, a
-	push	de
-	ld	(ix + -3), bc
-	ld	bc, -711
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	push	de
-	push	ix
-	ld	bc, -702
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
-	ld	bc, (ix + -3)
-	push	bc
+	ld	a, d
+	and	a, (iy + hmap_offset_mask + 1)
+	ld	d, a
+	ret
+
+; copies bc bytes from hl to de, bc may be 0
+; destroys: af, bc, de, hl
+_hmap_copy:
 	push	hl
-	call	hash_mgf1
-	ld	bc, -702
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	iy, (hl)
-	pop	hl
-	pop	hl
-	pop	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
 	pop	hl
+	ret	z
+	ldir
+	ret
+
+
+;------------------------------------------
+; one-time passwords (RFC 4226 HOTP, RFC 6238 TOTP)
+; the context keeps the hmac-sha1 inner and outer midstates, so each code
+; costs two sha1 compressions no matter how long the key is
+virtual at 0
+	otp_offset_inner        rb 5*4
+	otp_offset_outer        rb 5*4
+	otp_offset_digits       rb 1
+	_otp_ctx_size:
+end virtual
+
+OTP_MAX_DIGITS          := 9
+
+; otp_init(ctx, key, keylen, digits);
+otp_init:
+	save_interrupts
+
+	ld	hl, -_hmac_sha1ctx_size
+	call	ti._frameset
+	ld	a, (ix + 15)
+	dec	a
+	cp	a, OTP_MAX_DIGITS
+	ld	a, 0
+	jq	nc, .exit
+	; key a hmac-sha1 context in the frame, then keep its midstates
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	bc, -_hmac_sha1ctx_size
+	lea	iy, ix + 0
+	add	iy, bc
+	push	iy
+	call	hmac_sha1_init
+	pop	iy, hl, hl
+	push	iy
 	pop	hl
-	ld	de, (ix + 9)
-	ld	(ix + -3), de
-	ld	de, -708
-	lea	hl, ix + 0
-	add	hl, de
-	ld	bc, (hl)
-	ld	de, (ix + -3)
-.lbl_12:
+	ld	bc, 128 + offset_state
+	add	hl, bc
+	ld	de, (ix + 6)
+	ld	bc, 5*4
+	ldir
 	push	de
+	push	iy
 	pop	hl
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_14
-	ld	(ix + -3), de
-	ld	de, -699
-	lea	hl, ix + 0
-	add	hl, de
-	ld	hl, (hl)
+	ld	bc, 64
 	add	hl, bc
-	ld	a, (hl)
-	xor	a, (iy)
-	ld	(hl), a
-	inc	bc
-	inc	iy
-	ld	de, (ix + -3)
-	jq	.lbl_12
-.lbl_14:
-	ld	a, (ix + 18)
-	ld	l, a
 	push	hl
-	ld	bc, -717
-	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	call	hash_init
-	pop	hl
-	pop	hl
+	call	_sha1_pad_block
+	pop	hl, bc
+	ld	bc, offset_state
+	add	hl, bc
+	pop	de
+	ld	bc, 5*4
+	ldir
+	ld	a, (ix + 15)
+	ld	(de), a
+	ld	a, 1
+.exit:
+	restore_interrupts_noret_preserve_a otp_init
+	jp stack_clear
+
+
+; hotp_generate(ctx, counter);
+hotp_generate:
+	save_interrupts
+
+	ld	hl, -(_sha1ctx_size + 3)
+	call	ti._frameset
+._blk := -_sha1ctx_size
+._tmp := ._blk - 3
+	; inner block: the counter as 8 bytes big endian, padded as a 72-byte message
+	lea	de, ix + ._blk
+	ld	hl, $FF0000
+	ld	bc, 64
+	ldir
+	ld	a, (ix + 12)
+	ld	(ix + ._blk + 4), a
+	ld	a, (ix + 11)
+	ld	(ix + ._blk + 5), a
+	ld	a, (ix + 10)
+	ld	(ix + ._blk + 6), a
+	ld	a, (ix + 9)
+	ld	(ix + ._blk + 7), a
+	ld	(ix + ._blk + 8), $80
+	ld	(ix + ._blk + 62), 72*8 shr 8
+	ld	(ix + ._blk + 63), 72*8 and $FF
+	ld	hl, (ix + 6)
+	lea	de, ix + ._blk + offset_state
+	ld	bc, 5*4
+	ldir
+	pea	ix + ._blk
+	call	_sha1_transform
+	pop	hl
+	; outer block: the inner digest, padded as an 84-byte message
+	lea	iy, ix + ._blk + offset_state
+	ld	b, 5
+	call	_sha256_reverse_endianness
+	ld	(hl), $80
+	inc	hl
+	ex	de, hl
+	ld	hl, $FF0000
+	ld	bc, 64 - 20 - 1 - 2
+	ldir
+	ld	(ix + ._blk + 62), 84*8 shr 8
+	ld	(ix + ._blk + 63), 84*8 and $FF
+	ld	hl, (ix + 6)
+	ld	bc, otp_offset_outer
+	add	hl, bc
+	lea	de, ix + ._blk + offset_state
+	ld	bc, 5*4
+	ldir
+	pea	ix + ._blk
+	call	_sha1_transform
+	pop	hl
+	lea	iy, ix + ._blk + offset_state
+	ld	b, 5
+	call	_sha256_reverse_endianness
+	; dynamic truncation: 31 bits from offset hmac[19] & 15
+	ld	a, (ix + ._blk + 19)
+	and	a, $0F
+	ld	bc, 0
+	ld	c, a
+	lea	hl, ix + ._blk
+	add	hl, bc
+	ld	a, (hl)
+	and	a, $7F
+	ld	e, a
+	inc	hl
+	ld	a, (hl)
+	ld	(ix + ._tmp + 2), a
+	inc	hl
+	ld	a, (hl)
+	ld	(ix + ._tmp + 1), a
+	inc	hl
+	ld	a, (hl)
+	ld	(ix + ._tmp + 0), a
+	ld	hl, (ix + ._tmp)
+	; code = value mod 10^digits
+	ld	iy, (ix + 6)
+	ld	c, (iy + otp_offset_digits)
+	ld	b, 4
+	mlt	bc
+	ld	iy, _otp_pow10
+	add	iy, bc
+	ld	bc, (iy + 0)
+	ld	a, (iy + 3)
+	call	ti._lremu
+
+	restore_interrupts_noret hotp_generate
+	jp stack_clear
+
+
+; hotp_generate_range(ctx, counter, count, codes);
+hotp_generate_range:
+	call	ti._frameset0
+	; (ix + 6) ctx
+	; (ix + 9) counter
+	; (ix + 15) count
+	; (ix + 18) codes
+.loop:
 	ld	hl, (ix + 15)
 	add	hl, bc
 	or	a, a
 	sbc	hl, bc
-	jq	z, .lbl_16
+	jq	z, .done
+	dec	hl
+	ld	(ix + 15), hl
+	ld	hl, (ix + 12)
 	push	hl
-	call	ti._strlen
-	pop	de
+	ld	hl, (ix + 9)
 	push	hl
-	ld	hl, (ix + 15)
+	ld	hl, (ix + 6)
 	push	hl
-	ld	bc, -717
-	lea	hl, ix + 0
+	call	hotp_generate
+	pop	bc, bc, bc
+	ld	iy, (ix + 18)
+	ld	(iy + 0), hl
+	ld	(iy + 3), e
+	lea	iy, iy + 4
+	ld	(ix + 18), iy
+	ld	hl, (ix + 9)
+	ld	a, (ix + 12)
+	ld	bc, 1
 	add	hl, bc
-	ld	hl, (hl)
+	adc	a, 0
+	ld	(ix + 9), hl
+	ld	(ix + 12), a
+	jq	.loop
+.done:
+	ld	sp, ix
+	pop	ix
+	ret
+
+
+; totp_generate(ctx, time, step);
+totp_generate:
+	call	ti._frameset0
+	; counter = time / step
+	ld	hl, (ix + 9)
+	ld	e, (ix + 12)
+	ld	bc, (ix + 15)
+	xor	a, a
+	call	ti._ldivu
+	push	de
 	push	hl
-	call	hash_update
-	pop	hl
-	pop	hl
-	pop	hl
-.lbl_16:
-	ld	bc, -720
-	lea	hl, ix + 0
+	ld	hl, (ix + 6)
+	push	hl
+	call	hotp_generate
+	ld	sp, ix
+	pop	ix
+	ret
+
+hmac_pbkdf2:
+	call	_scratch_enter
+	save_interrupts
+
+ 	ld	hl, -654
+	call	ti._frameset
+	ld	a, (ix + 27)
+	ld	hl, _hash_out_lens
+	ld	iy, 0
+	ld	e, 0
+	push	ix
+	ld	bc, -623
+	add	ix, bc
+	ld	(ix + 0), e
+	pop	ix
+	push	ix
+	ld	bc, -380
+	add	ix, bc
+	lea	de, ix + 0
+	pop	ix
+	lea	bc, iy + 0
+	ld	c, a
+	ld	(ix + -3), de
+	push	ix
+	ld	de, -626
+	add	ix, de
+	ld	(ix + 0), bc
+	pop	ix
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -717
+	ld	a, (hl)
+	ld	bc, -632
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
+	ld	(hl), a
+	ld	hl, 242
 	push	hl
-	call	hash_final
-	pop	hl
-	pop	hl
-	ld	bc, -705
+	push	iy
+	ld	de, (ix + -3)
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	hl, (ix + 12)
-	push	hl
-	ld	bc, -720
-	lea	hl, ix + 0
+	ld	(hl), de
+	push	de
+	call	ti._memset
+	pop	de
+	pop	de
+	pop	de
+	; only the hash-based macs can be iterated
+	ld	a, (ix + 27)
+	cp	a, hmac_algs_impl
+	jq	nc, .lbl_17
+	ld	hl, (ix + 15)
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	digest_compare
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	l, 1
-	xor	a, l
-	bit	0, a
-	jq	nz, .lbl_10
-	ld	de, -729
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_1
+	jq	.lbl_17
+.lbl_1:
+	ld	de, -626
 	lea	hl, ix + 0
 	add	hl, de
 	ld	bc, (hl)
-	push	bc
-	pop	hl
-	ld	de, (ix + 9)
 	or	a, a
-	sbc	hl, de
-	jq	c, .lbl_19
-	push	bc
-	pop	de
-.lbl_19:
-	ld	(ix + -3), bc
-	ld	bc, -702
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), de
-	ld	iy, 0
-	ld	bc, (ix + -3)
-.lbl_20:
-	push	bc
-	pop	hl
+	sbc	hl, hl
+	ld	de, -635
+	lea	iy, ix + 0
+	add	iy, de
+	ld	(iy + 0), hl
 	ld	de, (ix + 9)
-	or	a, a
-	sbc	hl, de
-	jq	nc, .lbl_24
-	ld	de, -699
-	lea	hl, ix + 0
-	add	hl, de
-	ld	hl, (hl)
-	add	hl, bc
-	ld	a, (hl)
-	cp	a, 1
-	jq	z, .lbl_25
-	inc	bc
-	jq	.lbl_20
-.lbl_10:
-	ld	iy, 0
-.lbl_28:
-	lea	bc, iy + 0
-.lbl_29:
-	push	bc
-	pop	hl
-    restore_interrupts_noret oaep_decode
-    jp stack_clear
-.lbl_24:
-	ld	bc, -702
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	de, (hl)
-	jq	.lbl_26
-.lbl_25:
-	push	bc
-	pop	de
-.lbl_26:
 	push	de
 	pop	hl
-	ld	bc, (ix + 9)
+	add	hl, bc
 	or	a, a
 	sbc	hl, bc
-	jq	z, .lbl_28
-	inc	de
-	ld	(ix + -3), bc
-	ld	bc, -699
-	lea	hl, ix + 0
+	jq	nz, .lbl_2
+	jq	.lbl_17
+.lbl_2:
+	ld	iy, (ix + 6)
+	lea	hl, iy + 0
 	add	hl, bc
-	ld	iy, (hl)
-	add	iy, de
-	ld	bc, (ix + -3)
-	push	bc
-	pop	hl
 	or	a, a
-	sbc	hl, de
-	push	ix
-	ld	bc, -699
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	push	hl
-	push	iy
+	sbc	hl, bc
+	jq	nz, .lbl_3
+	jq	.lbl_17
+.lbl_3:
 	ld	hl, (ix + 12)
-	push	hl
-	call	ti._memcpy
-	ld	bc, -699
-	lea	hl, ix + 0
 	add	hl, bc
-	ld	iy, (hl)
-	pop	hl
-	pop	hl
-	pop	hl
-	jq	.lbl_28
-    
-    
-pss_encode:
-	save_interrupts
-
-    ld	hl, -606
-	call	ti._frameset
-	ld	a, (ix + 21)
-	ld	hl, _hash_out_lens
-	ld	iy, -1
-	ld	bc, 0
-	push	bc
-	pop	de
-	ld	e, a
-	add	hl, de
-	ld	a, (hl)
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_4
+	jq	.lbl_17
+.lbl_4:
+	ld	hl, (ix + 24)
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .lbl_5
+	jq	.lbl_17
+.lbl_5:
 	push	bc
-	pop	de
-	ld	e, a
 	push	de
-	pop	hl
-	lea	bc, iy + 0
-	call	ti._ixor
-	ld	bc, (ix + 15)
-	ld	(ix + -3), de
-	ld	de, -579
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), hl
-	push	hl
-	pop	iy
-	add	iy, bc
-	ld	bc, -585
+	push	iy
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	(hl), iy
-	ld	de, (ix + -3)
-	push	de
-	pop	hl
+	ld	hl, (hl)
 	push	hl
-	pop	iy
-	add	iy, iy
-	ld	bc, 8
-	add	iy, bc
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -582
-	add	ix, de
-	ld	(ix + 0), iy
-	pop	ix
+	call	hmac_init
+	pop	de
+	pop	de
+	pop	de
+	pop	de
 	add	hl, bc
-	ld	bc, -588
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_17
+	ld	bc, -138
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	bc, -638
 	lea	iy, ix + 0
 	add	iy, bc
 	ld	(iy + 0), hl
-	ld	bc, -579
+	ld	a, 1
+	ld	bc, -623
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
-	ld	de, (ix + -3)
-	or	a, a
-	sbc	hl, de
+	ld	(hl), a
+	lea	hl, ix + -70
 	push	ix
+	ld	bc, -626
 	add	ix, bc
 	ld	(ix + 0), hl
 	pop	ix
-	ld	iy, (ix + 15)
-	ld	bc, -128
-	add	iy, bc
-	ld	hl, (ix + 9)
+	ld	bc, -134
+	lea	hl, ix + 0
 	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_1
-	ld	hl, (ix + 6)
+	push	ix
+	ld	bc, -641
+	add	ix, bc
+	ld	(ix + 0), hl
+	pop	ix
+	ld	bc, -622
+	lea	hl, ix + 0
 	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_1
-	ld	hl, (ix + 12)
+	push	hl
+	pop	de
+	push	ix
+	ld	bc, -635
+	add	ix, bc
+	ld	hl, (ix + 0)
+	pop	ix
 	push	ix
-	ld	bc, -591
+	ld	bc, -632
+	add	ix, bc
+	ld	a, (ix + 0)
+	pop	ix
+	ld	l, a
+	push	ix
+	ld	bc, -635
 	add	ix, bc
 	ld	(ix + 0), hl
 	pop	ix
+	ld	hl, 242
+	push	hl
+	ld	bc, -629
+	lea	hl, ix + 0
 	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_1
-	ld	bc, -594
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -644
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	(hl), de
-	ld	de, 129
+	push	de
+	call	ti._memcpy
+	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, 1
+	xor	a, a
+	ld	de, (ix + 15)
+	ld	iy, 0
+.lbl_7:
 	lea	hl, iy + 0
 	or	a, a
 	sbc	hl, de
-	jq	c, .lbl_8
-.lbl_1:
-	or	a, a
-	sbc	hl, hl
-.lbl_17:
-    restore_interrupts_noret pss_encode
-	jp stack_clear
-.lbl_8:
-	ld	bc, -320
+	jq	nc, .lbl_23
+	ex	de, hl
+	lea	de, iy + 0
+	ld	(ix + -3), bc
+	ld	bc, -632
 	lea	iy, ix + 0
 	add	iy, bc
-	ld	bc, -142
-	lea	hl, ix + 0
-	add	hl, bc
+	ld	(iy + 0), de
+	or	a, a
+	sbc	hl, de
 	push	ix
-	ld	bc, -600
-	add	ix, bc
+	ld	de, -651
+	add	ix, de
 	ld	(ix + 0), hl
 	pop	ix
-	ld	bc, -603
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), iy
-	lea	hl, iy + 64
-	ld	bc, -597
+	ld	bc, (ix + -3)
+	push	bc
+	pop	de
+	ld	h, a
+	ld	l, 24
+	call	ti._lshru
+	ld	a, c
+	push	ix
+	ld	bc, -638
+	add	ix, bc
+	ld	iy, (ix + 0)
+	pop	ix
+	ld	(iy + 0), a
+	push	de
+	pop	bc
+	ld	(ix + -3), de
+	ld	de, -648
 	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), hl
-	ld	hl, (ix + 15)
+	add	iy, de
+	ld	(iy + 0), h
+	ld	a, h
+	ld	l, 16
+	call	ti._lshru
+	ld	a, c
+	push	ix
+	ld	bc, -638
+	add	ix, bc
+	ld	iy, (ix + 0)
+	pop	ix
+	ld	(iy + 1), a
+	ld	de, (ix + -3)
+	ld	a, d
+	ld	(iy + 2), a
+	push	ix
+	ld	bc, -647
+	add	ix, bc
+	ld	(ix + 0), de
+	pop	ix
+	ld	a, e
+	ld	(iy + 3), a
+	ld	hl, (ix + 21)
 	push	hl
-	or	a, a
-	sbc	hl, hl
+	ld	hl, (ix + 18)
 	push	hl
-	ld	hl, (ix + 12)
+	ld	bc, -629
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
 	push	hl
-	call	ti._memset
+	call	hmac_update
 	pop	hl
 	pop	hl
 	pop	hl
-	ld	hl, 136
+	ld	hl, 4
 	push	hl
-	or	a, a
-	sbc	hl, hl
+	ld	bc, -638
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
 	push	hl
-	ld	bc, -600
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	call	ti._memset
+	call	hmac_update
 	pop	hl
 	pop	hl
 	pop	hl
-	ld	a, (ix + 21)
-	ld	l, a
+	ld	bc, -626
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
 	push	hl
-	ld	bc, -597
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	call	hash_init
+	call	hmac_final
 	pop	hl
 	pop	hl
-	ld	l, 1
-	xor	a, l
-	bit	0, a
-	ld	hl, 0
-	jq	nz, .lbl_17
-	ld	bc, -603
+	ld	bc, -635
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	iy, (hl)
-	lea	hl, iy + 0
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), hl
-	ld	bc, -576
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -626
 	lea	hl, ix + 0
 	add	hl, bc
-	push	ix
-	ld	bc, -606
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	ld	hl, (ix + 9)
-	push	hl
-	ld	hl, (ix + 6)
+	ld	hl, (hl)
 	push	hl
-	ld	bc, -597
+	ld	bc, -641
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	call	hash_update
+	call	ti._memcpy
 	pop	hl
 	pop	hl
 	pop	hl
-	ld	bc, -600
+	ld	iy, 1
+	ld	de, 242
+.lbl_9:
+	lea	hl, iy + 0
+	ld	bc, (ix + 24)
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_10
+	ld	bc, -654
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	iy, (hl)
-	pea	iy + 8
-	ld	bc, -597
+	ld	(hl), iy
+	push	de
+	ld	bc, -644
 	lea	iy, ix + 0
 	add	iy, bc
 	ld	hl, (iy + 0)
 	push	hl
-	call	hash_final
-	ld	de, (ix + 18)
-	pop	hl
-	pop	hl
-	ld	bc, -600
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	iy, (hl)
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -588
-	add	ix, de
-	ld	bc, (ix + 0)
-	pop	ix
-	add	iy, bc
-	ld	de, (ix + -3)
-	push	de
+	ld	hl, (hl)
+	push	hl
+	call	ti._memcpy
 	pop	hl
+	pop	hl
+	pop	hl
+	ld	bc, -635
+	lea	hl, ix + 0
 	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	push	ix
-	ld	bc, -588
-	push	af
-	add	ix, bc
-	pop	af
-	ld	(ix + 0), iy
-	pop	ix
-	jq	nz, .lbl_11
-	ld	bc, -594
+	ld	hl, (hl)
+	push	hl
+	ld	bc, -626
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	push	iy
-	call	csrand_fill
-	jq	.lbl_12
-.lbl_11:
-	ld	bc, -594
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	push	de
-	push	iy
-	call	ti._memcpy
+	call	hmac_update
 	pop	hl
-.lbl_12:
 	pop	hl
 	pop	hl
-	ld	bc, -579
+	ld	bc, -626
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
-	ld	de, (ix + 15)
-	add	hl, de
-	ex	de, hl
-	ld	hl, (ix + 12)
+	push	hl
+	ld	bc, -629
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	hl, (hl)
+	push	hl
+	call	hmac_final
+	pop	hl
+	pop	hl
+	ld	de, -626
+	lea	hl, ix + 0
 	add	hl, de
-	ld	bc, -594
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	push	de
+	ld	iy, (hl)
+	push	ix
+	ld	de, -641
+	add	ix, de
+	ld	bc, (ix + 0)
+	pop	ix
+	ld	(ix + -3), bc
 	push	ix
-	ld	bc, -588
+	ld	bc, -635
 	add	ix, bc
 	ld	de, (ix + 0)
 	pop	ix
+	ld	bc, (ix + -3)
+.lbl_14:
 	push	de
-	push	hl
-	call	ti._memcpy
-	pop	hl
 	pop	hl
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .lbl_15
+	push	bc
 	pop	hl
-	ld	de, (ix + 15)
+	ld	a, (hl)
+	xor	a, (iy)
+	ld	(hl), a
 	dec	de
-	push	de
-	pop	hl
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -579
-	add	ix, de
-	ld	bc, (ix + 0)
-	pop	ix
-	add	hl, bc
+	inc	hl
 	push	hl
 	pop	bc
-	ld	iy, (ix + 12)
-	lea	hl, iy + 0
+	inc	iy
+	jq	.lbl_14
+.lbl_15:
+	ld	bc, -654
+	lea	hl, ix + 0
 	add	hl, bc
-	ld	(hl), 1
-	lea	hl, iy + 0
-	ld	de, (ix + -3)
+	ld	iy, (hl)
+	inc	iy
+	ld	de, 242
+	jq	.lbl_9
+.lbl_10:
+	ld	de, -651
+	lea	hl, ix + 0
 	add	hl, de
-	ld	(hl), -68
-	ld	a, (ix + 21)
-	ld	l, a
-	ld	bc, -579
+	ld	bc, (hl)
+	push	bc
+	pop	hl
+	ld	(ix + -3), bc
+	ld	bc, -635
 	lea	iy, ix + 0
 	add	iy, bc
-	ld	(iy + 0), hl
-	push	hl
-	ld	bc, -597
+	ld	de, (iy + 0)
+	or	a, a
+	sbc	hl, de
+	ld	bc, (ix + -3)
+	jq	c, .lbl_12
+	push	de
+	pop	bc
+.lbl_12:
+	ld	(ix + -3), bc
+	ld	bc, -632
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
+	ld	de, (hl)
+	ld	hl, (ix + 12)
+	add	hl, de
+	ld	bc, (ix + -3)
+	push	bc
+	ld	bc, -641
+	lea	iy, ix + 0
+	add	iy, bc
+	ld	de, (iy + 0)
+	push	de
 	push	hl
-	call	hash_init
+	call	ti._memcpy
 	pop	hl
 	pop	hl
-	ld	bc, -582
+	pop	hl
+	ld	hl, 242
+	push	hl
+	ld	bc, -644
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	ld	bc, -600
+	ld	bc, -629
 	lea	hl, ix + 0
 	add	hl, bc
 	ld	hl, (hl)
 	push	hl
-	ld	bc, -597
+	call	ti._memcpy
+	ld	bc, -632
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hash_update
+	ld	iy, (hl)
 	pop	hl
 	pop	hl
 	pop	hl
-	ld	bc, -603
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -597
+	ld	bc, -635
 	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hash_final
-	pop	hl
-	pop	hl
-	ld	hl, (ix + 12)
+	ld	de, (hl)
+	add	iy, de
 	push	ix
-	ld	bc, -585
+	ld	bc, -647
 	add	ix, bc
-	ld	de, (ix + 0)
+	ld	hl, (ix + 0)
 	pop	ix
-	add	hl, de
 	push	ix
-	ld	bc, -594
+	dec	bc
 	add	ix, bc
-	ld	de, (ix + 0)
+	ld	e, (ix + 0)
 	pop	ix
-	push	de
-	push	ix
-	ld	bc, -603
-	add	ix, bc
-	ld	de, (ix + 0)
+	ld	bc, 1
+	xor	a, a
+	call	ti._ladd
+	push	hl
+	pop	bc
+	ld	a, e
+	ld	de, (ix + 15)
+	jq	.lbl_7
+.lbl_23:
+.lbl_17:
+	ld	bc, -623
+	lea	hl, ix + 0
+	add	hl, bc
+	ld	a, (hl)
+	ld	sp, ix
 	pop	ix
+    restore_interrupts_preserve_a hmac_pbkdf2
+	ret
+ 
+
+;------------------------------------------
+; record layer
+virtual at 0
+	rec_offset_nonce        rb 4
+	rec_offset_seq          rb 8
+	rec_offset_window       rb 8
+	rec_offset_cipher       rb 3 + 240
+	rec_offset_inner        rb _sha256ctx_size
+	rec_offset_outer        rb _sha256ctx_size
+	_record_ctx_size:
+end virtual
+
+RECORD_HEADER_LEN       := 8
+RECORD_TAG_LEN          := 16
+RECORD_OVERHEAD         := RECORD_HEADER_LEN + RECORD_TAG_LEN
+
+RECORD_OK               := 0
+RECORD_INVALID_ARG      := 1
+RECORD_AUTH_FAILED      := 2
+RECORD_REPLAY           := 3
+RECORD_SEQ_EXHAUSTED    := 4
+
+_record_packet_size     := 10
+
+; record_init(context, key, keylen, mac_key, mac_keylen, nonce);
+record_init:
+	call	_scratch_enter
+	ld	hl, -(128 + _sha256ctx_size)
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) key
+	; (ix+12) keylen
+	; (ix+15) mac key
+	; (ix+18) mac keylen
+	; (ix+21) nonce
+	; (ix-233) hmac state
+
+	; expand the cipher key once for the whole session
+	ld	hl, (ix + 12)
+	push	hl
+	ld	iy, (ix + 6)
+	pea	iy + rec_offset_cipher
+	ld	hl, (ix + 9)
+	push	hl
+	call	aes_init
+	pop	hl, hl, hl
+	or	a, a
+	jq	z, .exit
+
+	; keep the hash states after the ipad and opad blocks,
+	; so each record only pays for its own data
+	ld	hl, (ix + 18)
+	push	hl
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, -(128 + _sha256ctx_size)
+	lea	de, ix + 0
+	add	hl, de
+	push	hl
+	call	hmac_sha256_init
+	pop	hl, de, de
+	push	hl
+	ld	de, 128
+	add	hl, de
+	ld	iy, (ix + 6)
+	ld	de, rec_offset_inner
+	add	iy, de
+	lea	de, iy + 0
+	ld	bc, _sha256ctx_size
+	ldir
 	push	de
+	call	hash_sha256_init
+	pop	de, hl
+	ld	bc, 64
+	add	hl, bc
+	call	_sha256_update_nz
+
+	; sequence numbers and the replay window start at zero
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 21)
+	lea	de, iy + rec_offset_nonce
+	ld	bc, 4
+	ldir
+	lea	hl, iy + rec_offset_seq
+	ld	(hl), b
+	lea	de, iy + rec_offset_seq + 1
+	ld	c, 8 + 8 - 1
+	ldir
+	ld	a, 1
+.exit:
+	jp	stack_clear
+
+; record_seal(context, plaintext, len, record);
+record_seal:
+	save_interrupts
+
+	call	ti._frameset0
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_record_seal
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a record_seal
+	ret
+
+; record_open(context, record, len, plaintext);
+record_open:
+	save_interrupts
+
+	call	ti._frameset0
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_record_open
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a record_open
+	ret
+
+; record_seal_bulk(context, packets, count);
+record_seal_bulk:
+	save_interrupts
+
+	ld	hl, _record_seal
+	call	_record_bulk
+
+	restore_interrupts_noret record_seal_bulk
+	ret
+
+; record_open_bulk(context, packets, count);
+record_open_bulk:
+	save_interrupts
+
+	ld	hl, _record_open
+	call	_record_bulk
+
+	restore_interrupts_noret record_open_bulk
+	ret
+
+; runs _record_seal or _record_open over an array of packets
+; hl = routine
+; returns hl = number of packets that succeeded
+_record_bulk:
+	ld	(.routine), hl
+	ld	hl, -6
+	call	ti._frameset
+	; the entry point's return address sits at (ix+6)
+	; (ix+9) context
+	; (ix+12) packets
+	; (ix+15) count
+	; (ix-3) packets left
+	; (ix-6) packets that succeeded
+
+	ld	hl, (ix + 15)
+	ld	(ix - 3), hl
+	or	a, a
+	sbc	hl, hl
+	ld	(ix - 6), hl
+.loop:
+	ld	bc, (ix - 3)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .done
+	dec	hl
+	ld	(ix - 3), hl
+	ld	iy, (ix + 12)
+	ld	hl, (iy + 6)
+	push	hl
+	ld	hl, (iy + 3)
+	push	hl
+	ld	hl, (iy + 0)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	call	0
+.routine := $-3
+	pop	hl, hl, hl, hl
+	ld	iy, (ix + 12)
+	ld	(iy + 9), a
+	lea	iy, iy + _record_packet_size
+	ld	(ix + 12), iy
+	or	a, a
+	jq	nz, .loop
+	ld	hl, (ix - 6)
+	inc	hl
+	ld	(ix - 6), hl
+	jq	.loop
+.done:
+	ld	hl, (ix - 6)
+	ld	sp, ix
+	pop	ix
+	ret
+
+; _record_seal(context, plaintext, len, record);
+_record_seal:
+	ld	hl, -32
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) plaintext
+	; (ix+12) len
+	; (ix+15) record
+	; (ix-32) tag
+
+	; a sequence number must never repeat under the same key
+	ld	iy, (ix + 6)
+	lea	hl, iy + rec_offset_seq
+	ld	b, 8
+	ld	a, $ff
+.check:
+	and	a, (hl)
+	inc	hl
+	djnz	.check
+	inc	a
+	ld	a, RECORD_SEQ_EXHAUSTED
+	jq	z, .exit
+
+	; header = sequence number, then advance it
+	lea	hl, iy + rec_offset_seq
+	ld	de, (ix + 15)
+	ld	bc, 8
+	ldir
+	ld	b, 8
+.increment:
+	dec	hl
+	inc	(hl)
+	jq	nz, .encrypt
+	djnz	.increment
+.encrypt:
+	ld	hl, (ix + 15)
+	ld	de, RECORD_HEADER_LEN
+	add	hl, de
 	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, -579
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 12)
 	push	hl
-	ld	bc, -585
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 9)
 	push	hl
-	ld	bc, -606
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 15)
 	push	hl
-	ld	bc, -594
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 6)
 	push	hl
-	ld	bc, -603
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	call	_record_ctr
+	pop	hl, hl, hl, hl, hl
+
+	; tag = HMAC(header | ciphertext), truncated
+	pea	ix - 32
+	ld	hl, (ix + 12)
+	ld	de, RECORD_HEADER_LEN
+	add	hl, de
 	push	hl
-	call	hash_mgf1
-	ld	de, -594
-	lea	hl, ix + 0
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_record_mac
+	pop	bc, hl, de, bc
 	add	hl, de
-	ld	bc, (hl)
-	ld	de, (ix + 15)
-	pop	hl
-	pop	hl
-	pop	hl
-	pop	hl
-	pop	hl
-	inc	bc
-.lbl_14:
-	push	de
-	pop	hl
-	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_16
-	ld	(ix + -3), de
-	ld	de, -591
-	lea	hl, ix + 0
+	ex	de, hl
+	lea	hl, ix - 32
+	ld	bc, RECORD_TAG_LEN
+	ldir
+	xor	a, a
+.exit:
+	jp	stack_clear
+
+; _record_open(context, record, len, plaintext);
+_record_open:
+	ld	hl, -42
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) record
+	; (ix+12) len, then the plaintext length
+	; (ix+15) plaintext
+	; (ix-8) distance from the highest sequence number accepted
+	; (ix-9) distance, clamped to 64
+	; (ix-10) nonzero if the record is newer than any accepted
+	; (ix-42) tag
+
+	ld	a, RECORD_INVALID_ARG
+	ld	hl, (ix + 12)
+	ld	de, -RECORD_OVERHEAD
 	add	hl, de
-	ld	hl, (hl)
+	jq	nc, .exit
+	ld	(ix + 12), hl
+
+	; distance = sequence number - highest sequence number accepted
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 9)
+	ld	de, 7
+	add	hl, de
+	lea	de, iy + rec_offset_seq + 7
+	lea	iy, ix - 1
+	ld	b, 8
+	or	a, a
+.distance:
+	ld	a, (de)
+	ld	c, a
 	ld	a, (hl)
-	ld	de, -606
-	lea	iy, ix + 0
-	add	iy, de
-	ld	iy, (iy + 0)
-	xor	a, (iy)
+	sbc	a, c
+	ld	(iy), a
+	dec	hl
+	dec	de
+	dec	iy
+	djnz	.distance
+	sbc	a, a
+	inc	a
+	ld	(ix - 10), a
+	jq	nz, .clamp
+	lea	hl, ix - 1
+	ld	b, 8
+	or	a, a
+.negate:
+	ld	a, 0
+	sbc	a, (hl)
 	ld	(hl), a
-	inc	bc
-	inc	iy
-	push	ix
-	add	ix, de
-	ld	(ix + 0), iy
-	pop	ix
+	dec	hl
+	djnz	.negate
+.clamp:
+	lea	hl, ix - 8
+	xor	a, a
+	ld	b, 7
+.high:
+	or	a, (hl)
 	inc	hl
-	ld	de, -591
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), hl
-	ld	de, (ix + -3)
-	jq	.lbl_14
-.lbl_16:
-	ex	de, hl
-	jq	.lbl_17
-    
+	djnz	.high
+	ld	a, 64
+	jq	nz, .clamped
+	cp	a, (hl)
+	jq	c, .clamped
+	ld	a, (hl)
+.clamped:
+	ld	(ix - 9), a
+	or	a, a
+	jq	nz, .window
+	ld	(ix - 10), a
+.window:
+	; reject records that fell out of the window or were already accepted
+	ld	a, (ix - 10)
+	or	a, a
+	jq	nz, .authenticate
+	ld	a, (ix - 9)
+	cp	a, 64
+	jq	z, .replay
+	ld	iy, (ix + 6)
+	call	_record_window_bit
+	and	a, (hl)
+	jq	nz, .replay
 
- digest_compare:
-    pop	iy, de, hl, bc
-	push	bc, hl, de, iy
+.authenticate:
+	pea	ix - 42
+	ld	hl, (ix + 12)
+	ld	de, RECORD_HEADER_LEN
+	add	hl, de
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_record_mac
+	pop	bc, hl, de, bc
+	add	hl, de
+	ld	bc, RECORD_TAG_LEN
+	push	bc, hl
+	pea	ix - 42
+	call	digest_compare
+	pop	hl, hl, hl
+	or	a, a
+	ld	a, RECORD_AUTH_FAILED
+	jq	z, .exit
+
+	; the record is authentic, slide the window up to it
+	ld	iy, (ix + 6)
+	ld	a, (ix - 10)
+	or	a, a
+	jq	z, .mark
+	ld	c, (ix - 9)
+.slide:
+	lea	hl, iy + rec_offset_window
+	ld	b, 8
+	or	a, a
+.slide.byte:
+	rl	(hl)
+	inc	hl
+	djnz	.slide.byte
+	dec	c
+	jq	nz, .slide
+	ld	hl, (ix + 9)
+	lea	de, iy + rec_offset_seq
+	ld	bc, 8
+	ldir
+	xor	a, a
+	ld	(ix - 9), a
+.mark:
+	ld	a, (ix - 9)
+	call	_record_window_bit
+	or	a, (hl)
+	ld	(hl), a
+
+	; decrypt last, the plaintext may overwrite the header
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	ld	de, RECORD_HEADER_LEN
+	add	hl, de
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_record_ctr
+	pop	hl, hl, hl, hl, hl
+	xor	a, a
+.exit:
+	jp	stack_clear
+.replay:
+	ld	a, RECORD_REPLAY
+	jq	.exit
+
+; iy = context, a = distance from the highest sequence number (0 to 63)
+; returns hl = window byte, a = mask of the bit for that distance
+_record_window_bit:
+	ld	c, a
+	rrca
+	rrca
+	rrca
+	and	a, 7
+	lea	hl, iy + rec_offset_window
+	ld	de, 0
+	ld	e, a
+	add	hl, de
+	ld	a, c
+	and	a, 7
+	ld	b, a
+	inc	b
 	xor	a, a
+	scf
+.shift:
+	rla
+	djnz	.shift
+	ret
+
+; _record_ctr(context, header, in, len, out);
+; out = in xor AES-CTR keystream, counter = nonce | sequence number | block
+_record_ctr:
+	ld	hl, -32
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) header
+	; (ix+12) input
+	; (ix+15) len
+	; (ix+18) output
+	; (ix-16) counter block
+	; (ix-32) keystream
+
+	ld	hl, (ix + 6)
+	lea	de, ix - 16
+	ld	bc, 4
+	ldir
+	ld	hl, (ix + 9)
+	ld	c, 8
+	ldir
+	ld	(ix - 4), bc
+	ld	(ix - 1), c
 .loop:
-	ld	iyl, a
-	ld	a, (de)
-	inc	de
+	ld	bc, (ix + 15)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .done
+	ld	hl, (ix + 6)
+	ld	de, rec_offset_cipher
+	add	hl, de
+	push	hl
+	pea	ix - 32
+	pea	ix - 16
+	call	aes_ecb_unsafe_encrypt
+	pop	hl, hl, hl
+
+	; bc = min(16, len)
+	ld	hl, (ix + 15)
+	ld	bc, 16
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .full
+	add	hl, bc
+	ld	c, l
+	or	a, a
+	sbc	hl, hl
+.full:
+	ld	(ix + 15), hl
+	ld	b, c
+	ld	hl, (ix + 12)
+	ld	de, (ix + 18)
+	lea	iy, ix - 32
+.xor:
+	ld	a, (iy)
 	xor	a, (hl)
-	or	a, iyl
-	cpi
-	jq	pe, .loop
-	add	a, -1
-	sbc	a, a
-	inc	a
-	ret
-    
-	
-hash_mgf1:
-	save_interrupts
+	ld	(de), a
+	inc	hl
+	inc	de
+	inc	iy
+	djnz	.xor
+	ld	(ix + 12), hl
+	ld	(ix + 18), de
 
-   	ld	hl, -328
+	lea	hl, ix - 1
+	ld	b, 4
+.next:
+	inc	(hl)
+	jq	nz, .loop
+	dec	hl
+	djnz	.next
+	jq	.loop
+.done:
+	jp	stack_clear
+
+; _record_mac(context, data, len, digest);
+; HMAC-SHA256 resumed from the midstates kept by record_init
+_record_mac:
+	ld	hl, -_sha256ctx_size
 	call	ti._frameset
-	ld	bc, -302
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	a, (ix + 18)
-	ld	hl, _hash_out_lens
-	ld	de, 0
-	push	ix
-	ld	bc, -308
-	add	ix, bc
-	ld	(ix + 0), de
-	pop	ix
-	push	ix
-	ld	de, -311
-	add	ix, de
-	ld	(ix + 0), iy
-	pop	ix
-	lea	bc, iy + 114
-	ld	de, 0
-	ld	(ix + -3), bc
-	ld	bc, -305
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), de
-	ld	e, a
+	; (ix+6) context
+	; (ix+9) data
+	; (ix+12) len
+	; (ix+15) digest
+
+	ld	hl, (ix + 6)
+	ld	de, rec_offset_inner
 	add	hl, de
-	ld	l, (hl)
-	push	ix
-	ld	de, -320
-	add	ix, de
-	ld	(ix + 0), l
-	pop	ix
-	ld	l, a
+	lea	de, ix - _sha256ctx_size
+	ld	bc, _sha256ctx_size
+	ldir
+	lea	de, ix - _sha256ctx_size
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	call	_sha256_update_nz
+	ld	hl, (ix + 15)
+	push	hl, de
+	call	hash_sha256_final
+	pop	hl, hl
+
+	ld	hl, (ix + 6)
+	ld	de, rec_offset_outer
+	add	hl, de
+	lea	de, ix - _sha256ctx_size
+	ld	bc, _sha256ctx_size
+	ldir
+	lea	de, ix - _sha256ctx_size
+	ld	hl, (ix + 15)
+	ld	bc, 32
+	call	_sha256_update_nz
+	push	hl, de
+	call	hash_sha256_final
+	jp	stack_clear
+
+
+; record_seal_compressed(context, plaintext, len, record, reclen);
+record_seal_compressed:
+	save_interrupts
+
+	call	ti._frameset0
+	; compress straight into the body of the record, then seal it in place
+	ld	hl, (ix + 15)
+	ld	bc, RECORD_HEADER_LEN
+	add	hl, bc
+	push	hl
+	ld	hl, (ix + 12)
 	push	hl
-	ld	bc, (ix + -3)
-	ld	de, -314
-	lea	hl, ix + 0
-	add	hl, de
-	ld	(hl), bc
-	push	bc
-	call	hash_init
-	ld	e, a
-	pop	hl
-	pop	hl
-	ld	l, 1
-	xor	a, l
-	bit	0, a
-	jq	nz, .lbl_6
+	ld	hl, (ix + 9)
+	push	hl
+	call	lz_compress
+	pop	bc, bc, de
+	push	hl
+	ld	bc, (ix + 15)
+	push	bc, hl, de
 	ld	hl, (ix + 6)
-	ld	bc, -321
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), e
-	ld	de, (ix + 9)
-	lea	bc, ix + -70
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -324
-	add	ix, de
-	ld	(ix + 0), bc
-	pop	ix
-	push	ix
-	ld	de, -311
-	add	ix, de
-	ld	iy, (ix + 0)
-	pop	ix
-	lea	bc, iy + 0
-	ld	de, -317
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), bc
-	push	ix
-	ld	de, -305
-	add	ix, de
-	ld	bc, (ix + 0)
-	pop	ix
-	push	ix
-	ld	de, -320
-	add	ix, de
-	ld	a, (ix + 0)
-	pop	ix
-	ld	c, a
-	push	ix
-	ld	de, -305
-	add	ix, de
-	ld	(ix + 0), bc
-	pop	ix
-	ld	de, (ix + -3)
-	push	de
 	push	hl
-	ld	bc, -314
-	lea	hl, ix + 0
+	call	_record_seal
+	pop	hl, hl, hl, hl
+	pop	hl
+	ld	bc, RECORD_OVERHEAD
+	add	hl, bc
+	ex	de, hl
+	ld	hl, (ix + 18)
+	ld	(hl), de
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a record_seal_compressed
+	ret
+
+; record_open_compressed(context, record, len, plaintext, maxlen, outlen);
+record_open_compressed:
+	save_interrupts
+
+	call	ti._frameset0
+	; open in place, then expand into the caller's buffer
+	ld	hl, (ix + 9)
+	ld	bc, RECORD_HEADER_LEN
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	call	hash_update
-	ld	bc, (ix + 15)
-	ld	(ix + -3), bc
-	ld	bc, -321
-	lea	hl, ix + 0
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_record_open
+	pop	hl, hl, hl, de
+	or	a, a
+	jq	nz, .exit
+	ld	hl, (ix + 18)
+	push	hl
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, (ix + 12)
+	ld	bc, RECORD_OVERHEAD
+	or	a, a
+	sbc	hl, bc
+	push	hl, de
+	call	lz_decompress
+	ld	bc, 1
 	add	hl, bc
-	ld	e, (hl)
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, (ix + -3)
-	ld	(ix + -3), de
-	ld	de, -311
-	lea	hl, ix + 0
-	add	hl, de
-	ld	(hl), bc
+	ld	a, RECORD_INVALID_ARG
+	jq	c, .exit
+	dec	hl
+	ex	de, hl
+	ld	hl, (ix + 21)
+	ld	(hl), de
 	xor	a, a
-	ld	iy, 0
-	ld	de, (ix + -3)
-.lbl_2:
-	lea	hl, iy + 0
+.exit:
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a record_open_compressed
+	ret
+
+
+;------------------------------------------
+; LZSS compression
+; a flag byte, low bit first, says whether each of the next 8 items is a literal byte (0)
+; or a match (1). A match is 2 bytes: distance - 1 in 12 bits, length - 3 in 4 bits
+;	byte 0 = distance - 1, low 8 bits
+;	byte 1 = (distance - 1) >> 8 << 4 | length - 3
+LZ_MIN_MATCH            := 3
+LZ_MAX_MATCH            := LZ_MIN_MATCH + 15
+LZ_WINDOW               := 4096
+LZ_STREAM_WINDOW        := 2 * LZ_WINDOW
+
+; a stream keeps the last 4 KB of data in the caller's arena, followed by the hash table
+virtual at 0
+	lz_offset_window        rb 3
+	lz_offset_fill          rb 3
+	lz_offset_bit           rb 1
+	lz_offset_flags         rb 1
+	lz_offset_pending_len   rb 1
+	lz_offset_pending       rb 15
+	_lz_ctx_size:
+end virtual
+
+; frame of _lz_compress_run, set up by lz_compress and lz_stream_compress
+_lz_src                 := -3
+_lz_end                 := -6
+_lz_dst                 := -9
+_lz_flags               := -12
+_lz_bit                 := -13
+_lz_tab                 := -16
+_lz_dist                := -19
+_lz_frame               := 19
+
+; lz_compress(in, len, out);
+lz_compress:
+	call	_scratch_enter
+	ld	hl, -(_lz_frame + 3 * 256)
+	call	ti._frameset
+	; (ix+6) in
+	; (ix+9) len
+	; (ix+12) out
+	; the most recent position of each 3-byte hash, one candidate per hash
+	ld	hl, -(_lz_frame + 3 * 256)
+	lea	de, ix + 0
+	add	hl, de
+	ld	(ix + _lz_tab), hl
+	call	_lz_clear_table
+	ld	hl, (ix + 6)
+	ld	(ix + _lz_src), hl
+	ld	bc, (ix + 9)
+	add	hl, bc
+	ld	(ix + _lz_end), hl
+	ld	hl, (ix + 12)
+	ld	(ix + _lz_dst), hl
+	ld	(ix + _lz_bit), 0
+	call	_lz_compress_run
+	ld	hl, (ix + _lz_dst)
+	ld	de, (ix + 12)
+	or	a, a
+	sbc	hl, de
+	ld	sp, ix
+	pop	ix
+	ret
+
+; hl = hash table
+; returns bc = 0
+_lz_clear_table:
+	ld	(hl), 0
+	push	hl
+	pop	de
+	inc	de
+	ld	bc, 3 * 256 - 1
+	ldir
+	ret
+
+; compresses from _lz_src up to _lz_end, appending to _lz_dst
+; a match never reaches past _lz_end, nor further back than the table allows
+_lz_compress_run:
+.loop:
+	ld	hl, (ix + _lz_end)
+	ld	de, (ix + _lz_src)
+	or	a, a
+	sbc	hl, de
+	ret	z
+	ld	a, (ix + _lz_bit)
+	or	a, a
+	jq	nz, .have_flags
+	ld	iy, (ix + _lz_dst)
+	ld	(iy + 0), a
+	ld	(ix + _lz_flags), iy
+	inc	iy
+	ld	(ix + _lz_dst), iy
+	ld	(ix + _lz_bit), 1
+.have_flags:
+	; hl = bytes left, de = src
+	ld	bc, LZ_MIN_MATCH
 	or	a, a
 	sbc	hl, bc
-	jq	nc, .lbl_6
-	ld	bc, -320
-	lea	hl, ix + 0
+	jq	c, .literal
 	add	hl, bc
-	ld	(hl), iy
-	ld	bc, -305
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	push	de
-	pop	hl
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -311
-	add	ix, de
-	ld	bc, (ix + 0)
-	pop	ix
+	ld	bc, LZ_MAX_MATCH
 	or	a, a
 	sbc	hl, bc
-	ld	de, (ix + -3)
-	jq	c, .lbl_5
-	push	bc
-	pop	de
-.lbl_5:
-	ld	(ix + -3), bc
-	ld	bc, -328
-	lea	hl, ix + 0
 	add	hl, bc
-	ld	(hl), de
-	ld	bc, -308
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	ld	bc, (ix + -3)
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -311
-	add	ix, de
-	ld	(ix + 0), bc
-	pop	ix
-	ld	de, (ix + -3)
-	push	de
+	jq	c, .short
+	ld	hl, LZ_MAX_MATCH
+.short:
+	ld	a, l
+	push	af
+	ex	de, hl
+	ld	a, (hl)
+	rlca
+	inc	hl
+	xor	a, (hl)
+	rlca
+	inc	hl
+	xor	a, (hl)
+	dec	hl
+	dec	hl
+	push	hl
+	ld	bc, 0
+	ld	c, a
+	ld	hl, (ix + _lz_tab)
+	add	hl, bc
+	add	hl, bc
+	add	hl, bc
+	ld	de, (hl)
 	pop	bc
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -325
-	add	ix, de
-	ld	(ix + 0), a
-	pop	ix
-	ld	l, 24
-	call	ti._lshru
-	ld	a, c
-	ld	(ix + -74), a
-	ld	de, (ix + -3)
-	push	de
+	ld	(hl), bc
+	; the candidate must be within the window
+	push	bc
+	pop	hl
+	or	a, a
+	sbc	hl, de
+	dec	hl
+	ld	(ix + _lz_dist), hl
+	ld	bc, LZ_WINDOW
+	or	a, a
+	sbc	hl, bc
 	pop	bc
-	ld	(ix + -3), de
-	push	ix
-	ld	de, -325
-	add	ix, de
-	ld	a, (ix + 0)
-	pop	ix
-	ld	l, 16
-	call	ti._lshru
+	jq	nc, .literal
+	ld	hl, (ix + _lz_src)
+	ld	c, 0
+.compare:
+	ld	a, (de)
+	cp	a, (hl)
+	jq	nz, .compared
+	inc	hl
+	inc	de
+	inc	c
+	djnz	.compare
+.compared:
 	ld	a, c
-	ld	(ix + -73), a
-	ld	de, (ix + -3)
-	push	ix
-	ld	bc, -308
-	add	ix, bc
-	ld	(ix + 0), de
-	pop	ix
-	ld	a, d
-	ld	(ix + -72), a
-	ld	a, e
-	ld	(ix + -71), a
-	ld	hl, 114
-	push	hl
-	ld	bc, -314
-	lea	hl, ix + 0
+	cp	a, LZ_MIN_MATCH
+	jq	c, .literal
+	ld	iy, (ix + _lz_dst)
+	ld	hl, (ix + _lz_dist)
+	ld	(iy + 0), l
+	ld	b, a
+	ld	a, h
+	add	a, a
+	add	a, a
+	add	a, a
+	add	a, a
+	ld	c, a
+	ld	a, b
+	sub	a, LZ_MIN_MATCH
+	or	a, c
+	ld	(iy + 1), a
+	lea	iy, iy + 2
+	ld	(ix + _lz_dst), iy
+	ld	hl, (ix + _lz_flags)
+	ld	a, (ix + _lz_bit)
+	or	a, (hl)
+	ld	(hl), a
+	ld	hl, (ix + _lz_src)
+	ld	de, 0
+	ld	e, b
+	add	hl, de
+	ld	(ix + _lz_src), hl
+	jq	.next
+.literal:
+	ld	hl, (ix + _lz_src)
+	ld	a, (hl)
+	inc	hl
+	ld	(ix + _lz_src), hl
+	ld	hl, (ix + _lz_dst)
+	ld	(hl), a
+	inc	hl
+	ld	(ix + _lz_dst), hl
+.next:
+	sla	(ix + _lz_bit)
+	jq	.loop
+
+; lz_decompress(in, len, out, outmax);
+lz_decompress:
+	ld	hl, -8
+	call	ti._frameset
+	; (ix+6) in
+	; (ix+9) len
+	; (ix+12) out
+	; (ix+15) outmax
+._end := -3
+._out_end := -6
+._flags := -7
+._bit := -8
+	ld	hl, (ix + 6)
+	ld	bc, (ix + 9)
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -317
-	lea	hl, ix + 0
+	ld	(ix + ._end), hl
+	ld	hl, (ix + 12)
+	ld	bc, (ix + 15)
 	add	hl, bc
-	ld	hl, (hl)
+	ld	(ix + ._out_end), hl
+	ld	iy, (ix + 6)
+	ld	de, (ix + 12)
+	ld	(ix + ._bit), 0
+	; iy = src, de = dst
+.loop:
+	lea	hl, iy + 0
+	ld	bc, (ix + ._end)
+	or	a, a
+	sbc	hl, bc
+	jq	z, .done
+	ld	a, (ix + ._bit)
+	or	a, a
+	jq	nz, .item
+	ld	a, (iy + 0)
+	inc	iy
+	ld	(ix + ._flags), a
+	ld	(ix + ._bit), 1
+	jq	.loop
+.item:
+	and	a, (ix + ._flags)
+	jq	nz, .match
+	ld	hl, (ix + ._out_end)
+	or	a, a
+	sbc	hl, de
+	jq	z, .error
+	ld	a, (iy + 0)
+	inc	iy
+	ld	(de), a
+	inc	de
+	jq	.next
+.match:
+	ld	hl, (ix + ._end)
+	lea	bc, iy + 0
+	or	a, a
+	sbc	hl, bc
+	ld	bc, 2
+	sbc	hl, bc
+	jq	c, .error
+	ld	a, (iy + 1)
+	rrca
+	rrca
+	rrca
+	rrca
+	and	a, $0F
+	ld	bc, 0
+	ld	b, a
+	ld	c, (iy + 0)
+	inc	bc
+	ld	a, (iy + 1)
+	and	a, $0F
+	add	a, LZ_MIN_MATCH
+	lea	iy, iy + 2
+	; the match must start inside the output, and fit in what is left of it
+	ld	hl, (ix + 12)
+	ex	de, hl
 	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
+	or	a, a
+	sbc	hl, de
+	pop	de
+	or	a, a
+	sbc	hl, bc
+	jq	c, .error
+	push	bc
+	ld	hl, (ix + ._out_end)
+	or	a, a
+	sbc	hl, de
+	ld	bc, 0
+	ld	c, a
+	sbc	hl, bc
+	jq	c, .error
 	pop	hl
-	ld	hl, 4
+	ex	de, hl
 	push	hl
-	pea	ix + -74
-	ld	bc, -317
-	lea	hl, ix + 0
+	or	a, a
+	sbc	hl, de
+	pop	de
+	ldir
+.next:
+	sla	(ix + ._bit)
+	jq	.loop
+.done:
+	ex	de, hl
+	ld	de, (ix + 12)
+	or	a, a
+	sbc	hl, de
+	jq	.exit
+.error:
+	scf
+	sbc	hl, hl
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; lz_stream_init(context, arena);
+lz_stream_init:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) arena
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 9)
+	ld	(iy + lz_offset_window), hl
+	ld	bc, LZ_STREAM_WINDOW
+	add	hl, bc
+	call	_lz_clear_table
+	ld	(iy + lz_offset_fill), bc
+	ld	(iy + lz_offset_bit), c
+	ld	(iy + lz_offset_flags), c
+	ld	(iy + lz_offset_pending_len), c
+	pop	ix
+	ret
+
+; keeps the newest LZ_WINDOW bytes, moving them to the start of the window
+; iy = lz context
+; returns hl = how far the data moved
+_lz_slide:
+	ld	de, (iy + lz_offset_window)
+	ld	hl, (iy + lz_offset_fill)
+	ld	bc, -LZ_WINDOW
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	call	hash_update
-	pop	hl
-	pop	hl
+	add	hl, de
+	ld	bc, LZ_WINDOW
+	ldir
+	ld	hl, LZ_WINDOW
+	ld	(iy + lz_offset_fill), hl
 	pop	hl
-	ld	bc, -324
-	lea	hl, ix + 0
+	ret
+
+; lz_stream_compress(context, in, len, out);
+lz_stream_compress:
+	ld	hl, -_lz_frame
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) in
+	; (ix+12) len
+	; (ix+15) out
+	ld	iy, (ix + 6)
+	ld	hl, (iy + lz_offset_window)
+	ld	bc, LZ_STREAM_WINDOW
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -317
-	lea	hl, ix + 0
+	ld	(ix + _lz_tab), hl
+	; pick up the unfinished flag group of the last call
+	ld	de, (ix + 15)
+	ld	(ix + _lz_flags), de
+	ld	a, (iy + lz_offset_bit)
+	ld	(ix + _lz_bit), a
+	or	a, a
+	jq	z, .piece
+	lea	hl, iy + lz_offset_pending
+	ld	bc, 0
+	ld	c, (iy + lz_offset_pending_len)
+	ldir
+.piece:
+	ld	(ix + _lz_dst), de
+	ld	hl, (ix + 12)
 	add	hl, bc
-	ld	hl, (hl)
+	or	a, a
+	sbc	hl, bc
+	jq	z, .done
+	; the input goes through the window, which slides once it is full
+	ld	iy, (ix + 6)
+	ld	hl, LZ_STREAM_WINDOW
+	ld	de, (iy + lz_offset_fill)
+	or	a, a
+	sbc	hl, de
+	jq	nz, .room
+	call	_lz_slide
+	; the table moves along with the data, old positions end up out of reach
+	ex	de, hl
+	ld	hl, (ix + _lz_tab)
+	ld	b, 0
+.rebase:
+	push	bc
+	ld	bc, (hl)
 	push	hl
-	call	hash_final
+	push	bc
 	pop	hl
+	or	a, a
+	sbc	hl, de
+	push	hl
+	pop	bc
 	pop	hl
-	ld	bc, -320
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	de, (hl)
+	ld	(hl), bc
+	inc	hl
+	inc	hl
+	inc	hl
+	pop	bc
+	djnz	.rebase
+	ld	hl, LZ_STREAM_WINDOW - LZ_WINDOW
+.room:
+	ld	de, (ix + 12)
+	or	a, a
+	sbc	hl, de
+	add	hl, de
+	jq	c, .take
+	ex	de, hl
+.take:
+	push	hl
+	pop	bc
 	ld	hl, (ix + 12)
+	or	a, a
+	sbc	hl, bc
+	ld	(ix + 12), hl
+	ld	hl, (iy + lz_offset_window)
+	ld	de, (iy + lz_offset_fill)
 	add	hl, de
-	push	ix
-	ld	bc, -328
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
-	push	ix
-	ld	bc, -324
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
+	ld	(ix + _lz_src), hl
+	ex	de, hl
+	ld	hl, (ix + 9)
+	ldir
+	ld	(ix + 9), hl
+	ld	(ix + _lz_end), de
+	ex	de, hl
+	ld	de, (iy + lz_offset_window)
+	or	a, a
+	sbc	hl, de
+	ld	(iy + lz_offset_fill), hl
+	call	_lz_compress_run
+	ld	de, (ix + _lz_dst)
+	jq	.piece
+.done:
+	; hold back an unfinished flag group, the next call adds to it
+	ld	iy, (ix + 6)
+	ld	a, (ix + _lz_bit)
+	ld	(iy + lz_offset_bit), a
+	ld	(iy + lz_offset_pending_len), 0
+	or	a, a
+	jq	z, .length
+	ld	hl, (ix + _lz_flags)
+	ex	de, hl
+	or	a, a
+	sbc	hl, de
+	ld	(iy + lz_offset_pending_len), l
 	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, -320
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	iy, (hl)
-	push	ix
-	ld	bc, -305
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	add	iy, de
-	push	ix
-	ld	bc, -308
-	add	ix, bc
-	ld	hl, (ix + 0)
-	pop	ix
-	push	ix
-	ld	bc, -325
-	add	ix, bc
-	ld	e, (ix + 0)
-	pop	ix
-	ld	bc, 1
-	xor	a, a
-	call	ti._ladd
-	ld	(ix + -3), bc
-	push	ix
-	ld	bc, -308
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	ld	a, e
-	push	ix
-	ld	bc, -311
-	add	ix, bc
-	ld	hl, (ix + 0)
-	pop	ix
-	push	ix
-	ld	bc, -305
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
+	pop	bc
+	ex	de, hl
+	push	hl
+	lea	de, iy + lz_offset_pending
+	ldir
+	pop	de
+.length:
+	ex	de, hl
+	ld	de, (ix + 15)
 	or	a, a
 	sbc	hl, de
-	push	ix
-	ld	bc, -311
-	add	ix, bc
-	ld	(ix + 0), hl
+	ld	sp, ix
 	pop	ix
-	push	ix
-	ld	bc, -321
-	add	ix, bc
-	ld	e, (ix + 0)
+	ret
+
+; lz_stream_finish(context, out);
+lz_stream_finish:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) out
+	ld	iy, (ix + 6)
+	lea	hl, iy + lz_offset_pending
+	ld	de, (ix + 9)
+	ld	bc, 0
+	ld	c, (iy + lz_offset_pending_len)
+	ld	(iy + lz_offset_pending_len), b
+	ld	(iy + lz_offset_bit), b
+	push	bc
+	ld	a, c
+	or	a, a
+	jq	z, .empty
+	ldir
+.empty:
+	pop	hl
 	pop	ix
-	ld	bc, (ix + -3)
-	ld	bc, (ix + 15)
-	jq	.lbl_2
-.lbl_6:
-	ld	a, e
-    restore_interrupts_noret hash_mgf1
-	jp stack_clear
- 
-	
-rsa_encrypt:
-	save_interrupts
+	ret
 
+; lz_stream_decompress(context, in, len, out, outmax);
+lz_stream_decompress:
 	ld	hl, -6
 	call	ti._frameset
-	ld	hl, (ix + 12)
-	ld	iyl, 0
-	ld	de, 1
+	; (ix+6) context
+	; (ix+9) in
+	; (ix+12) len
+	; (ix+15) out
+	; (ix+18) outmax
+._end := -3
+._out_end := -6
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	add	hl, bc
+	ld	(ix + ._end), hl
+	ld	hl, (ix + 15)
+	ld	bc, (ix + 18)
 	add	hl, bc
+	ld	(ix + ._out_end), hl
+	ld	iy, (ix + 6)
+	ld	de, (ix + 15)
+	; (ix+9) = src, de = dst
+.loop:
+	ld	hl, (ix + 9)
+	ld	bc, (ix + ._end)
 	or	a, a
 	sbc	hl, bc
-	jq	nz, .lbl_1
-	jq	.lbl_12
-.lbl_1:
-	ld	hl, (ix + 6)
+	jq	z, .done
 	add	hl, bc
+	ld	a, (iy + lz_offset_bit)
 	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_2
-	jq	.lbl_12
-.lbl_2:
-	ld	hl, (ix + 15)
-	add	hl, bc
+	jq	nz, .item
+	ld	a, (hl)
+	inc	hl
+	ld	(ix + 9), hl
+	ld	(iy + lz_offset_flags), a
+	ld	(iy + lz_offset_bit), 1
+	jq	.loop
+.item:
+	; leave room in the window for the longest match
+	push	hl, de
+	ld	hl, (iy + lz_offset_fill)
+	ld	bc, LZ_STREAM_WINDOW - LZ_MAX_MATCH + 1
 	or	a, a
 	sbc	hl, bc
-	jq	z, .lbl_12
-	ld	hl, (ix + 18)
-	ld	de, 3
-	ld	bc, -128
+	call	nc, _lz_slide
+	pop	de, hl
+	ld	a, (iy + lz_offset_bit)
+	and	a, (iy + lz_offset_flags)
+	jq	nz, .match
+	ld	c, (hl)
+	inc	hl
+	ld	(ix + 9), hl
+	ld	hl, (ix + ._out_end)
+	or	a, a
+	sbc	hl, de
+	jq	z, .error
+	ld	a, c
+	ld	(de), a
+	inc	de
+	ld	hl, (iy + lz_offset_fill)
+	push	hl
+	ld	bc, (iy + lz_offset_window)
 	add	hl, bc
-	ld	bc, 129
+	ld	(hl), a
+	pop	hl
+	inc	hl
+	ld	(iy + lz_offset_fill), hl
+	jq	.next
+.match:
+	; the first byte of a match may have come at the end of the last call
+	ld	a, (iy + lz_offset_pending_len)
+	or	a, a
+	jq	nz, .second
+	ld	a, (hl)
+	inc	hl
+	ld	(ix + 9), hl
+	ld	(iy + lz_offset_pending), a
+	ld	(iy + lz_offset_pending_len), 1
+	ld	bc, (ix + ._end)
 	or	a, a
 	sbc	hl, bc
-	jq	c, .lbl_4
-	jq	.lbl_12
-.lbl_4:
-	ld	bc, (ix + 18)
-	dec	bc
-	ld	hl, (ix + 15)
+	jq	z, .done
 	add	hl, bc
+.second:
+	ld	(iy + lz_offset_pending_len), 0
 	ld	a, (hl)
-	and	a, 1
-	ld	l, 1
-	xor	a, l
-	bit	0, a
-	jq	nz, .lbl_12
-	ld	de, 2
-.lbl_6:
+	inc	hl
+	ld	(ix + 9), hl
+	push	af
+	rrca
+	rrca
+	rrca
+	rrca
+	and	a, $0F
 	ld	bc, 0
-	ld	c, iyl
-	ld	hl, (ix + 15)
-	add	hl, bc
-	ld	a, (hl)
-	or	a, a
-	jq	nz, .lbl_8
-	inc	iyl
-	ld	hl, (ix + 12)
-	add	hl, bc
-	ld	(hl), 0
-	jq	.lbl_6
-.lbl_8:
-	ld	iy, (ix + 9)
-	lea	hl, iy + 0
-	add	hl, bc
+	ld	b, a
+	ld	c, (iy + lz_offset_pending)
+	inc	bc
+	pop	af
+	and	a, $0F
+	add	a, LZ_MIN_MATCH
+	; the match must start inside the window, and fit in what is left of the output
+	ld	hl, (iy + lz_offset_fill)
 	or	a, a
 	sbc	hl, bc
-	jq	nz, .lbl_9
-	jq	.lbl_12
-.lbl_9:
-	push	bc
-	pop	iy
-	ld	bc, 66
-	add	hl, bc
-	lea	bc, iy + 0
+	jq	c, .error
 	push	hl
-	pop	iy
-	ld	hl, (ix + 18)
-	ld	(ix + -6), bc
-	or	a, a
-	sbc	hl, bc
-	ld	(ix + -3), hl
-	lea	bc, iy + 0
+	ld	hl, (ix + ._out_end)
 	or	a, a
+	sbc	hl, de
+	ld	bc, 0
+	ld	c, a
 	sbc	hl, bc
-	jq	c, .lbl_12
-	ld	hl, (ix + 12)
-	ld	de, (ix + -6)
-	add	hl, de
-	ld	a, (ix + 21)
-	ld	e, a
-	push	de
-	ld	de, 0
+	pop	hl
+	jq	c, .error
+	; expand it in the window, then copy it out
 	push	de
-	ld	de, (ix + -3)
+	ld	de, (iy + lz_offset_window)
+	add	hl, de
+	push	hl
+	ld	hl, (iy + lz_offset_fill)
+	add	hl, de
+	ex	de, hl
+	pop	hl
 	push	de
+	ldir
+	ex	de, hl
+	ld	de, (iy + lz_offset_window)
+	or	a, a
+	sbc	hl, de
+	ld	(iy + lz_offset_fill), hl
+	pop	hl
+	pop	de
+	ld	c, a
+	ldir
+.next:
+	sla	(iy + lz_offset_bit)
+	jq	.loop
+.done:
+	ex	de, hl
+	ld	de, (ix + 15)
+	or	a, a
+	sbc	hl, de
+	jq	.exit
+.error:
+	scf
+	sbc	hl, hl
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+;------------------------------------------
+; encrypted container
+; header | chunk 0 | chunk 1 | ... each chunk is sealed on its own with Ascon-AEAD128,
+; so any one of them can be read back without touching the rest
+virtual at 0
+	cont_hdr_magic          rb 4
+	cont_hdr_chunk_len      rb 2
+	cont_hdr_rounds         rb 2
+	cont_hdr_salt           rb 16
+	cont_hdr_nonce          rb 8
+	CONTAINER_HEADER_LEN:
+end virtual
+
+virtual at 0
+	cont_offset_key         rb 16
+	cont_offset_header      rb CONTAINER_HEADER_LEN
+	_container_ctx_size:
+end virtual
+
+CONTAINER_TAG_LEN       := 16
+
+; container_create(context, password, passlen, chunk_len, rounds, header);
+container_create:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) password
+	; (ix+12) passlen
+	; (ix+15) chunk_len
+	; (ix+18) rounds
+	; (ix+21) header
+	; both are stored as 16 bits, and neither may be 0
+	ld	a, (ix + 17)
+	or	a, (ix + 20)
+	jq	nz, _container_fail
+	ld	a, (ix + 15)
+	or	a, (ix + 16)
+	jq	z, _container_fail
+	ld	a, (ix + 18)
+	or	a, (ix + 19)
+	jq	z, _container_fail
+
+	ld	iy, (ix + 6)
+	lea	de, iy + cont_offset_header
+	ld	hl, _container_magic
+	ld	bc, 4
+	ldir
+	ld	hl, (ix + 15)
+	ex	de, hl
+	ld	(hl), e
+	inc	hl
+	ld	(hl), d
+	inc	hl
+	ld	de, (ix + 18)
+	ld	(hl), e
+	inc	hl
+	ld	(hl), d
+	inc	hl
+	; a fresh salt gives a fresh key, and the nonce prefix a fresh set of nonces
+	ld	de, 16 + 8
+	push	de, hl
+	call	csrand_fill
+	pop	hl, de
+
+	ld	iy, (ix + 6)
+	lea	hl, iy + cont_offset_header
+	ld	de, (ix + 21)
+	ld	bc, CONTAINER_HEADER_LEN
+	ldir
+	jq	_container_derive
+
+; container_load(context, password, passlen, header);
+container_load:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) password
+	; (ix+12) passlen
+	; (ix+15) header
+	ld	hl, (ix + 15)
+	ld	b, 4
+	ld	de, _container_magic
+.magic:
+	ld	a, (de)
+	cp	a, (hl)
+	jq	nz, _container_fail
+	inc	hl
+	inc	de
+	djnz	.magic
+	ld	a, (hl)
+	inc	hl
+	or	a, (hl)
+	jq	z, _container_fail
+	inc	hl
+	ld	a, (hl)
+	inc	hl
+	or	a, (hl)
+	jq	z, _container_fail
+	ld	iy, (ix + 6)
+	lea	de, iy + cont_offset_header
+	ld	hl, (ix + 15)
+	ld	bc, CONTAINER_HEADER_LEN
+	ldir
+
+; key = pbkdf2(password, salt, rounds), with the frame of either routine above
+_container_derive:
+	ld	iy, (ix + 6)
+	ld	hl, 0		; SHA256
+	push	hl
+	ld	l, (iy + cont_offset_header + cont_hdr_rounds)
+	ld	h, (iy + cont_offset_header + cont_hdr_rounds + 1)
+	push	hl
+	ld	hl, 16
+	push	hl
+	pea	iy + cont_offset_header + cont_hdr_salt
+	ld	hl, 16
+	push	hl
+	pea	iy + cont_offset_key
+	ld	hl, (ix + 12)
 	push	hl
 	ld	hl, (ix + 9)
 	push	hl
-	ld	hl, (ix + 6)
+	call	hmac_pbkdf2
+	jq	_container_exit
+_container_fail:
+	xor	a, a
+_container_exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; container_seal(context, index, plaintext, len, last, chunk);
+container_seal:
+	ld	a, 1
+	jq	_container_chunk
+
+; container_open(context, index, chunk, len, last, plaintext);
+container_open:
+	ld	a, 2
+_container_chunk:
+	ld	hl, -16
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) index
+	; (ix+12) in
+	; (ix+15) len
+	; (ix+18) last
+	; (ix+21) out
+	; (ix-16) nonce
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 15)
+	ld	c, a
+	dec	a
+	jq	z, .check_len
+	ld	de, CONTAINER_TAG_LEN
+	or	a, a
+	sbc	hl, de
+	jq	c, _container_fail
+.check_len:
+	; every chunk but the last is full, so chunk n is always at the same offset
+	ld	de, 0
+	ld	e, (iy + cont_offset_header + cont_hdr_chunk_len)
+	ld	d, (iy + cont_offset_header + cont_hdr_chunk_len + 1)
+	or	a, a
+	sbc	hl, de
+	jq	z, .nonce
+	jq	nc, _container_fail
+	ld	a, (ix + 18)
+	or	a, a
+	jq	z, _container_fail
+
+	; nonce = nonce prefix | u32 index | 0, 0, 0 | last
+.nonce:
+	lea	hl, iy + cont_offset_header + cont_hdr_nonce
+	lea	de, ix - 16
+	ld	a, c
+	ld	bc, 8
+	ldir
+	ex	de, hl
+	ld	de, (ix + 9)
+	ld	(hl), de
+	inc	hl
+	inc	hl
+	inc	hl
+	ld	(hl), b
+	inc	hl
+	ld	(hl), b
+	inc	hl
+	ld	(hl), b
+	inc	hl
+	ld	(hl), b
+	inc	hl
+	ld	c, a
+	ld	a, (ix + 18)
+	or	a, a
+	jq	z, .last
+	ld	a, 1
+.last:
+	ld	(hl), a
+
+	; the header is the associated data of every chunk, binding it to its parameters
+	ld	hl, (ix + 21)
+	push	hl
+	ld	hl, (ix + 15)
+	push	hl
+	ld	hl, (ix + 12)
+	push	hl
+	ld	hl, CONTAINER_HEADER_LEN
+	push	hl
+	pea	iy + cont_offset_header
+	pea	ix - 16
+	pea	iy + cont_offset_key
+	dec	c
+	jq	nz, .open
+	call	ascon_aead_encrypt
+	ld	a, 1
+	jq	_container_exit
+.open:
+	call	ascon_aead_decrypt
+	jq	_container_exit
+
+;------------------------------------------
+; merkle tree
+virtual at 0
+	merkle_offset_nodes     rb 3
+	merkle_offset_leaf_size rb 3
+	merkle_offset_depth     rb 1
+	_merkle_ctx_size:
+end virtual
+
+MERKLE_MAX_DEPTH        := 15
+
+; merkle_init(context, nodes, depth, leaf_size);
+merkle_init:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) nodes
+	; (ix+12) depth
+	; (ix+15) leaf size
+
+	xor	a, a
+	ld	hl, (ix + 15)
+	add	hl, de
+	or	a, a
+	sbc	hl, de
+	jq	z, .exit
+	ld	a, (ix + 12)
+	cp	a, MERKLE_MAX_DEPTH + 1
+	ld	a, 0
+	jq	nc, .exit
+	ld	iy, (ix + 6)
+	ld	(iy + merkle_offset_leaf_size), hl
+	ld	hl, (ix + 9)
+	ld	(iy + merkle_offset_nodes), hl
+	ld	a, (ix + 12)
+	ld	(iy + merkle_offset_depth), a
+	ld	a, 1
+.exit:
+	pop	ix
+	ret
+
+; merkle_build(context, data, len);
+merkle_build:
+	ld	hl, -3
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) data
+	; (ix+12) len
+	; (ix-3) leaf
+
+	; the data must fit in the leaves
+	ld	iy, (ix + 6)
+	call	_merkle_leaves
+	ex	de, hl
+	xor	a, a
+	ld	hl, (ix + 12)
+	ld	bc, 1
+	sbc	hl, bc
+	jq	c, .fits
+	push	de
+	ld	bc, (iy + merkle_offset_leaf_size)
+	call	ti._idivu
+	pop	de
+	or	a, a
+	sbc	hl, de
+	ld	a, 0
+	jq	nc, .exit
+.fits:
+
+	; hash each leaf, zeroing the ones past the end of the data
+	or	a, a
+	sbc	hl, hl
+	ld	(ix - 3), hl
+.leaf_loop:
+	ld	iy, (ix + 6)
+	call	_merkle_leaves
+	ld	de, (ix - 3)
+	or	a, a
+	sbc	hl, de
+	jq	z, .leaves_done
+	add	hl, de
+	dec	hl
+	add	hl, de
+	call	_merkle_node_ptr
 	push	hl
-	call	oaep_encode
-	pop	de
-	pop	de
-	pop	de
-	pop	de
-	pop	de
-	pop	de
-	add	hl, bc
+	ld	hl, (ix + 12)
+	ld	bc, (iy + merkle_offset_leaf_size)
 	or	a, a
 	sbc	hl, bc
-	ld	de, 4
-	jq	z, .lbl_12
-	ld	hl, (ix + 18)
-	ld	bc, 255
-	call	ti._iand
-	ld	de, (ix + 15)
-	push	de
-	ld	de, 65537
-	push	de
-	ld	de, (ix + 12)
-	push	de
+	jq	nc, .full_leaf
+	add	hl, bc
 	push	hl
-	call	_powmod
-	pop	hl
-	pop	hl
-	pop	hl
+	pop	bc
+	or	a, a
+	sbc	hl, hl
+.full_leaf:
+	ld	(ix + 12), hl
+	ld	de, (ix + 9)
 	pop	hl
-	ld	de, 0
-.lbl_12:
-	ex	de, hl
-	restore_interrupts_noret rsa_encrypt
-	jp stack_clear
- 
- 
-;void powmod(uint8_t size, uint8_t *restrict base, uint24_t exp, const uint8_t *restrict mod);
-_powmod:
-   push   ix
-   ld   ix, 0
-   lea   bc, ix
-   add   ix, sp
-.ret  := ix    + long
-.size := .ret  + long
-.base := .size + long
-.exp  := .base + long
-.mod  := .exp  + long
-.acc  := ix    - long
-.tmp  := .acc  - long
-.end  := .tmp  - byte
-   ld   c, (.size)
-   dec   c
-   ld   hl, .end - ix
-   add   hl, sp
-   push   hl
-;   scf
-   sbc   hl, bc
-   push   hl
-;   or   a, a
-   sbc   hl, bc
-   ld   sp, hl
-   ld   hl, (.mod)
-   add   hl, bc
-   ld   (.mod), hl
-   ld   b, bsr 8
-   ld   e, b
-;   ld   e, 1
-.nmi.loop:
-   ld   a, e
-   ld   d, (hl)
-   mlt   de
-   inc   de
-   inc   de
-   ld   d, a
-   mlt   de
-   djnz   .nmi.loop ; leaks size
-   ld   a, e
-   ld   (.nmi), a
-   ld   hl, (.base)
-   add   hl, bc
-   ld   (.base), hl
-   ld   c, 8
-.mod.outer:
-   ld   b, (.size)
-.mod.inner:
-   push   bc, hl
-   ld   b, (.size)
-;   or   a, a
-.shift:
-   rl   (hl)
-   dec   hl
-   djnz   .shift ; leaks size
-   pop   hl
-   push   hl
-   call   .reduce
-   pop   hl, bc
-   djnz   .mod.inner ; leaks size
-   dec   c
-   jq   nz, .mod.outer ; leaks constant
-   ld   c, (.size)
-   dec   c
-   inc   bc
-   ld   de, (.acc)
-   lddr ; leaks size
-   ld   hl, (.exp)
-   scf
-.normalize:
-   adc   hl, hl
-   jq   nc, .normalize ; leaks exp
-   xor   a, a
-.loop:
-   push   hl, af
-   ld   hl, (.acc)
-   call   nz, .mul ; leaks exp
-   pop   af
-   ld   hl, (.base)
-   call   c, .mul ; leaks exp
-   pop   hl
-;   or   a, a
-   adc   hl, hl
-   jq   nz, .loop ; leaks exp
-   ld   de, (.tmp)
-   add   hl, de
-   dec   de
-;   ld   bc, 0
-   ld   c, (.size)
-   dec   c
-   ld   (hl), b
-   push   hl
-   lddr ; leaks size
-   pop   hl
-   inc   (hl)
-   ld   iy, (.base)
-   call   .mul.alt
-   ld   sp, ix
-   pop   ix
-   ret
-   ; vi(acc) = vi(acc) * vi(hl) % vi(mod)
-   ; assumes bc = 0
-   ; destroys vi(tmp)
-   ; returns bc = 0, cf = 0
-.mul:
-   ld   iy, (.tmp)
-.mul.alt:
-   push   hl
-   lea   hl, iy - 0
-   lea   de, iy - 1
-   ld   c, (.size)
-   dec   c
-   ld   (hl), b
-   lddr ; leaks size
-   ld   de, (.acc)
-   ld   (.acc), iy
-   ld   (.tmp), de
-   pop   hl
-   ld   c, (.size)
-   or   a, a
-.mul.outer:
-   ld   a, (de)
-   ld   (.cur), a
-   dec   de
-   push   de, hl, ix, iy, af
-   ld   e, (hl)
-   ld   d, a
-   mlt   de
-   push   hl
-   ld   l, (iy)
-   ld   h, 0
-   add   hl, de
-   ld   e, l
-   ld   d, 0
-.nmi := $ - byte
-   mlt   de
-   ld   a, e
-   ld   (.adj), a
-   ld   b, (.size)
-   dec   b
-   ld   ix, (.mod)
-   ld   d, (ix)
-   mlt   de
-   add.s   hl, de
-   ld   e, h
-   ld   d, l
-;   ld   d, 0
-   rl   d
-   pop   hl
-.mul.inner:
-   dec   hl
-   push   hl
-   ld   l, (hl)
-   ld   h, 0
-.cur := $ - byte
-   mlt   hl
-   adc   hl, de
-   dec   ix
-   ld   e, (ix)
-   ld   d, 0
-.adj := $ - byte
-   mlt   de
-   add.s   hl, de
-   ld   e, h
-   ld   d, 0
-   rl   d
-   ld   a, l
-   dec   iy
-   add   a, (iy)
-   ld   (iy + 1), a
-   pop   hl
-   djnz   .mul.inner ; leaks size
-   ld   l, b
-   rl   l
-   ld   h, b
-   pop   af
-   adc   hl, de
-   ld   (iy + 0), l
-   sra   h
-   pop   iy, ix, hl, de
-   dec   c
-   jq   nz, .mul.outer ; leaks size
-   lea   hl, iy
-   ; if (cf:vi(hl) >= vi(mod)) cf:vi(hl) -= vi(mod)
-   ; assumes bcu = 0
-   ; destroys vi(tmp)
-   ; returns bc = 0, cf = 0
-.reduce:
-   ccf
-   sbc   a, a
-   ld   c, a
-   ld   b, (.size)
-   ld   de, (.tmp)
-   ld   iy, (.mod)
-   or   a, a
-   push   hl, de
-.reduce.sub:
-   ld   a, (hl)
-   dec   hl
-   sbc   a, (iy)
-   dec   iy
-   ld   (de), a
-   dec   de
-   djnz   .reduce.sub ; leaks size
-   sbc   a, a
-   and   a, c
-   and   a, long
-   sbc   hl, hl
-   ld   l, a
-   add   hl, sp
-   ld   hl, (hl)
-   pop   de, de
-   ld   c, (.size)
-   dec   c
-   inc   bc
-   lddr ; leaks size, assuming that base and stack are in normal ram
-   ret
- 
- 
-hmac_sha256_init:
-	save_interrupts
+	call	_merkle_set_leaf
+	ld	hl, (ix + 9)
+	add	hl, bc
+	ld	(ix + 9), hl
+	ld	hl, (ix - 3)
+	inc	hl
+	ld	(ix - 3), hl
+	jq	.leaf_loop
 
-	ld	hl, -70
-	call	ti._frameset
-	ld	hl, 64
-	ld	de, 0
-	lea	bc, ix + -64
-	ld	(ix + -67), bc
+.leaves_done:
+	; then every node above them, from the bottom up
+	call	_merkle_leaves
+	dec	hl
+.node_loop:
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .done
+	dec	hl
 	push	hl
-	push	de
-	push	bc
-	call	ti._memset
-	pop	hl
+	call	_merkle_combine
 	pop	hl
-	pop	hl
-	ld	de, 65
-	ld	hl, (ix + 12)
+	jq	.node_loop
+.done:
+	ld	a, 1
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; merkle_update(context, index, leaf, len);
+merkle_update:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) index
+	; (ix+12) leaf
+	; (ix+15) len
+
+	ld	iy, (ix + 6)
+	xor	a, a
+	ld	hl, (iy + merkle_offset_leaf_size)
+	ld	de, (ix + 15)
+	sbc	hl, de
+	jq	c, .exit
+	call	_merkle_leaves
+	ld	de, (ix + 9)
+	dec	hl
 	or	a, a
 	sbc	hl, de
-	ld	de, 128
-	jq	c, .lbl_2
-	ld	hl, (ix + 6)
+	jq	c, .exit
+
+	; rehash the leaf, then only the nodes on its path to the root
+	add	hl, de
 	add	hl, de
-	ld	(ix + -70), hl
 	push	hl
-	call	hash_sha256_init
+	call	_merkle_node_ptr
+	ld	de, (ix + 12)
+	ld	bc, (ix + 15)
+	call	_merkle_set_leaf
 	pop	hl
+.path:
+	add	hl, bc
 	or	a, a
-	sbc	hl, hl
+	sbc	hl, bc
+	jq	z, .done
+	; parent = (node - 1) / 2, node indices fit in 16 bits
+	dec	hl
+	srl	h
+	rr	l
+	push	hl
+	call	_merkle_combine
+	pop	hl
+	jq	.path
+.done:
+	ld	a, 1
+.exit:
+	pop	ix
+	ret
+
+; merkle_path(context, index, path);
+merkle_path:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) index
+	; (ix+12) path
+
+	ld	iy, (ix + 6)
+	call	_merkle_leaves
+	ld	de, (ix + 9)
+	dec	hl
+	xor	a, a
+	sbc	hl, de
+	jq	c, .exit
+	add	hl, de
+	add	hl, de
+	ld	de, (ix + 12)
+.sibling:
+	add	hl, bc
+	or	a, a
+	sbc	hl, bc
+	jq	z, .done
+	; left children have odd indices, their siblings follow them
 	push	hl
+	bit	0, l
+	jq	z, .right
+	inc	hl
+	inc	hl
+.right:
+	dec	hl
+	call	_merkle_node_ptr
+	ld	bc, 32
+	ldir
+	pop	hl
+	dec	hl
+	srl	h
+	rr	l
+	jq	.sibling
+.done:
+	ld	a, 1
+.exit:
+	pop	ix
+	ret
+
+; merkle_verify(root, depth, index, leaf, len, path);
+merkle_verify:
+	ld	hl, -32
+	call	ti._frameset
+	; (ix+6) root
+	; (ix+9) depth
+	; (ix+12) index
+	; (ix+15) leaf
+	; (ix+18) len
+	; (ix+21) path
+	; (ix-32) digest
+
+	xor	a, a
+	ld	b, (ix + 9)
+	ld	c, a
+	ld	a, b
+	cp	a, MERKLE_MAX_DEPTH + 1
+	ld	a, c
+	jq	nc, .exit
+	ld	hl, 1
+	inc	b
+	jr	.check_start
+.check:
+	add	hl, hl
+.check_start:
+	djnz	.check
+	ld	de, (ix + 12)
+	or	a, a
+	sbc	hl, de
+	jq	c, .exit
+	jq	z, .exit
+
+	lea	hl, ix - 32
+	ld	de, (ix + 15)
+	ld	bc, (ix + 18)
+	call	_merkle_set_leaf
+
+	; climb to the root, the index bits saying which side the digest is on
+.level:
+	ld	a, (ix + 9)
+	or	a, a
+	jq	z, .compare
+	dec	a
+	ld	(ix + 9), a
+	ld	de, (ix + 21)
+	lea	hl, ix - 32
+	bit	0, (ix + 12)
+	jq	z, .ordered
+	ex	de, hl
+.ordered:
+	ld	bc, 32
+	push	bc, de, bc, hl
+	ld	c, 1
+	push	bc
+	pea	ix - 32
+	call	_merkle_hash
+	pop	hl, hl, hl, hl, hl, hl
+	ld	hl, (ix + 21)
+	ld	de, 32
+	add	hl, de
+	ld	(ix + 21), hl
 	ld	hl, (ix + 12)
+	srl	h
+	rr	l
+	ld	(ix + 12), hl
+	jq	.level
+
+.compare:
+	ld	hl, 32
 	push	hl
-	ld	hl, (ix + 9)
+	pea	ix - 32
+	ld	hl, (ix + 6)
 	push	hl
-	ld	hl, (ix + -70)
+	call	digest_compare
+.exit:
+	ld	sp, ix
+	pop	ix
+	ret
+
+; iy = context
+; returns hl = number of leaves
+; destroys b
+_merkle_leaves:
+	ld	b, (iy + merkle_offset_depth)
+	ld	hl, 1
+	inc	b
+	jr	.start
+.loop:
+	add	hl, hl
+.start:
+	djnz	.loop
+	ret
+
+; iy = context, hl = node index
+; returns hl = node
+; destroys bc
+_merkle_node_ptr:
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	ld	bc, (iy + merkle_offset_nodes)
+	add	hl, bc
+	ret
+
+; hl = leaf node, de = data, bc = len
+; leaf = H(0x00 | data), or zeroes if there is no data
+; preserves bc, iy
+_merkle_set_leaf:
 	push	hl
-	call	hash_sha256_update
-	pop	hl
-	pop	hl
-	pop	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
 	pop	hl
-	ld	hl, (ix + -67)
+	jq	nz, .hash
+	ld	(hl), c
 	push	hl
-	ld	hl, (ix + -70)
+	pop	de
+	inc	de
+	ld	c, 31
+	ldir
+	ret
+.hash:
+	push	iy
+	ld	iy, 0
+	push	bc, iy, iy, bc, de, iy, hl
+	call	_merkle_hash
+	pop	hl, hl, hl, hl, hl, hl, bc
+	pop	iy
+	ret
+
+; iy = context, hl = node index
+; node = H(0x01 | left child | right child), the children are adjacent
+; preserves iy
+_merkle_combine:
 	push	hl
+	add	hl, hl
+	inc	hl
+	call	_merkle_node_ptr
+	ex	de, hl
+	pop	hl
+	call	_merkle_node_ptr
+	push	iy
+	ld	bc, 0
+	push	bc, bc
+	ld	c, 64
+	push	bc, de
+	ld	c, 1
+	push	bc, hl
+	call	_merkle_hash
+	pop	hl, hl, hl, hl, hl, hl
+	pop	iy
+	ret
+
+; _merkle_hash(digest, tag, a, alen, b, blen);
+; digest = H(tag | a | b)
+_merkle_hash:
+	ld	hl, -_sha256ctx_size
+	call	ti._frameset
+	; (ix+6) digest
+	; (ix+9) tag
+	; (ix+12) a
+	; (ix+15) alen
+	; (ix+18) b
+	; (ix+21) blen
+
+	pea	ix - _sha256ctx_size
+	call	hash_sha256_init
+	pop	de
+	lea	hl, ix + 9
+	ld	bc, 1
+	call	_sha256_update_nz
+	ld	hl, (ix + 12)
+	ld	bc, (ix + 15)
+	call	_sha256_update_nz
+	ld	hl, (ix + 18)
+	ld	bc, (ix + 21)
+	call	_sha256_update_nz
+	ld	hl, (ix + 6)
+	push	hl, de
 	call	hash_sha256_final
-	jq	.lbl_3
-.lbl_2:
+	ld	sp, ix
+	pop	ix
+	ret
+
+
+;------------------------------------------
+; content-defined chunking
+virtual at 0
+	cdc_offset_min          rb 3
+	cdc_offset_max          rb 3
+	cdc_offset_threshold    rb 3
+	_cdc_ctx_size:
+end virtual
+
+virtual at 0
+	cdcidx_offset_entries   rb 3
+	cdcidx_offset_count     rb 3
+	cdcidx_offset_capacity  rb 3
+	_cdc_index_size:
+end virtual
+
+CDC_MAX_CHUNK           := 65535
+CDC_INDEX_DIGEST_LEN    := 16
+CDC_INDEX_MAX           := $7FFF
+
+CDC_NEW                 := 0
+CDC_KNOWN               := 1
+CDC_INDEX_FULL          := 2
+
+; cdc_init(context, min_size, avg_size, max_size);
+cdc_init:
+	call	ti._frameset0
+	; (ix+6) context
+	; (ix+9) min size
+	; (ix+12) average size
+	; (ix+15) max size
+
+	; min + 2 <= avg <= max <= CDC_MAX_CHUNK
+	xor	a, a
+	ld	hl, CDC_MAX_CHUNK
+	ld	de, (ix + 15)
+	sbc	hl, de
+	jq	c, .exit
+	ex	de, hl
+	ld	de, (ix + 12)
+	sbc	hl, de
+	jq	c, .exit
+	ex	de, hl
+	ld	de, (ix + 9)
+	sbc	hl, de
+	jq	c, .exit
+	ld	bc, 2
+	sbc	hl, bc
+	jq	c, .exit
+	add	hl, bc
+
+	; cut where the hash is below 2^24 >> log2(avg - min),
+	; once every (avg - min) bytes past the minimum on average
+	ld	de, 1
+.log2:
+	ex	de, hl
+	add	hl, hl
+	ex	de, hl
+	add	hl, hl
+	jq	nc, .log2
+	ld	iy, (ix + 6)
+	ld	(iy + cdc_offset_threshold), de
+	ld	hl, (ix + 9)
+	ld	(iy + cdc_offset_min), hl
+	ld	hl, (ix + 15)
+	ld	(iy + cdc_offset_max), hl
+	inc	a
+.exit:
+	pop	ix
+	ret
+
+; cdc_next(context, data, len, digest);
+cdc_next:
+	ld	hl, -_sha256ctx_size
+	call	ti._frameset
+	; (ix+6) context
+	; (ix+9) data
+	; (ix+12) len, then chunk length
+	; (ix+15) digest
+
+	; the chunk ends at max, or at the end of the data
+	ld	iy, (ix + 6)
 	ld	hl, (ix + 12)
+	ld	de, (iy + cdc_offset_max)
+	or	a, a
+	sbc	hl, de
+	jq	c, .short
+	ex	de, hl
+	jq	.limit
+.short:
+	add	hl, de
+.limit:
+	ld	(ix + 12), hl
+
+	; unless a boundary turns up between min and there
+	ld	de, (iy + cdc_offset_min)
+	or	a, a
+	sbc	hl, de
+	jq	c, .fingerprint
+	jq	z, .fingerprint
+	ex	de, hl
+	ld	bc, (ix + 9)
+	add	hl, bc
+	ld	bc, (iy + cdc_offset_threshold)
+	ld	(.threshold), bc
+	push	ix
 	push	hl
+	pop	ix
+	or	a, a
+	sbc	hl, hl
+.scan:
+	; gear hash, h = (h << 1) + gear[byte]
+	ld	c, (ix + 0)
+	inc	ix
+	ld	b, 3
+	mlt	bc
+	ld	iy, _cdc_gear
+	add	iy, bc
+	ld	bc, (iy + 0)
+	add	hl, hl
+	add	hl, bc
+	ld	bc, 0
+.threshold := $-3
+	or	a, a
+	sbc	hl, bc
+	add	hl, bc
+	jq	c, .cut
+	; at most CDC_MAX_CHUNK bytes are scanned, so d:e is the whole count
+	dec	de
+	ld	a, d
+	or	a, e
+	jq	nz, .scan
+	pop	ix
+	jq	.fingerprint
+.cut:
+	lea	hl, ix + 0
+	pop	ix
+	ld	de, (ix + 9)
+	or	a, a
+	sbc	hl, de
+	ld	(ix + 12), hl
+
+.fingerprint:
+	pea	ix - _sha256ctx_size
+	call	hash_sha256_init
+	pop	de
 	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	call	_sha256_update_nz
+	ld	hl, (ix + 15)
+	push	hl, de
+	call	hash_sha256_final
+	ld	hl, (ix + 12)
+	ld	sp, ix
+	pop	ix
+	ret
+
+; cdc_index_init(index, entries, size, count);
+cdc_index_init:
+	call	ti._frameset0
+	; (ix+6) index
+	; (ix+9) entries
+	; (ix+12) size
+	; (ix+15) count
+
+	ld	hl, (ix + 12)
+	ld	bc, CDC_INDEX_DIGEST_LEN
+	call	ti._idivu
+	ld	de, CDC_INDEX_MAX
+	or	a, a
+	sbc	hl, de
+	jq	nc, .clamp
+	add	hl, de
+	ex	de, hl
+.clamp:
+	ld	iy, (ix + 6)
+	ld	(iy + cdcidx_offset_capacity), de
+	ld	hl, (ix + 9)
+	ld	(iy + cdcidx_offset_entries), hl
+	ld	hl, (ix + 15)
+	or	a, a
+	sbc	hl, de
+	jq	nc, .full
+	add	hl, de
+	ex	de, hl
+.full:
+	ld	(iy + cdcidx_offset_count), de
+	ld	hl, (iy + cdcidx_offset_capacity)
+	pop	ix
+	ret
+
+; cdc_index_find(index, digest);
+cdc_index_find:
+	pop	bc, iy, de
+	push	de, iy, bc
+	call	_cdc_index_search
+	sbc	a, a
+	inc	a
+	ret
+
+; cdc_index_add(index, digest);
+cdc_index_add:
+	call	ti._frameset0
+	; (ix+6) index
+	; (ix+9) digest
+
+	ld	iy, (ix + 6)
+	ld	de, (ix + 9)
+	call	_cdc_index_search
+	ld	a, CDC_KNOWN
+	jq	nc, .exit
+	ld	a, CDC_INDEX_FULL
+	ex	de, hl
+	ld	hl, (iy + cdcidx_offset_count)
+	ld	bc, (iy + cdcidx_offset_capacity)
+	or	a, a
+	sbc	hl, bc
+	jq	z, .exit
+	add	hl, bc
+
+	; shift the entries after the position up one
 	push	hl
-	ld	hl, (ix + -67)
-	push	hl
-	call	ti._memcpy
-	pop	hl
-.lbl_3:
-	pop	hl
+	inc	hl
+	ld	(iy + cdcidx_offset_count), hl
 	pop	hl
-	ld	hl, 64
+	or	a, a
+	sbc	hl, de
+	push	de
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
 	push	hl
-	ld	hl, 54
+	pop	bc
+	ex	de, hl
+	call	_cdc_index_entry
+	jq	z, .insert
+	add	hl, bc
+	dec	hl
 	push	hl
-	ld	hl, (ix + 6)
+	pop	de
 	push	hl
-	call	ti._memset
-	pop	hl
+	ld	hl, CDC_INDEX_DIGEST_LEN
+	add	hl, de
+	ex	de, hl
 	pop	hl
+	lddr
+.insert:
 	pop	hl
-	ld	hl, 64
-	push	hl
-	ld	hl, 92
+	call	_cdc_index_entry
+	ex	de, hl
+	ld	hl, (ix + 9)
+	ld	bc, CDC_INDEX_DIGEST_LEN
+	ldir
+	xor	a, a
+.exit:
+	pop	ix
+	ret
+
+; iy = index, hl = position
+; returns hl = entry, z if bc is zero
+_cdc_index_entry:
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	push	de
+	ld	de, (iy + cdcidx_offset_entries)
+	add	hl, de
+	pop	de
 	push	hl
-	ld	iy, (ix + 6)
-	pea	iy + 64
-	call	ti._memset
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	de, 64
-	ld	bc, 0
-.lbl_5:
-	push	bc
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
 	pop	hl
+	ret
+
+; iy = index, de = digest
+; binary search for the digest
+; returns hl = position of the first entry not below the digest, nc if it is that entry
+; preserves de, iy
+; keeps its own frame, since ti._frameset would clobber de
+_cdc_index_search:
+	push	ix
+	ld	ix, -6
+	add	ix, sp
+	ld	sp, ix
+	; (ix+0) low
+	; (ix+3) high
 	or	a, a
-	sbc	hl, de
-	ld	hl, (ix + -67)
-	jq	z, .lbl_7
+	sbc	hl, hl
+	ld	(ix + 0), hl
+	ld	hl, (iy + cdcidx_offset_count)
+	ld	(ix + 3), hl
+.loop:
+	ld	hl, (ix + 0)
+	ld	bc, (ix + 3)
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .not_found
+	; mid = (low + high) / 2, positions fit in 16 bits
 	add	hl, bc
-	ld	l, (hl)
-	ld	iy, (ix + 6)
-	add	iy, bc
-	ld	a, (iy)
-	xor	a, l
-	ld	(iy), a
-	ld	a, (iy + 64)
-	xor	a, l
-	ld	(iy + 64), a
-	inc	bc
-	jq	.lbl_5
-.lbl_7:
-	ld	hl, (ix + 6)
-	ld	de, 128
-	add	hl, de
-	ld	(ix + -67), hl
+	add	hl, bc
+	srl	h
+	rr	l
 	push	hl
-	call	hash_sha256_init
-	pop	hl
+	push	de
+	call	_cdc_index_entry
+	ld	b, CDC_INDEX_DIGEST_LEN
+.compare:
+	ld	a, (de)
+	cp	a, (hl)
+	jq	nz, .differ
+	inc	hl
+	inc	de
+	djnz	.compare
+	pop	de, hl
+	or	a, a
+	jq	.exit
+.differ:
+	pop	de, hl
+	jq	c, .lower
+	inc	hl
+	ld	(ix + 0), hl
+	jq	.loop
+.lower:
+	ld	(ix + 3), hl
+	jq	.loop
+.not_found:
+	ld	hl, (ix + 0)
+	scf
+.exit:
+	lea	ix, ix + 6
+	ld	sp, ix
+	pop	ix
+	ret
+
+; first 3 bytes of SHA-256 of each byte value
+_cdc_gear:
+	dl	$0B346E, $12F54B, $B4C1DB, $ED4F08, $9C2DE5, $9A7BE7, $6E5867, $8735CA
+	dl	$D7EABE, $344C2B, $47BA01, $46CFE7, $BD6CEF, $0E1E9D, $3E7B4D, $9C0EDC
+	dl	$EA55C5, $A1644A, $7999F2, $7F89AB, $1D8983, $D10F2F, $C4B77C, $B0118F
+	dl	$A12B45, $2EAA68, $B0F758, $FCAD77, $C44FBD, $D6181F, $595296, $79E6FF
+	dl	$E7A936, $0872BB, $1F338A, $594333, $96FC09, $F1F3BB, $CE1D95, $DA5F26
+	dl	$B1EB32, $C55EBA, $884868, $C218A3, $0235D0, $E07339, $EEB4CD, $DA5E8A
+	dl	$EBEC5F, $B2866B, $5E73D4, $40074E, $77224B, $122DEF, $C0F6E7, $690279
+	dl	$42622C, $1E5819, $07ACE7, $05B841, $3ABDDA, $180938, $7EB662, $E88D8A
+	dl	$1F64C3, $EA9A55, $707EDF, $C0236B, $D5393F, $15F5A9, $B17AF6, $0A3E33
+	dl	$7ABD44, $D03DA8, $3BA46D, $9ABE86, $CFDF72, $71F208, $6AE88C, $4F69C4
+	dl	$E0625C, $15E84A, $74258C, $B3E08D, $B732E6, $1355A2, $6F5ADE, $F4B5FC
+	dl	$AB684B, $38F518, $BDEEBB, $435824, $3D25A9, $0DAECF, $9ECD74, $ADE2D2
+	dl	$F5338D, $8197CA, $E8233E, $2C7D2E, $3EAC18, $BB793F, $102F25, $A90ACD
+	dl	$40A9AA, $1B7DDE, $409F18, $C35482, $86ACAC, $6AC662, $B1161B, $4CC765
+	dl	$E98D14, $C2358E, $494345, $713A04, $8AB9E3, $93FE0B, $48944C, $21E750
+	dl	$16712D, $E4FCA1, $514E59, $B51F02, $CFE5CB, $360BD1, $43CE7A, $FD0B62
+	dl	$8BBE76, $7C1B59, $78ABA5, $DDE05E, $E6A8AA, $7F0EC0, $AFBD3C, $26FA4B
+	dl	$2F364F, $C0B0E9, $93312D, $1BBE3E, $B0EF9D, $985107, $949F94, $30375E
+	dl	$6C079E, $9DA57D, $626095, $D26BD1, $72C867, $0DAD5B, $388784, $B70A2A
+	dl	$C7BE79, $2895FD, $D10506, $BB368D, $AF3F6E, $71279D, $2DAF35, $4F181F
+	dl	$799AC1, $50898A, $B2430A, $FB906D, $3EAA88, $E92269, $CD1DFE, $93BF2D
+	dl	$ADE174, $8C8E9E, $F6EEBC, $807D08, $B86BEE, $AFAD22, $3A7519, $7A6E5A
+	dl	$7CF9F4, $889414, $79E39B, $58F165, $219527, $602F89, $8441CA, $8E6A4D
+	dl	$0DBBD3, $C0D604, $931C28, $DAECCB, $BFE526, $573268, $088547, $C82DB1
+	dl	$5EFFE4, $D7BBD1, $E757C5, $463FAE, $1021D1, $C30E5A, $449949, $884033
+	dl	$D25B7C, $33B74F, $865913, $5D3E38, $31D81D, $7B7B9A, $DE37C3, $4B4A7A
+	dl	$C0B0D4, $A5C9B5, $7EF985, $9C9628, $848A52, $93CECD, $6E2C0A, $214A41
+	dl	$3A19AF, $2D1519, $7D5C5D, $52D2B7, $AA95FB, $049527, $CB4179, $70A92E
+	dl	$5D8C7D, $EF31F0, $BFA530, $487E45, $FF1E5E, $BA61AB, $AE3A0A, $2B75D0
+	dl	$07F2E6, $332EDE, $E4D43A, $0ED2F8, $3DF845, $1FDFF3, $5E4594, $754D4D
+	dl	$02E5FD, $9EF0D4, $7C6C96, $022E78, $FF1720, $DEAB27, $98B2B0, $8F8650
+	dl	$A896E5, $2220D5, $2572AA, $D3B804, $2E7298, $14153E, $7B68AA, $0A10A8
+
+
+;------------------------------------------
+; rsync-style delta sync
+virtual at 0
+	rsync_offset_signature  rb 3
+	rsync_offset_blocks     rb 3
+	rsync_offset_block_len  rb 3
+	rsync_offset_filter     rb 256
+	_rsync_ctx_size:
+end virtual
+
+RSYNC_WEAK_LEN          := 4
+RSYNC_STRONG_LEN        := 8
+RSYNC_SIG_ENTRY         := RSYNC_WEAK_LEN + RSYNC_STRONG_LEN
+RSYNC_MIN_BLOCK         := 8
+
+RSYNC_OP_LITERAL        := 0
+RSYNC_OP_COPY           := 1
+
+; rsync_weak(data, len);
+rsync_weak:
+	call	ti._frameset0
+	ld	hl, (ix + 9)
+	push	hl, hl
+	ld	iy, 0
+	add	iy, sp
+	ld	hl, (ix + 6)
+	ld	bc, (ix + 9)
+	call	_rsync_weak
+	pop	hl, de
+	ld	sp, ix
+	pop	ix
+	ret
+
+; rsync_roll(weak, out, in, len);
+rsync_roll:
+	call	ti._frameset0
+	; (ix+6) weak
+	; (ix+12) byte leaving the window
+	; (ix+15) byte entering the window
+	; (ix+18) window length
+	lea	iy, ix + 6
+	ld	b, (ix + 15)
+	ld	c, (ix + 12)
+	ld	de, (ix + 18)
+	call	_rsync_roll
+	ld	hl, (ix + 6)
+	ld	e, (ix + 9)
+	pop	ix
+	ret
+
+; rsync_signature(data, len, block_len, signature);
+rsync_signature:
+	ld	hl, -3
+	call	ti._frameset
+	; (ix+6) data
+	; (ix+9) len
+	; (ix+12) block len
+	; (ix+15) signature
+	; (ix-3) blocks
+
 	or	a, a
 	sbc	hl, hl
-	push	hl
-	ld	hl, 64
-	push	hl
+	ld	(ix - 3), hl
+	ld	hl, (ix + 12)
+	ld	de, RSYNC_MIN_BLOCK
+	sbc	hl, de
+	jq	c, .done
+	ld	de, $10000 - RSYNC_MIN_BLOCK
+	sbc	hl, de
+	jq	nc, .done
+
+	; a weak and a strong checksum for each whole block
+.block:
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	or	a, a
+	sbc	hl, bc
+	jq	c, .done
+	ld	(ix + 9), hl
+	ld	iy, (ix + 15)
 	ld	hl, (ix + 6)
+	call	_rsync_weak
+	ld	hl, (ix + 12)
 	push	hl
-	ld	hl, (ix + -67)
+	ld	hl, (ix + 6)
 	push	hl
-	call	hash_sha256_update
+	pea	iy + RSYNC_WEAK_LEN
+	call	_rsync_strong
+	pop	hl, hl, hl
+	ld	hl, (ix + 15)
+	ld	de, RSYNC_SIG_ENTRY
+	add	hl, de
+	ld	(ix + 15), hl
+	ld	hl, (ix + 6)
+	ld	de, (ix + 12)
+	add	hl, de
+	ld	(ix + 6), hl
+	ld	hl, (ix - 3)
+	inc	hl
+	ld	(ix - 3), hl
+	jq	.block
+.done:
+	ld	hl, (ix - 3)
+	ld	sp, ix
+	pop	ix
+	ret
 
-	restore_interrupts_noret hmac_sha256_init
-	jp stack_clear
-    
- 
-hmac_sha256_update:
+; rsync_delta_init(context, signature, blocks, block_len);
+rsync_delta_init:
 	call	ti._frameset0
-	ld	hl, (ix + 6)
-	ld	iy, (ix + 9)
+	; (ix+6) context
+	; (ix+9) signature
+	; (ix+12) blocks
+	; (ix+15) block len
+
+	xor	a, a
+	ld	hl, (ix + 15)
+	ld	de, RSYNC_MIN_BLOCK
+	sbc	hl, de
+	jq	c, .exit
+	ld	de, $10000 - RSYNC_MIN_BLOCK
+	sbc	hl, de
+	jq	nc, .exit
+	ld	hl, (ix + 12)
+	ld	de, $10000
+	or	a, a
+	sbc	hl, de
+	jq	nc, .exit
+
+	ld	iy, (ix + 6)
+	ld	hl, (ix + 9)
+	ld	(iy + rsync_offset_signature), hl
+	ld	hl, (ix + 12)
+	ld	(iy + rsync_offset_blocks), hl
+	ld	hl, (ix + 15)
+	ld	(iy + rsync_offset_block_len), hl
+
+	; set a filter bit for each block, so most windows are
+	; ruled out without searching the signature
+	lea	hl, iy + rsync_offset_filter
+	lea	de, iy + rsync_offset_filter + 1
+	ld	(hl), a
+	ld	bc, 255
+	ldir
+	ld	hl, (ix + 9)
 	ld	bc, (ix + 12)
-	ld	de, 128
+.mark:
+	ld	a, b
+	or	a, c
+	jq	z, .done
+	push	bc, hl
+	call	_rsync_filter
+	or	a, (hl)
+	ld	(hl), a
+	pop	hl, bc
+	ld	de, RSYNC_SIG_ENTRY
 	add	hl, de
-	ld	de, 0
-	push	de
-	push	bc
-	push	iy
-	push	hl
-	call	hash_sha256_update
-	ld	sp, ix
+	dec	bc
+	jq	.mark
+.done:
+	ld	a, 1
+.exit:
 	pop	ix
 	ret
-	
-    
-hmac_sha256_final:
-	save_interrupts
 
-    ld	hl, -280
+; rsync_delta(context, data, len, delta);
+rsync_delta:
+	ld	hl, -32
 	call	ti._frameset
-	ld	bc, (ix + 6)
-	ld	hl, 236
-	lea	de, ix + -38
-	ld	(ix + -3), bc
-	ld	bc, -280
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), de
-	push	ix
-	ld	bc, -274
-	add	ix, bc
-	lea	de, ix + 0
-	pop	ix
-	push	ix
-	ld	bc, -277
-	add	ix, bc
-	ld	(ix + 0), de
-	pop	ix
-	push	hl
-	ld	bc, (ix + -3)
-	push	bc
-	push	de
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	de, 128
-	ld	bc, -277
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	; (ix+6) context
+	; (ix+9) data
+	; (ix+12) len
+	; (ix+15) delta
+	; (ix-3) window
+	; (ix-6) start of the pending literal bytes
+	; (ix-9) end of the data
+	; (ix-12) output
+	; (ix-15) signature entry
+	; (ix-18) block index
+	; (ix-22) weak checksum of the window
+	; (ix-23) strong checksum is valid
+	; (ix-24) weak checksum is valid
+	; (ix-32) strong checksum of the window
+
+	ld	hl, (ix + 9)
+	ld	(ix - 3), hl
+	ld	(ix - 6), hl
+	ld	de, (ix + 12)
 	add	hl, de
-	push	ix
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	push	ix
-	ld	bc, -280
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	push	de
-	push	hl
-	call	hash_sha256_final
-	pop	hl
-	pop	hl
-	ld	bc, -277
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hash_sha256_init
-	pop	hl
+	ld	(ix - 9), hl
+	ld	hl, (ix + 15)
+	ld	(ix - 12), hl
+	xor	a, a
+	ld	(ix - 24), a
+
+.window:
+	; stop once less than a block is left
+	ld	iy, (ix + 6)
+	ld	hl, (ix - 9)
+	ld	de, (ix - 3)
+	or	a, a
+	sbc	hl, de
+	ld	bc, (iy + rsync_offset_block_len)
+	sbc	hl, bc
+	jq	c, .tail
+	xor	a, a
+	ld	(ix - 23), a
+	or	a, (ix - 24)
+	jq	nz, .weak_valid
+	inc	a
+	ld	(ix - 24), a
+	ex	de, hl
+	lea	iy, ix - 22
+	call	_rsync_weak
+	ld	iy, (ix + 6)
+.weak_valid:
+	lea	hl, ix - 22
+	call	_rsync_filter
+	and	a, (hl)
+	jq	z, .roll
+
+	; the filter matched, search the signature
+	ld	hl, (iy + rsync_offset_signature)
+	ld	(ix - 15), hl
 	or	a, a
 	sbc	hl, hl
+	ld	(ix - 18), hl
+.search:
+	ld	iy, (ix + 6)
+	ld	hl, (ix - 18)
+	ld	de, (iy + rsync_offset_blocks)
+	or	a, a
+	sbc	hl, de
+	jq	nc, .roll
+	ld	hl, (ix - 15)
+	lea	de, ix - 22
+	ld	b, RSYNC_WEAK_LEN
+	call	_rsync_compare
+	jq	nz, .next_entry
+	; only hash the window once a weak checksum matches
+	ld	a, (ix - 23)
+	or	a, a
+	jq	nz, .strong_valid
+	inc	a
+	ld	(ix - 23), a
+	ld	hl, (iy + rsync_offset_block_len)
 	push	hl
-	ld	hl, 64
+	ld	hl, (ix - 3)
 	push	hl
+	pea	ix - 32
+	call	_rsync_strong
+	pop	hl, hl, hl
+.strong_valid:
+	ld	hl, (ix - 15)
+	ld	de, RSYNC_WEAK_LEN
+	add	hl, de
+	lea	de, ix - 32
+	ld	b, RSYNC_STRONG_LEN
+	call	_rsync_compare
+	jq	z, .match
+.next_entry:
+	ld	hl, (ix - 15)
+	ld	de, RSYNC_SIG_ENTRY
+	add	hl, de
+	ld	(ix - 15), hl
+	ld	hl, (ix - 18)
+	inc	hl
+	ld	(ix - 18), hl
+	jq	.search
+
+.roll:
+	; slide the window one byte, unless it is at the end of the data
 	ld	iy, (ix + 6)
-	pea	iy + 64
-	ld	bc, -277
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix - 3)
+	ld	de, (iy + rsync_offset_block_len)
+	ld	c, (hl)
+	inc	hl
+	ld	(ix - 3), hl
+	dec	hl
+	add	hl, de
+	ex	de, hl
+	ld	hl, (ix - 9)
+	or	a, a
+	sbc	hl, de
+	jq	z, .tail
+	ex	de, hl
+	ld	b, (hl)
+	ld	de, (iy + rsync_offset_block_len)
+	lea	iy, ix - 22
+	call	_rsync_roll
+	jq	.window
+
+.match:
+	ld	hl, (ix - 3)
+	call	_rsync_flush
+	ld	a, RSYNC_OP_COPY
+	ld	(de), a
+	inc	de
+	ld	a, (ix - 18)
+	ld	(de), a
+	inc	de
+	ld	a, (ix - 17)
+	ld	(de), a
+	inc	de
+	ld	(ix - 12), de
+	ld	iy, (ix + 6)
+	ld	hl, (ix - 3)
+	ld	de, (iy + rsync_offset_block_len)
+	add	hl, de
+	ld	(ix - 3), hl
+	ld	(ix - 6), hl
+	xor	a, a
+	ld	(ix - 24), a
+	jq	.window
+
+.tail:
+	ld	hl, (ix - 9)
+	call	_rsync_flush
+	ex	de, hl
+	ld	de, (ix + 15)
+	or	a, a
+	sbc	hl, de
+	ld	sp, ix
+	pop	ix
+	ret
+
+; writes the pending literal bytes up to hl, in rsync_delta's frame
+; returns de = output
+_rsync_flush:
+	ld	de, (ix - 6)
+	or	a, a
+	sbc	hl, de
 	push	hl
-	call	hash_sha256_update
-	pop	hl
+	pop	bc
+	ex	de, hl
+	ld	de, (ix - 12)
+	; fall through
+
+; hl = bytes, bc = count, de = output
+; writes them as literal ops of at most 65535 bytes
+; returns de = end of the output
+_rsync_literal:
+	push	hl
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
 	pop	hl
+	ret	z
+	push	bc, hl
+	ld	hl, $FFFF
+	or	a, a
+	sbc	hl, bc
+	jq	nc, .fits
+	ld	bc, $FFFF
+.fits:
 	pop	hl
+	ld	a, RSYNC_OP_LITERAL
+	ld	(de), a
+	inc	de
+	ld	a, c
+	ld	(de), a
+	inc	de
+	ld	a, b
+	ld	(de), a
+	inc	de
+	push	bc
+	ldir
+	pop	bc
+	ex	(sp), hl
+	or	a, a
+	sbc	hl, bc
+	push	hl
+	pop	bc
 	pop	hl
+	jq	_rsync_literal
+
+; rsync_patch(base, base_len, block_len, delta, delta_len, out);
+rsync_patch:
+	ld	hl, -3
+	call	ti._frameset
+	; (ix+6) base
+	; (ix+9) base len
+	; (ix+12) block len
+	; (ix+15) delta
+	; (ix+18) delta len
+	; (ix+21) out
+	; (ix-3) blocks in the base
+
+	ld	bc, (ix + 12)
 	or	a, a
 	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .invalid
+	ld	hl, (ix + 9)
+	call	ti._idivu
+	ld	(ix - 3), hl
+	ld	hl, (ix + 15)
+	ld	de, (ix + 21)
+.op:
+	; hl = delta, de = output
 	push	hl
-	ld	hl, 32
-	push	hl
-	ld	bc, -280
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -277
-	lea	hl, ix + 0
+	ld	bc, (ix + 18)
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	jq	z, .done
+	ld	hl, -3
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hash_sha256_update
+	jq	nc, .invalid
+	ld	(ix + 18), hl
 	pop	hl
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, (ix + 9)
+	ld	a, (hl)
+	inc	hl
+	ld	bc, 0
+	ld	c, (hl)
+	inc	hl
+	ld	b, (hl)
+	inc	hl
+	cp	a, RSYNC_OP_COPY
+	jq	z, .copy
+	or	a, a
+	jq	nz, .invalid
+
+	; literal bytes, which must all be in the delta
 	push	hl
-	ld	bc, -277
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 18)
+	sbc	hl, bc
+	jq	c, .invalid
+	ld	(ix + 18), hl
+	pop	hl
 	push	hl
-	call	hash_sha256_final
-
-	restore_interrupts_noret hmac_sha256_final
-	jp stack_clear
-	
-    
-hmac_sha256_reset:
-	save_interrupts
+	or	a, a
+	sbc	hl, hl
+	adc	hl, bc
+	pop	hl
+	jq	z, .op
+	ldir
+	jq	.op
 
-    ld	hl, -3
-	call	ti._frameset
-	ld	hl, (ix + 6)
-	ld	de, 128
-	add	hl, de
-	ld	(ix + -3), hl
+.copy:
+	; a block of the base, which must be a whole block
 	push	hl
-	call	hash_sha256_init
+	ld	hl, (ix - 3)
+	or	a, a
+	sbc	hl, bc
+	jq	c, .invalid
+	jq	z, .invalid
+	push	de
+	ld	hl, (ix + 12)
+	call	ti._imulu
+	ld	de, (ix + 6)
+	add	hl, de
+	pop	de
+	ld	bc, (ix + 12)
+	ldir
 	pop	hl
+	jq	.op
+
+.done:
+	ex	de, hl
+	ld	de, (ix + 21)
 	or	a, a
+	sbc	hl, de
+	jq	.exit
+.invalid:
+	scf
 	sbc	hl, hl
-	push	hl
-	ld	hl, 64
-	push	hl
-	ld	hl, (ix + 6)
-	push	hl
-	ld	hl, (ix + -3)
-	push	hl
-	call	hash_sha256_update
+.exit:
 	ld	sp, ix
 	pop	ix
-
-	restore_interrupts hmac_sha256_reset
 	ret
 
-hmac_pbkdf2:
-	save_interrupts
-
- 	ld	hl, -654
-	call	ti._frameset
-	ld	a, (ix + 27)
-	ld	hl, _hash_out_lens
-	ld	iy, 0
-	ld	e, 0
-	push	ix
-	ld	bc, -623
-	add	ix, bc
-	ld	(ix + 0), e
-	pop	ix
-	push	ix
-	ld	bc, -380
-	add	ix, bc
-	lea	de, ix + 0
-	pop	ix
-	lea	bc, iy + 0
-	ld	c, a
-	ld	(ix + -3), de
+; hl = data, bc = len, iy = weak
+; a is the sum of the bytes, b the sum of a after each byte, both mod 2^16
+; preserves iy
+_rsync_weak:
 	push	ix
-	ld	de, -626
+	ld	ix, 0
+	ld	de, 0
+.loop:
+	ld	a, b
+	or	a, c
+	jq	z, .done
+	ld	a, e
+	add	a, (hl)
+	ld	e, a
+	jq	nc, .no_carry
+	inc	d
+.no_carry:
 	add	ix, de
-	ld	(ix + 0), bc
-	pop	ix
-	add	hl, bc
-	ld	a, (hl)
-	ld	bc, -632
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), a
-	ld	hl, 242
-	push	hl
-	push	iy
-	ld	de, (ix + -3)
-	ld	bc, -629
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), de
-	push	de
-	call	ti._memset
-	pop	de
-	pop	de
-	pop	de
-	ld	hl, (ix + 15)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_1
-	jq	.lbl_17
-.lbl_1:
-	ld	de, -626
+	inc	hl
+	dec	bc
+	jq	.loop
+.done:
+	ld	(iy + 0), e
+	ld	(iy + 1), d
 	lea	hl, ix + 0
-	add	hl, de
-	ld	bc, (hl)
-	or	a, a
-	sbc	hl, hl
-	ld	de, -635
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), hl
-	ld	de, (ix + 9)
-	push	de
-	pop	hl
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_2
-	jq	.lbl_17
-.lbl_2:
-	ld	iy, (ix + 6)
-	lea	hl, iy + 0
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_3
-	jq	.lbl_17
-.lbl_3:
-	ld	hl, (ix + 12)
-	add	hl, bc
-	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_4
-	jq	.lbl_17
-.lbl_4:
-	ld	hl, (ix + 24)
+	ld	(iy + 2), l
+	ld	(iy + 3), h
+	pop	ix
+	ret
+
+; iy = weak, b = byte entering the window, c = byte leaving it, de = window length
+; a += in - out, b += a - len * out, both mod 2^16
+_rsync_roll:
+	ld	hl, (iy + 0)
+	ld	a, l
+	add	a, b
+	ld	l, a
+	jq	nc, .in_done
+	inc	h
+.in_done:
+	ld	a, l
+	sub	a, c
+	ld	l, a
+	jq	nc, .out_done
+	dec	h
+.out_done:
+	ld	(iy + 0), l
+	ld	(iy + 1), h
+	push	hl
+	ld	b, e
+	ld	e, c
+	mlt	bc
+	mlt	de
+	ld	d, e
+	ld	e, 0
+	ex	de, hl
 	add	hl, bc
+	ex	de, hl
+	ld	hl, (iy + 2)
 	or	a, a
-	sbc	hl, bc
-	jq	nz, .lbl_5
-	jq	.lbl_17
-.lbl_5:
-	push	bc
-	push	de
-	push	iy
-	ld	bc, -629
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hmac_init
-	pop	de
-	pop	de
-	pop	de
+	sbc	hl, de
 	pop	de
-	add	hl, bc
+	add	hl, de
+	ld	(iy + 2), l
+	ld	(iy + 3), h
+	ret
+
+; iy = context, hl = weak checksum
+; returns hl = filter byte, a = filter bit
+; destroys bc, e
+_rsync_filter:
+	ld	a, (hl)
+	inc	hl
+	inc	hl
+	xor	a, (hl)
+	ld	e, a
+	dec	hl
+	ld	a, (hl)
+	inc	hl
+	inc	hl
+	xor	a, (hl)
+	and	a, 7
 	or	a, a
-	sbc	hl, bc
-	jq	z, .lbl_17
-	ld	bc, -138
-	lea	hl, ix + 0
+	sbc	hl, hl
+	ld	h, a
+	ld	l, e
+	srl	h
+	rr	l
+	srl	h
+	rr	l
+	srl	h
+	rr	l
+	lea	bc, iy + rsync_offset_filter
 	add	hl, bc
-	ld	bc, -638
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), hl
+	ld	a, e
+	and	a, 7
+	ld	b, a
 	ld	a, 1
-	ld	bc, -623
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), a
-	lea	hl, ix + -70
-	push	ix
-	ld	bc, -626
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	ld	bc, -134
-	lea	hl, ix + 0
-	add	hl, bc
-	push	ix
-	ld	bc, -641
-	add	ix, bc
-	ld	(ix + 0), hl
-	pop	ix
-	ld	bc, -622
-	lea	hl, ix + 0
-	add	hl, bc
+	inc	b
+	jq	.start
+.shift:
+	add	a, a
+.start:
+	djnz	.shift
+	ret
+
+; hl, de = buffers, b = len
+; returns z if they are equal
+_rsync_compare:
+	ld	a, (de)
+	cp	a, (hl)
+	ret	nz
+	inc	hl
+	inc	de
+	djnz	_rsync_compare
+	ret
+
+; _rsync_strong(strong, data, len);
+; strong = the first RSYNC_STRONG_LEN bytes of H(data)
+_rsync_strong:
+	ld	hl, -(32 + _sha256ctx_size)
+	call	ti._frameset
+	; (ix+6) strong
+	; (ix+9) data
+	; (ix+12) len
+	; (ix-32) digest
+	; (ix-137) hash state
+
+	lea	hl, ix - 32
+	ld	de, -_sha256ctx_size
+	add	hl, de
 	push	hl
+	call	hash_sha256_init
 	pop	de
-	push	ix
-	ld	bc, -635
-	add	ix, bc
-	ld	hl, (ix + 0)
-	pop	ix
-	push	ix
-	ld	bc, -632
-	add	ix, bc
-	ld	a, (ix + 0)
-	pop	ix
-	ld	l, a
-	push	ix
-	ld	bc, -635
-	add	ix, bc
-	ld	(ix + 0), hl
+	ld	hl, (ix + 9)
+	ld	bc, (ix + 12)
+	call	_sha256_update_nz
+	pea	ix - 32
+	push	de
+	call	hash_sha256_final
+	pop	hl, hl
+	lea	hl, ix - 32
+	ld	de, (ix + 6)
+	ld	bc, RSYNC_STRONG_LEN
+	ldir
+	ld	sp, ix
 	pop	ix
-	ld	hl, 242
+	ret
+
+
+;------------------------------------------
+; ascon (NIST SP 800-232): Ascon-AEAD128 and Ascon-Hash256
+; lanes are kept as 8 little endian bytes, so the s-box runs a byte at a time
+; across the five lanes and the rotations are a few 1-bit shifts plus byte offsets
+virtual at 0
+	ascon_offset_state      rb 5*8
+	ascon_offset_pos        rb 1
+	ascon_offset_rate       rb 1
+	ascon_offset_rounds     rb 1
+	_ascon_sponge_size:
+end virtual
+
+ASCON_KEY_LEN           := 16
+ASCON_TAG_LEN           := 16
+
+; s-box on byte j of every lane
+; iy = state
+; destroys: af, bc, de, hl
+macro _ascon_sbox? j
+	ld c,(iy + 8 + j)		; x2 ^= x1
+	ld a,(iy + 16 + j)
+	xor a,c
+	ld d,a
+	ld e,(iy + 24 + j)
+	ld a,(iy + 32 + j)		; x0 ^= x4, x4 ^= x3
+	ld h,a
+	xor a,(iy + 0 + j)
+	ld b,a
+	ld a,h
+	xor a,e
+	ld h,a
+	ld a,c					; x0 ^ (~x1 & x2)
+	cpl
+	and a,d
+	xor a,b
+	ld l,a
+	ld a,d					; x1 = x1 ^ (~x2 & x3) ^ x0
+	cpl
+	and a,e
+	xor a,c
+	xor a,l
+	ld (iy + 8 + j),a
+	ld a,e					; x2 = ~(x2 ^ (~x3 & x4))
+	cpl
+	and a,h
+	xor a,d
+	ld d,a
+	cpl
+	ld (iy + 16 + j),a
+	ld a,h					; x3 = x3 ^ (~x4 & x0) ^ x2
+	cpl
+	and a,b
+	xor a,e
+	xor a,d
+	ld (iy + 24 + j),a
+	ld a,b					; x4 = x4 ^ (~x0 & x1), x0 ^= x4
+	cpl
+	and a,c
+	xor a,h
+	ld (iy + 32 + j),a
+	xor a,l
+	ld (iy + 0 + j),a
+end macro
+
+; copy the lane at src to the temporary at (ix + t)
+; destroys: hl
+macro _ascon_copy? src, t
+	ld hl,(src)
+	ld (ix + t),hl
+	ld hl,(src + 3)
+	ld (ix + t + 3),hl
+	ld hl,(src + 5)
+	ld (ix + t + 5),hl
+end macro
+
+; rotate the temporary lane at (ix + t) one bit right
+; destroys: af
+macro _ascon_ror1? t
+	ld a,(ix + t)
+	rra
+	rr (ix + t + 7)
+	rr (ix + t + 6)
+	rr (ix + t + 5)
+	rr (ix + t + 4)
+	rr (ix + t + 3)
+	rr (ix + t + 2)
+	rr (ix + t + 1)
+	rr (ix + t + 0)
+end macro
+
+; rotate the temporary lane at (ix + t) one bit left
+; destroys: af
+macro _ascon_rol1? t
+	ld a,(ix + t + 7)
+	rla
+	rl (ix + t + 0)
+	rl (ix + t + 1)
+	rl (ix + t + 2)
+	rl (ix + t + 3)
+	rl (ix + t + 4)
+	rl (ix + t + 5)
+	rl (ix + t + 6)
+	rl (ix + t + 7)
+end macro
+
+; byte j of the lane ^= t1 rotated right q1 bytes ^ t2 rotated right q2 bytes
+; destroys: af
+macro _ascon_mix1? lane, j, q1, q2
+	ld a,(ix + _ascon_t1 + ((j + q1) and 7))
+	xor a,(ix + _ascon_t2 + ((j + q2) and 7))
+	xor a,(iy + lane + j)
+	ld (iy + lane + j),a
+end macro
+macro _ascon_mix? lane, q1, q2
+	_ascon_mix1 lane, 0, q1, q2
+	_ascon_mix1 lane, 1, q1, q2
+	_ascon_mix1 lane, 2, q1, q2
+	_ascon_mix1 lane, 3, q1, q2
+	_ascon_mix1 lane, 4, q1, q2
+	_ascon_mix1 lane, 5, q1, q2
+	_ascon_mix1 lane, 6, q1, q2
+	_ascon_mix1 lane, 7, q1, q2
+end macro
+
+_ascon_t1 := -16
+_ascon_t2 := -8
+
+; ascon permutation
+; iy = state, a = rounds (12 or 8)
+; destroys: af, bc, de, hl
+_ascon_permute:
+._rc := _ascon_t1 - 3
+._n := ._rc - 1
+	ld hl,._n
+	call ti._frameset
+	ld (ix + ._n),a
+	ld hl,_ascon_rc + 12
+	ld bc,0
+	ld c,a
+	or a,a
+	sbc hl,bc
+	ld (ix + ._rc),hl
+._round:
+	ld hl,(ix + ._rc)
+	ld a,(hl)
+	inc hl
+	ld (ix + ._rc),hl
+	xor a,(iy + 16)
+	ld (iy + 16),a
+
+	_ascon_sbox 0
+	_ascon_sbox 1
+	_ascon_sbox 2
+	_ascon_sbox 3
+	_ascon_sbox 4
+	_ascon_sbox 5
+	_ascon_sbox 6
+	_ascon_sbox 7
+
+	; x0 ^= ROTR(x0,19) ^ ROTR(x0,28)
+	_ascon_copy iy + 0, _ascon_t1
+	_ascon_ror1 _ascon_t1
+	_ascon_ror1 _ascon_t1
+	_ascon_ror1 _ascon_t1
+	_ascon_copy ix + _ascon_t1, _ascon_t2
+	_ascon_ror1 _ascon_t2
+	_ascon_mix 0, 2, 3
+
+	; x1 ^= ROTR(x1,61) ^ ROTR(x1,39)
+	_ascon_copy iy + 8, _ascon_t1
+	_ascon_rol1 _ascon_t1
+	_ascon_copy ix + _ascon_t1, _ascon_t2
+	_ascon_rol1 _ascon_t2
+	_ascon_rol1 _ascon_t2
+	_ascon_mix 8, 5, 0
+
+	; x2 ^= ROTR(x2,1) ^ ROTR(x2,6)
+	_ascon_copy iy + 16, _ascon_t1
+	_ascon_ror1 _ascon_t1
+	_ascon_copy iy + 16, _ascon_t2
+	_ascon_rol1 _ascon_t2
+	_ascon_rol1 _ascon_t2
+	_ascon_mix 16, 0, 1
+
+	; x3 ^= ROTR(x3,10) ^ ROTR(x3,17)
+	_ascon_copy iy + 24, _ascon_t1
+	_ascon_ror1 _ascon_t1
+	_ascon_copy ix + _ascon_t1, _ascon_t2
+	_ascon_ror1 _ascon_t2
+	_ascon_mix 24, 2, 1
+
+	; x4 ^= ROTR(x4,7) ^ ROTR(x4,41)
+	_ascon_copy iy + 32, _ascon_t1
+	_ascon_rol1 _ascon_t1
+	_ascon_copy iy + 32, _ascon_t2
+	_ascon_ror1 _ascon_t2
+	_ascon_mix 32, 1, 5
+
+	dec (ix + ._n)
+	jq nz,._round
+	ld sp,ix
+	pop ix
+	ret
+
+; runs data through the rate of a sponge, permuting on every full block
+; iy = sponge, hl = src, de = dst, bc = len, a = mode
+; mode: 0 absorb, 1 encrypt, 2 decrypt (dst is unused when absorbing)
+; returns hl, de past the data
+; destroys: af, bc
+_ascon_duplex:
+	ld (.mode),a
+.chunk:
+	push hl
+	or a,a
+	sbc hl,hl
+	adc hl,bc
+	pop hl
+	ret z
+	; n = min(rate - pos, len)
+	ld a,(iy + ascon_offset_rate)
+	sub a,(iy + ascon_offset_pos)
+	push hl
+	or a,a
+	sbc hl,hl
+	ld l,a
+	or a,a
+	sbc hl,bc
+	pop hl
+	jq c,.room
+	ld a,c
+.room:
+	push hl
+	push bc
+	pop hl
+	ld bc,0
+	ld c,a
+	or a,a
+	sbc hl,bc
+	ex (sp),hl				; remaining length on the stack
+	push ix
+	push iy
+	pop ix
+	ld c,(iy + ascon_offset_pos)
+	add ix,bc				; ix = state + pos
+	ld c,a
+	add a,(iy + ascon_offset_pos)
+	ld (iy + ascon_offset_pos),a
+	ld b,c
+	ld a,0
+.mode := $-1
+	or a,a
+	jq z,.absorb
+	dec a
+	jq z,.encrypt
+.decrypt:
+	ld c,(hl)
+	ld a,(ix)
+	xor a,c
+	ld (de),a
+	ld (ix),c
+	inc hl
+	inc de
+	inc ix
+	djnz .decrypt
+	jq .next
+.encrypt:
+	ld a,(hl)
+	xor a,(ix)
+	ld (ix),a
+	ld (de),a
+	inc hl
+	inc de
+	inc ix
+	djnz .encrypt
+	jq .next
+.absorb:
+	ld a,(hl)
+	xor a,(ix)
+	ld (ix),a
+	inc hl
+	inc ix
+	djnz .absorb
+.next:
+	pop ix
+	pop bc
+	ld a,(iy + ascon_offset_pos)
+	cp a,(iy + ascon_offset_rate)
+	jq nz,.chunk
+	ld (iy + ascon_offset_pos),0
+	push hl, de, bc
+	ld a,(iy + ascon_offset_rounds)
+	call _ascon_permute
+	pop bc, de, hl
+	jq .chunk
+
+; pads the partial block of a sponge
+; iy = sponge
+; destroys: af, bc, hl
+_ascon_pad:
+	ld bc,0
+	ld c,(iy + ascon_offset_pos)
+	lea hl,iy + ascon_offset_state
+	add hl,bc
+	ld a,(hl)
+	xor a,$01
+	ld (hl),a
+	ret
+
+; (de) ^= (hl), 16 bytes
+; destroys: af, b, de, hl
+_ascon_xor16:
+	ld b,16
+.loop:
+	ld a,(de)
+	xor a,(hl)
+	ld (de),a
+	inc hl
+	inc de
+	djnz .loop
+	ret
+
+; void hash_ascon_init(ascon_hash_ctx *ctx);
+hash_ascon_init:
+	pop iy,de
+	push de
+	; the first permutation only sees the IV, so its output is a constant
+	ld hl,_ascon_hash_iv
+	ld bc,5*8
+	ldir
+	ex de,hl
+	ld (hl),0
+	inc hl
+	ld (hl),8
+	inc hl
+	ld (hl),12
+	ld a,1
+	jp (iy)
+
+; void hash_ascon_update(ascon_hash_ctx *ctx, const BYTE data[], size_t len);
+hash_ascon_update:
+	call ti._frameset0
+	ld iy,(ix + 6)
+	ld hl,(ix + 9)
+	ld bc,(ix + 12)
+	xor a,a
+	call _ascon_duplex
+	ld sp,ix
+	pop ix
+	ret
+
+; void hash_ascon_final(ascon_hash_ctx *ctx, BYTE hash[]);
+hash_ascon_final:
+	ld hl,-_ascon_sponge_size
+	call ti._frameset
+	ld hl,(ix + 6)
+	lea de,ix - _ascon_sponge_size
+	ld bc,_ascon_sponge_size
+	ldir
+	lea iy,ix - _ascon_sponge_size
+	call _ascon_pad
+	ld de,(ix + 9)
+	ld b,4
+.squeeze:
+	push bc,de
+	ld a,12
+	call _ascon_permute
+	pop de
+	lea hl,iy + ascon_offset_state
+	ld bc,8
+	ldir
+	pop bc
+	djnz .squeeze
+	ld sp,ix
+	pop ix
+	ret
+
+; ascon_aead_encrypt(key, nonce, ad, adlen, in, len, out);
+ascon_aead_encrypt:
+	ld a,1
+	jq _ascon_aead
+
+; ascon_aead_decrypt(key, nonce, ad, adlen, in, len, out);
+ascon_aead_decrypt:
+	ld a,2
+_ascon_aead:
+	ld hl,-(_ascon_sponge_size + ASCON_TAG_LEN + 1)
+	call ti._frameset
+	; (ix + 6) key
+	; (ix + 9) nonce
+	; (ix + 12) ad
+	; (ix + 15) adlen
+	; (ix + 18) in
+	; (ix + 21) len
+	; (ix + 24) out
+._mode := -1
+._tag := ._mode - ASCON_TAG_LEN
+._sponge := ._tag - _ascon_sponge_size
+	ld (ix + ._mode),a
+	; when decrypting, the tag is the last 16 bytes of the input
+	cp a,2
+	jq nz,.init
+	ld hl,(ix + 21)
+	ld bc,ASCON_TAG_LEN
+	or a,a
+	sbc hl,bc
+	ld a,0
+	jq c,.exit
+	ld (ix + 21),hl
+.init:
+	; S = IV || key || nonce
+	lea iy,ix + ._sponge
+	lea de,iy + ascon_offset_state
+	ld hl,_ascon_aead_iv
+	ld bc,8
+	ldir
+	ld hl,(ix + 6)
+	ld c,ASCON_KEY_LEN
+	ldir
+	ld hl,(ix + 9)
+	ld c,16
+	ldir
+	ex de,hl
+	ld (hl),0
+	inc hl
+	ld (hl),16
+	inc hl
+	ld (hl),8
+	ld a,12
+	call _ascon_permute
+	ld hl,(ix + 6)
+	lea de,iy + 24
+	call _ascon_xor16
+
+	; associated data, skipped entirely when there is none
+	ld bc,(ix + 15)
+	ld hl,(ix + 12)
+	push hl
+	or a,a
+	sbc hl,hl
+	adc hl,bc
+	pop hl
+	jq z,.data
+	xor a,a
+	call _ascon_duplex
+	call _ascon_pad
+	ld a,8
+	call _ascon_permute
+	ld (iy + ascon_offset_pos),0
+.data:
+	ld a,(iy + 39)
+	xor a,$80
+	ld (iy + 39),a
+
+	ld hl,(ix + 18)
+	ld de,(ix + 24)
+	ld bc,(ix + 21)
+	ld a,(ix + ._mode)
+	call _ascon_duplex
+	call _ascon_pad
+
+	; tag = last 128 bits of p12(S ^ (0 || key || 0)) ^ key
+	ld hl,(ix + 6)
+	lea de,iy + 16
+	call _ascon_xor16
+	ld a,12
+	call _ascon_permute
+	lea hl,iy + 24
+	lea de,ix + ._tag
+	ld bc,ASCON_TAG_LEN
+	ldir
+	ld hl,(ix + 6)
+	lea de,ix + ._tag
+	call _ascon_xor16
+
+	ld a,(ix + ._mode)
+	cp a,2
+	jq z,.verify
+	ld hl,(ix + 24)
+	ld bc,(ix + 21)
+	add hl,bc
+	ex de,hl
+	lea hl,ix + ._tag
+	ld bc,ASCON_TAG_LEN
+	ldir
+	ld a,1
+	jq .exit
+.verify:
+	ld hl,ASCON_TAG_LEN
+	push hl
+	ld hl,(ix + 18)
+	ld bc,(ix + 21)
+	add hl,bc
+	push hl
+	pea ix + ._tag
+	call digest_compare
+	pop bc,bc,bc
+	or a,a
+	jq nz,.exit
+	; never hand back plaintext that failed authentication
+	ld hl,(ix + 21)
+	push hl
+	ld hl,0
+	push hl
+	ld hl,(ix + 24)
+	push hl
+	call ti._memset
+	pop bc,bc,bc
+	xor a,a
+.exit:
+	jp stack_clear
+
+
+;------------------------------------------
+; LMS/HSS signature verification (RFC 8554), SHA-256 with n = m = 32
+; almost all of the work is LM-OTS hash chains, H(I || q || i || j || tmp). That is
+; 55 bytes, so each step is a single compression of a block that is built once per
+; signature: I || q and the padding never move, only i, j and tmp are rewritten
+LMS_PUB_LEN             := 4 + 4 + 16 + 32
+LMS_MAX_LEVELS          := 8
+
+; lms_verify(msg, msglen, pub, publen, sig, siglen);
+lms_verify:
+	call	_scratch_enter
+	save_interrupts
+
+	call	ti._frameset0
+	; (ix + 6) msg
+	; (ix + 9) msglen
+	; (ix + 12) pub
+	; (ix + 15) publen
+	; (ix + 18) sig
+	; (ix + 21) siglen
+	ld	hl, (ix + 15)
+	ld	bc, LMS_PUB_LEN
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .fail
+	ld	iy, (ix + 18)
+	ld	hl, (ix + 21)
+	call	_lms_sig_len
+	or	a, a
+	jq	z, .exit
+	ld	bc, (ix + 21)
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .fail
+	ld	hl, (ix + 18)
 	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 12)
 	push	hl
-	ld	bc, -644
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	(hl), de
-	push	de
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, 1
+	ld	hl, (ix + 9)
+	push	hl
+	ld	hl, (ix + 6)
+	push	hl
+	call	_lms_verify_one
+	jq	.exit
+.fail:
 	xor	a, a
-	ld	de, (ix + 15)
-	ld	iy, 0
-.lbl_7:
-	lea	hl, iy + 0
+.exit:
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a lms_verify
+	ret
+
+
+; hss_verify(msg, msglen, pub, publen, sig, siglen);
+hss_verify:
+	call	_scratch_enter
+	save_interrupts
+
+	ld	hl, -12
+	call	ti._frameset
+	; (ix + 6) msg
+	; (ix + 9) msglen
+	; (ix + 12) pub
+	; (ix + 15) publen
+	; (ix + 18) sig
+	; (ix + 21) siglen
+._key := -3
+._ptr := -6
+._avail := -9
+._levels := -10
+	; pub = u32 L || LMS public key, with 1 <= L <= 8
+	ld	hl, (ix + 15)
+	ld	bc, 4 + LMS_PUB_LEN
 	or	a, a
-	sbc	hl, de
-	jq	nc, .lbl_23
+	sbc	hl, bc
+	jq	nz, .fail
+	ld	iy, (ix + 12)
+	ld	a, (iy + 0)
+	or	a, (iy + 1)
+	or	a, (iy + 2)
+	jq	nz, .fail
+	ld	a, (iy + 3)
+	dec	a
+	cp	a, LMS_MAX_LEVELS
+	jq	nc, .fail
+	ld	(ix + ._levels), a
+	lea	hl, iy + 4
+	ld	(ix + ._key), hl
+	; sig = u32 (L - 1) || (LMS signature || LMS public key) * (L - 1) || LMS signature
+	ld	hl, (ix + 21)
+	ld	bc, 4
+	or	a, a
+	sbc	hl, bc
+	jq	c, .fail
+	ld	(ix + ._avail), hl
+	ld	iy, (ix + 18)
+	ld	a, (iy + 0)
+	or	a, (iy + 1)
+	or	a, (iy + 2)
+	jq	nz, .fail
+	ld	a, (iy + 3)
+	cp	a, (ix + ._levels)
+	jq	nz, .fail
+	lea	hl, iy + 4
+	ld	(ix + ._ptr), hl
+.level:
+	ld	a, (ix + ._levels)
+	or	a, a
+	jq	z, .last
+	dec	a
+	ld	(ix + ._levels), a
+	; each level signs the public key of the next
+	ld	iy, (ix + ._ptr)
+	ld	hl, (ix + ._avail)
+	call	_lms_sig_len
+	or	a, a
+	jq	z, .exit
+	push	hl
+	ld	bc, LMS_PUB_LEN
+	add	hl, bc
 	ex	de, hl
-	lea	de, iy + 0
-	ld	(ix + -3), bc
-	ld	bc, -632
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	(iy + 0), de
+	ld	hl, (ix + ._avail)
 	or	a, a
 	sbc	hl, de
-	push	ix
-	ld	de, -651
-	add	ix, de
-	ld	(ix + 0), hl
-	pop	ix
-	ld	bc, (ix + -3)
-	push	bc
-	pop	de
-	ld	h, a
-	ld	l, 24
-	call	ti._lshru
-	ld	a, c
-	push	ix
-	ld	bc, -638
-	add	ix, bc
-	ld	iy, (ix + 0)
-	pop	ix
-	ld	(iy + 0), a
-	push	de
 	pop	bc
-	ld	(ix + -3), de
-	ld	de, -648
-	lea	iy, ix + 0
-	add	iy, de
-	ld	(iy + 0), h
-	ld	a, h
-	ld	l, 16
-	call	ti._lshru
-	ld	a, c
-	push	ix
-	ld	bc, -638
-	add	ix, bc
-	ld	iy, (ix + 0)
-	pop	ix
-	ld	(iy + 1), a
-	ld	de, (ix + -3)
-	ld	a, d
-	ld	(iy + 2), a
-	push	ix
-	ld	bc, -647
-	add	ix, bc
-	ld	(ix + 0), de
-	pop	ix
-	ld	a, e
-	ld	(iy + 3), a
-	ld	hl, (ix + 21)
-	push	hl
-	ld	hl, (ix + 18)
+	jq	c, .fail
+	ld	(ix + ._avail), hl
+	ld	hl, (ix + ._ptr)
 	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
 	add	hl, bc
-	ld	hl, (hl)
+	ex	de, hl
+	ld	hl, (ix + ._key)
 	push	hl
-	call	hmac_update
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, 4
+	ld	hl, LMS_PUB_LEN
 	push	hl
-	ld	bc, -638
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	push	de
+	call	_lms_verify_one
+	pop	de, hl, hl, hl
+	or	a, a
+	jq	z, .exit
+	ld	(ix + ._key), de
+	ld	hl, LMS_PUB_LEN
+	add	hl, de
+	ld	(ix + ._ptr), hl
+	jq	.level
+.last:
+	ld	iy, (ix + ._ptr)
+	ld	hl, (ix + ._avail)
+	call	_lms_sig_len
+	or	a, a
+	jq	z, .exit
+	ld	bc, (ix + ._avail)
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .fail
+	ld	hl, (ix + ._ptr)
 	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + ._key)
 	push	hl
-	call	hmac_update
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, -626
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 9)
 	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
+	ld	hl, (ix + 6)
 	push	hl
-	call	hmac_final
-	pop	hl
-	pop	hl
-	ld	bc, -635
-	lea	hl, ix + 0
+	call	_lms_verify_one
+	jq	.exit
+.fail:
+	xor	a, a
+.exit:
+	ld	sp, ix
+	pop	ix
+
+	restore_interrupts_preserve_a hss_verify
+	ret
+
+
+; length of the LMS signature at iy, if it is well formed and fits in hl bytes
+; returns a = 1, hl = length, or a = 0
+; destroys: bc, de
+_lms_sig_len:
+	ex	de, hl
+	; q, then the LM-OTS type
+	ld	hl, 8
+	or	a, a
+	sbc	hl, de
+	jq	z, .ots
+	jq	nc, .bad
+.ots:
+	ld	a, (iy + 4)
+	or	a, (iy + 5)
+	or	a, (iy + 6)
+	jq	nz, .bad
+	ld	a, (iy + 7)
+	dec	a
+	cp	a, 4
+	jq	nc, .bad
+	; the LMS type follows C and the p chain values
+	ld	bc, 0
+	ld	c, a
+	sla	c
+	sla	c
+	ld	hl, _lmots_params + 2
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -626
-	lea	hl, ix + 0
+	ld	c, (hl)
+	inc	hl
+	ld	b, (hl)
+	push	bc
+	pop	hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	ld	bc, 4 + 4 + 32
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	ld	bc, -641
-	lea	hl, ix + 0
+	ld	bc, 4
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	iy, 1
-	ld	de, 242
-.lbl_9:
+	ex	de, hl
+	or	a, a
+	sbc	hl, de
+	ex	de, hl
+	pop	bc
+	jq	c, .bad
+	; de = bytes left after the LMS type, bc = its offset
 	lea	hl, iy + 0
-	ld	bc, (ix + 24)
+	add	hl, bc
+	ld	a, (hl)
+	inc	hl
+	or	a, (hl)
+	inc	hl
+	or	a, (hl)
+	jq	nz, .bad
+	inc	hl
+	ld	a, (hl)
+	sub	a, 5
+	cp	a, 5
+	jq	nc, .bad
+	; then h path nodes, h = 5 * (type - 4)
+	inc	a
+	push	bc
+	ld	bc, 0
+	ld	b, a
+	ld	c, 5 * 32
+	mlt	bc
+	ex	de, hl
 	or	a, a
 	sbc	hl, bc
-	jq	z, .lbl_10
-	ld	bc, -654
-	lea	hl, ix + 0
+	pop	hl
+	jq	c, .bad
 	add	hl, bc
-	ld	(hl), iy
-	push	de
-	ld	bc, -644
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	hl, (iy + 0)
-	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
+	ld	bc, 4
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
+	ld	a, 1
+	ret
+.bad:
+	xor	a, a
+	ret
+
+
+; _lms_verify_one(msg, msglen, pub, sig);
+; sig must have passed _lms_sig_len
+_lms_verify_one:
+._rd := -3
+._cur := -4
+._left := -5
+._w := -6
+._max := -7
+._ls := -8
+._h := -9
+._cnt := -12
+._i := -15
+._y := -18
+._path := -21
+._ctx := -24
+._blk := -27
+._nb := -30
+._q := -30 - 34
+._frame := ._q - 2 * _sha256ctx_size - 86
+	ld	hl, ._frame
+	call	ti._frameset
+	; (ix + 6) msg
+	; (ix + 9) msglen
+	; (ix + 12) pub
+	; (ix + 15) sig
+	lea	hl, ix + ._q
+	ld	bc, -_sha256ctx_size
+	add	hl, bc
+	ld	(ix + ._ctx), hl
+	add	hl, bc
+	ld	(ix + ._blk), hl
+	ld	bc, -86
+	add	hl, bc
+	ld	(ix + ._nb), hl
+
+	; the key must be for the same LM-OTS type as the signature
+	ld	hl, (ix + 12)
+	ld	de, 4
+	add	hl, de
+	ld	de, (ix + 15)
+	inc	de
+	inc	de
+	inc	de
+	inc	de
+	call	.eq4
+	jq	nz, .fail
+	ld	iy, (ix + 15)
+	ld	a, (iy + 7)
+	dec	a
+	ld	bc, 0
+	ld	c, a
+	sla	c
+	sla	c
+	ld	hl, _lmots_params
+	add	hl, bc
+	ld	a, (hl)
+	ld	(ix + ._w), a
+	ld	b, a
+	ld	a, 1
+.pow2:
+	add	a, a
+	djnz	.pow2
+	dec	a
+	ld	(ix + ._max), a
+	inc	hl
+	ld	a, (hl)
+	ld	(ix + ._ls), a
+	inc	hl
+	ld	bc, 0
+	ld	c, (hl)
+	inc	hl
+	ld	b, (hl)
+	ld	(ix + ._cnt), bc
+	; ... and for the same LMS type
+	push	bc
 	pop	hl
-	ld	bc, -635
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -626
-	lea	hl, ix + 0
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	add	hl, hl
+	ld	bc, 4 + 4 + 32
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
+	ld	bc, (ix + 15)
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hmac_update
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, -626
-	lea	hl, ix + 0
+	ex	de, hl
+	ld	hl, (ix + 12)
+	call	.eq4
+	jq	nz, .fail
+	ld	(ix + ._path), de
+	ex	de, hl
+	dec	hl
+	ld	a, (hl)
+	sub	a, 4
+	ld	b, a
+	add	a, a
+	add	a, a
+	add	a, b
+	ld	(ix + ._h), a
+
+	; q < 2^h
+	ld	b, a
+	ld	d, (iy + 0)
+	ld	e, (iy + 1)
+	ld	h, (iy + 2)
+	ld	l, (iy + 3)
+.q_shift:
+	srl	d
+	rr	e
+	rr	h
+	rr	l
+	djnz	.q_shift
+	ld	a, d
+	or	a, e
+	or	a, h
+	or	a, l
+	jq	nz, .fail
+
+	; chain block: I || q || u16 i || u8 j || tmp, padded as a 55-byte message
+	ld	de, (ix + ._blk)
+	ld	hl, $FF0000
+	ld	bc, 64
+	ldir
+	ld	hl, (ix + 12)
+	ld	bc, 8
 	add	hl, bc
-	ld	hl, (hl)
+	ld	de, (ix + ._blk)
+	ld	c, 16
+	ldir
+	ld	hl, (ix + 15)
+	ld	c, 4
+	ldir
+	ld	iy, (ix + ._blk)
+	ld	(iy + 55), $80
+	ld	(iy + 62), 55*8 shr 8
+	ld	(iy + 63), 55*8 and $FF
+
+	; Q = H(I || q || D_MESG || C || msg)
+	ld	hl, (ix + ._ctx)
 	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
+	call	hash_sha256_init
+	pop	de
+	ld	hl, (ix + ._blk)
+	ld	bc, 20
+	call	_sha256_update_nz
+	ld	hl, _lms_d_mesg
+	ld	c, 2
+	call	_sha256_update_nz
+	ld	hl, (ix + 15)
+	ld	c, 8
 	add	hl, bc
-	ld	hl, (hl)
-	push	hl
-	call	hmac_final
-	pop	hl
-	pop	hl
-	ld	de, -626
-	lea	hl, ix + 0
-	add	hl, de
-	ld	iy, (hl)
-	push	ix
-	ld	de, -641
-	add	ix, de
-	ld	bc, (ix + 0)
-	pop	ix
-	ld	(ix + -3), bc
-	push	ix
-	ld	bc, -635
-	add	ix, bc
-	ld	de, (ix + 0)
-	pop	ix
-	ld	bc, (ix + -3)
-.lbl_14:
+	ld	c, 32
+	call	_sha256_update_nz
+	ld	hl, (ix + 6)
+	ld	bc, (ix + 9)
+	call	_sha256_update_nz
+	pea	ix + ._q
 	push	de
-	pop	hl
+	call	hash_sha256_final
+	pop	hl, hl
+
+	; Q || Cksm(Q), the checksum is sum(2^w - 1 - digit) << ls over the 256 / w digits of Q
+	lea	hl, ix + ._q
+	ld	(ix + ._rd), hl
+	ld	(ix + ._left), 0
+	ld	hl, 256
+	ld	bc, 0
+	ld	c, (ix + ._w)
+	call	ti._idivu
+	ld	(ix + ._i), hl
+	or	a, a
+	sbc	hl, hl
+	ld	(ix + ._y), hl
+.cksm:
+	call	.digit
+	ld	b, a
+	ld	a, (ix + ._max)
+	sub	a, b
+	ld	hl, (ix + ._y)
+	ld	bc, 0
+	ld	c, a
+	add	hl, bc
+	ld	(ix + ._y), hl
+	ld	hl, (ix + ._i)
+	dec	hl
+	ld	(ix + ._i), hl
 	add	hl, bc
 	or	a, a
 	sbc	hl, bc
-	jq	z, .lbl_15
-	push	bc
-	pop	hl
-	ld	a, (hl)
-	xor	a, (iy)
-	ld	(hl), a
-	dec	de
-	inc	hl
+	jq	nz, .cksm
+	ld	hl, (ix + ._y)
+	ld	a, (ix + ._ls)
+	or	a, a
+	jq	z, .cksm_store
+	ld	b, a
+.cksm_shift:
+	add	hl, hl
+	djnz	.cksm_shift
+.cksm_store:
+	ld	(ix + ._q + 32), h
+	ld	(ix + ._q + 33), l
+
+	; Kc = H(I || q || D_PBLC || z[0] || ... || z[p-1])
+	ld	hl, (ix + ._ctx)
 	push	hl
-	pop	bc
-	inc	iy
-	jq	.lbl_14
-.lbl_15:
-	ld	bc, -654
-	lea	hl, ix + 0
+	call	hash_sha256_init
+	pop	de
+	ld	hl, (ix + ._blk)
+	ld	bc, 20
+	call	_sha256_update_nz
+	ld	hl, _lms_d_pblc
+	ld	c, 2
+	call	_sha256_update_nz
+	lea	hl, ix + ._q
+	ld	(ix + ._rd), hl
+	ld	(ix + ._left), 0
+	ld	hl, (ix + 15)
+	ld	bc, 4 + 4 + 32
 	add	hl, bc
-	ld	iy, (hl)
-	inc	iy
-	ld	de, 242
-	jq	.lbl_9
-.lbl_10:
-	ld	de, -651
-	lea	hl, ix + 0
-	add	hl, de
-	ld	bc, (hl)
-	push	bc
-	pop	hl
-	ld	(ix + -3), bc
-	ld	bc, -635
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
+	ld	(ix + ._y), hl
 	or	a, a
-	sbc	hl, de
-	ld	bc, (ix + -3)
-	jq	c, .lbl_12
+	sbc	hl, hl
+	ld	(ix + ._i), hl
+.chain:
+	; z[i] = y[i] hashed from step Q digit i up to 2^w - 2
+	ld	iy, (ix + ._blk)
+	ld	a, (ix + ._i + 1)
+	ld	(iy + 20), a
+	ld	a, (ix + ._i + 0)
+	ld	(iy + 21), a
+	ld	hl, (ix + ._y)
+	lea	de, iy + 23
+	ld	bc, 32
+	ldir
+	ld	(ix + ._y), hl
+	call	.digit
+	ld	(iy + 22), a
+.step:
+	ld	a, (iy + 22)
+	cp	a, (ix + ._max)
+	jq	z, .link
+	lea	de, iy + offset_state
+	ld	hl, _sha256_state_init
+	ld	bc, 8*4
+	ldir
+	push	iy
+	call	_sha256_transform
+	pop	iy
+	lea	hl, iy + 23
+	lea	iy, iy + offset_state
+	ld	b, 8
+	call	_sha256_reverse_endianness
+	ld	iy, (ix + ._blk)
+	inc	(iy + 22)
+	jq	.step
+.link:
+	lea	hl, iy + 23
+	ld	bc, 32
+	ld	de, (ix + ._ctx)
+	call	_sha256_update_nz
+	ld	hl, (ix + ._i)
+	inc	hl
+	ld	(ix + ._i), hl
+	ld	bc, (ix + ._cnt)
+	or	a, a
+	sbc	hl, bc
+	jq	nz, .chain
+	ld	iy, (ix + ._nb)
+	pea	iy + 22
 	push	de
-	pop	bc
-.lbl_12:
-	ld	(ix + -3), bc
-	ld	bc, -632
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	de, (hl)
+	call	hash_sha256_final
+	pop	hl, hl
+
+	; leaf = H(I || u32 (2^h + q) || D_LEAF || Kc)
 	ld	hl, (ix + 12)
-	add	hl, de
-	ld	bc, (ix + -3)
-	push	bc
-	ld	bc, -641
-	lea	iy, ix + 0
-	add	iy, bc
-	ld	de, (iy + 0)
-	push	de
-	push	hl
-	call	ti._memcpy
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	hl, 242
-	push	hl
-	ld	bc, -644
-	lea	hl, ix + 0
+	ld	bc, 8
 	add	hl, bc
-	ld	hl, (hl)
+	ld	de, (ix + ._nb)
+	ld	c, 16
+	ldir
+	ld	hl, (ix + 15)
+	ld	c, 4
+	ldir
+	ld	a, (ix + ._h)
+	ld	c, a
+	srl	a
+	srl	a
+	srl	a
+	ld	hl, (ix + ._nb)
+	ld	de, 19
+	add	hl, de
+	ld	e, a
+	or	a, a
+	sbc	hl, de
+	ld	a, c
+	and	a, 7
+	ld	b, a
+	ld	a, 1
+	jq	z, .leaf_bit
+.leaf_shift:
+	add	a, a
+	djnz	.leaf_shift
+.leaf_bit:
+	or	a, (hl)
+	ld	(hl), a
+	ld	iy, (ix + ._nb)
+	ld	(iy + 20), $82
+	ld	(iy + 21), $82
+	ld	bc, 16 + 4 + 2 + 32
+	call	.hash
+
+	; up the tree: H(I || u32 (node / 2) || D_INTR || left || right)
+.climb:
+	ld	iy, (ix + ._nb)
+	ld	a, (iy + 16)
+	or	a, (iy + 17)
+	or	a, (iy + 18)
+	jq	nz, .up
+	ld	a, (iy + 19)
+	cp	a, 2
+	jq	c, .root
+.up:
+	ld	hl, (ix + ._path)
+	lea	de, iy + 22
+	bit	0, (iy + 19)
+	jq	nz, .sibling
+	lea	de, iy + 54
+.sibling:
+	ld	bc, 32
+	ldir
+	ld	(ix + ._path), hl
+	lea	de, iy + 54
+	bit	0, (iy + 19)
+	jq	nz, .child
+	lea	de, iy + 22
+.child:
+	lea	hl, ix + ._q
+	ld	c, 32
+	ldir
+	srl	(iy + 16)
+	rr	(iy + 17)
+	rr	(iy + 18)
+	rr	(iy + 19)
+	ld	(iy + 20), $83
+	ld	(iy + 21), $83
+	ld	bc, 16 + 4 + 2 + 64
+	call	.hash
+	jq	.climb
+.root:
+	ld	hl, 32
 	push	hl
-	ld	bc, -629
-	lea	hl, ix + 0
+	ld	hl, (ix + 12)
+	ld	bc, 24
 	add	hl, bc
-	ld	hl, (hl)
 	push	hl
-	call	ti._memcpy
-	ld	bc, -632
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	iy, (hl)
-	pop	hl
-	pop	hl
-	pop	hl
-	ld	bc, -635
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	de, (hl)
-	add	iy, de
-	push	ix
-	ld	bc, -647
-	add	ix, bc
-	ld	hl, (ix + 0)
-	pop	ix
-	push	ix
-	dec	bc
-	add	ix, bc
-	ld	e, (ix + 0)
-	pop	ix
-	ld	bc, 1
+	pea	ix + ._q
+	call	digest_compare
+	jq	.exit
+.fail:
 	xor	a, a
-	call	ti._ladd
-	push	hl
-	pop	bc
-	ld	a, e
-	ld	de, (ix + 15)
-	jq	.lbl_7
-.lbl_23:
-.lbl_17:
-	ld	bc, -623
-	lea	hl, ix + 0
-	add	hl, bc
-	ld	a, (hl)
+.exit:
 	ld	sp, ix
 	pop	ix
-    restore_interrupts hmac_pbkdf2
 	ret
- 
+
+; ._q = H(node buffer), bc = length
+.hash:
+	push	bc
+	ld	hl, (ix + ._ctx)
+	push	hl
+	call	hash_sha256_init
+	pop	de, bc
+	ld	hl, (ix + ._nb)
+	call	_sha256_update_nz
+	pea	ix + ._q
+	push	de
+	call	hash_sha256_final
+	pop	hl, hl
+	ret
+
+; next w-bit digit of Q || Cksm(Q), most significant first
+; returns a = digit
+; destroys: bc, hl
+.digit:
+	ld	a, (ix + ._left)
+	or	a, a
+	jq	nz, .digit_have
+	ld	hl, (ix + ._rd)
+	ld	a, (hl)
+	inc	hl
+	ld	(ix + ._rd), hl
+	ld	(ix + ._cur), a
+	ld	a, 8
+.digit_have:
+	sub	a, (ix + ._w)
+	ld	(ix + ._left), a
+	ld	b, (ix + ._w)
+	ld	c, (ix + ._cur)
+	xor	a, a
+.digit_bits:
+	sla	c
+	rla
+	djnz	.digit_bits
+	ld	(ix + ._cur), c
+	ret
+
+; z if the 4 bytes at hl and de match
+; destroys: af, b, de, hl
+.eq4:
+	ld	b, 4
+.eq4_loop:
+	ld	a, (de)
+	cp	a, (hl)
+	ret	nz
+	inc	hl
+	inc	de
+	djnz	.eq4_loop
+	ret
+
 
 digest_tostring:
 	save_interrupts
@@ -8121,7 +17172,57 @@ digest_tostring:
 	ret
  
  _hexc:     db	"0123456789ABCDEF"
- _hash_out_lens:    db 32
+ _hash_out_lens:    db 32, 20, 32
+
+_otp_pow10:
+	dd	1
+	dd	10
+	dd	100
+	dd	1000
+	dd	10000
+	dd	100000
+	dd	1000000
+	dd	10000000
+	dd	100000000
+	dd	1000000000
+
+_ascon_rc:
+	db	$F0, $E1, $D2, $C3, $B4, $A5, $96, $87, $78, $69, $5A, $4B
+
+_ascon_aead_iv:
+	db	$01, $00, $8C, $80, $00, $10, $00, $00
+
+_ascon_hash_iv:
+	db	$81, $D6, $34, $E9, $94, $54, $1E, $9B
+	db	$D2, $51, $37, $33, $1E, $A0, $C3, $4B
+	db	$1A, $B8, $34, $6B, $6C, $39, $65, $AE
+	db	$B3, $4D, $6A, $D5, $A4, $D4, $7F, $3C
+	db	$6D, $97, $C5, $06, $49, $46, $5C, $1A
+
+_siphash_iv:
+	db	"uespemos"
+	db	"modnarod"
+	db	"arenegyl"
+	db	"setybdet"
+
+_container_magic:
+	db	"HLCF"
+
+_lmots_params:
+	; w, ls, p for LMOTS_SHA256_N32_W1 .. W8
+	db	1, 7
+	dw	265
+	db	2, 6
+	dw	133
+	db	4, 4
+	dw	67
+	db	8, 0
+	dw	34
+
+_lms_d_mesg:
+	db	$81, $81
+_lms_d_pblc:
+	db	$80, $80
 
 _sprng_read_addr:        rb 3
 _sprng_entropy_pool.size = 119
@@ -8134,8 +17235,19 @@ virtual at $E30800
 end virtual
 _sha256_m_buffer    :=  _sprng_sha_mbuffer
 
+; build with -i 'HASHLIB_AES_TABLES := <address>' to leave the AES tables out of the library
+; and have aes_init() generate them at that address instead. They take 512 bytes
+if defined HASHLIB_AES_TABLES
+virtual at HASHLIB_AES_TABLES
+    _aes_sbox               rb 256
+    _aes_invsbox            rb 256
+end virtual
+_aes_tables_ready:      db 0
+end if
+
 
 
+if ~ defined HASHLIB_AES_TABLES
  _aes_sbox:
 	db	"c|w{",362o,"ko",305o,"0",001o,"g+",376o,327o,253o,"v"
 	db	"",312o,202o,311o,"}",372o,"YG",360o,255o,324o,242o,257o,234o,244o,"r",300o
@@ -8153,6 +17265,7 @@ _sha256_m_buffer    :=  _sprng_sha_mbuffer
 	db	"p>",265o,"fH",003o,366o,016o,"a5W",271o,206o,301o,035o,236o
 	db	"",341o,370o,230o,021o,"i",331o,216o,224o,233o,036o,207o,351o,316o,"U(",337o
 	db	"",214o,241o,211o,015o,277o,346o,"BhA",231o,"-",017o,260o,"T",273o,026o
+end if
  
  L___const.hashlib_AESLoadKey.Rcon:
 	dd	16777216
@@ -8171,6 +17284,7 @@ _sha256_m_buffer    :=  _sprng_sha_mbuffer
 	dd	1291845632
 	dd	2583691264
  
+if ~ defined HASHLIB_AES_TABLES
  _aes_invsbox:
 	db	"R",011o,"j",325o,"06",245o,"8",277o,"@",243o,236o,201o,363o,327o,373o
 	db	"|",343o,"9",202o,233o,"/",377o,207o,"4",216o,"CD",304o,336o,351o,313o
@@ -8188,269 +17302,19 @@ _sha256_m_buffer    :=  _sprng_sha_mbuffer
 	db	"`Q",177o,251o,031o,265o,"J",015o,"-",345o,"z",237o,223o,311o,234o,357o
 	db	"",240o,340o,";M",256o,"*",365o,260o,310o,353o,273o,"<",203o,"S",231o,"a"
 	db	"",027o,"+",004o,"~",272o,"w",326o,"&",341o,"i",024o,"cU!",014o,"}"
- 
- _gf_mul:
-	db	6 dup 0
-	db	"",002o,003o,011o,013o,015o,016o
-	db	"",004o,006o,022o,026o,032o,034o
-	db	"",006o,005o,033o,035o,027o,022o
-	db	"",010o,014o,"$,48"
-	db	"",012o,017o,"-'96"
-	db	"",014o,012o,"6:.$"
-	db	"",016o,011o,"?1#*"
-	db	"",020o,030o,"HXhp"
-	db	"",022o,033o,"ASe~"
-	db	"",024o,036o,"ZNrl"
-	db	"",026o,035o,"SE",177o,"b"
-	db	"",030o,024o,"lt\H"
-	db	"",032o,027o,"e",177o,"QF"
-	db	"",034o,022o,"~bFT"
-	db	"",036o,021o,"wiKZ"
-	db	" 0",220o,260o,320o,340o
-	db	"""3",231o,273o,335o,356o
-	db	"$6",202o,246o,312o,374o
-	db	"&5",213o,255o,307o,362o
-	db	"(<",264o,234o,344o,330o
-	db	"*?",275o,227o,351o,326o
-	db	",:",246o,212o,376o,304o
-	db	".9",257o,201o,363o,312o
-	db	"0(",330o,350o,270o,220o
-	db	"2+",321o,343o,265o,236o
-	db	"4.",312o,376o,242o,214o
-	db	"6-",303o,365o,257o,202o
-	db	"8$",374o,304o,214o,250o
-	db	":'",365o,317o,201o,246o
-	db	"<""",356o,322o,226o,264o
-	db	">!",347o,331o,233o,272o
-	db	"@`;{",273o,333o
-	db	"Bc2p",266o,325o
-	db	"Df)m",241o,307o
-	db	"Fe f",254o,311o
-	db	"Hl",037o,"W",217o,343o
-	db	"Jo",026o,"\",202o,355o
-	db	"Lj",015o,"A",225o,377o
-	db	"Ni",004o,"J",230o,361o
-	db	"Pxs#",323o,253o
-	db	"R{z(",336o,245o
-	db	"T~a5",311o,267o
-	db	"V}h>",304o,271o
-	db	"XtW",017o,347o,223o
-	db	"Zw^",004o,352o,235o
-	db	"\rE",031o,375o,217o
-	db	"^qL",022o,360o,201o
-	db	"`P",253o,313o,"k;"
-	db	"bS",242o,300o,"f5"
-	db	"dV",271o,335o,"q'"
-	db	"fU",260o,326o,"|)"
-	db	"h\",217o,347o,"_",003o
-	db	"j_",206o,354o,"R",015o
-	db	"lZ",235o,361o,"E",037o
-	db	"nY",224o,372o,"H",021o
-	db	"pH",343o,223o,003o,"K"
-	db	"rK",352o,230o,016o,"E"
-	db	"tN",361o,205o,031o,"W"
-	db	"vM",370o,216o,024o,"Y"
-	db	"xD",307o,277o,"7s"
-	db	"zG",316o,264o,":}"
-	db	"|B",325o,251o,"-o"
-	db	"~A",334o,242o," a"
-	db	"",200o,300o,"v",366o,"m",255o
-	db	"",202o,303o,177o,375o,"`",243o
-	db	"",204o,306o,"d",340o,"w",261o
-	db	"",206o,305o,"m",353o,"z",277o
-	db	"",210o,314o,"R",332o,"Y",225o
-	db	"",212o,317o,"[",321o,"T",233o
-	db	"",214o,312o,"@",314o,"C",211o
-	db	"",216o,311o,"I",307o,"N",207o
-	db	"",220o,330o,">",256o,005o,335o
-	db	"",222o,333o,"7",245o,010o,323o
-	db	"",224o,336o,",",270o,037o,301o
-	db	"",226o,335o,"%",263o,022o,317o
-	db	"",230o,324o,032o,202o,"1",345o
-	db	"",232o,327o,023o,211o,"<",353o
-	db	"",234o,322o,010o,224o,"+",371o
-	db	"",236o,321o,001o,237o,"&",367o
-	db	"",240o,360o,346o,"F",275o,"M"
-	db	"",242o,363o,357o,"M",260o,"C"
-	db	"",244o,366o,364o,"P",247o,"Q"
-	db	"",246o,365o,375o,"[",252o,"_"
-	db	"",250o,374o,302o,"j",211o,"u"
-	db	"",252o,377o,313o,"a",204o,"{"
-	db	"",254o,372o,320o,"|",223o,"i"
-	db	"",256o,371o,331o,"w",236o,"g"
-	db	"",260o,350o,256o,036o,325o,"="
-	db	"",262o,353o,247o,025o,330o,"3"
-	db	"",264o,356o,274o,010o,317o,"!"
-	db	"",266o,355o,265o,003o,302o,"/"
-	db	"",270o,344o,212o,"2",341o,005o
-	db	"",272o,347o,203o,"9",354o,013o
-	db	"",274o,342o,230o,"$",373o,031o
-	db	"",276o,341o,221o,"/",366o,027o
-	db	"",300o,240o,"M",215o,326o,"v"
-	db	"",302o,243o,"D",206o,333o,"x"
-	db	"",304o,246o,"_",233o,314o,"j"
-	db	"",306o,245o,"V",220o,301o,"d"
-	db	"",310o,254o,"i",241o,342o,"N"
-	db	"",312o,257o,"`",252o,357o,"@"
-	db	"",314o,252o,"{",267o,370o,"R"
-	db	"",316o,251o,"r",274o,365o,"\"
-	db	"",320o,270o,005o,325o,276o,006o
-	db	"",322o,273o,014o,336o,263o,010o
-	db	"",324o,276o,027o,303o,244o,032o
-	db	"",326o,275o,036o,310o,251o,024o
-	db	"",330o,264o,"!",371o,212o,">"
-	db	"",332o,267o,"(",362o,207o,"0"
-	db	"",334o,262o,"3",357o,220o,""""
-	db	"",336o,261o,":",344o,235o,","
-	db	"",340o,220o,335o,"=",006o,226o
-	db	"",342o,223o,324o,"6",013o,230o
-	db	"",344o,226o,317o,"+",034o,212o
-	db	"",346o,225o,306o," ",021o,204o
-	db	"",350o,234o,371o,021o,"2",256o
-	db	"",352o,237o,360o,032o,"?",240o
-	db	"",354o,232o,353o,007o,"(",262o
-	db	"",356o,231o,342o,014o,"%",274o
-	db	"",360o,210o,225o,"en",346o
-	db	"",362o,213o,234o,"nc",350o
-	db	"",364o,216o,207o,"st",372o
-	db	"",366o,215o,216o,"xy",364o
-	db	"",370o,204o,261o,"IZ",336o
-	db	"",372o,207o,270o,"BW",320o
-	db	"",374o,202o,243o,"_@",302o
-	db	"",376o,201o,252o,"TM",314o
-	db	"",033o,233o,354o,367o,332o,"A"
-	db	"",031o,230o,345o,374o,327o,"O"
-	db	"",037o,235o,376o,341o,300o,"]"
-	db	"",035o,236o,367o,352o,315o,"S"
-	db	"",023o,227o,310o,333o,356o,"y"
-	db	"",021o,224o,301o,320o,343o,"w"
-	db	"",027o,221o,332o,315o,364o,"e"
-	db	"",025o,222o,323o,306o,371o,"k"
-	db	"",013o,203o,244o,257o,262o,"1"
-	db	"",011o,200o,255o,244o,277o,"?"
-	db	"",017o,205o,266o,271o,250o,"-"
-	db	"",015o,206o,277o,262o,245o,"#"
-	db	"",003o,217o,200o,203o,206o,011o
-	db	"",001o,214o,211o,210o,213o,007o
-	db	"",007o,211o,222o,225o,234o,025o
-	db	"",005o,212o,233o,236o,221o,033o
-	db	";",253o,"|G",012o,241o
-	db	"9",250o,"uL",007o,257o
-	db	"?",255o,"nQ",020o,275o
-	db	"=",256o,"gZ",035o,263o
-	db	"3",247o,"Xk>",231o
-	db	"1",244o,"Q`3",227o
-	db	"7",241o,"J}$",205o
-	db	"5",242o,"Cv)",213o
-	db	"+",263o,"4",037o,"b",321o
-	db	")",260o,"=",024o,"o",337o
-	db	"/",265o,"&",011o,"x",315o
-	db	"-",266o,"/",002o,"u",303o
-	db	"#",277o,020o,"3V",351o
-	db	"!",274o,031o,"8[",347o
-	db	"'",271o,002o,"%L",365o
-	db	"%",272o,013o,".A",373o
-	db	"[",373o,327o,214o,"a",232o
-	db	"Y",370o,336o,207o,"l",224o
-	db	"_",375o,305o,232o,"{",206o
-	db	"]",376o,314o,221o,"v",210o
-	db	"S",367o,363o,240o,"U",242o
-	db	"Q",364o,372o,253o,"X",254o
-	db	"W",361o,341o,266o,"O",276o
-	db	"U",362o,350o,275o,"B",260o
-	db	"K",343o,237o,324o,011o,352o
-	db	"I",340o,226o,337o,004o,344o
-	db	"O",345o,215o,302o,023o,366o
-	db	"M",346o,204o,311o,036o,370o
-	db	"C",357o,273o,370o,"=",322o
-	db	"A",354o,262o,363o,"0",334o
-	db	"G",351o,251o,356o,"'",316o
-	db	"E",352o,240o,345o,"*",300o
-	db	"{",313o,"G<",261o,"z"
-	db	"y",310o,"N7",274o,"t"
-	db	"",177o,315o,"U*",253o,"f"
-	db	"}",316o,"\!",246o,"h"
-	db	"s",307o,"c",020o,205o,"B"
-	db	"q",304o,"j",033o,210o,"L"
-	db	"w",301o,"q",006o,237o,"^"
-	db	"u",302o,"x",015o,222o,"P"
-	db	"k",323o,017o,"d",331o,012o
-	db	"i",320o,006o,"o",324o,004o
-	db	"o",325o,035o,"r",303o,026o
-	db	"m",326o,024o,"y",316o,030o
-	db	"c",337o,"+H",355o,"2"
-	db	"a",334o,"""C",340o,"<"
-	db	"g",331o,"9^",367o,"."
-	db	"e",332o,"0U",372o," "
-	db	"",233o,"[",232o,001o,267o,354o
-	db	"",231o,"X",223o,012o,272o,342o
-	db	"",237o,"]",210o,027o,255o,360o
-	db	"",235o,"^",201o,034o,240o,376o
-	db	"",223o,"W",276o,"-",203o,324o
-	db	"",221o,"T",267o,"&",216o,332o
-	db	"",227o,"Q",254o,";",231o,310o
-	db	"",225o,"R",245o,"0",224o,306o
-	db	"",213o,"C",322o,"Y",337o,234o
-	db	"",211o,"@",333o,"R",322o,222o
-	db	"",217o,"E",300o,"O",305o,200o
-	db	"",215o,"F",311o,"D",310o,216o
-	db	"",203o,"O",366o,"u",353o,244o
-	db	"",201o,"L",377o,"~",346o,252o
-	db	"",207o,"I",344o,"c",361o,270o
-	db	"",205o,"J",355o,"h",374o,266o
-	db	"",273o,"k",012o,261o,"g",014o
-	db	"",271o,"h",003o,272o,"j",002o
-	db	"",277o,"m",030o,247o,"}",020o
-	db	"",275o,"n",021o,254o,"p",036o
-	db	"",263o,"g.",235o,"S4"
-	db	"",261o,"d'",226o,"^:"
-	db	"",267o,"a<",213o,"I("
-	db	"",265o,"b5",200o,"D&"
-	db	"",253o,"sB",351o,017o,"|"
-	db	"",251o,"pK",342o,002o,"r"
-	db	"",257o,"uP",377o,025o,"`"
-	db	"",255o,"vY",364o,030o,"n"
-	db	"",243o,177o,"f",305o,";D"
-	db	"",241o,"|o",316o,"6J"
-	db	"",247o,"yt",323o,"!X"
-	db	"",245o,"z}",330o,",V"
-	db	"",333o,";",241o,"z",014o,"7"
-	db	"",331o,"8",250o,"q",001o,"9"
-	db	"",337o,"=",263o,"l",026o,"+"
-	db	"",335o,">",272o,"g",033o,"%"
-	db	"",323o,"7",205o,"V8",017o
-	db	"",321o,"4",214o,"]5",001o
-	db	"",327o,"1",227o,"@""",023o
-	db	"",325o,"2",236o,"K/",035o
-	db	"",313o,"#",351o,"""dG"
-	db	"",311o," ",340o,")iI"
-	db	"",317o,"%",373o,"4~["
-	db	"",315o,"&",362o,"?sU"
-	db	"",303o,"/",315o,016o,"P",177o
-	db	"",301o,",",304o,005o,"]q"
-	db	"",307o,")",337o,030o,"Jc"
-	db	"",305o,"*",326o,023o,"Gm"
-	db	"",373o,013o,"1",312o,334o,327o
-	db	"",371o,010o,"8",301o,321o,331o
-	db	"",377o,015o,"#",334o,306o,313o
-	db	"",375o,016o,"*",327o,313o,305o
-	db	"",363o,007o,025o,346o,350o,357o
-	db	"",361o,004o,034o,355o,345o,341o
-	db	"",367o,001o,007o,360o,362o,363o
-	db	"",365o,002o,016o,373o,377o,375o
-	db	"",353o,023o,"y",222o,264o,247o
-	db	"",351o,020o,"p",231o,271o,251o
-	db	"",357o,025o,"k",204o,256o,273o
-	db	"",355o,026o,"b",217o,243o,265o
-	db	"",343o,037o,"]",276o,200o,237o
-	db	"",341o,034o,"T",265o,215o,221o
-	db	"",347o,031o,"O",250o,232o,203o
-	db	"",345o,032o,"F",243o,227o,215o
+end if
  
  _aes_padding:
 	db	128
 	db	14 dup 0
  
+ _sha1_state_init:
+	dd	$67452301
+	dd	$EFCDAB89
+	dd	$98BADCFE
+	dd	$10325476
+	dd	$C3D2E1F0
+
  _sha256_state_init:
 	dl 648807
 	db 106
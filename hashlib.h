@@ -4,10 +4,22 @@
  *
  *	Industry-Standard Cryptography for the TI-84+ CE
  *	- Secure Random Number Generator (SRNG)
- *	- hash_sha256, hash_mgf1
+ *	- hash_sha256, hash_mgf1, hash_pow_search
  *  - hmac_sha256, hmac_pbkdf2
- *	- cipher_aes
+ *	- hash_sha1, hmac_sha1, and hotp/totp one-time passwords
+ *  - poly1305 and siphash-2-4 (through the hmac functions)
+ *	- cipher_aes, and aes-siv deterministic encryption
+ *	- ascon-aead128 and ascon-hash256
  *	- cipher_rsa
+ *	- lms/hss (hash-based signature verification)
+ *	- srp (SRP-6a password authentication)
+ *	- record layer (AES-CTR + HMAC-SHA256 with replay protection)
+ *	- lzss compression, whole-buffer or streamed, and compressed records
+ *	- an encrypted, chunked container format for appvars
+ *	- merkle trees (SHA-256)
+ *	- content-defined chunking and a chunk index for deduplication
+ *	- a SipHash-keyed hash map
+ *	- rsync-style signatures and deltas
  *  - secure buffer comparison
  *
  *	@author Anthony @e ACagliano Cagliano
@@ -88,6 +100,7 @@ The SRNG previded by HASHLIB solves both tests like so:
  * The SRNG is initialized by polling the 512-bytes from address 0xD65800 to 0xD66000.
  * This region consists of unmapped memory that contains bus noise.
  * Each bit in that region is polled 1024 times and the address with the bit that is the least biased is selected.
+ * The scan ends early if a bit is set in exactly 512 of the 1024 polls, since no other byte can do better.
  * That will be the byte the SRNG uses to generate entropy.
  * @return boolean: True if a sufficient entropy source was identified. False otherwise.
  * @note Catch and respond to a @b False return from this function. Do not proceed with generating nonces
@@ -96,6 +109,28 @@ The SRNG previded by HASHLIB solves both tests like so:
  ***************************************************************************************************************************/
 bool csrand_init(void);
 
+/// Suggested target for csrand_init_adaptive(): two standard deviations of a fair bit over 1024 polls.
+#define CSRAND_TARGET_DEFAULT   32
+
+/****************************************************************************************************************************
+ * @brief Initializes the crypto-safe random number generator, stopping as soon as a good byte is found.
+ *
+ * Performs the same selection as csrand_init(), with two shortcuts.
+ * First, each byte is read 32 times before it is fully tested. If the byte reads the same value all 32 times,
+ * it is skipped without being polled 1024 times. This screening only rejects bytes that look constant;
+ * it does not measure bias, which is still left to the full test.
+ * Second, the scan stops at the first byte whose least biased bit is within @b target of 512 set polls out of 1024,
+ * instead of testing the rest of the region.
+ * A byte is still only accepted if it meets the same bias bound as csrand_init().
+ * @param target The deviation from 512 at which a byte is accepted and the scan ends.
+ *      With 0, the scan still ends early, at the first byte with a bit set exactly 512 times,
+ *      since no other byte can beat it. csrand_init() does the same. Otherwise the whole region is scanned.
+ * @return boolean: True if a sufficient entropy source was identified. False otherwise.
+ * @note A bit fair enough to be selected by csrand_init() stays constant over 32 reads with probability below 1 in 10000,
+ *      so the screening pass almost never discards a usable byte.
+ ***************************************************************************************************************************/
+bool csrand_init_adaptive(size_t target);
+
 /***************************************************************************************************************************
  * @brief Generates a random 32-bit number.
  *
@@ -141,6 +176,30 @@ typedef struct _sha256_ctx {
 	uint32_t state[8];		/**< holds hash state for transformed data */
 } sha256_ctx;
 
+/*******************************************************************************************************************
+ * @typedef sha1_ctx
+ * Defines hash-state data for an instance of SHA-1.
+ * @note This is internal to the struct hash_ctx. You should never need to use this.
+ ********************************************************************************************************************/
+typedef struct _sha1_ctx {
+	uint8_t data[64];		/**< holds sha-1 block for transformation */
+	uint8_t datalen;		/**< holds the current length of data in data[64] */
+	uint8_t bitlen[8];		/**< holds the current length of transformed data */
+	uint32_t state[5];		/**< holds hash state for transformed data */
+} sha1_ctx;
+
+/*******************************************************************************************************************
+ * @typedef ascon_hash_ctx
+ * Defines hash-state data for an instance of Ascon-Hash256.
+ * @note This is internal to the struct hash_ctx. You should never need to use this.
+ ********************************************************************************************************************/
+typedef struct _ascon_hash_ctx {
+	uint8_t state[40];		/**< holds the five 64-bit lanes of the Ascon state */
+	uint8_t pos;			/**< holds the number of bytes absorbed into the current block */
+	uint8_t rate;			/**< holds the block size, in bytes */
+	uint8_t rounds;			/**< holds the number of permutation rounds per block */
+} ascon_hash_ctx;
+
 /****************************************************************************************************************
  * @typedef hash_ctx
  * Defines universal hash-state data, including pointer to algorithm-specific handling methods and
@@ -153,6 +212,8 @@ typedef struct _hash_ctx {
     void (*final)(void* ctx, void* output);                      /**< pointer to the digest output method for the given hash algorithm */
     union _hash {           /**< a union of computational states for various hashes */
         sha256_ctx sha256;
+        sha1_ctx sha1;
+        ascon_hash_ctx ascon;
     } Hash;
 } hash_ctx;
  
@@ -163,6 +224,10 @@ typedef struct _hash_ctx {
   ***************************************************/
 enum hash_algorithms {
     SHA256,             /**< algorithm type identifier for SHA-256 */
+    SHA1,               /**< algorithm type identifier for SHA-1. Only use it where a protocol requires it, such as HOTP/TOTP */
+    ASCON_HASH256,      /**< algorithm type identifier for Ascon-Hash256 (NIST SP 800-232). Not available for HMAC */
+    POLY1305,           /**< algorithm type identifier for the Poly1305 one-time MAC (RFC 8439). Only available for hmac_init() */
+    SIPHASH24,          /**< algorithm type identifier for the SipHash-2-4 keyed PRF. Only available for hmac_init() */
 };
 
 /******************************************************
@@ -171,6 +236,42 @@ enum hash_algorithms {
  * ****************************************************/
 #define SHA256_DIGEST_LEN   32
 
+/******************************************************
+ * @def SHA1_DIGEST_LEN
+ * Binary length of the SHA-1 hash output.
+ * ****************************************************/
+#define SHA1_DIGEST_LEN     20
+
+/******************************************************
+ * @def ASCON_HASH256_DIGEST_LEN
+ * Binary length of the Ascon-Hash256 hash output.
+ * ****************************************************/
+#define ASCON_HASH256_DIGEST_LEN    32
+
+/******************************************************
+ * @def POLY1305_DIGEST_LEN
+ * Binary length of the Poly1305 tag.
+ * ****************************************************/
+#define POLY1305_DIGEST_LEN     16
+
+/******************************************************
+ * @def POLY1305_KEY_LEN
+ * Binary length of a Poly1305 key.
+ * ****************************************************/
+#define POLY1305_KEY_LEN        32
+
+/******************************************************
+ * @def SIPHASH24_DIGEST_LEN
+ * Binary length of the SipHash-2-4 output.
+ * ****************************************************/
+#define SIPHASH24_DIGEST_LEN    8
+
+/******************************************************
+ * @def SIPHASH24_KEY_LEN
+ * Binary length of a SipHash-2-4 key.
+ * ****************************************************/
+#define SIPHASH24_KEY_LEN       16
+
 /*********************************************************************************************************************
  *	@brief Generic hash initializer.
  *	Initializes the given context with the starting state for the given hash algorithm and
@@ -192,6 +293,27 @@ bool hash_init(hash_ctx* ctx, uint8_t hash_alg);
  ******************************************************************************************************/
 void hash_update(hash_ctx* ctx, const void* data, size_t len);
 
+/******************************************************************************************************
+ * @typedef hash_iovec
+ * Describes one segment of a message split across several buffers.
+ * see hash_updatev() and hmac_updatev()
+ ******************************************************************************************************/
+typedef struct _hash_iovec {
+    const void* data;       /**< pointer to the segment */
+    size_t len;             /**< length of the segment, in bytes. May be 0 */
+} hash_iovec;
+
+/******************************************************************************************************
+ *	@brief Updates the hash context for several segments of data in one call.
+ *	@param ctx Pointer to a hash context.
+ *	@param iov Pointer to an array of segments to hash, in order.
+ *	@param count Number of segments at @b iov.
+ *  @note The result is the same as calling hash_update() once per segment, but SHA-256
+ *      processes all of them under a single call, with no per-segment setup.
+ *	@warning You must have an initialized hash context or a crash will ensue.
+ ******************************************************************************************************/
+void hash_updatev(hash_ctx* ctx, const hash_iovec* iov, size_t count);
+
 /**********************************************************************************************
  *	@brief Finalize context and render digest for hash
  *	@param ctx Pointer to a hash context.
@@ -217,6 +339,24 @@ void hash_final(hash_ctx* ctx, void* digest);
  **********************************************************************************************************************/
 bool hash_mgf1(const void* data, size_t datalen, void* outbuf, size_t outlen, uint8_t hash_alg);
 
+/**********************************************************************************************************************
+ *	@brief Proof-of-Work Nonce Search
+ *
+ *	Finds a nonce such that SHA-256(prefix || nonce) starts with @b difficulty zero bits.
+ *	The nonce is 4 bytes, little endian.
+ *
+ *	@param prefix Pointer to the data to prove work for.
+ *	@param len Number of bytes at @b prefix.
+ *	@param difficulty The number of leading zero bits required.
+ *	@param nonce Pointer to a 4-byte nonce. The search starts from its value, and the nonce found is written back.
+ *	@return True if a nonce was found. False if every nonce from the starting value up was tried.
+ *  @note The whole blocks of @b prefix are compressed once, and the nonce is incremented in place
+ *      in the final block, so each try costs one or two SHA-256 compressions no matter how long the prefix is.
+ *  @note 2^difficulty tries are needed on average. Candidates are rejected on the first digest word
+ *      whenever possible, without producing the rest of the digest.
+ **********************************************************************************************************************/
+bool hash_pow_search(const void* prefix, size_t len, uint8_t difficulty, uint32_t* nonce);
+
 
 /*
 Hash-Based Message Authentication Code (HMAC)
@@ -224,6 +364,14 @@ Hash-Based Message Authentication Code (HMAC)
 HMAC generates a more secure hash by using a key known only to authorized
 parties as part of the hash initialization. Thus, while normal hashes can be
 verified by anyone, only the parties with the key can validate using a HMAC hash.
+
+The same functions also run two MACs that are not built on a hash, and that cost far less
+than the four SHA-256 compressions HMAC needs for even a short message:
+- POLY1305 is a one-time authenticator. Its 32-byte key must never be used for a second message,
+  so derive a fresh one per message, for example from a stream cipher keyed with a session key.
+- SIPHASH24 is a keyed pseudorandom function with an 8-byte output, meant for hash table keys
+  and short tags. Its 16-byte key can be reused.
+Switching between them and HMAC only takes a different @b hash_alg in hmac_init().
 */
 
 /*******************************************************************************************************************
@@ -240,6 +388,45 @@ typedef struct _sha256hmac_ctx {
 	uint32_t state[8];		/**< holds hash state for transformed data */
 } sha256hmac_ctx;
 
+/*******************************************************************************************************************
+ * @typedef sha1hmac_ctx
+ * Defines hash-state data for an instance of SHA-1-HMAC.
+ * @note This is internal to the struct hmac_ctx. You should never need to use this.
+ ********************************************************************************************************************/
+typedef struct _sha1hmac_ctx {
+    uint8_t ipad[64];       /**< holds the key xored with a magic value to be hashed with the inner digest */
+    uint8_t opad[64];       /**< holds the key xored with a magic value to be hashed with the outer digest */
+    uint8_t data[64];		/**< holds sha-1 block for transformation */
+	uint8_t datalen;		/**< holds the current length of data in data[64] */
+	uint8_t bitlen[8];		/**< holds the current length of transformed data */
+	uint32_t state[5];		/**< holds hash state for transformed data */
+} sha1hmac_ctx;
+
+/*******************************************************************************************************************
+ * @typedef poly1305_ctx
+ * Defines MAC-state data for an instance of Poly1305.
+ * @note This is internal to the struct hmac_ctx. You should never need to use this.
+ ********************************************************************************************************************/
+typedef struct _poly1305_ctx {
+    uint8_t h[17];          /**< holds the accumulator, partially reduced mod 2^130 - 5 */
+    uint8_t r[16];          /**< holds the clamped multiplier, most significant byte first */
+    uint8_t s[16];          /**< holds the value added to the accumulator for the tag */
+    uint8_t data[16];       /**< holds the block being filled */
+    uint8_t datalen;        /**< holds the current length of data in data[16] */
+} poly1305_ctx;
+
+/*******************************************************************************************************************
+ * @typedef siphash_ctx
+ * Defines MAC-state data for an instance of SipHash-2-4.
+ * @note This is internal to the struct hmac_ctx. You should never need to use this.
+ ********************************************************************************************************************/
+typedef struct _siphash_ctx {
+    uint8_t v[32];          /**< holds the four 64-bit state words */
+    uint8_t data[8];        /**< holds the word being filled */
+    uint8_t datalen;        /**< holds the current length of data in data[8] */
+    uint8_t len;            /**< holds the total length of the message, mod 256 */
+} siphash_ctx;
+
 /*******************************************************************************************************************
  * @typedef hmac_ctx
  * Defines hash-state data for an instance of SHA-256-HMAC.
@@ -251,6 +438,9 @@ typedef struct _hmac_ctx {
     void (*final)(void* ctx, void* output);                      /**< pointer to the digest output method for the given hash algorithm */
     union _hmac {           /**< a union of computational states for various hashes */
         sha256hmac_ctx sha256hmac;
+        sha1hmac_ctx sha1hmac;
+        poly1305_ctx poly1305;
+        siphash_ctx siphash;
     } Hmac;
 } hmac_ctx;
 
@@ -263,7 +453,9 @@ typedef struct _hmac_ctx {
  *	@param key Pointer to an authentication key used to initialize the base hmac context.
  *	@param keylen Length of @b key, in bytes.
  *  @param hash_alg The numeric ID of the hashing algorithm to use. See @b hash_algorithms.
- *  @return Boolean. True if hash initialization succeeded. False if hash ID invalid.
+ *  @return Boolean. True if hash initialization succeeded. False if hash ID invalid, or if @b keylen
+ *      is not @b POLY1305_KEY_LEN for POLY1305 or @b SIPHASH24_KEY_LEN for SIPHASH24.
+ *  @warning A POLY1305 key authenticates one message only. Reusing it lets an attacker forge tags.
  **********************************************************************************************************************/
 bool hmac_init(hmac_ctx* ctx, const void* key, size_t keylen, uint8_t hash_alg);
 
@@ -278,6 +470,17 @@ bool hmac_init(hmac_ctx* ctx, const void* key, size_t keylen, uint8_t hash_alg);
  **************************************************************************************************************/
 void hmac_update(hmac_ctx* ctx, const void* data, size_t len);
 
+/*************************************************************************************************************
+ *	@brief Updates the hmac context for several segments of data in one call.
+ *	@param ctx Pointer to an HMAC context.
+ *	@param iov Pointer to an array of segments to hash, in order. See @b hash_iovec.
+ *	@param count Number of segments at @b iov.
+ *  @note Use this to authenticate a header, payload and trailer kept in separate buffers
+ *      without copying them together first.
+ *	@warning You must have an initialized hash context or a crash will ensue.
+ **************************************************************************************************************/
+void hmac_updatev(hmac_ctx* ctx, const hash_iovec* iov, size_t count);
+
 /*********************************************************************************************
  *	@brief Finalize Context and Render Digest for HMAC
  *	@param ctx Pointer to an HMAC context.
@@ -302,6 +505,7 @@ void hmac_final(hmac_ctx* ctx, void* output);
  * @param saltlen The length of the salt to use (in bytes).
  * @param rounds The number of times to iterate the hash function per block of @b keylen.
  * @param hash_alg The numeric ID of the hashing algorithm to use. See @b hash_algorithms.
+ *      Only SHA256 and SHA1 can be used; POLY1305 and SIPHASH24 return false.
  * @note Standards recommend a salt of at least 128 bits (16 bytes).
  * @note @b rounds is used to increase the cost (computational time) of generating a key. What makes password-
  * hashing algorithms secure is the time needed to generate a rainbow table attack against it. More rounds means
@@ -318,6 +522,70 @@ bool hmac_pbkdf2(
     size_t rounds,
     uint8_t hash_alg);
 
+/*
+One-Time Passwords (HOTP/TOTP)
+
+HOTP (RFC 4226) and TOTP (RFC 6238) generate the short codes used by two-factor
+authenticator apps. Each code is an HMAC-SHA1 of a counter, cut down to a few decimal
+digits. For TOTP the counter is the number of time steps (usually 30 seconds) since
+the Unix epoch, so the calculator and the server agree on it without talking.
+*/
+/*******************************************************************************************************************
+ * @typedef otp_ctx
+ * Stores a keyed HMAC-SHA1 state for generating codes.
+ * @note The context holds the inner and outer hash states after the key pads, not the key itself,
+ *      so each code costs two SHA-1 compressions no matter how long the key is.
+ ********************************************************************************************************************/
+typedef struct _otp_ctx {
+    uint32_t inner[5];      /**< SHA-1 state after the inner key pad */
+    uint32_t outer[5];      /**< SHA-1 state after the outer key pad */
+    uint8_t digits;         /**< number of decimal digits per code */
+} otp_ctx;
+
+/***********************************************************
+ * @def OTP_MAX_DIGITS
+ * The most digits a code can have and still fit a uint32_t.
+ ***********************************************************/
+#define OTP_MAX_DIGITS      9
+
+/**********************************************************************************************************************
+ *	@brief Initializes a one-time password context.
+ *	@param ctx Pointer to an OTP context.
+ *	@param key Pointer to the shared secret (the Base32-decoded key from the provisioning QR code).
+ *	@param keylen Length of @b key, in bytes.
+ *	@param digits Number of decimal digits per code, 1 to @b OTP_MAX_DIGITS. Most services use 6.
+ *	@return True if the context was initialized. False if @b digits is out of range.
+ **********************************************************************************************************************/
+bool otp_init(otp_ctx* ctx, const void* key, size_t keylen, uint8_t digits);
+
+/**********************************************************************************************************************
+ *	@brief Generates an HOTP code.
+ *	@param ctx Pointer to an initialized OTP context.
+ *	@param counter The counter value to generate the code for.
+ *	@return The code. Print it with leading zeros to @b digits width.
+ **********************************************************************************************************************/
+uint32_t hotp_generate(const otp_ctx* ctx, uint32_t counter);
+
+/**********************************************************************************************************************
+ *	@brief Generates HOTP codes for consecutive counter values.
+ *	@param ctx Pointer to an initialized OTP context.
+ *	@param counter The first counter value.
+ *	@param count Number of codes to generate.
+ *	@param codes Pointer to an array of at least @b count codes to write.
+ *	@note To show the codes for the current TOTP window and those around it, pass
+ *      (unix_time / step) - n as @b counter and 2n + 1 as @b count.
+ **********************************************************************************************************************/
+void hotp_generate_range(const otp_ctx* ctx, uint32_t counter, size_t count, uint32_t* codes);
+
+/**********************************************************************************************************************
+ *	@brief Generates a TOTP code.
+ *	@param ctx Pointer to an initialized OTP context.
+ *	@param unix_time The current time, in seconds since the Unix epoch (UTC).
+ *	@param step The time step, in seconds. Most services use 30. Must not be 0.
+ *	@return The code. Print it with leading zeros to @b digits width.
+ **********************************************************************************************************************/
+uint32_t totp_generate(const otp_ctx* ctx, uint32_t unix_time, uint24_t step);
+
 
 /*
 Advanced Encryption Standard (AES)
@@ -332,6 +600,19 @@ AES is one of the most secure encryption systems in use today.
 The most secure version of the algorithm is AES-256 (uses a 256-bit key).
 AES is one of the open-source encryption schemes believed secure enough to withstand even
 the advent of quantum computing.
+ 
+The two S-boxes take 512 bytes of the library. Building the library with
+	fasmg -i 'HASHLIB_AES_TABLES := <address>' hashlib.asm hashlib.8xv
+leaves them out, and aes_init() generates them at that address the first time it is called instead.
+The address must have 512 bytes of RAM that nothing else uses while the program runs.
+ 
+Looking bytes up in the S-boxes indexes memory with secret data, which can show in the timing.
+Building the library with
+	fasmg -i 'HASHLIB_AES_BITSLICE := 1' hashlib.asm hashlib.8xv
+runs CTR mode and CBC decryption through a bitsliced AES instead. It works on eight blocks at a time
+using only boolean logic, so the time it takes does not depend on the key or the data. A full batch
+costs about three times as much as eight table-based blocks, and a shorter message still pays for
+a whole batch. CBC encryption must go one block at a time and stays on the tables, as does aes_init().
 */
 /***************************************************************************************************
  * @typedef aes_ctx
@@ -478,6 +759,197 @@ aes_error_t aes_decrypt(
     uint8_t ciphermode,
     uint8_t paddingmode);
 
+/***************************************************************************************************
+ * @typedef aes_cache
+ * A least-recently-used cache of AES key schedules, held in a caller-provided arena.
+ * For programs that switch between many keys, a cache hit skips aes_init() entirely.
+ * @note Entries are found by a fingerprint of the key, then confirmed against the
+ *      key itself, so two keys never share an entry.
+ ***************************************************************************************************/
+typedef struct _aes_cache {
+    void *entries;              /**< the arena passed to aes_cache_init() */
+    size_t capacity;            /**< number of key schedules the arena holds */
+    uint24_t clock;             /**< use counter for least-recently-used eviction */
+} aes_cache;
+
+/*****************************************************************
+ * @def AES_CACHE_ENTRY_SIZE
+ * Defines the number of arena bytes used per cached key schedule.
+ *****************************************************************/
+#define AES_CACHE_ENTRY_SIZE    249
+
+/***************************************************************************************************
+ * @brief Sets up a key schedule cache in an arena.
+ * @param cache Pointer to a cache context.
+ * @param arena Pointer to a buffer to hold the key schedules.
+ * @param size The size of @b arena, in bytes.
+ * @return The number of key schedules the cache can hold, @b size / AES_CACHE_ENTRY_SIZE.
+ * @note The arena is zeroed.
+ **************************************************************************************************/
+size_t aes_cache_init(aes_cache* cache, void* arena, size_t size);
+
+/***************************************************************************************************
+ * @brief Returns the key schedule for a key, expanding it only if it is not cached.
+ * @param cache Pointer to a cache context.
+ * @param key Pointer to the AES key.
+ * @param keylen The length of the key, in bytes.
+ * @return Pointer to the key schedule, for aes_encrypt() and aes_decrypt(). NULL if @b keylen
+ *      is invalid or the cache holds no entries.
+ * @note On a miss the least recently used entry is zeroed and reused.
+ * @note The returned pointer stays valid until that entry is evicted.
+ **************************************************************************************************/
+const aes_ctx* aes_cache_get(aes_cache* cache, const void* key, size_t keylen);
+
+/***************************************************************************************************
+ * @brief Removes a key from the cache and zeroes its key schedule.
+ * @param cache Pointer to a cache context.
+ * @param key Pointer to the AES key.
+ * @param keylen The length of the key, in bytes.
+ * @return True if the key was cached. False otherwise.
+ **************************************************************************************************/
+bool aes_cache_evict(aes_cache* cache, const void* key, size_t keylen);
+
+/***************************************************************************************************
+ * @brief Zeroes every key schedule in the cache.
+ * @param cache Pointer to a cache context.
+ * @note Call this before freeing or reusing the arena.
+ **************************************************************************************************/
+void aes_cache_clear(aes_cache* cache);
+
+/*
+AES-SIV (RFC 5297)
+
+AES-SIV is deterministic authenticated encryption. Instead of taking a nonce, it derives the IV
+(the "synthetic IV", V) from the key, the associated data, and the message with AES-CMAC, then
+encrypts the message in CTR mode under that IV. Encrypting the same message twice gives the same
+output, but nothing else leaks, so reusing or never having a nonce is safe. This makes it a good
+fit for wrapping keys and for deterministic records, where calling csrand_fill() for an IV and
+adding an HMAC would cost more than the message itself.
+
+The key is two AES keys back to back: the first half for CMAC, the second for CTR.
+The output is V followed by the ciphertext. CTR mode goes through aes_encrypt(), so a library
+built with HASHLIB_AES_BITSLICE runs it bitsliced.
+*/
+/*****************************************************
+ * @def AES_SIV_TAG_LEN
+ * Length of the synthetic IV at the start of an AES-SIV ciphertext, in bytes.
+ *****************************************************/
+#define AES_SIV_TAG_LEN     16
+
+/**************************************************************************************************************
+ * @brief Encrypts and authenticates a message with AES-SIV.
+ * @param key Pointer to the key.
+ * @param keylen Length of @b key, in bytes. Must be 32, 48, or 64.
+ * @param ad Pointer to associated data to authenticate but not encrypt. NULL for none, which is not
+ *      the same as @b adlen 0.
+ * @param adlen Length of @b ad, in bytes.
+ * @param plaintext Pointer to the message to encrypt.
+ * @param len Length of @b plaintext, in bytes.
+ * @param ciphertext Pointer to a buffer to write V and then the ciphertext to. Must be at least
+ *      @b len + AES_SIV_TAG_LEN bytes large.
+ * @return True if the message was encrypted. False if @b keylen is invalid.
+ * @note To encrypt in place, put the message at @b ciphertext + AES_SIV_TAG_LEN.
+ **************************************************************************************************************/
+bool aes_siv_encrypt(
+    const void* key,
+    size_t keylen,
+    const void* ad,
+    size_t adlen,
+    const void* plaintext,
+    size_t len,
+    void* ciphertext);
+
+/**************************************************************************************************************
+ * @brief Verifies and decrypts a message with AES-SIV.
+ * @param key Pointer to the key.
+ * @param keylen Length of @b key, in bytes. Must be 32, 48, or 64.
+ * @param ad Pointer to the associated data, or NULL if there was none.
+ * @param adlen Length of @b ad, in bytes.
+ * @param ciphertext Pointer to V followed by the ciphertext.
+ * @param len Length of @b ciphertext, in bytes, including V.
+ * @param plaintext Pointer to a buffer to write @b len - AES_SIV_TAG_LEN bytes of plaintext to.
+ * @return True if V is valid. False if it is not, or @b keylen is invalid, or @b len is shorter than V.
+ * @note If V is invalid, @b plaintext is zeroed.
+ * @note To decrypt in place, pass @b ciphertext + AES_SIV_TAG_LEN as @b plaintext.
+ **************************************************************************************************************/
+bool aes_siv_decrypt(
+    const void* key,
+    size_t keylen,
+    const void* ad,
+    size_t adlen,
+    const void* ciphertext,
+    size_t len,
+    void* plaintext);
+
+/*
+Ascon Authenticated Encryption
+
+Ascon-AEAD128 (NIST SP 800-232) is a lightweight authenticated cipher. It encrypts and authenticates
+a message, plus optional associated data that is authenticated but sent in the clear, in a single pass.
+There is no key schedule to expand, so it is a good fit for short packets, where aes_init() and a
+separate HMAC would cost more than the message itself.
+*/
+/*****************************************************
+ * @def ASCON_KEY_LEN
+ * Length of an Ascon-AEAD128 key, in bytes.
+ *****************************************************/
+#define ASCON_KEY_LEN       16
+
+/*****************************************************
+ * @def ASCON_NONCE_LEN
+ * Length of an Ascon-AEAD128 nonce, in bytes.
+ *****************************************************/
+#define ASCON_NONCE_LEN     16
+
+/*****************************************************
+ * @def ASCON_TAG_LEN
+ * Length of an Ascon-AEAD128 authentication tag, in bytes.
+ *****************************************************/
+#define ASCON_TAG_LEN       16
+
+/**************************************************************************************************************
+ * @brief Encrypts and authenticates a message with Ascon-AEAD128.
+ * @param key Pointer to a 16-byte key.
+ * @param nonce Pointer to a 16-byte nonce. Never use the same nonce twice with the same key.
+ * @param ad Pointer to associated data to authenticate but not encrypt. May be NULL if @b adlen is 0.
+ * @param adlen Length of @b ad, in bytes.
+ * @param plaintext Pointer to the message to encrypt.
+ * @param len Length of @b plaintext, in bytes.
+ * @param ciphertext Pointer to a buffer to write the ciphertext and then the tag to. Must be at least
+ *      @b len + ASCON_TAG_LEN bytes large.
+ * @note @b plaintext and @b ciphertext are aliasable.
+ **************************************************************************************************************/
+void ascon_aead_encrypt(
+    const void* key,
+    const void* nonce,
+    const void* ad,
+    size_t adlen,
+    const void* plaintext,
+    size_t len,
+    void* ciphertext);
+
+/**************************************************************************************************************
+ * @brief Verifies and decrypts a message with Ascon-AEAD128.
+ * @param key Pointer to a 16-byte key.
+ * @param nonce Pointer to the 16-byte nonce the message was encrypted with.
+ * @param ad Pointer to the associated data. May be NULL if @b adlen is 0.
+ * @param adlen Length of @b ad, in bytes.
+ * @param ciphertext Pointer to the ciphertext followed by its tag.
+ * @param len Length of @b ciphertext, in bytes, including the tag.
+ * @param plaintext Pointer to a buffer to write @b len - ASCON_TAG_LEN bytes of plaintext to.
+ * @return True if the tag is valid. False if it is not, or @b len is shorter than a tag.
+ * @note If the tag is invalid, @b plaintext is zeroed.
+ * @note @b plaintext and @b ciphertext are aliasable.
+ **************************************************************************************************************/
+bool ascon_aead_decrypt(
+    const void* key,
+    const void* nonce,
+    const void* ad,
+    size_t adlen,
+    const void* ciphertext,
+    size_t len,
+    void* plaintext);
+
 /*
  RSA Public Key Encryption
  
@@ -538,6 +1010,1081 @@ rsa_error_t rsa_encrypt(
     size_t keylen,
     uint8_t oaep_hash_alg);
     
+/*
+Hash-Based Signatures (LMS/HSS)
+
+LMS (RFC 8554) is a signature scheme built on nothing but SHA-256, so it is not broken by a
+quantum computer the way RSA is. That makes it a good choice for signing updates: the signer
+keeps a private key on a PC and the calculator only ever needs to verify.
+An LMS key can only sign a fixed number of messages (2^h). HSS chains several LMS trees,
+each signing the public key of the one below it, to allow many more.
+Signatures are large, a few kilobytes, and verifying one costs a few hundred to a few thousand
+SHA-256 compressions depending on the LM-OTS parameter (W1/W2 are fastest, W8 is smallest).
+Only the SHA-256, n = m = 32 parameter sets are supported.
+*/
+/*****************************************************
+ * @def LMS_PUB_LEN
+ * Length of an LMS public key, in bytes.
+ *****************************************************/
+#define LMS_PUB_LEN     56
+
+/*****************************************************
+ * @def HSS_PUB_LEN
+ * Length of an HSS public key, in bytes.
+ *****************************************************/
+#define HSS_PUB_LEN     (4 + LMS_PUB_LEN)
+
+/**************************************************************************************************
+ * @brief Verifies an LMS signature.
+ * @param msg Pointer to the signed message.
+ * @param msglen Length of @b msg, in bytes.
+ * @param pubkey Pointer to the LMS public key, in the RFC 8554 encoding.
+ * @param publen Length of @b pubkey. Must be LMS_PUB_LEN.
+ * @param sig Pointer to the signature, in the RFC 8554 encoding.
+ * @param siglen Length of @b sig, in bytes.
+ * @return True if the signature is valid. False if it is not, or is malformed or of an
+ *      unsupported type.
+ **************************************************************************************************/
+bool lms_verify(
+    const void* msg,
+    size_t msglen,
+    const void* pubkey,
+    size_t publen,
+    const void* sig,
+    size_t siglen);
+
+/**************************************************************************************************
+ * @brief Verifies an HSS signature.
+ * @param msg Pointer to the signed message.
+ * @param msglen Length of @b msg, in bytes.
+ * @param pubkey Pointer to the HSS public key, in the RFC 8554 encoding.
+ * @param publen Length of @b pubkey. Must be HSS_PUB_LEN.
+ * @param sig Pointer to the signature, in the RFC 8554 encoding.
+ * @param siglen Length of @b sig, in bytes.
+ * @return True if the signature is valid. False if it is not, or is malformed or of an
+ *      unsupported type.
+ * @note Up to 8 levels are supported, as in RFC 8554.
+ **************************************************************************************************/
+bool hss_verify(
+    const void* msg,
+    size_t msglen,
+    const void* pubkey,
+    size_t publen,
+    const void* sig,
+    size_t siglen);
+
+/*
+ Secure Remote Password (SRP-6a)
+ 
+ SRP is a password-authenticated key exchange. The client proves it knows the password
+ without ever sending it, or anything derived from it that could be replayed, over the wire.
+ The server stores only a salt and a verifier derived from the password. Each login uses
+ fresh ephemeral values, so a captured login is worthless to an eavesdropper, and both
+ parties finish with a shared session key.
+ 
+ This implementation follows RFC 5054 with SHA-256 as the hash function H.
+ 	k = H(N | PAD(g))
+ 	x = H(s | H(I | ":" | P))
+ 	v = g^x % N
+ 	A = g^a % N
+ 	u = H(PAD(A) | PAD(B))
+ 	S = (B - k * g^x) ^ (a + u * x) % N
+ 	K = H(S)
+ 	M1 = H(H(N) xor H(g) | H(I) | s | A | B | K)
+ 	M2 = H(A | M1 | K)
+ A, B, and S are padded to the length of N wherever they are hashed.
+ 
+ A login looks like this:
+ 	@code
+ 	srp_init(&srp, N, sizeof N, g, user, strlen(user));
+ 	srp_client_start(&srp, A);
+ 	// send user and A, receive salt and B
+ 	if(srp_client_process(&srp, B, salt, saltlen, pass, strlen(pass), M1) != SRP_OK) abort();
+ 	// send M1, receive M2
+ 	if(!srp_client_verify(&srp, M2)) abort();
+ 	// srp.session_key now holds the shared key
+ 	@endcode
+ Use one of the groups from RFC 5054 appendix A. SRP needs three modular exponentiations
+ per login, one in srp_client_start() and two in srp_client_process(). With the 1024-bit group
+ and g = 2, srp_client_start() moves 74 million bytes to and from memory and srp_client_process()
+ 253 million. At the calculator's 48 MHz that is at least 1.5 and 5.3 seconds, and several times
+ that with the wait states of code run from flash. Larger groups cost roughly quadratically more.
+ */
+ 
+/***************************************************************************************************
+ * @typedef srp_ctx
+ * Stores state for one SRP-6a login.
+ * @note Only @b session_key is meant to be read by the caller.
+ ***************************************************************************************************/
+typedef struct _srp_ctx {
+    const uint8_t *modulus;         /**< the group modulus, N */
+    uint8_t size;                   /**< length of the group modulus, in bytes. 0 means 256 */
+    uint8_t generator;              /**< the group generator, g */
+    uint8_t secret[32];             /**< the client's ephemeral secret, a */
+    uint8_t session_key[32];        /**< the shared session key, K */
+    uint8_t server_proof[32];       /**< the proof expected from the server, M2 */
+    uint8_t identity_hash[32];      /**< the hash of the username, H(I) */
+    sha256_ctx identity;            /**< hash state over the username, used to compute x */
+    uint8_t pubkey[256];            /**< the client's public value, A */
+} srp_ctx;
+
+/***************************************************
+ * @enum srp_error_t
+ * SRP Error Codes
+ ***************************************************/
+typedef enum {
+    SRP_OK,                         /**< SRP step completed successfully */
+    SRP_INVALID_SERVER_KEY          /**< SRP step failed, the server's public value is invalid */
+} srp_error_t;
+
+/***************************************************************************************************
+ * @brief Initializes an SRP context for a group and username.
+ * @param ctx Pointer to an SRP context.
+ * @param modulus Pointer to the group modulus, N, in bytearray (big endian) format.
+ * @param modlen The length of the group modulus, in bytes.
+ * @param generator The group generator, g.
+ * @param identity Pointer to the username, I.
+ * @param idlen The length of the username, in bytes.
+ * @return True if the context was initialized. False if the group is invalid.
+ * @note @b modulus must be between 33 and 256 bytes long, odd, and have a nonzero leading byte.
+ * @note @b modulus is not copied and must remain valid for the lifetime of @b ctx.
+ **************************************************************************************************/
+bool srp_init(
+    srp_ctx* ctx,
+    const void* modulus,
+    size_t modlen,
+    uint8_t generator,
+    const void* identity,
+    size_t idlen);
+
+/***************************************************************************************************
+ * @brief Computes the password verifier to register with the server.
+ * @param ctx Pointer to an SRP context initialized with srp_init().
+ * @param salt Pointer to a salt, s. Generate it with csrand_fill() when registering.
+ * @param saltlen The length of the salt, in bytes.
+ * @param password Pointer to the password, P.
+ * @param passlen The length of the password, in bytes.
+ * @param verifier Pointer to a buffer to write the verifier, v, to.
+ * @note @b verifier must be at least as large as the group modulus.
+ * @note Send the salt and the verifier to the server once, over a trusted channel.
+ **************************************************************************************************/
+void srp_verifier(
+    srp_ctx* ctx,
+    const void* salt,
+    size_t saltlen,
+    const void* password,
+    size_t passlen,
+    void* verifier);
+
+/***************************************************************************************************
+ * @brief Starts a login by generating the client's ephemeral key pair.
+ * @param ctx Pointer to an SRP context initialized with srp_init().
+ * @param pubkey Pointer to a buffer to write the client's public value, A, to.
+ * @note @b pubkey must be at least as large as the group modulus.
+ * @note csrand_init() must have succeeded before calling this function.
+ **************************************************************************************************/
+void srp_client_start(srp_ctx* ctx, void* pubkey);
+
+/***************************************************************************************************
+ * @brief Processes the server's reply and computes the session key and the client's proof.
+ * @param ctx Pointer to an SRP context passed to srp_client_start().
+ * @param server_pubkey Pointer to the server's public value, B, padded to the length of the modulus.
+ * @param salt Pointer to the salt sent by the server.
+ * @param saltlen The length of the salt, in bytes.
+ * @param password Pointer to the password, P.
+ * @param passlen The length of the password, in bytes.
+ * @param proof Pointer to a buffer to write the client's proof, M1, to. Must be at least 32 bytes large.
+ * @return srp_error_t
+ * @note On success, the session key is available at @b ctx->session_key.
+ * @note Do not use the session key until srp_client_verify() accepts the server's proof.
+ **************************************************************************************************/
+srp_error_t srp_client_process(
+    srp_ctx* ctx,
+    const void* server_pubkey,
+    const void* salt,
+    size_t saltlen,
+    const void* password,
+    size_t passlen,
+    void* proof);
+
+/***************************************************************************************************
+ * @brief Checks the server's proof, M2.
+ * @param ctx Pointer to an SRP context passed to srp_client_process().
+ * @param proof Pointer to the server's proof. 32 bytes.
+ * @return True if the server proved it knows the verifier. False otherwise.
+ **************************************************************************************************/
+bool srp_client_verify(srp_ctx* ctx, const void* proof);
+    
+
+/*
+ Record Layer
+ 
+ The record layer turns a stream of messages into authenticated, encrypted records, in the
+ style of TLS. Each record carries an 8-byte sequence number, the message encrypted with AES
+ in CTR mode, and a 16-byte HMAC-SHA256 tag over both (encrypt-then-MAC).
+ 	record = sequence number | ciphertext | tag
+ The counter block for each record is the 4-byte nonce, the sequence number, and a 4-byte block
+ counter, so no two records ever share keystream.
+ 
+ Use one context per direction, with different keys. Both ends must initialize their contexts
+ with the same keys and nonce, for example from an SRP session key run through hmac_pbkdf2().
+ The AES key schedule and the HMAC key are processed once, in record_init(), not per record.
+ 
+ A receiving context remembers the highest sequence number it has accepted and which of the
+ 64 before it have arrived. Records older than that window, or already accepted, are rejected,
+ so a captured record cannot be replayed. Records may arrive out of order within the window.
+ */
+ 
+/***************************************************************************************************
+ * @typedef record_ctx
+ * Stores keys and counters for one direction of a record layer session.
+ ***************************************************************************************************/
+typedef struct _record_ctx {
+    uint8_t nonce[4];               /**< the fixed part of the counter block */
+    uint8_t sequence[8];            /**< next sequence number to send, or highest accepted */
+    uint8_t window[8];              /**< replay window, bit n set if highest - n was accepted */
+    aes_ctx cipher;                 /**< the expanded cipher key */
+    sha256_ctx mac_inner;           /**< hash state after the HMAC inner pad */
+    sha256_ctx mac_outer;           /**< hash state after the HMAC outer pad */
+} record_ctx;
+
+/***************************************************************************************************
+ * @typedef record_packet
+ * Describes one record for record_seal_bulk() and record_open_bulk().
+ ***************************************************************************************************/
+typedef struct _record_packet {
+    const void *in;                 /**< the message to seal, or the record to open */
+    size_t len;                     /**< length of @b in, in bytes */
+    void *out;                      /**< buffer for the record, or for the opened message */
+    uint8_t status;                 /**< set to the record_error_t for this packet */
+} record_packet;
+
+/***************************************************
+ * @enum record_error_t
+ * Record Layer Error Codes
+ ***************************************************/
+typedef enum {
+    RECORD_OK,                      /**< record sealed or opened successfully */
+    RECORD_INVALID_ARG,             /**< record too short to be valid */
+    RECORD_AUTH_FAILED,             /**< record tag did not match, the record was forged or damaged */
+    RECORD_REPLAY,                  /**< record already accepted, or older than the replay window */
+    RECORD_SEQ_EXHAUSTED            /**< no sequence numbers left, rekey the session */
+} record_error_t;
+
+/******************************************************
+ * @def RECORD_HEADER_LEN
+ * Length of the sequence number at the start of a record.
+ * ****************************************************/
+#define RECORD_HEADER_LEN   8
+
+/******************************************************
+ * @def RECORD_TAG_LEN
+ * Length of the authentication tag at the end of a record.
+ * ****************************************************/
+#define RECORD_TAG_LEN      16
+
+/******************************************************
+ * @def record_outsize()
+ * Returns the size of a record holding a message of length @b len.
+ * ****************************************************/
+#define record_outsize(len) \
+	((len) + RECORD_HEADER_LEN + RECORD_TAG_LEN)
+
+/***************************************************************************************************
+ * @brief Initializes one direction of a record layer session.
+ * @param ctx Pointer to a record context.
+ * @param key Pointer to the AES key.
+ * @param keylen The length of the AES key, in bytes. 16, 24, or 32.
+ * @param mac_key Pointer to the HMAC key.
+ * @param mac_keylen The length of the HMAC key, in bytes.
+ * @param nonce Pointer to a 4-byte nonce.
+ * @return True if the context was initialized. False if @b keylen is invalid.
+ * @note The sequence number and the replay window start at zero.
+ * @warning Never initialize two contexts with the same key and nonce, unless they are the sending
+ *      and receiving ends of the same direction.
+ **************************************************************************************************/
+bool record_init(
+    record_ctx* ctx,
+    const void* key,
+    size_t keylen,
+    const void* mac_key,
+    size_t mac_keylen,
+    const void* nonce);
+
+/***************************************************************************************************
+ * @brief Encrypts and authenticates a message into a record.
+ * @param ctx Pointer to a sending record context.
+ * @param plaintext Pointer to the message to seal.
+ * @param len The length of the message, in bytes.
+ * @param record Pointer to a buffer to write the record to. Must be at least record_outsize(len) bytes large.
+ * @return record_error_t
+ * @note To seal in place, put the message at @b record + RECORD_HEADER_LEN.
+ *      Otherwise @b plaintext and @b record must not overlap.
+ **************************************************************************************************/
+record_error_t record_seal(record_ctx* ctx, const void* plaintext, size_t len, void* record);
+
+/***************************************************************************************************
+ * @brief Checks and decrypts a record.
+ * @param ctx Pointer to a receiving record context.
+ * @param record Pointer to the record to open.
+ * @param len The length of the record, in bytes.
+ * @param plaintext Pointer to a buffer to write the message to. Must be at least len - 24 bytes large.
+ * @return record_error_t
+ * @note @b plaintext is only written if the record is accepted.
+ * @note @b plaintext may point to @b record or @b record + RECORD_HEADER_LEN to open in place.
+ **************************************************************************************************/
+record_error_t record_open(record_ctx* ctx, const void* record, size_t len, void* plaintext);
+
+/***************************************************************************************************
+ * @brief Seals a queue of messages in one call.
+ * @param ctx Pointer to a sending record context.
+ * @param packets Pointer to an array of packets, @b in and @b len describing each message.
+ * @param count The number of packets.
+ * @return The number of packets sealed successfully. Each packet's @b status is set.
+ **************************************************************************************************/
+size_t record_seal_bulk(record_ctx* ctx, record_packet* packets, size_t count);
+
+/***************************************************************************************************
+ * @brief Opens a queue of records in one call.
+ * @param ctx Pointer to a receiving record context.
+ * @param packets Pointer to an array of packets, @b in and @b len describing each record.
+ * @param count The number of packets.
+ * @return The number of packets opened successfully. Each packet's @b status is set.
+ * @note A rejected record does not stop the rest of the queue from being opened.
+ **************************************************************************************************/
+size_t record_open_bulk(record_ctx* ctx, record_packet* packets, size_t count);
+    
+
+/***************************************************************************************************
+ * @brief Compresses a message, then seals it into a record.
+ * @param ctx Pointer to a sending record context.
+ * @param plaintext Pointer to the message to seal.
+ * @param len The length of the message, in bytes.
+ * @param record Pointer to a buffer to write the record to. Must be at least
+ *      record_outsize(lz_maxsize(len)) bytes large.
+ * @param reclen Pointer to write the length of the record to.
+ * @return record_error_t
+ * @note The message is compressed directly into @b record and encrypted there, so no other buffer is used.
+ *      @b plaintext and @b record must not overlap.
+ * @warning The length of the record now depends on the content of the message, not just its length.
+ *      If an attacker can get their own data into a message alongside a secret, for example by choosing a
+ *      name that is sent with a password, they can learn the secret byte by byte by watching record sizes.
+ *      Only use this for data that does not mix secrets with attacker-chosen input, and use record_seal() otherwise.
+ **************************************************************************************************/
+record_error_t record_seal_compressed(record_ctx* ctx, const void* plaintext, size_t len, void* record, size_t* reclen);
+
+/***************************************************************************************************
+ * @brief Checks and decrypts a record sealed with record_seal_compressed(), then decompresses it.
+ * @param ctx Pointer to a receiving record context.
+ * @param record Pointer to the record to open. It is decrypted in place.
+ * @param len The length of the record, in bytes.
+ * @param plaintext Pointer to a buffer to write the message to.
+ * @param maxlen The size of @b plaintext, in bytes.
+ * @param outlen Pointer to write the length of the message to.
+ * @return record_error_t. RECORD_INVALID_ARG if the message does not fit in @b maxlen bytes.
+ **************************************************************************************************/
+record_error_t record_open_compressed(
+    record_ctx* ctx,
+    void* record,
+    size_t len,
+    void* plaintext,
+    size_t maxlen,
+    size_t* outlen);
+    
+
+/*
+ Compression
+ 
+ lz_compress() is a small LZSS compressor. It replaces repeats within the last 4 KB with 2-byte
+ references, which is what save data, text and tables tend to be made of. It only keeps one
+ candidate per position, trading some ratio for speed, and needs no memory beyond its own stack.
+ Compress before encrypting, never after: ciphertext does not compress.
+ See record_seal_compressed() for doing both in one call, and for why that leaks information.
+ 
+ lz_compress() and lz_decompress() need the whole buffer at once. For data that is read or sent
+ piece by piece, the lz_stream functions produce the same format, keep the last 4 KB in an arena
+ of LZ_STREAM_ARENA bytes, and let each piece of output go straight to record_seal() or
+ container_seal(). The pieces only decompress in order, as one stream.
+ 
+ The format is a flag byte, then up to 8 items. Bit n of the flag byte, low bit first, is 0 if
+ item n is a literal byte and 1 if it is a 2-byte match:
+ 	byte 0 = (distance - 1) & 0xFF
+ 	byte 1 = ((distance - 1) >> 8) << 4 | (length - 3)
+ */
+ 
+/******************************************************
+ * @def lz_maxsize()
+ * Returns the largest size lz_compress() can produce for @b len bytes of input.
+ * ****************************************************/
+#define lz_maxsize(len) \
+	((len) + ((len) + 7) / 8)
+
+/******************************************************
+ * @def LZ_ERROR
+ * Returned by lz_decompress() if the input is malformed or the output does not fit.
+ * ****************************************************/
+#define LZ_ERROR    ((size_t)-1)
+
+/***************************************************************************************************
+ * @brief Compresses a buffer.
+ * @param in Pointer to the data to compress.
+ * @param len Length of @b in, in bytes.
+ * @param out Pointer to a buffer to write the compressed data to. Must be at least lz_maxsize(len) bytes large.
+ * @return The length of the compressed data.
+ * @note @b in and @b out must not overlap.
+ **************************************************************************************************/
+size_t lz_compress(const void* in, size_t len, void* out);
+
+/***************************************************************************************************
+ * @brief Decompresses a buffer.
+ * @param in Pointer to the compressed data.
+ * @param len Length of @b in, in bytes.
+ * @param out Pointer to a buffer to write the data to.
+ * @param outmax The size of @b out, in bytes.
+ * @return The length of the data, or LZ_ERROR if @b in is malformed or the data is longer than @b outmax.
+ * @note @b in and @b out must not overlap.
+ **************************************************************************************************/
+size_t lz_decompress(const void* in, size_t len, void* out, size_t outmax);
+
+/******************************************************
+ * @def LZ_STREAM_ARENA
+ * The size of the arena for lz_stream_init(), in bytes.
+ * ****************************************************/
+#define LZ_STREAM_ARENA     (8192 + 768)
+
+/******************************************************
+ * @def lz_stream_maxsize()
+ * Returns the largest size lz_stream_compress() can produce for @b len bytes of input.
+ * ****************************************************/
+#define lz_stream_maxsize(len) \
+	(lz_maxsize(len) + 15)
+
+/***************************************************************************************************
+ * @typedef lz_ctx
+ * Stores the state of a compression or decompression stream.
+ ***************************************************************************************************/
+typedef struct _lz_ctx {
+    uint8_t *window;                /**< the arena: recent data, then the compressor's hash table */
+    size_t fill;                    /**< bytes of recent data in the window */
+    uint8_t bit;                    /**< flag bit of the next item, 0 at the start of a group */
+    uint8_t flags;                  /**< flag byte being decompressed */
+    uint8_t pending_len;            /**< number of bytes held in pending */
+    uint8_t pending[15];            /**< an unfinished flag group, or the first byte of a match */
+} lz_ctx;
+
+/***************************************************************************************************
+ * @brief Starts a compression or decompression stream.
+ * @param ctx Pointer to an lz context.
+ * @param arena Pointer to LZ_STREAM_ARENA bytes, for the stream's own use until it is done.
+ **************************************************************************************************/
+void lz_stream_init(lz_ctx* ctx, void* arena);
+
+/***************************************************************************************************
+ * @brief Compresses the next piece of a stream.
+ * @param ctx Pointer to an lz context.
+ * @param in Pointer to the data to compress.
+ * @param len Length of @b in, in bytes.
+ * @param out Pointer to a buffer to write the compressed data to. Must be at least
+ *      lz_stream_maxsize(len) bytes large.
+ * @return The length of the compressed data written, which may be 0.
+ * @note Matches reach back into earlier pieces. The last, unfinished flag group is held in @b ctx
+ *      until the next call or lz_stream_finish().
+ **************************************************************************************************/
+size_t lz_stream_compress(lz_ctx* ctx, const void* in, size_t len, void* out);
+
+/***************************************************************************************************
+ * @brief Ends a compression stream.
+ * @param ctx Pointer to an lz context.
+ * @param out Pointer to a buffer to write the rest of the compressed data to. Must be at least 15 bytes large.
+ * @return The length of the compressed data written, which may be 0.
+ * @note Call lz_stream_init() again before starting another stream.
+ **************************************************************************************************/
+size_t lz_stream_finish(lz_ctx* ctx, void* out);
+
+/***************************************************************************************************
+ * @brief Decompresses the next piece of a stream.
+ * @param ctx Pointer to an lz context.
+ * @param in Pointer to the compressed data. It may be cut anywhere, the rest of an item is expected in the next call.
+ * @param len Length of @b in, in bytes.
+ * @param out Pointer to a buffer to write the data to.
+ * @param outmax The size of @b out, in bytes. 9 * @b len + 9 bytes is always enough.
+ * @return The length of the data, or LZ_ERROR if @b in is malformed or the data is longer than @b outmax.
+ *      The stream cannot go on after an error.
+ **************************************************************************************************/
+size_t lz_stream_decompress(lz_ctx* ctx, const void* in, size_t len, void* out, size_t outmax);
+    
+
+/*
+ Encrypted Containers
+ 
+ A container stores a file, such as a save appvar, as a header followed by fixed-size chunks,
+ each encrypted and authenticated on its own with Ascon-AEAD128:
+ 	container = header | chunk 0 | chunk 1 | ... | chunk n
+ 	chunk = ciphertext | tag
+ Every chunk but the last holds exactly chunk_len bytes of data, so chunk i always starts at
+ container_offset(i) and can be read, checked and decrypted without touching the rest of the
+ file. Reading one record costs one chunk, not the whole file, and needs one chunk of memory.
+ 
+ The header holds the parameters, a random salt and a random nonce prefix. The key is derived from
+ a password (or any secret) and the salt with hmac_pbkdf2(), so each container gets its own key.
+ The nonce of each chunk is the nonce prefix, the chunk index, and a flag marking the last chunk.
+ A chunk therefore fails to open if it is moved to a different index, and a file cut short
+ at a chunk boundary fails to open its last chunk. The header is authenticated with every chunk.
+ 
+ To change a chunk in place, reseal it with the same index. To rewrite the whole file, call
+ container_create() again for a new salt and key.
+ */
+ 
+/******************************************************
+ * @def CONTAINER_HEADER_LEN
+ * Length of a container header.
+ * ****************************************************/
+#define CONTAINER_HEADER_LEN    32
+
+/******************************************************
+ * @def CONTAINER_TAG_LEN
+ * Length of the authentication tag at the end of each chunk.
+ * ****************************************************/
+#define CONTAINER_TAG_LEN       16
+
+/***************************************************************************************************
+ * @typedef container_header
+ * The header at the start of a container.
+ ***************************************************************************************************/
+typedef struct _container_header {
+    char magic[4];                  /**< "HLCF" */
+    uint16_t chunk_len;             /**< bytes of data in each chunk */
+    uint16_t rounds;                /**< hmac_pbkdf2() rounds for the key */
+    uint8_t salt[16];               /**< salt for the key */
+    uint8_t nonce[8];               /**< nonce prefix shared by the chunks */
+} container_header;
+
+/***************************************************************************************************
+ * @typedef container_ctx
+ * Stores the key and header of an open container.
+ ***************************************************************************************************/
+typedef struct _container_ctx {
+    uint8_t key[16];                /**< the Ascon-AEAD128 key */
+    container_header header;        /**< a copy of the header */
+} container_ctx;
+
+/******************************************************
+ * @def container_offset()
+ * Returns the offset of chunk @b index from the start of the container.
+ * ****************************************************/
+#define container_offset(ctx, index) \
+	(CONTAINER_HEADER_LEN + (size_t)(index) * ((size_t)(ctx)->header.chunk_len + CONTAINER_TAG_LEN))
+
+/***************************************************************************************************
+ * @brief Starts a new container, with a fresh salt, key and nonce prefix.
+ * @param ctx Pointer to a container context.
+ * @param password Pointer to the password or secret to derive the key from.
+ * @param passlen Length of @b password, in bytes.
+ * @param chunk_len Bytes of data in each chunk, 1 to 65535.
+ * @param rounds hmac_pbkdf2() rounds, 1 to 65535.
+ * @param header Pointer to a buffer to write the CONTAINER_HEADER_LEN-byte header to.
+ * @return True if the container was created. False if an argument is out of range.
+ * @note Zero @b ctx when it is no longer needed, it holds the key.
+ **************************************************************************************************/
+bool container_create(
+    container_ctx* ctx,
+    const void* password,
+    size_t passlen,
+    size_t chunk_len,
+    size_t rounds,
+    void* header);
+
+/***************************************************************************************************
+ * @brief Opens an existing container from its header.
+ * @param ctx Pointer to a container context.
+ * @param password Pointer to the password or secret the container was created with.
+ * @param passlen Length of @b password, in bytes.
+ * @param header Pointer to the header at the start of the container.
+ * @return True if the header is well formed. False if it is not.
+ * @note A wrong password is not detected here. Every chunk will fail to open instead.
+ **************************************************************************************************/
+bool container_load(
+    container_ctx* ctx,
+    const void* password,
+    size_t passlen,
+    const void* header);
+
+/***************************************************************************************************
+ * @brief Encrypts and authenticates one chunk.
+ * @param ctx Pointer to a container context.
+ * @param index Index of the chunk in the container.
+ * @param plaintext Pointer to the data to seal.
+ * @param len Length of @b plaintext. Must be chunk_len, or at most chunk_len for the last chunk.
+ * @param last True if this is the last chunk of the container.
+ * @param chunk Pointer to a buffer to write @b len + CONTAINER_TAG_LEN bytes to.
+ * @return True if the chunk was sealed. False if @b len is invalid.
+ * @note @b plaintext and @b chunk are aliasable.
+ **************************************************************************************************/
+bool container_seal(
+    const container_ctx* ctx,
+    size_t index,
+    const void* plaintext,
+    size_t len,
+    bool last,
+    void* chunk);
+
+/***************************************************************************************************
+ * @brief Checks and decrypts one chunk.
+ * @param ctx Pointer to a container context.
+ * @param index Index of the chunk in the container.
+ * @param chunk Pointer to the sealed chunk.
+ * @param len Length of @b chunk, including the tag.
+ * @param last True if this is the last chunk of the container.
+ * @param plaintext Pointer to a buffer to write @b len - CONTAINER_TAG_LEN bytes to.
+ * @return True if the chunk is authentic. False if it is not, or @b len is invalid.
+ * @note If the chunk is not authentic, @b plaintext is zeroed.
+ * @note @b chunk and @b plaintext are aliasable.
+ **************************************************************************************************/
+bool container_open(
+    const container_ctx* ctx,
+    size_t index,
+    const void* chunk,
+    size_t len,
+    bool last,
+    void* plaintext);
+    
+
+/*
+ Merkle Trees
+ 
+ A Merkle tree hashes data as a sequence of fixed-size leaves, then hashes pairs of digests up to a
+ single root digest. Changing one leaf only changes the digests on its path to the root, so it can be
+ rehashed in O(log n) compressions instead of rehashing the whole file.
+ A single leaf can likewise be checked against a trusted root using only the digests beside its path.
+ 
+ The tree is stored as a flat array of 32-byte nodes, the root first and the children of node i at
+ 2i + 1 and 2i + 2. The leaves are the last 2^depth nodes. The array holds no pointers, so it can be
+ saved in an appvar alongside the data and reloaded later.
+ 	leaf = SHA-256(0x00 | data)
+ 	node = SHA-256(0x01 | left | right)
+ Leaves past the end of the data are all zeroes. The prefix bytes keep a leaf from being passed off
+ as a node.
+ */
+ 
+/***************************************************************************************************
+ * @typedef merkle_ctx
+ * Describes a Merkle tree and the node array it is stored in.
+ ***************************************************************************************************/
+typedef struct _merkle_ctx {
+    uint8_t *nodes;                 /**< the node array, root first */
+    size_t leaf_size;               /**< the length of each leaf, in bytes */
+    uint8_t depth;                  /**< the tree has 2^depth leaves */
+} merkle_ctx;
+
+/******************************************************
+ * @def MERKLE_MAX_DEPTH
+ * The largest supported tree depth.
+ * ****************************************************/
+#define MERKLE_MAX_DEPTH    15
+
+/******************************************************
+ * @def merkle_nodes_size()
+ * Returns the size of the node array for a tree of depth @b depth.
+ * ****************************************************/
+#define merkle_nodes_size(depth) \
+	(((2 << (depth)) - 1) * SHA256_DIGEST_LEN)
+
+/******************************************************
+ * @def merkle_root()
+ * Returns a pointer to the root digest of a tree.
+ * ****************************************************/
+#define merkle_root(ctx) \
+	((const void*)(ctx)->nodes)
+
+/***************************************************************************************************
+ * @brief Sets up a Merkle tree over a node array.
+ * @param ctx Pointer to a Merkle tree context.
+ * @param nodes Pointer to the node array. Must be at least merkle_nodes_size(depth) bytes large.
+ * @param depth The depth of the tree. The tree has 2^depth leaves.
+ * @param leaf_size The length of each leaf, in bytes.
+ * @return True if the context was set up. False if @b depth is above MERKLE_MAX_DEPTH or @b leaf_size is 0.
+ * @note This does not touch the node array. Call merkle_build() for a new tree, or point @b nodes
+ *      at a saved array to continue with it.
+ **************************************************************************************************/
+bool merkle_init(merkle_ctx* ctx, void* nodes, uint8_t depth, size_t leaf_size);
+
+/***************************************************************************************************
+ * @brief Hashes every leaf and node of a tree from a buffer.
+ * @param ctx Pointer to a Merkle tree context.
+ * @param data Pointer to the data. Leaf i is the @b leaf_size bytes at @b data + i * @b leaf_size.
+ * @param len The length of the data, in bytes. The last leaf may be short.
+ * @return True if the tree was built. False if @b len is more than the leaves can hold.
+ **************************************************************************************************/
+bool merkle_build(merkle_ctx* ctx, const void* data, size_t len);
+
+/***************************************************************************************************
+ * @brief Replaces one leaf and rehashes only the nodes on its path to the root.
+ * @param ctx Pointer to a Merkle tree context.
+ * @param index The index of the leaf, from 0.
+ * @param leaf Pointer to the new contents of the leaf.
+ * @param len The length of the leaf, in bytes. At most @b leaf_size, 0 to clear the leaf.
+ * @return True if the leaf was updated. False if @b index or @b len is out of range.
+ **************************************************************************************************/
+bool merkle_update(merkle_ctx* ctx, size_t index, const void* leaf, size_t len);
+
+/***************************************************************************************************
+ * @brief Copies out the authentication path of a leaf.
+ * @param ctx Pointer to a Merkle tree context.
+ * @param index The index of the leaf, from 0.
+ * @param path Pointer to a buffer to write the path to. Must be at least depth * 32 bytes large.
+ * @return True if the path was written. False if @b index is out of range.
+ * @note The path is the sibling of each node from the leaf up, not including the root.
+ **************************************************************************************************/
+bool merkle_path(const merkle_ctx* ctx, size_t index, void* path);
+
+/***************************************************************************************************
+ * @brief Checks a single leaf against a root digest.
+ * @param root Pointer to the trusted root digest.
+ * @param depth The depth of the tree.
+ * @param index The index of the leaf, from 0.
+ * @param leaf Pointer to the contents of the leaf.
+ * @param len The length of the leaf, in bytes.
+ * @param path Pointer to the leaf's authentication path, from merkle_path().
+ * @return True if the leaf belongs at @b index in the tree with that root. False otherwise.
+ * @note Costs @b depth + 1 hashes, and no node array is needed.
+ **************************************************************************************************/
+bool merkle_verify(const void* root, uint8_t depth, size_t index, const void* leaf, size_t len, const void* path);
+    
+
+/*
+ Content-Defined Chunking
+ 
+ Content-defined chunking splits data where the data itself says to, rather than every n bytes.
+ A rolling gear hash runs over the data and a chunk ends wherever it falls below a threshold.
+ Since a boundary only depends on the last few bytes before it, an insertion or deletion only
+ changes the chunks around the edit; the chunks after it are cut exactly as before.
+ 
+ Each chunk is fingerprinted with SHA-256. A backup then only needs to send chunks whose
+ fingerprints are not already in the chunk index, a sorted array of digests that can be saved in an
+ appvar between backups.
+ 	cdc_init(&cdc, 512, 2048, 8192);
+ 	while (len) {
+ 		size_t n = cdc_next(&cdc, data, len, digest);
+ 		if (cdc_index_add(&index, digest) == CDC_NEW) send_chunk(data, n, digest);
+ 		data += n; len -= n;
+ 	}
+ */
+ 
+/***************************************************************************************************
+ * @typedef cdc_ctx
+ * Stores the chunk size limits for the chunker.
+ ***************************************************************************************************/
+typedef struct _cdc_ctx {
+    size_t min_size;                /**< no chunk is shorter, except at the end of the data */
+    size_t max_size;                /**< no chunk is longer */
+    size_t threshold;               /**< hash value below which a chunk is cut */
+} cdc_ctx;
+
+/***************************************************************************************************
+ * @typedef cdc_index
+ * A sorted array of chunk digests.
+ ***************************************************************************************************/
+typedef struct _cdc_index {
+    uint8_t *entries;               /**< the digests, CDC_INDEX_DIGEST_LEN bytes each, in ascending order */
+    size_t count;                   /**< the number of digests in the index */
+    size_t capacity;                /**< the number of digests the index can hold */
+} cdc_index;
+
+/***************************************************
+ * @enum cdc_status_t
+ * Results of adding a digest to a chunk index
+ ***************************************************/
+typedef enum {
+    CDC_NEW,                        /**< the digest was not in the index and has been added */
+    CDC_KNOWN,                      /**< the digest was already in the index */
+    CDC_INDEX_FULL                  /**< the digest was not in the index, and there was no room to add it */
+} cdc_status_t;
+
+/******************************************************
+ * @def CDC_MAX_CHUNK
+ * The largest supported maximum chunk size.
+ * ****************************************************/
+#define CDC_MAX_CHUNK           65535
+
+/******************************************************
+ * @def CDC_INDEX_DIGEST_LEN
+ * Length of the digests kept in a chunk index, the first half of each SHA-256 digest.
+ * ****************************************************/
+#define CDC_INDEX_DIGEST_LEN    16
+
+/***************************************************************************************************
+ * @brief Sets the chunk size limits for the chunker.
+ * @param ctx Pointer to a chunker context.
+ * @param min_size The minimum chunk size, in bytes.
+ * @param avg_size The target average chunk size, in bytes. At least @b min_size + 2.
+ * @param max_size The maximum chunk size, in bytes. At least @b avg_size, at most CDC_MAX_CHUNK.
+ * @return True if the context was set up. False if the sizes are out of order or out of range.
+ * @note Chunks average about @b min_size plus the largest power of 2 not above @b avg_size - @b min_size.
+ * @note Both ends of a sync must use the same sizes, or no chunks will match.
+ **************************************************************************************************/
+bool cdc_init(cdc_ctx* ctx, size_t min_size, size_t avg_size, size_t max_size);
+
+/***************************************************************************************************
+ * @brief Finds the next chunk in a buffer and fingerprints it.
+ * @param ctx Pointer to a chunker context.
+ * @param data Pointer to the start of the chunk.
+ * @param len The number of bytes left in the data.
+ * @param digest Pointer to a buffer to write the chunk's SHA-256 digest to. Must be at least 32 bytes large.
+ * @return The length of the chunk, in bytes. 0 if @b len is 0.
+ * @note Call again at @b data plus the returned length for the chunk after it.
+ **************************************************************************************************/
+size_t cdc_next(const cdc_ctx* ctx, const void* data, size_t len, void* digest);
+
+/***************************************************************************************************
+ * @brief Sets up a chunk index in an arena.
+ * @param index Pointer to a chunk index.
+ * @param entries Pointer to the arena for the digests.
+ * @param size The size of the arena, in bytes.
+ * @param count The number of digests already in the arena, in ascending order, for an index
+ *      reloaded from an appvar. 0 for a new index.
+ * @return The number of digests the index can hold.
+ **************************************************************************************************/
+size_t cdc_index_init(cdc_index* index, void* entries, size_t size, size_t count);
+
+/***************************************************************************************************
+ * @brief Checks if a digest is in a chunk index.
+ * @param index Pointer to a chunk index.
+ * @param digest Pointer to a digest. Only the first CDC_INDEX_DIGEST_LEN bytes are used.
+ * @return True if the digest is in the index. False otherwise.
+ **************************************************************************************************/
+bool cdc_index_find(const cdc_index* index, const void* digest);
+
+/***************************************************************************************************
+ * @brief Adds a digest to a chunk index, unless it is already there.
+ * @param index Pointer to a chunk index.
+ * @param digest Pointer to a digest. Only the first CDC_INDEX_DIGEST_LEN bytes are used.
+ * @return cdc_status_t
+ * @note Lookups are a binary search. Adding a digest moves the digests after it along by one.
+ **************************************************************************************************/
+cdc_status_t cdc_index_add(cdc_index* index, const void* digest);
+    
+
+/*
+ Hash Map
+ 
+ An open-addressing hash map for in-RAM indexes keyed by untrusted data, such as strings received
+ from the network. Keys are hashed with SipHash-2-4 under a key drawn from the secure RNG when the
+ map is set up, so a sender cannot pick keys that all land in the same slot and turn each lookup
+ into a scan. A lookup costs one SipHash of the key and, almost always, one key comparison.
+ 
+ The map lives in an arena you provide. The slots come first, as one flat array, and each key is
+ copied into the space after them, so the map keeps no pointers to your buffers.
+ 	hmap_ctx map;
+ 	static uint8_t arena[64 * HMAP_SLOT_SIZE + 1024];
+ 	hmap_init(&map, arena, sizeof arena, 64);
+ 	hmap_put(&map, name, strlen(name), handle);
+ 	if (hmap_find(&map, name, strlen(name), &handle)) ...
+ */
+ 
+/***************************************************************************************************
+ * @typedef hmap_ctx
+ * Defines the state of a hash map.
+ ***************************************************************************************************/
+typedef struct _hmap_ctx {
+    uint8_t key[SIPHASH24_KEY_LEN]; /**< the SipHash key, from the secure RNG */
+    uint8_t *slots;                 /**< the slot array, at the start of the arena */
+    size_t mask;                    /**< the number of slots, less 1 */
+    size_t count;                   /**< the number of keys in the map */
+    uint8_t *free;                  /**< where the next key will be copied to */
+    uint8_t *end;                   /**< the end of the arena */
+} hmap_ctx;
+
+/***************************************************
+ * @enum hmap_status_t
+ * Results of adding a key to a hash map
+ ***************************************************/
+typedef enum {
+    HMAP_NEW,                       /**< the key was not in the map and has been added */
+    HMAP_UPDATED,                   /**< the key was already in the map, and its value was replaced */
+    HMAP_FULL                       /**< the key was not in the map, and there was no room to add it */
+} hmap_status_t;
+
+/******************************************************
+ * @def HMAP_SLOT_SIZE
+ * The size of one slot, in bytes.
+ * ****************************************************/
+#define HMAP_SLOT_SIZE          12
+
+/******************************************************
+ * @def HMAP_MAX_SLOTS
+ * The largest supported number of slots.
+ * ****************************************************/
+#define HMAP_MAX_SLOTS          32768
+
+/***************************************************************************************************
+ * @brief Sets up an empty hash map in an arena.
+ * @param map Pointer to a hash map context.
+ * @param arena Pointer to the arena for the slots and the keys.
+ * @param size The size of the arena, in bytes. At least @b slots * HMAP_SLOT_SIZE.
+ * @param slots The number of slots. A power of 2, from 2 to HMAP_MAX_SLOTS.
+ * @return True if the map was set up. False if @b slots or @b size is out of range.
+ * @note At most 3/4 of the slots are used, so the map holds up to @b slots * 3 / 4 keys.
+ *      The rest of the arena holds the keys themselves.
+ * @note Calling this again empties the map and picks a new SipHash key.
+ * @note csrand_init() must have succeeded before calling this function.
+ **************************************************************************************************/
+bool hmap_init(hmap_ctx* map, void* arena, size_t size, size_t slots);
+
+/***************************************************************************************************
+ * @brief Looks up a key in a hash map.
+ * @param map Pointer to a hash map context.
+ * @param key Pointer to the key.
+ * @param keylen The length of the key, in bytes. May be 0.
+ * @param value Pointer to write the key's value to, if it is found. May be NULL.
+ * @return True if the key is in the map. False otherwise.
+ **************************************************************************************************/
+bool hmap_find(const hmap_ctx* map, const void* key, size_t keylen, size_t* value);
+
+/***************************************************************************************************
+ * @brief Adds a key to a hash map, or replaces its value if it is already there.
+ * @param map Pointer to a hash map context.
+ * @param key Pointer to the key. It is copied into the arena.
+ * @param keylen The length of the key, in bytes. May be 0.
+ * @param value The value to store for the key, such as an index or a pointer.
+ * @return hmap_status_t
+ **************************************************************************************************/
+hmap_status_t hmap_put(hmap_ctx* map, const void* key, size_t keylen, size_t value);
+
+/***************************************************************************************************
+ * @brief Removes a key from a hash map.
+ * @param map Pointer to a hash map context.
+ * @param key Pointer to the key.
+ * @param keylen The length of the key, in bytes.
+ * @return True if the key was removed. False if it was not in the map.
+ * @note The slot is freed at once, and no tombstone is left behind to slow later lookups.
+ *      The copy of the key in the arena is only reclaimed by hmap_init().
+ **************************************************************************************************/
+bool hmap_remove(hmap_ctx* map, const void* key, size_t keylen);
+    
+
+/*
+ Delta Sync
+ 
+ To update a file that the other side has an older copy of, in the style of rsync:
+ 1. The side with the old file (the base) splits it into blocks and sends the signature, a weak
+    and a strong checksum of each block. See rsync_signature().
+ 2. The side with the new file slides a window over it. Wherever the window matches a block of
+    the signature, it sends the block number instead of the data. See rsync_delta().
+ 3. The side with the base rebuilds the new file from the base and the delta. See rsync_patch().
+ 
+ The weak checksum is the one rsync uses, and it can be slid one byte in constant time:
+ 	a = sum of the bytes, b = sum of a after each byte, both mod 2^16
+ 	weak = b << 16 | a
+ Only windows whose weak checksum matches a block are hashed, and the strong checksum (the
+ first 8 bytes of SHA-256) confirms the match.
+ 
+ A delta is a sequence of operations:
+ 	0x00, n (2 bytes, little endian), then n bytes of literal data
+ 	0x01, i (2 bytes, little endian), copying block i of the base
+ Blocks and signatures are written and read in order, so both can be sent as they are produced.
+ */
+ 
+/***************************************************************************************************
+ * @typedef rsync_ctx
+ * Holds the signature of a base file while deltas against it are computed.
+ ***************************************************************************************************/
+typedef struct _rsync_ctx {
+    const uint8_t *signature;       /**< the signature of the base */
+    size_t blocks;                  /**< the number of blocks in the signature */
+    size_t block_len;               /**< the length of each block, in bytes */
+    uint8_t filter[256];            /**< a bit set for each weak checksum in the signature */
+} rsync_ctx;
+
+/******************************************************
+ * @def RSYNC_SIG_ENTRY
+ * Length of the signature of each block, a 4-byte weak checksum then an 8-byte strong checksum.
+ * ****************************************************/
+#define RSYNC_SIG_ENTRY     12
+
+/******************************************************
+ * @def RSYNC_MIN_BLOCK
+ * The shortest supported block length.
+ * ****************************************************/
+#define RSYNC_MIN_BLOCK     8
+
+/******************************************************
+ * @def rsync_sigsize()
+ * Returns the size of the signature of @b len bytes in blocks of @b block_len.
+ * ****************************************************/
+#define rsync_sigsize(len, block_len) \
+	(((len) / (block_len)) * RSYNC_SIG_ENTRY)
+
+/******************************************************
+ * @def rsync_delta_maxsize()
+ * Returns the largest possible delta for a new file of @b len bytes.
+ * ****************************************************/
+#define rsync_delta_maxsize(len) \
+	((len) + 3 * ((len) / 65535 + 1))
+
+/***************************************************************************************************
+ * @brief Computes the weak checksum of a buffer.
+ * @param data Pointer to the data.
+ * @param len The length of the data, in bytes. At most 65535.
+ * @return The weak checksum, b << 16 | a.
+ **************************************************************************************************/
+uint32_t rsync_weak(const void* data, size_t len);
+
+/***************************************************************************************************
+ * @brief Slides a weak checksum along by one byte.
+ * @param weak The weak checksum of the window.
+ * @param out The byte leaving the window, at its start.
+ * @param in The byte entering the window, just past its end.
+ * @param len The length of the window, in bytes.
+ * @return The weak checksum of the window one byte further on.
+ **************************************************************************************************/
+uint32_t rsync_roll(uint32_t weak, uint8_t out, uint8_t in, size_t len);
+
+/***************************************************************************************************
+ * @brief Computes the signature of a base file.
+ * @param data Pointer to the base.
+ * @param len The length of the base, in bytes.
+ * @param block_len The length of each block, in bytes. RSYNC_MIN_BLOCK to 65535.
+ * @param signature Pointer to a buffer to write the signature to. Must be at least
+ *      rsync_sigsize(len, block_len) bytes large.
+ * @return The number of blocks. 0 if @b block_len is out of range.
+ * @note Only whole blocks are signed; bytes past the last one are always sent as literals.
+ **************************************************************************************************/
+size_t rsync_signature(const void* data, size_t len, size_t block_len, void* signature);
+
+/***************************************************************************************************
+ * @brief Prepares to compute deltas against a signature.
+ * @param ctx Pointer to a delta context.
+ * @param signature Pointer to the signature of the base, from rsync_signature().
+ * @param blocks The number of blocks in the signature. At most 65535.
+ * @param block_len The block length the signature was made with.
+ * @return True if the context was set up. False if @b blocks or @b block_len is out of range.
+ * @note The signature must stay in memory while the context is used.
+ **************************************************************************************************/
+bool rsync_delta_init(rsync_ctx* ctx, const void* signature, size_t blocks, size_t block_len);
+
+/***************************************************************************************************
+ * @brief Computes the delta that turns the base into a new file.
+ * @param ctx Pointer to a delta context.
+ * @param data Pointer to the new file.
+ * @param len The length of the new file, in bytes.
+ * @param delta Pointer to a buffer to write the delta to. Must be at least rsync_delta_maxsize(len) bytes large.
+ * @return The length of the delta, in bytes.
+ **************************************************************************************************/
+size_t rsync_delta(const rsync_ctx* ctx, const void* data, size_t len, void* delta);
+
+/***************************************************************************************************
+ * @brief Rebuilds a new file from the base and a delta.
+ * @param base Pointer to the base.
+ * @param base_len The length of the base, in bytes.
+ * @param block_len The block length the signature was made with.
+ * @param delta Pointer to the delta, from rsync_delta().
+ * @param delta_len The length of the delta, in bytes.
+ * @param out Pointer to a buffer to write the new file to. Must not overlap @b base.
+ * @return The length of the new file, in bytes. SIZE_MAX if the delta is malformed.
+ * @note A delta does not authenticate the new file. Send a hash of it alongside, and check the result.
+ **************************************************************************************************/
+size_t rsync_patch(const void* base, size_t base_len, size_t block_len, const void* delta, size_t delta_len, void* out);
+    
 
 // Miscellaneous Functions
 
@@ -562,6 +2109,71 @@ bool digest_tostring(const void* digest, size_t len, char* hexstr);
  **************************************************************************************************************/
 bool digest_compare(const void* digest1, const void* digest2, size_t len);
 
+/******************************************************
+ * @def HASHLIB_SCRATCH_MIN
+ * The smallest arena hashlib_set_scratch() accepts.
+ * ****************************************************/
+#define HASHLIB_SCRATCH_MIN     1024
+
+/**************************************************************************************************************
+ * @brief Sets a caller-owned arena for the library's scratch memory.
+ *
+ * The routines with large working buffers (aes_encrypt(), aes_decrypt(), hmac_final(), hash_mgf1(),
+ * hmac_pbkdf2(), the RSA, SRP and record layer setup functions, powmod() and powmod_bigexp())
+ * normally build them on the stack and erase the stack on the way out. With an arena set, the
+ * outermost of these calls moves itself, and everything it calls, onto the arena instead.
+ * Nested calls reuse it, and the arena is erased once, when the outermost call returns.
+ *
+ * @param arena Pointer to the arena, or NULL to go back to using the stack.
+ * @param size The size of @b arena, in bytes.
+ * @return True if the arena was set. False if @b size is below HASHLIB_SCRATCH_MIN,
+ *      or if called from within a library routine.
+ * @note The arena must hold the deepest call chain you use, plus room for interrupts.
+ *      1024 bytes covers AES, HMAC and hashing. hmac_pbkdf2(), RSA and powmod_bigexp()
+ *      need up to 2304, and SRP with a 256-byte group about 3072.
+ * @note The arena is only written while a library routine runs, and is left zeroed.
+ **************************************************************************************************************/
+bool hashlib_set_scratch(void* arena, size_t size);
+
+
+/*
+Profiling
+
+Building the library with
+	fasmg -i 'HASHLIB_PROFILE := 1' hashlib.asm hashlib.8xv
+makes hashlib_profile_begin() and hashlib_profile_end() measure how much stack, and how much of the
+scratch arena, the calls between them use. begin fills the free stack and the arena with a known byte,
+and end finds the lowest byte that no longer holds it. The routines that erase the stack or the arena
+on the way out check it first, and erase with the same byte while profiling.
+The benchmark program in examples/hashlib_bench uses them to report the time, stack and scratch use
+of one or two calls from each family of primitives: hashes, MACs, ciphers, public key, the record layer,
+compression, containers and the indexing helpers. The internal functions are not measured on their own.
+*/
+/******************************************************
+ * @typedef hashlib_profile
+ * Memory use reported by hashlib_profile_end().
+ * ****************************************************/
+typedef struct _hashlib_profile {
+    size_t stack;           /**< bytes of stack used below the caller of hashlib_profile_begin() */
+    size_t scratch;         /**< bytes of the scratch arena used, 0 if no arena was set */
+} hashlib_profile;
+
+/**************************************************************************************************************
+ * @brief Starts measuring stack and scratch arena use.
+ * @note Does nothing unless the library was built with HASHLIB_PROFILE.
+ **************************************************************************************************************/
+void hashlib_profile_begin(void);
+
+/**************************************************************************************************************
+ * @brief Reports the stack and scratch arena use since hashlib_profile_begin().
+ * @param report Pointer to a hashlib_profile to fill.
+ * @return True if @b report was filled. False if the library was not built with HASHLIB_PROFILE.
+ * @note The figures include the arguments and return address of each call, anything your own code
+ *      puts on the stack in between, and whatever interrupts push while it runs.
+ * @note Call both from the same function, and set the scratch arena before calling hashlib_profile_begin().
+ **************************************************************************************************************/
+bool hashlib_profile_end(hashlib_profile* report);
+
 
 #ifdef HASHLIB_ENABLE_ADVANCED_MODE
 
@@ -672,6 +2284,31 @@ void powmod(
         uint24_t exp,
         const uint8_t *restrict mod);
 
+/*********************************************************************************************************
+ * @brief Modular Exponentiation function for exponents of any length
+ * @param size The length, in bytes, of the @b base and @b modulus.
+ * @param base Pointer to buffer containing the base, in bytearray (big endian) format.
+ * @param exp Pointer to buffer containing the exponent, in bytearray (big endian) format.
+ * @param mod Pointer to buffer containing the modulus, in bytearray (big endian) format.
+ * @param exp_len The length, in bytes, of @b exp.
+ * @note Uses sliding-window exponentiation, which needs far fewer multiplications than powmod()
+ *      for long exponents, at the cost of up to 12 modulus-sized buffers of stack.
+ * @note A base below 256, such as the generator of a Diffie-Hellman or SRP group, skips the
+ *      window table. Each one bit of the exponent then costs a few additions instead of a
+ *      multiplication, which makes the whole exponentiation about a third faster.
+ * @note For the @b size field, the bounds are [0, 255] with 0 actually meaning 256.
+ * @note @b size must not be 1.
+ * @note @b base must be less than @b modulus.
+ * @note @b modulus must be odd.
+ * @warning The running time depends on the exponent.
+***********************************************************************************************************/
+void powmod_bigexp(
+        uint8_t size,
+        uint8_t *restrict base,
+        const uint8_t *restrict exp,
+        const uint8_t *restrict mod,
+        size_t exp_len);
+
 #endif
 
 #endif
@@ -0,0 +1,799 @@
+"""A small eZ80 (ADL mode) assembler for the fasmg syntax hashlib.asm is written in.
+
+It is not a replacement for fasmg. It knows the parts of the syntax the library uses:
+local labels, `:=` and `=` symbols, macros, virtual, repeat, if/else, db/dw/dl/dd/rb, and
+the eZ80 instructions, including lea, pea, mlt and the 24-bit ld forms. `jq` becomes a jr
+where the target is in reach, as the toolchain's ez80.inc does. include, library and section
+lines are skipped, and the `ti.` symbols come from the caller.
+
+tools/perf_sim.py uses it to run the library without the toolchain.
+"""
+import re
+
+REG8 = {'b': 0, 'c': 1, 'd': 2, 'e': 3, 'h': 4, 'l': 5, 'a': 7}
+IDX8 = {'ixh': ('ix', 4), 'ixl': ('ix', 5), 'iyh': ('iy', 4), 'iyl': ('iy', 5)}
+RP = {'bc': 0, 'de': 1, 'hl': 2, 'sp': 3}
+RP2 = {'bc': 0, 'de': 1, 'hl': 2, 'af': 3}
+CC = {'nz': 0, 'z': 1, 'nc': 2, 'c': 3, 'po': 4, 'pe': 5, 'p': 6, 'm': 7}
+ALU = {'add': 0, 'adc': 1, 'sub': 2, 'sbc': 3, 'and': 4, 'xor': 5, 'or': 6, 'cp': 7}
+ROT = {'rlc': 0, 'rrc': 1, 'rl': 2, 'rr': 3, 'sla': 4, 'sra': 5, 'srl': 7}
+PFX = {'ix': 0xDD, 'iy': 0xFD}
+SUFFIX = {'s': 0x40, 'sis': 0x40, 'lis': 0x49, 'sil': 0x52, 'l': 0x5B, 'lil': 0x5B}
+
+
+class AsmError(Exception):
+    pass
+
+
+class RegOff:
+    def __init__(self, reg, off):
+        self.reg, self.off = reg, off
+
+    def __add__(self, o):
+        if isinstance(o, RegOff):
+            raise AsmError('reg+reg')
+        return RegOff(self.reg, self.off + o)
+
+    __radd__ = __add__
+
+    def __eq__(self, o):
+        return isinstance(o, RegOff) and (self.reg, self.off) == (o.reg, o.off)
+
+    def __hash__(self):
+        return hash((self.reg, self.off))
+
+    def __sub__(self, o):
+        if isinstance(o, RegOff):
+            if o.reg == self.reg:
+                return self.off - o.off
+            raise AsmError('reg-reg')
+        return RegOff(self.reg, self.off - o)
+
+
+class Undefined(Exception):
+    pass
+
+
+def split_operands(s):
+    out, depth, cur, q = [], 0, '', None
+    for ch in s:
+        if q:
+            cur += ch
+            if ch == q:
+                q = None
+            continue
+        if ch in '"\'':
+            q = ch
+            cur += ch
+        elif ch == '(':
+            depth += 1
+            cur += ch
+        elif ch == ')':
+            depth -= 1
+            cur += ch
+        elif ch == ',' and depth == 0:
+            out.append(cur.strip())
+            cur = ''
+        else:
+            cur += ch
+    if cur.strip():
+        out.append(cur.strip())
+    return out
+
+
+def strip_comment(line):
+    q = None
+    for i, ch in enumerate(line):
+        if q:
+            if ch == q:
+                q = None
+        elif ch in '"\'':
+            q = ch
+        elif ch == ';':
+            return line[:i]
+    return line
+
+
+TOK = re.compile(r"\s*(?:(?P<num>\$[0-9a-fA-F]+|0x[0-9a-fA-F]+|[0-9][0-9a-fA-F]*[hH]\b|[0-7]+[oO]\b|[01]+[bB]\b|[0-9]+)"
+                 r"|(?P<chr>'(?:[^']|'')')|(?P<id>[A-Za-z_.?@][A-Za-z0-9_.?@]*)|(?P<dollar>\$)|(?P<op><<|>>|[-+*/()~&|^%]))")
+
+
+class Expr:
+    def __init__(self, asm, text):
+        self.asm = asm
+        self.toks = []
+        pos = 0
+        text = text.strip()
+        while pos < len(text):
+            m = TOK.match(text, pos)
+            if not m or m.end() == pos:
+                if text[pos:].strip() == '':
+                    break
+                raise AsmError('bad expr %r' % text)
+            pos = m.end()
+            k = m.lastgroup
+            self.toks.append((k, m.group(k)))
+        self.i = 0
+
+    def peek(self):
+        return self.toks[self.i] if self.i < len(self.toks) else (None, None)
+
+    def next(self):
+        t = self.peek()
+        self.i += 1
+        return t
+
+    def parse(self):
+        v = self.p_or()
+        if self.i != len(self.toks):
+            raise AsmError('trailing tokens %r' % (self.toks[self.i:],))
+        return v
+
+    def kw(self, *names):
+        k, v = self.peek()
+        if k == 'id' and v.lower() in names:
+            self.i += 1
+            return v.lower()
+        if k == 'op' and v in names:
+            self.i += 1
+            return v
+        return None
+
+    def p_or(self):
+        v = self.p_xor()
+        while self.kw('or', '|'):
+            v = v | self.p_xor()
+        return v
+
+    def p_xor(self):
+        v = self.p_and()
+        while self.kw('xor', '^'):
+            v = v ^ self.p_and()
+        return v
+
+    def p_and(self):
+        v = self.p_shift()
+        while self.kw('and', '&'):
+            v = v & self.p_shift()
+        return v
+
+    def p_shift(self):
+        v = self.p_add()
+        while True:
+            o = self.kw('shl', 'shr', '<<', '>>')
+            if not o:
+                return v
+            r = self.p_add()
+            v = v << r if o in ('shl', '<<') else v >> r
+
+    def p_add(self):
+        v = self.p_mul()
+        while True:
+            o = self.kw('+', '-')
+            if not o:
+                return v
+            r = self.p_mul()
+            v = v + r if o == '+' else v - r
+
+    def p_mul(self):
+        v = self.p_un()
+        while True:
+            o = self.kw('*', '/', 'mod', '%')
+            if not o:
+                return v
+            r = self.p_un()
+            if o == '*':
+                v = v * r
+            elif o == '/':
+                v = int(v / r) if (v < 0) != (r < 0) else v // r
+            else:
+                v = v % r
+        return v
+
+    def p_un(self):
+        o = self.kw('-', '+', '~', 'not', 'bsr', 'bsf', 'defined')
+        if o == '-':
+            return -self.p_un()
+        if o == '+':
+            return self.p_un()
+        if o in ('~', 'not'):
+            v = self.p_un()
+            # fasmg: ~ on a condition is logical not
+            return (0 if v else 1) if v in (0, 1) else ~v
+        if o == 'bsr':
+            v = self.p_un()
+            return v.bit_length() - 1
+        if o == 'bsf':
+            v = self.p_un()
+            return (v & -v).bit_length() - 1
+        if o == 'defined':
+            k, v = self.next()
+            return 1 if self.asm.is_defined(v) else 0
+        return self.p_atom()
+
+    def p_atom(self):
+        k, v = self.next()
+        if k == 'num':
+            return parse_num(v)
+        if k == 'chr':
+            return ord(v[1])
+        if k == 'dollar':
+            return self.asm.pc
+        if k == 'op' and v == '(':
+            r = self.p_or()
+            if self.next() != ('op', ')'):
+                raise AsmError('missing )')
+            return r
+        if k == 'id':
+            return self.asm.lookup(v)
+        raise AsmError('unexpected %r' % (v,))
+
+
+def parse_num(v):
+    if v.startswith('$'):
+        return int(v[1:], 16)
+    lv = v.lower()
+    if lv.startswith('0x'):
+        return int(v[2:], 16)
+    if lv.endswith('h'):
+        return int(v[:-1], 16)
+    if lv.endswith('o'):
+        return int(v[:-1], 8)
+    if lv.endswith('b') and re.fullmatch('[01]+', v[:-1]):
+        return int(v[:-1], 2)
+    return int(v)
+
+
+class Assembler:
+    def __init__(self, base, symbols=None, defines=None):
+        self.base = base
+        self.ext = dict(symbols or {})
+        self.defines = dict(defines or {})
+
+    def is_defined(self, name):
+        name = self.resolve_name(name)
+        return name in self.syms or name in self.ext or name in self.defines
+
+    def resolve_name(self, name):
+        name = name.lstrip('?')
+        if name == '.':
+            return self.scope
+        if name.startswith('.'):
+            return self.scope + name
+        return name
+
+    def lookup(self, name):
+        low = name.lower()
+        if low in ('long',):
+            return 3
+        if low in ('byte',):
+            return 1
+        if low in ('word',):
+            return 2
+        if low in ('ix', 'iy'):
+            return RegOff(low, 0)
+        full = self.resolve_name(name)
+        for tbl in (self.syms, self.defines, self.ext):
+            if full in tbl:
+                return tbl[full]
+        if self.final:
+            raise AsmError('undefined symbol %s' % full)
+        raise Undefined(full)
+
+    def ev(self, text):
+        try:
+            return Expr(self, text).parse()
+        except Undefined:
+            if self.final:
+                raise
+            return 0
+
+    # ---------------------------------------------------------------
+    def load(self, text):
+        lines = text.split('\n')
+        self.macros = {}
+        self.src = []
+        # collect macros and expand (single level + nested expansions)
+        i = 0
+        raw = []
+        while i < len(lines):
+            ln = strip_comment(lines[i]).rstrip()
+            st = ln.strip()
+            m = re.match(r'macro\s+\??([A-Za-z_][A-Za-z0-9_]*)\??\s*(.*)$', st, re.I)
+            if m:
+                name = m.group(1).lower()
+                params = [p.strip().rstrip('*') for p in m.group(2).split(',') if p.strip()]
+                body = []
+                i += 1
+                while not re.match(r'\s*end\s+macro', lines[i], re.I):
+                    body.append(strip_comment(lines[i]).rstrip())
+                    i += 1
+                self.macros[name] = (params, body)
+                i += 1
+                continue
+            raw.append((i + 1, ln))
+            i += 1
+        self.src = self.expand(raw, 0)
+
+    def expand(self, raw, depth):
+        out = []
+        for lno, ln in raw:
+            st = ln.strip()
+            m = re.match(r'([A-Za-z_][A-Za-z0-9_]*)\??(\s+(.*))?$', st)
+            if m and m.group(1).lower() in self.macros:
+                params, body = self.macros[m.group(1).lower()]
+                args = split_operands(m.group(3) or '')
+                sub = []
+                for b in body:
+                    for p, a in zip(params, args):
+                        b = re.sub(r'(?<![A-Za-z0-9_.])' + re.escape(p) + r'(?![A-Za-z0-9_])', a, b)
+                    for p in params[len(args):]:
+                        b = re.sub(r'(?<![A-Za-z0-9_.])' + re.escape(p) + r'(?![A-Za-z0-9_])', '', b)
+                    sub.append((lno, b))
+                out.extend(self.expand(sub, depth + 1))
+            else:
+                out.append((lno, ln))
+        return out
+
+    # ---------------------------------------------------------------
+    def assemble(self):
+        self.syms = {}
+        self.jq_short = []
+        prev = None
+        for _ in range(50):
+            self.final = False
+            self.run_pass()
+            if self.syms == prev:
+                break
+            prev = dict(self.syms)
+        else:
+            raise AsmError('symbols do not settle')
+        self.final = True
+        self.run_pass()
+        return bytes(self.out)
+
+    def run_pass(self):
+        self.pc = self.base
+        self.jq_count = 0
+        self.out = bytearray()
+        self.scope = ''
+        self.virt = []
+        self.cond = []
+        self.run_lines(self.src)
+
+    def active(self):
+        return all(c[0] for c in self.cond)
+
+    def run_lines(self, lines):
+        i = 0
+        while i < len(lines):
+            lno, ln = lines[i]
+            st = ln.strip()
+            low = st.lower()
+            i += 1
+            # conditionals
+            m = re.match(r'if\s+(.*)$', st, re.I)
+            if m and not low.startswith('if\t') or (m and low.startswith('if\t')):
+                if m:
+                    if self.active():
+                        v = bool(self.ev_cond(m.group(1)))
+                        self.cond.append([v, v])
+                    else:
+                        self.cond.append([False, True])
+                    continue
+            m = re.match(r'else\s+if\s+(.*)$', st, re.I)
+            if m:
+                c = self.cond[-1]
+                parent = all(x[0] for x in self.cond[:-1])
+                if c[1] or not parent:
+                    c[0] = False
+                else:
+                    v = bool(self.ev_cond(m.group(1)))
+                    c[0] = v
+                    c[1] = v
+                continue
+            if low == 'else':
+                c = self.cond[-1]
+                c[0] = not c[1]
+                c[1] = True
+                continue
+            if re.match(r'end\s+if$', low):
+                self.cond.pop()
+                continue
+            m = re.match(r'repeat\s+(.*)$', st, re.I)
+            if m:
+                depth, j, body = 1, i, []
+                while True:
+                    l2 = lines[j][1].strip().lower()
+                    if re.match(r'repeat\s', l2):
+                        depth += 1
+                    elif re.match(r'end\s+repeat$', l2):
+                        depth -= 1
+                        if depth == 0:
+                            break
+                    body.append(lines[j])
+                    j += 1
+                i = j + 1
+                if self.active():
+                    spec = m.group(1)
+                    mm = re.match(r'(.*?)\s*,\s*(\w+)\s*:\s*(.*)$', spec)
+                    if mm:
+                        n = self.ev(mm.group(1)); var = mm.group(2); start = self.ev(mm.group(3))
+                    else:
+                        n = self.ev(spec); var = None; start = 1
+                    for k in range(n):
+                        val = str(start + k)
+                        sub = []
+                        for l3, b in body:
+                            b = re.sub(r'%(?![0-9A-Za-z])', val, b)
+                            if var:
+                                b = re.sub(r'(?<![A-Za-z0-9_.])' + var + r'(?![A-Za-z0-9_])', val, b)
+                            sub.append((l3, b))
+                        self.run_lines(sub)
+                continue
+            if not self.active() or not st:
+                continue
+            try:
+                self.line(st)
+            except AsmError as e:
+                raise AsmError('line %d: %s: %s' % (lno, st, e))
+
+    def ev_cond(self, t):
+        t = t.strip()
+        m = re.match(r'(.*?)\s*(=|<>|<=|>=|<|>)\s*(.*)$', t)
+        if m and not t.lower().startswith('defined'):
+            a, op, b = self.ev(m.group(1)), m.group(2), self.ev(m.group(3))
+            return {'=': a == b, '<>': a != b, '<': a < b, '>': a > b, '<=': a <= b, '>=': a >= b}[op]
+        return self.ev(t)
+
+    def define(self, name, val, redefinable=False):
+        full = self.resolve_name(name)
+        self.syms[full] = val
+
+    def emit(self, bs):
+        if self.virt:
+            self.pc += len(bs)
+            return
+        self.out.extend(b & 0xFF for b in bs)
+        self.pc += len(bs)
+
+    def line(self, st):
+        # label definitions
+        m = re.match(r'([A-Za-z_.?@][A-Za-z0-9_.?@]*)\s*(:=|=)\s*(.*)$', st)
+        if m and not re.match(r'(ld|add)\b', st, re.I):
+            self.define(m.group(1), self.ev(m.group(3)))
+            return
+        m = re.match(r'([A-Za-z_.?@][A-Za-z0-9_.?@]*):(?!=)\s*(.*)$', st)
+        if m:
+            name = m.group(1).lstrip('?')
+            if not name.startswith('.'):
+                self.scope = name
+            self.define(name, self.pc)
+            rest = m.group(2).strip()
+            if rest:
+                self.line(rest)
+            return
+        m = re.match(r'([A-Za-z_.?@][A-Za-z0-9_.?@]*)\s+(rb|db|dw|dl|dd)\b\s*(.*)$', st, re.I)
+        if m and m.group(1).lower() not in ('db', 'dl', 'dd', 'dw', 'rb'):
+            name = m.group(1).lstrip('?')
+            self.define(name, self.pc)
+            self.line(m.group(2) + ' ' + m.group(3))
+            return
+        parts = st.split(None, 1)
+        mn = parts[0].lower()
+        rest = parts[1] if len(parts) > 1 else ''
+        if mn in ('include', 'library', 'section'):
+            return
+        if mn == 'export':
+            return
+        if mn == 'virtual':
+            mm = re.match(r'at\s+(.*)', rest, re.I)
+            self.virt.append(self.pc)
+            self.pc = self.ev(mm.group(1))
+            return
+        if mn == 'end' and rest.lower().strip() == 'virtual':
+            self.pc = self.virt.pop()
+            return
+        if mn in ('db', 'dw', 'dl', 'dd'):
+            size = {'db': 1, 'dw': 2, 'dl': 3, 'dd': 4}[mn]
+            for item in split_operands(rest):
+                mm = re.match(r'(.*?)\s+dup\s+(.*)$', item, re.I)
+                if mm:
+                    n = self.ev(mm.group(1))
+                    inner = mm.group(2).strip()
+                    if inner.startswith('(') and inner.endswith(')'):
+                        inner = inner[1:-1]
+                    vals = [self.ev(x) for x in split_operands(inner)]
+                    for _ in range(n):
+                        for v in vals:
+                            self.emit(v.to_bytes(size, 'little', signed=False) if v >= 0 else (v & ((1 << (8 * size)) - 1)).to_bytes(size, 'little'))
+                    continue
+                if item[0] in '"\'' and item[-1] == item[0] and len(item) >= 2:
+                    s = item[1:-1].replace(item[0] * 2, item[0])
+                    for ch in s:
+                        self.emit((ord(ch) & 0xff).to_bytes(size, 'little'))
+                    continue
+                v = self.ev(item)
+                self.emit((v & ((1 << (8 * size)) - 1)).to_bytes(size, 'little'))
+            return
+        if mn == 'rb':
+            n = self.ev(rest)
+            self.emit([0] * n)
+            return
+        if mn == 'align':
+            n = self.ev(rest)
+            while self.pc % n:
+                self.emit([0])
+            return
+        if mn in ('assert', 'display', 'err'):
+            return
+        self.emit(self.encode(mn, split_operands(rest)))
+
+    # ---------------------------------------------------------------
+    def operand(self, o):
+        """classify operand"""
+        lo = o.lower().replace(' ', '')
+        if lo in REG8:
+            return ('r', REG8[lo])
+        if lo in IDX8:
+            return ('ir', IDX8[lo])
+        if lo in CC:
+            return ('cc', lo)
+        if lo in ('bc', 'de', 'hl', 'sp', 'af', 'ix', 'iy', "af'", 'i', 'r', 'mb'):
+            return ('rr', lo)
+        if o.startswith('(') and self._balanced(o):
+            inner = o[1:-1].strip()
+            il = inner.lower().replace(' ', '')
+            if il in ('hl', 'bc', 'de', 'sp', 'c'):
+                return ('ind', il)
+            if il in ('ix', 'iy'):
+                return ('idx', il, 0)
+            v = self.ev(inner)
+            if isinstance(v, RegOff):
+                return ('idx', v.reg, v.off)
+            return ('mem', v)
+        # lea style ix+d
+        v = self.ev(o)
+        if isinstance(v, RegOff):
+            return ('ro', v.reg, v.off)
+        return ('imm', v)
+
+    @staticmethod
+    def _balanced(o):
+        if not (o.startswith('(') and o.endswith(')')):
+            return False
+        d = 0
+        for k, ch in enumerate(o):
+            if ch == '(':
+                d += 1
+            elif ch == ')':
+                d -= 1
+                if d == 0 and k != len(o) - 1:
+                    return False
+        return True
+
+    @staticmethod
+    def l24(v):
+        v &= 0xFFFFFF
+        return [v & 255, (v >> 8) & 255, v >> 16]
+
+    def encode(self, mn, ops):
+        suffix = None
+        if '.' in mn:
+            mn, suffix = mn.split('.', 1)
+        code = self.enc(mn, ops)
+        if suffix:
+            code = [SUFFIX[suffix]] + code
+        return code
+
+    def enc(self, mn, ops):
+        O = [self.operand(o) for o in ops]
+        if mn in ('push', 'pop') and len(O) > 1:
+            code = []
+            for o in ops:
+                code += self.enc(mn, [o])
+            return code
+        if mn == 'nop': return [0]
+        if mn == 'ret':
+            if not O: return [0xC9]
+            return [0xC0 | CC[ops[0].lower()] << 3]
+        if mn == 'jq':
+            target = O[-1][1]
+            if (len(O) == 1 or ops[0].lower() in ('nz', 'z', 'nc', 'c')) and isinstance(target, int) \
+                    and self.near(target):
+                return self.enc('jr', ops)
+            mn = 'jp'
+        if mn in ('jp', 'call'):
+            if len(O) == 1:
+                if O[0][0] == 'ind' and O[0][1] == 'hl': return [0xE9]
+                if O[0][0] == 'idx': return [PFX[O[0][1]], 0xE9]
+                return [0xC3 if mn != 'call' else 0xCD] + self.l24(O[0][1])
+            cc = CC[ops[0].lower()]
+            return [(0xC2 if mn != 'call' else 0xC4) | cc << 3] + self.l24(O[1][1])
+        if mn == 'jr':
+            if len(O) == 1:
+                return [0x18, self.rel(O[0][1], 2)]
+            return [0x20 | CC[ops[0].lower()] << 3, self.rel(O[1][1], 2)]
+        if mn == 'djnz':
+            return [0x10, self.rel(O[0][1], 2)]
+        if mn == 'rst': return [0xC7 | O[0][1]]
+        simple = {'rlca': [7], 'rrca': [0xF], 'rla': [0x17], 'rra': [0x1F], 'daa': [0x27], 'cpl': [0x2F], 'scf': [0x37],
+                  'ccf': [0x3F], 'exx': [0xD9], 'di': [0xF3], 'ei': [0xFB], 'halt': [0x76], 'neg': [0xED, 0x44],
+                  'ldi': [0xED, 0xA0], 'cpi': [0xED, 0xA1], 'ldd': [0xED, 0xA8], 'cpd': [0xED, 0xA9], 'ldir': [0xED, 0xB0],
+                  'cpir': [0xED, 0xB1], 'lddr': [0xED, 0xB8], 'cpdr': [0xED, 0xB9], 'reti': [0xED, 0x4D], 'retn': [0xED, 0x45]}
+        if mn in simple and not O: return simple[mn]
+        if mn == 'ex':
+            a, b = [x.lower().replace(' ', '') for x in ops]
+            if {a, b} == {'de', 'hl'}: return [0xEB]
+            if a == 'af': return [0x08]
+            if a == '(sp)': return ([PFX[b]] if b in PFX else []) + [0xE3]
+        if mn in ('push', 'pop'):
+            base = 0xC5 if mn == 'push' else 0xC1
+            r = ops[0].lower()
+            if r in PFX: return [PFX[r], base | 0x20]
+            return [base | RP2[r] << 4]
+        if mn == 'mlt': return [0xED, 0x4C | RP[ops[0].lower()] << 4]
+        if mn == 'lea':
+            dst = ops[0].lower(); src = O[1]
+            if src[0] != 'ro':
+                src = ('ro',) + (src[1], 0) if src[0] == 'rr' else src
+            reg, off = src[1], src[2]
+            if reg == 'ix':
+                t = {'bc': 0x02, 'de': 0x12, 'hl': 0x22, 'ix': 0x32, 'iy': 0x55}[dst]
+            else:
+                t = {'bc': 0x03, 'de': 0x13, 'hl': 0x23, 'iy': 0x33, 'ix': 0x54}[dst]
+            return [0xED, t, disp(off)]
+        if mn == 'pea':
+            src = O[0]
+            if src[0] == 'rr':
+                src = ('ro', src[1], 0)
+            return [0xED, 0x65 if src[1] == 'ix' else 0x66, disp(src[2])]
+        if mn == 'tst':
+            if len(O) == 2: O = O[1:]
+            if O[0][0] == 'imm': return [0xED, 0x64, O[0][1] & 255]
+            if O[0][0] == 'r': return [0xED, 0x04 | O[0][1] << 3]
+            if O[0][0] == 'ind': return [0xED, 0x34]
+        if mn in ('im',):
+            return [0xED, {0: 0x46, 1: 0x56, 2: 0x5E}[O[0][1]]]
+        if mn in ALU:
+            op = ALU[mn]
+            if len(O) == 2 and O[0] == ('r', 7):
+                src = O[1]
+            elif len(O) == 1:
+                src = O[0]
+            else:
+                dst = ops[0].lower()
+                rr = ops[1].lower()
+                if dst == 'hl':
+                    if mn == 'add': return [0x09 | RP[rr] << 4]
+                    if mn == 'adc': return [0xED, 0x4A | RP[rr] << 4]
+                    if mn == 'sbc': return [0xED, 0x42 | RP[rr] << 4]
+                if dst in PFX and mn == 'add':
+                    rr = 'hl' if rr == dst else rr
+                    return [PFX[dst], 0x09 | RP[rr] << 4]
+                raise AsmError('bad alu')
+            return self.r8op(src, lambda r: 0x80 | op << 3 | r, lambda: [0xC6 | op << 3])
+        if mn in ('inc', 'dec'):
+            o = O[0]
+            lo = ops[0].lower()
+            if lo in RP: return [(0x03 if mn == 'inc' else 0x0B) | RP[lo] << 4]
+            if lo in PFX: return [PFX[lo], 0x23 if mn == 'inc' else 0x2B]
+            return self.r8op(o, lambda r: (0x04 if mn == 'inc' else 0x05) | r << 3, None)
+        if mn in ROT:
+            return self.cbop(O[-1], ROT[mn] << 3)
+        if mn in ('bit', 'set', 'res'):
+            b = O[0][1]
+            base = {'bit': 0x40, 'res': 0x80, 'set': 0xC0}[mn]
+            return self.cbop(O[1], base | b << 3)
+        if mn == 'ld':
+            return self.ld(ops, O)
+        raise AsmError('unknown instruction %s %s' % (mn, ops))
+
+    def near(self, target):
+        # every jq starts out as a jp, and one that became a jr stays one: code only ever
+        # shrinks from pass to pass, so a jump in reach stays in reach
+        k = self.jq_count
+        self.jq_count += 1
+        if k == len(self.jq_short):
+            self.jq_short.append(False)
+        if not self.jq_short[k] and not self.final and -128 <= target - (self.pc + 2) <= 127:
+            self.jq_short[k] = True
+        return self.jq_short[k]
+
+    def rel(self, target, size):
+        d = target - (self.pc + size)
+        if self.final and not -128 <= d <= 127:
+            raise AsmError('jr out of range')
+        return d & 255
+
+    def r8op(self, o, f, imm):
+        if o[0] == 'r': return [f(o[1])]
+        if o[0] == 'ind' and o[1] == 'hl': return [f(6)]
+        if o[0] == 'ir': return [PFX[o[1][0]], f(o[1][1])]
+        if o[0] == 'idx': return [PFX[o[1]], f(6), disp(o[2])]
+        if o[0] == 'imm' and imm: return imm() + [o[1] & 255]
+        raise AsmError('bad operand %r' % (o,))
+
+    def cbop(self, o, op):
+        if o[0] == 'r': return [0xCB, op | o[1]]
+        if o[0] == 'ind': return [0xCB, op | 6]
+        if o[0] == 'idx': return [PFX[o[1]], 0xCB, disp(o[2]), op | 6]
+        raise AsmError('bad cb operand')
+
+    def ld(self, ops, O):
+        a, b = O
+        la, lb = ops[0].lower().replace(' ', ''), ops[1].lower().replace(' ', '')
+        # 8 bit reg/reg
+        r8like = lambda o: o[0] in ('r', 'ir') or (o[0] == 'ind' and o[1] == 'hl') or o[0] == 'idx'
+        if la == 'a' and lb == 'i': return [0xED, 0x57]
+        if la == 'i' and lb == 'a': return [0xED, 0x47]
+        if la == 'a' and lb == 'r': return [0xED, 0x5F]
+        if la == 'a' and b[0] == 'ind' and b[1] in ('bc', 'de'): return [0x0A if b[1] == 'bc' else 0x1A]
+        if lb == 'a' and a[0] == 'ind' and a[1] in ('bc', 'de'): return [0x02 if a[1] == 'bc' else 0x12]
+        if la == 'a' and b[0] == 'mem': return [0x3A] + self.l24(b[1])
+        if lb == 'a' and a[0] == 'mem': return [0x32] + self.l24(a[1])
+        if a[0] in ('r', 'ir', 'idx') or (a[0] == 'ind' and a[1] == 'hl' and (b[0] in ('r', 'imm'))):
+            if b[0] == 'imm':
+                if a[0] == 'idx': return self._ldimm(a, b[1])
+                return self.r8op(a, lambda r: 0x06 | r << 3, None) + [b[1] & 255]
+            if r8like(b) and not (a[0] in ('idx',) and b[0] == 'idx'):
+                # determine prefix
+                pf = None
+                ra = rb = None
+                d = None
+                for o, which in ((a, 'a'), (b, 'b')):
+                    if o[0] == 'r': r = o[1]
+                    elif o[0] == 'ind': r = 6
+                    elif o[0] == 'ir':
+                        pf = PFX[o[1][0]]; r = o[1][1]
+                    else:
+                        pf = PFX[o[1]]; r = 6; d = disp(o[2])
+                    if which == 'a': ra = r
+                    else: rb = r
+                code = ([pf] if pf else []) + [0x40 | ra << 3 | rb]
+                if d is not None: code.append(d)
+                return code
+        # 16/24 bit
+        if la in RP and b[0] == 'imm': return [0x01 | RP[la] << 4] + self.l24(b[1])
+        if la in PFX and b[0] == 'imm': return [PFX[la], 0x21] + self.l24(b[1])
+        if la == 'hl' and b[0] == 'mem': return [0x2A] + self.l24(b[1])
+        if lb == 'hl' and a[0] == 'mem': return [0x22] + self.l24(a[1])
+        if la in PFX and b[0] == 'mem': return [PFX[la], 0x2A] + self.l24(b[1])
+        if lb in PFX and a[0] == 'mem': return [PFX[lb], 0x22] + self.l24(a[1])
+        if la in RP and b[0] == 'mem': return [0xED, 0x4B | RP[la] << 4] + self.l24(b[1])
+        if lb in RP and a[0] == 'mem': return [0xED, 0x43 | RP[lb] << 4] + self.l24(a[1])
+        if la == 'sp' and lb == 'hl': return [0xF9]
+        if la == 'sp' and lb in PFX: return [PFX[lb], 0xF9]
+        # eZ80 ld rr,(hl)
+        if b[0] == 'ind' and b[1] == 'hl':
+            if la in ('bc', 'de', 'hl'): return [0xED, 0x07 | RP[la] << 4]
+            if la == 'ix': return [0xED, 0x37]
+            if la == 'iy': return [0xED, 0x31]
+        if a[0] == 'ind' and a[1] == 'hl':
+            if lb in ('bc', 'de', 'hl'): return [0xED, 0x0F | RP[lb] << 4]
+            if lb == 'ix': return [0xED, 0x3F]
+            if lb == 'iy': return [0xED, 0x3E]
+        if b[0] == 'idx':
+            base = b[1]
+            if la in ('bc', 'de', 'hl'): return [PFX[base], 0x07 | RP[la] << 4, disp(b[2])]
+            if la == base: return [PFX[base], 0x37, disp(b[2])]
+            if la in PFX: return [PFX[base], 0x31, disp(b[2])]
+        if a[0] == 'idx':
+            base = a[1]
+            if lb in ('bc', 'de', 'hl'): return [PFX[base], 0x0F | RP[lb] << 4, disp(a[2])]
+            if lb == base: return [PFX[base], 0x3F, disp(a[2])]
+            if lb in PFX: return [PFX[base], 0x3E, disp(a[2])]
+        raise AsmError('bad ld %s' % (ops,))
+
+    def _ldimm(self, a, v):
+        if a[0] == 'r': return [0x06 | a[1] << 3, v & 255]
+        if a[0] == 'ind': return [0x36, v & 255]
+        if a[0] == 'ir': return [PFX[a[1][0]], 0x06 | a[1][1] << 3, v & 255]
+        if a[0] == 'idx': return [PFX[a[1]], 0x36, disp(a[2]), v & 255]
+        raise AsmError('bad ld imm')
+
+
+def disp(d):
+    if not -128 <= d <= 127:
+        raise AsmError('displacement out of range %d' % d)
+    return d & 255
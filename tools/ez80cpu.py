@@ -0,0 +1,551 @@
+"""An eZ80 CPU in ADL mode, enough of one to run hashlib.
+
+There are no interrupts, no I/O ports and no Z80 mode. A `.s` or `.l` suffix only changes the
+width of 16/24-bit adds and subtracts, which is all the library uses suffixes for.
+
+`cycles` counts one for each byte fetched, read or written, plus the extra cycles of mlt. That
+is the eZ80's timing with zero wait states, near enough to see a routine get faster or slower,
+but not a cycle-exact model of the calculator. `steps` counts instructions.
+
+`hooks` maps addresses to Python functions that run instead of the code there, for the OS and
+bootcode routines the library calls.
+"""
+
+S, Z, H, PV, N, C = 0x80, 0x40, 0x10, 0x04, 0x02, 0x01
+M24 = 0xFFFFFF
+
+
+def parity(v):
+    return PV if bin(v & 255).count('1') % 2 == 0 else 0
+
+
+class CPU:
+    def __init__(self, mem=None):
+        self.mem = mem if mem is not None else bytearray(1 << 24)
+        self.a = self.f = 0
+        self.bc = self.de = self.hl = self.ix = self.iy = 0
+        self.sp = 0xD1A87E
+        self.pc = 0
+        self.i = 0
+        self.iff = 1
+        self.hooks = {}
+        self.cycles = 0
+        self.steps = 0
+        self.short = False
+        self.min_sp = self.sp
+        self.alt = (0, 0, 0)
+        self.alt_af = (0, 0)
+
+    # memory
+    def rb(self, a):
+        self.cycles += 1
+        return self.mem[a & M24]
+
+    def wb(self, a, v):
+        self.cycles += 1
+        self.mem[a & M24] = v & 255
+
+    def r24(self, a):
+        m = self.mem
+        self.cycles += 3
+        return m[a & M24] | m[(a + 1) & M24] << 8 | m[(a + 2) & M24] << 16
+
+    def w24(self, a, v):
+        self.wb(a, v)
+        self.wb(a + 1, v >> 8)
+        self.wb(a + 2, v >> 16)
+
+    def push(self, v):
+        self.sp = (self.sp - 3) & M24
+        if self.sp < self.min_sp:
+            self.min_sp = self.sp
+        self.w24(self.sp, v)
+
+    def pop(self):
+        v = self.r24(self.sp)
+        self.sp = (self.sp + 3) & M24
+        return v
+
+    def fetch(self):
+        v = self.mem[self.pc]
+        self.pc = (self.pc + 1) & M24
+        self.cycles += 1
+        return v
+
+    def fetch24(self):
+        v = self.r24(self.pc)
+        self.pc = (self.pc + 3) & M24
+        return v
+
+    def fetchd(self):
+        d = self.fetch()
+        return d - 256 if d > 127 else d
+
+    # 8-bit regs
+    def get8(self, r, pf=None):
+        if r == 0: return self.bc >> 8 & 255
+        if r == 1: return self.bc & 255
+        if r == 2: return self.de >> 8 & 255
+        if r == 3: return self.de & 255
+        if r == 4:
+            if pf == 'ix': return self.ix >> 8 & 255
+            if pf == 'iy': return self.iy >> 8 & 255
+            return self.hl >> 8 & 255
+        if r == 5:
+            if pf == 'ix': return self.ix & 255
+            if pf == 'iy': return self.iy & 255
+            return self.hl & 255
+        if r == 7: return self.a
+        raise ValueError
+
+    def set8(self, r, v, pf=None):
+        v &= 255
+        if r == 0: self.bc = self.bc & 0xFF00FF | v << 8
+        elif r == 1: self.bc = self.bc & 0xFFFF00 | v
+        elif r == 2: self.de = self.de & 0xFF00FF | v << 8
+        elif r == 3: self.de = self.de & 0xFFFF00 | v
+        elif r == 4:
+            if pf == 'ix': self.ix = self.ix & 0xFF00FF | v << 8
+            elif pf == 'iy': self.iy = self.iy & 0xFF00FF | v << 8
+            else: self.hl = self.hl & 0xFF00FF | v << 8
+        elif r == 5:
+            if pf == 'ix': self.ix = self.ix & 0xFFFF00 | v
+            elif pf == 'iy': self.iy = self.iy & 0xFFFF00 | v
+            else: self.hl = self.hl & 0xFFFF00 | v
+        elif r == 7: self.a = v
+        else: raise ValueError
+
+    def getrp(self, p, pf=None):
+        if p == 0: return self.bc
+        if p == 1: return self.de
+        if p == 2: return self.ix if pf == 'ix' else self.iy if pf == 'iy' else self.hl
+        return self.sp
+
+    def setrp(self, p, v, pf=None):
+        v &= M24
+        if p == 0: self.bc = v
+        elif p == 1: self.de = v
+        elif p == 2:
+            if pf == 'ix': self.ix = v
+            elif pf == 'iy': self.iy = v
+            else: self.hl = v
+        else: self.sp = v
+
+    def cond(self, cc):
+        f = self.f
+        return [not f & Z, bool(f & Z), not f & C, bool(f & C), not f & PV, bool(f & PV), not f & S, bool(f & S)][cc]
+
+    # ALU
+    def alu(self, op, v):
+        a = self.a
+        if op in (0, 1):
+            c = 1 if op == 1 and self.f & C else 0
+            r = a + v + c
+            f = (r & 0x80) | (Z if r & 255 == 0 else 0) | (H if (a & 15) + (v & 15) + c > 15 else 0)
+            f |= PV if ((a ^ ~v) & (a ^ r) & 0x80) else 0
+            f |= C if r > 255 else 0
+            self.a = r & 255; self.f = f
+        elif op in (2, 3, 7):
+            c = 1 if op == 3 and self.f & C else 0
+            r = a - v - c
+            f = (r & 0x80) | (Z if r & 255 == 0 else 0) | N | (H if (a & 15) - (v & 15) - c < 0 else 0)
+            f |= PV if ((a ^ v) & (a ^ r) & 0x80) else 0
+            f |= C if r < 0 else 0
+            self.f = f
+            if op != 7:
+                self.a = r & 255
+        elif op == 4:
+            self.a &= v; self.f = (self.a & 0x80) | (Z if self.a == 0 else 0) | H | parity(self.a)
+        elif op == 5:
+            self.a ^= v; self.f = (self.a & 0x80) | (Z if self.a == 0 else 0) | parity(self.a)
+        elif op == 6:
+            self.a |= v; self.f = (self.a & 0x80) | (Z if self.a == 0 else 0) | parity(self.a)
+
+    def inc8(self, v, d):
+        r = (v + d) & 255
+        f = self.f & C
+        f |= (r & 0x80) | (Z if r == 0 else 0)
+        if d == 1:
+            f |= PV if v == 0x7F else 0
+            f |= H if (v & 15) == 15 else 0
+        else:
+            f |= N | (PV if v == 0x80 else 0) | (H if (v & 15) == 0 else 0)
+        self.f = f
+        return r
+
+    def rot(self, op, v):
+        c = self.f & C
+        if op == 0: c = v >> 7; v = (v << 1 | c) & 255
+        elif op == 1: c = v & 1; v = (v >> 1 | c << 7) & 255
+        elif op == 2: nc = v >> 7; v = (v << 1 | c) & 255; c = nc
+        elif op == 3: nc = v & 1; v = (v >> 1 | c << 7) & 255; c = nc
+        elif op == 4: c = v >> 7; v = (v << 1) & 255
+        elif op == 5: c = v & 1; v = (v >> 1) | (v & 0x80)
+        elif op == 6: c = v >> 7; v = (v << 1 | 1) & 255
+        elif op == 7: c = v & 1; v >>= 1
+        self.f = (v & 0x80) | (Z if v == 0 else 0) | parity(v) | (C if c else 0)
+        return v
+
+    def add24(self, x, y, carry=0, full=False, sub=False):
+        mask = 0xFFFF if self.short else M24
+        top = 0x8000 if self.short else 0x800000
+        x &= mask; y &= mask
+        if sub:
+            r = x - y - carry
+            res = r & mask
+            f = N | (C if r < 0 else 0)
+            if full:
+                f |= (S if res & top else 0) | (Z if res == 0 else 0) | (PV if ((x ^ y) & (x ^ res) & top) else 0)
+            else:
+                f = (self.f & (S | Z | PV)) | f
+        else:
+            r = x + y + carry
+            res = r & mask
+            f = C if r > mask else 0
+            if full:
+                f |= (S if res & top else 0) | (Z if res == 0 else 0) | (PV if ((x ^ ~y) & (x ^ res) & top) else 0)
+            else:
+                f = (self.f & (S | Z | PV)) | f
+        self.f = f
+        return res
+
+    # ------------------------------------------------------------------
+    def run(self, until, max_steps=1_000_000_000):
+        while self.pc != until:
+            if self.pc in self.hooks:
+                self.hooks[self.pc](self)
+                continue
+            self.step()
+            self.steps += 1
+            if self.steps > max_steps:
+                raise RuntimeError('step limit')
+
+    def step(self):
+        op = self.fetch()
+        if op in (0x40, 0x49, 0x52, 0x5B):
+            self.short = op in (0x40, 0x52)
+            # suffix only meaningful for next instruction
+            op = self.fetch()
+            try:
+                self.exec(op, None)
+            finally:
+                self.short = False
+            return
+        self.exec(op, None)
+
+    def addr_hl(self, pf):
+        if pf is None:
+            return self.hl
+        d = self.fetchd()
+        return ((self.ix if pf == 'ix' else self.iy) + d) & M24
+
+    def exec(self, op, pf):
+        x, y, z = op >> 6, (op >> 3) & 7, op & 7
+        p, q = y >> 1, y & 1
+        if op == 0xDD or op == 0xFD:
+            npf = 'ix' if op == 0xDD else 'iy'
+            op2 = self.fetch()
+            return self.exec_idx(op2, npf)
+        if op == 0xCB:
+            return self.exec_cb(None)
+        if op == 0xED:
+            return self.exec_ed()
+        if x == 1:
+            if op == 0x76:
+                raise RuntimeError('halt')
+            # ld r,r'
+            if z == 6:
+                v = self.rb(self.addr_hl(pf))
+                self.set8(y, v)
+            elif y == 6:
+                a = self.addr_hl(pf)
+                self.wb(a, self.get8(z))
+            else:
+                self.set8(y, self.get8(z, pf), pf)
+            return
+        if x == 2:
+            if z == 6:
+                v = self.rb(self.addr_hl(pf))
+            else:
+                v = self.get8(z, pf)
+            self.alu(y, v)
+            return
+        if x == 0:
+            if z == 0:
+                if y == 0: return
+                if y == 1:
+                    (self.a, self.f), self.alt_af = self.alt_af, (self.a, self.f)
+                    return
+                if y == 2:
+                    d = self.fetchd()
+                    b = ((self.bc >> 8) - 1) & 255
+                    self.set8(0, b)
+                    if b: self.pc = (self.pc + d) & M24
+                    return
+                d = self.fetchd()
+                if y == 3 or self.cond(y - 4):
+                    self.pc = (self.pc + d) & M24
+                return
+            if z == 1:
+                if q == 0:
+                    self.setrp(p, self.fetch24(), pf)
+                else:
+                    self.setrp(2, self.add24(self.getrp(2, pf), self.getrp(p, pf) if p != 2 else self.getrp(2, pf)), pf)
+                return
+            if z == 2:
+                if op == 0x02: self.wb(self.bc, self.a)
+                elif op == 0x12: self.wb(self.de, self.a)
+                elif op == 0x0A: self.a = self.rb(self.bc)
+                elif op == 0x1A: self.a = self.rb(self.de)
+                elif op == 0x22: self.w24(self.fetch24(), self.getrp(2, pf))
+                elif op == 0x2A: self.setrp(2, self.r24(self.fetch24()), pf)
+                elif op == 0x32: self.wb(self.fetch24(), self.a)
+                elif op == 0x3A: self.a = self.rb(self.fetch24())
+                return
+            if z == 3:
+                v = self.getrp(p, pf)
+                self.setrp(p, v + (1 if q == 0 else -1), pf)
+                return
+            if z in (4, 5):
+                d = 1 if z == 4 else -1
+                if y == 6:
+                    a = self.addr_hl(pf)
+                    self.wb(a, self.inc8(self.rb(a), d))
+                else:
+                    self.set8(y, self.inc8(self.get8(y, pf), d), pf)
+                return
+            if z == 6:
+                if y == 6:
+                    a = self.addr_hl(pf)
+                    self.wb(a, self.fetch())
+                else:
+                    self.set8(y, self.fetch(), pf)
+                return
+            if z == 7:
+                a = self.a
+                c = self.f & C
+                fk = self.f & (S | Z | PV)
+                if y == 0: c = a >> 7; self.a = (a << 1 | c) & 255; self.f = fk | c
+                elif y == 1: c = a & 1; self.a = (a >> 1 | c << 7) & 255; self.f = fk | c
+                elif y == 2: nc = a >> 7; self.a = (a << 1 | c) & 255; self.f = fk | nc
+                elif y == 3: nc = a & 1; self.a = (a >> 1 | c << 7) & 255; self.f = fk | nc
+                elif y == 4: raise RuntimeError('daa')
+                elif y == 5: self.a = ~a & 255; self.f |= H | N
+                elif y == 6: self.f = (self.f & (S | Z | PV)) | C
+                elif y == 7: self.f = (self.f & (S | Z | PV)) | (0 if self.f & C else C)
+                return
+        if x == 3:
+            if z == 0:
+                if self.cond(y): self.pc = self.pop()
+                return
+            if z == 1:
+                if q == 0:
+                    v = self.pop()
+                    if p == 3:
+                        self.a = v >> 8 & 255; self.f = v & 255
+                    else:
+                        self.setrp(p, v, pf)
+                    return
+                if p == 0: self.pc = self.pop(); return
+                if p == 1:
+                    self.bc, self.de, self.hl, self.alt = self.alt[0], self.alt[1], self.alt[2], (self.bc, self.de, self.hl)
+                    return
+                if p == 2: self.pc = self.getrp(2, pf); return
+                if p == 3: self.sp = self.getrp(2, pf); return
+            if z == 2:
+                a = self.fetch24()
+                if self.cond(y): self.pc = a
+                return
+            if z == 3:
+                if y == 0: self.pc = self.fetch24(); return
+                if y == 4:
+                    v = self.r24(self.sp)
+                    self.w24(self.sp, self.getrp(2, pf))
+                    self.setrp(2, v, pf)
+                    return
+                if y == 5:
+                    self.de, self.hl = self.hl, self.de
+                    return
+                if y == 6: self.iff = 0; return
+                if y == 7: self.iff = 1; return
+                raise RuntimeError('io %02x' % op)
+            if z == 4:
+                a = self.fetch24()
+                if self.cond(y):
+                    self.push(self.pc); self.pc = a
+                return
+            if z == 5:
+                if q == 0:
+                    if p == 3:
+                        self.push(self.a << 8 | self.f)
+                    else:
+                        self.push(self.getrp(p, pf))
+                    return
+                if p == 0:
+                    a = self.fetch24()
+                    self.push(self.pc); self.pc = a
+                    return
+            if z == 6:
+                self.alu(y, self.fetch())
+                return
+            if z == 7:
+                self.push(self.pc); self.pc = y * 8
+                return
+        raise RuntimeError('unimplemented opcode %02x at %06x' % (op, self.pc - 1))
+
+    def exec_idx(self, op, pf):
+        base = self.ix if pf == 'ix' else self.iy
+        # eZ80 24-bit ld forms
+        if op in (0x07, 0x17, 0x27):
+            d = self.fetchd()
+            self.setrp({0x07: 0, 0x17: 1, 0x27: 2}[op], self.r24(base + d))
+            return
+        if op in (0x0F, 0x1F, 0x2F):
+            d = self.fetchd()
+            self.w24(base + d, self.getrp({0x0F: 0, 0x1F: 1, 0x2F: 2}[op]))
+            return
+        if op == 0x37:
+            d = self.fetchd(); v = self.r24(base + d)
+            if pf == 'ix': self.ix = v
+            else: self.iy = v
+            return
+        if op == 0x31:
+            d = self.fetchd(); v = self.r24(base + d)
+            if pf == 'ix': self.iy = v
+            else: self.ix = v
+            return
+        if op == 0x3F:
+            d = self.fetchd(); self.w24(base + d, base)
+            return
+        if op == 0x3E:
+            d = self.fetchd(); self.w24(base + d, self.iy if pf == 'ix' else self.ix)
+            return
+        if op == 0xCB:
+            d = self.fetchd()
+            op2 = self.fetch()
+            return self.exec_cb_addr((base + d) & M24, op2)
+        x, y, z = op >> 6, (op >> 3) & 7, op & 7
+        if x == 1 and op != 0x76:
+            if z == 6:
+                a = self.addr_hl(pf)
+                self.set8(y, self.rb(a))
+                return
+            if y == 6:
+                a = self.addr_hl(pf)
+                self.wb(a, self.get8(z))
+                return
+            self.set8(y, self.get8(z, pf), pf)
+            return
+        if op == 0x21:
+            self.setrp(2, self.fetch24(), pf); return
+        if op in (0x09, 0x19, 0x29, 0x39):
+            p = (op >> 4) & 3
+            self.setrp(2, self.add24(base, base if p == 2 else self.getrp(p)), pf)
+            return
+        return self.exec(op, pf)
+
+    def exec_cb(self, pf):
+        op = self.fetch()
+        x, y, z = op >> 6, (op >> 3) & 7, op & 7
+        if z == 6:
+            return self.exec_cb_addr(self.hl, op)
+        v = self.get8(z)
+        if x == 0:
+            self.set8(z, self.rot(y, v))
+        elif x == 1:
+            self.f = (self.f & C) | H | (0 if v >> y & 1 else Z | PV) | (S if y == 7 and v & 0x80 else 0)
+        elif x == 2:
+            self.set8(z, v & ~(1 << y))
+        else:
+            self.set8(z, v | (1 << y))
+
+    def exec_cb_addr(self, a, op):
+        x, y = op >> 6, (op >> 3) & 7
+        v = self.rb(a)
+        if x == 0:
+            self.wb(a, self.rot(y, v))
+        elif x == 1:
+            self.f = (self.f & C) | H | (0 if v >> y & 1 else Z | PV) | (S if y == 7 and v & 0x80 else 0)
+        elif x == 2:
+            self.wb(a, v & ~(1 << y))
+        else:
+            self.wb(a, v | (1 << y))
+
+    def exec_ed(self):
+        op = self.fetch()
+        if op in (0x07, 0x17, 0x27):
+            self.setrp({0x07: 0, 0x17: 1, 0x27: 2}[op], self.r24(self.hl)); return
+        if op in (0x0F, 0x1F, 0x2F):
+            self.w24(self.hl, self.getrp({0x0F: 0, 0x1F: 1, 0x2F: 2}[op])); return
+        if op == 0x37: self.ix = self.r24(self.hl); return
+        if op == 0x31: self.iy = self.r24(self.hl); return
+        if op == 0x3F: self.w24(self.hl, self.ix); return
+        if op == 0x3E: self.w24(self.hl, self.iy); return
+        if op in (0x02, 0x12, 0x22, 0x32, 0x03, 0x13, 0x23, 0x33, 0x54, 0x55):
+            d = self.fetchd()
+            src = self.ix if op in (0x02, 0x12, 0x22, 0x32, 0x55) else self.iy
+            v = (src + d) & M24
+            dst = {0x02: 'bc', 0x12: 'de', 0x22: 'hl', 0x32: 'ix', 0x03: 'bc', 0x13: 'de', 0x23: 'hl', 0x33: 'iy', 0x54: 'ix', 0x55: 'iy'}[op]
+            setattr(self, dst, v)
+            return
+        if op in (0x65, 0x66):
+            d = self.fetchd()
+            self.push(((self.ix if op == 0x65 else self.iy) + d) & M24)
+            return
+        if op in (0x4C, 0x5C, 0x6C, 0x7C):
+            p = (op >> 4) & 3
+            v = self.getrp(p)
+            self.setrp(p, ((v >> 8) & 255) * (v & 255))
+            self.cycles += 4
+            return
+        if op == 0x64:
+            v = self.a & self.fetch()
+            self.f = (v & 0x80) | (Z if v == 0 else 0) | H | parity(v)
+            return
+        if op & 0xC7 == 0x04:
+            r = (op >> 3) & 7
+            v = self.a & (self.rb(self.hl) if r == 6 else self.get8(r))
+            self.f = (v & 0x80) | (Z if v == 0 else 0) | H | parity(v)
+            return
+        if op == 0x57:
+            self.a = self.i & 255
+            self.f = (self.f & C) | (self.a & 0x80) | (Z if self.a == 0 else 0) | (PV if self.iff else 0)
+            return
+        if op == 0x47:
+            self.i = self.a; return
+        if op == 0x44:
+            v = self.a; self.a = 0; self.alu(2, v); return
+        if op & 0xC7 == 0x42:
+            p = (op >> 4) & 3
+            c = self.f & C
+            self.hl = self.add24(self.hl, self.getrp(p), c, full=True, sub=(op & 8) == 0)
+            return
+        if op & 0xCF == 0x4B:
+            p = (op >> 4) & 3
+            self.setrp(p, self.r24(self.fetch24())); return
+        if op & 0xCF == 0x43:
+            p = (op >> 4) & 3
+            self.w24(self.fetch24(), self.getrp(p)); return
+        if op in (0xA0, 0xA8, 0xB0, 0xB8):
+            step = 1 if op in (0xA0, 0xB0) else -1
+            while True:
+                self.wb(self.de, self.rb(self.hl))
+                self.hl = (self.hl + step) & M24
+                self.de = (self.de + step) & M24
+                self.bc = (self.bc - 1) & M24
+                if op in (0xA0, 0xA8) or self.bc == 0:
+                    break
+            self.f = (self.f & (S | Z | C)) | (PV if self.bc else 0)
+            return
+        if op in (0xA1, 0xA9, 0xB1, 0xB9):
+            step = 1 if op in (0xA1, 0xB1) else -1
+            while True:
+                v = self.rb(self.hl)
+                r = (self.a - v) & 255
+                self.hl = (self.hl + step) & M24
+                self.bc = (self.bc - 1) & M24
+                self.f = (self.f & C) | N | (r & 0x80) | (Z if r == 0 else 0) | (PV if self.bc else 0)
+                if op in (0xA1, 0xA9) or self.bc == 0 or r == 0:
+                    break
+            return
+        raise RuntimeError('unimplemented ED %02x at %06x' % (op, self.pc - 2))
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Compares a run of the benchmark program against the committed baseline.
+
+    perf_check.py bench.log tools/perf_baseline.json [--threshold 5]
+    perf_check.py bench.log tools/perf_baseline.json --update
+
+bench.log is the output of tools/perf_sim.py, or the CEmu console output of
+examples/hashlib_bench; a baseline only makes sense against runs of the same kind, as their
+cycle counts differ. The baseline maps each benchmark name to its cycle count. The check fails if a benchmark in the baseline is missing
+from the run, or takes more than --threshold percent more cycles than the baseline says.
+--update writes the run as the new baseline instead; commit it along with the change that
+made it faster, or that makes a slowdown worth it.
+"""
+
+import argparse
+import json
+import sys
+
+
+def read_run(path):
+    with open(path, errors='replace') as f:
+        text = f.read()
+    start = text.rfind('{"benchmarks"')
+    if start < 0:
+        sys.exit('%s: no benchmark output found' % path)
+    try:
+        run, _ = json.JSONDecoder().raw_decode(text, start)
+    except ValueError as e:
+        sys.exit('%s: benchmark output is cut short (%s)' % (path, e))
+    return {b['name']: b['cycles'] for b in run['benchmarks']}
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n', 1)[0])
+    ap.add_argument('log', help='output of the benchmark run')
+    ap.add_argument('baseline', help='baseline file, benchmark name to cycles')
+    ap.add_argument('--threshold', type=float, default=5.0, help='allowed slowdown, in percent')
+    ap.add_argument('--update', action='store_true', help='write the run as the new baseline')
+    args = ap.parse_args()
+
+    run = read_run(args.log)
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            json.dump(run, f, indent=4, sort_keys=True)
+            f.write('\n')
+        print('%s: %d benchmarks written' % (args.baseline, len(run)))
+        return 0
+
+    try:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    except FileNotFoundError:
+        sys.exit('%s: no baseline, create one with make perf-baseline' % args.baseline)
+
+    failed = 0
+    width = max(len(name) for name in list(baseline) + list(run))
+    for name in sorted(set(baseline) | set(run)):
+        if name not in run:
+            print('%-*s  missing from the run' % (width, name))
+            failed += 1
+            continue
+        if name not in baseline:
+            print('%-*s  %10d  new, not in the baseline' % (width, name, run[name]))
+            continue
+        old, new = baseline[name], run[name]
+        change = (new - old) * 100.0 / old if old else 0.0
+        if change > args.threshold:
+            verdict = 'REGRESSED'
+            failed += 1
+        elif change < -args.threshold:
+            verdict = 'faster, update the baseline'
+        else:
+            verdict = 'ok'
+        print('%-*s  %10d  %10d  %+6.1f%%  %s' % (width, name, old, new, change, verdict))
+
+    if failed:
+        print('%d of %d benchmarks failed, threshold %g%%' % (failed, len(baseline), args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+"""Turns a CEmu PC trace into collapsed stacks for a flamegraph.
+
+    trace_fold.py hashlib.lst trace.txt --base D0A5C3 [--inc ti84pceg.inc] > hashlib.folded
+    flamegraph.pl hashlib.folded > hashlib.svg
+
+The listing comes from assembling with fasmg's listing.inc:
+
+    fasmg -i 'include "listing.inc"' hashlib.asm hashlib.8xv > hashlib.lst
+
+Each listing line that starts with an address (`0001A3: 3E 01    ld a, 1`) is read. Labels
+name the routines, and `.lbl_*` and other local labels name the blocks inside them.
+
+Each trace line holds the PC of one executed instruction, as the first 6-digit hex number on
+the line. With --cycles, the next number on the line is a running cycle count, and each
+instruction weighs the cycles up to the next line instead of 1.
+
+--base is where libload put the library, the runtime address of listing address 0. It can
+also be given as --anchor hash_init=D0B123 with the runtime address of any label.
+
+Calls into the OS and bootcode, such as ti._imulu and ti._frameset, show under the names
+from --inc (ti84pceg.inc from the toolchain), or as their address without it.
+"""
+
+import argparse
+import bisect
+import re
+import sys
+from collections import Counter
+
+LISTING_LINE = re.compile(r'^\s*\[?([0-9A-Fa-f]{4,8})\]?:?\s+((?:[0-9A-Fa-f]{2}\s+)*)(.*)$')
+LABEL = re.compile(r'^\s*([A-Za-z_.?@][\w.?@]*):(?!=)\s*(.*)$')
+INC_SYMBOL = re.compile(r'^\s*\??([A-Za-z_][\w.]*)\s*:?=\s*0?([0-9A-Fa-f]+)h\b')
+TRACE_PC = re.compile(r'\b(?:0x)?([0-9A-Fa-f]{6})\b')
+TRACE_COUNT = re.compile(r'\b(\d+)\b')
+
+CALLS = ('call', 'rst')
+RETURNS = ('ret', 'reti', 'retn')
+
+
+class Listing:
+    def __init__(self, path):
+        self.mnemonic = {}      # address -> lowercase mnemonic
+        self.functions = []     # (address, name) of global labels
+        self.blocks = []        # (address, qualified name) of local labels
+        scope = ''
+        with open(path, errors='replace') as f:
+            for text in f:
+                m = LISTING_LINE.match(text)
+                if not m:
+                    continue
+                addr = int(m.group(1), 16)
+                src = m.group(3).split(';', 1)[0].strip()
+                while True:
+                    lm = LABEL.match(src)
+                    if not lm:
+                        break
+                    name = lm.group(1).lstrip('?')
+                    if name.startswith('.'):
+                        self.blocks.append((addr, scope + name))
+                    else:
+                        scope = name
+                        self.functions.append((addr, name))
+                        self.blocks.append((addr, name))
+                    src = lm.group(2)
+                if src and m.group(2) and addr not in self.mnemonic:
+                    self.mnemonic[addr] = src.split(None, 1)[0].lower()
+        self.functions.sort()
+        self.blocks.sort()
+        self.function_addresses = [a for a, _ in self.functions]
+        self.block_addresses = [a for a, _ in self.blocks]
+        self.addresses = sorted(self.mnemonic)
+        self.end = self.addresses[-1] + 1 if self.addresses else 0
+
+    @staticmethod
+    def _find(addresses, table, addr):
+        i = bisect.bisect_right(addresses, addr) - 1
+        return table[i][1] if i >= 0 else None
+
+    def contains(self, addr):
+        return 0 <= addr < self.end
+
+    def function(self, addr):
+        return self._find(self.function_addresses, self.functions, addr) or '[hashlib]'
+
+    def block(self, addr):
+        return self._find(self.block_addresses, self.blocks, addr) or self.function(addr)
+
+    def next_address(self, addr):
+        i = bisect.bisect_right(self.addresses, addr)
+        return self.addresses[i] if i < len(self.addresses) else None
+
+    def label(self, name):
+        for addr, n in self.functions + self.blocks:
+            if n == name:
+                return addr
+        raise KeyError(name)
+
+
+class Symbols:
+    def __init__(self, paths):
+        table = {}
+        for path in paths:
+            with open(path, errors='replace') as f:
+                for text in f:
+                    m = INC_SYMBOL.match(text)
+                    if m:
+                        table[int(m.group(2), 16)] = m.group(1)
+        self.table = table
+
+    def name(self, addr):
+        n = self.table.get(addr)
+        return 'ti.' + n if n else '%06X' % addr
+
+
+class Frame:
+    def __init__(self, name, ret):
+        self.name = name
+        self.ret = ret
+
+
+def fold(listing, symbols, base, trace, cycles, blocks):
+    stacks = Counter()
+    frames = []
+    pending = None      # frame entered from outside the library, named once past the jump table
+    prev = None
+    prev_count = None
+
+    def local(pc):
+        a = pc - base
+        return a if listing.contains(a) else None
+
+    def sample(pc):
+        a = local(pc)
+        names = [f.name for f in frames]
+        if a is not None:
+            func = listing.function(a)
+            if not names or names[-1] != func:
+                names.append(func)
+            if blocks:
+                block = listing.block(a)
+                if block != func:
+                    names.append(block)
+        elif not frames:
+            names.append('[program]')
+        return ';'.join(names)
+
+    for text in trace:
+        m = TRACE_PC.search(text)
+        if not m:
+            continue
+        pc = int(m.group(1), 16)
+        if prev is not None:
+            a = local(prev)
+            mn = listing.mnemonic.get(a) if a is not None else None
+            nxt = listing.next_address(a) if mn else None
+            returned = False
+            for i in range(len(frames) - 1, -1, -1):
+                if frames[i].ret == pc:
+                    del frames[i:]
+                    returned = True
+                    break
+            if returned:
+                pass
+            elif mn in CALLS and nxt is not None and pc != nxt + base:
+                target = local(pc)
+                name = listing.function(target) if target is not None else symbols.name(pc)
+                frames.append(Frame(name, nxt + base))
+            elif a is None and local(pc) is not None and not any(f.ret is None for f in frames):
+                pending = Frame('[hashlib]', None)
+                frames.append(pending)
+            elif mn in RETURNS and local(pc) is None and frames and frames[-1].ret is None:
+                frames.pop()
+        if pending is not None:
+            a = local(pc)
+            if a is not None and listing.mnemonic.get(a) not in ('jp', 'jq'):
+                pending.name = listing.function(a)
+                pending = None
+        count = None
+        if cycles:
+            c = TRACE_COUNT.search(text, m.end())
+            count = int(c.group(1)) if c else None
+        if prev is not None:
+            if not cycles:
+                stacks[prev_stack] += 1
+            elif count is not None and prev_count is not None:
+                stacks[prev_stack] += max(count - prev_count, 0)
+        prev_stack = sample(pc)
+        prev_count = count
+        prev = pc
+    if prev is not None and not cycles:
+        stacks[prev_stack] += 1
+    return stacks
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n', 1)[0])
+    ap.add_argument('listing', help='fasmg listing of hashlib.asm')
+    ap.add_argument('trace', nargs='?', help='PC trace, one instruction per line (default: stdin)')
+    ap.add_argument('--base', help='runtime address of the library, in hex')
+    ap.add_argument('--anchor', help='LABEL=ADDR, the runtime address of a label, in hex')
+    ap.add_argument('--inc', action='append', default=[], help='include file with OS and bootcode symbols')
+    ap.add_argument('--cycles', action='store_true', help='weigh by the cycle count after each PC')
+    ap.add_argument('--no-blocks', dest='blocks', action='store_false', help='stop at routines, without the blocks in them')
+    args = ap.parse_args()
+
+    listing = Listing(args.listing)
+    if args.anchor:
+        name, addr = args.anchor.split('=', 1)
+        base = int(addr, 16) - listing.label(name)
+    elif args.base:
+        base = int(args.base, 16)
+    else:
+        ap.error('one of --base or --anchor is required')
+
+    trace = open(args.trace, errors='replace') if args.trace else sys.stdin
+    with trace:
+        stacks = fold(listing, Symbols(args.inc), base, trace, args.cycles, args.blocks)
+    for stack, count in sorted(stacks.items()):
+        if count:
+            print(stack, count)
+
+
+if __name__ == '__main__':
+    main()